@@ -0,0 +1,431 @@
+#include <cassert>
+#include "BlockCompressor.h"
+#include "CompressedImage.h"
+#include "MipmapBuilder.h"
+#include "ThreadPool.h"
+
+/*
+ * Pack an 8 bit color into 5:6:5
+ */
+static int To565(float r, float g, float b)
+{
+    int r5 = (int)(r * 31.0f / 255.0f + 0.5f);
+    int g6 = (int)(g * 63.0f / 255.0f + 0.5f);
+    int b5 = (int)(b * 31.0f / 255.0f + 0.5f);
+    r5 = r5 < 0 ? 0 : (r5 > 31 ? 31 : r5);
+    g6 = g6 < 0 ? 0 : (g6 > 63 ? 63 : g6);
+    b5 = b5 < 0 ? 0 : (b5 > 31 ? 31 : b5);
+    return (r5 << 11) | (g6 << 5) | b5;
+}
+
+/*
+ * Unpack a 5:6:5 color to 8 bits, the same way the GPU does
+ */
+static void From565(int color, int rgb[3])
+{
+    int r5 = (color >> 11) & 31;
+    int g6 = (color >> 5) & 63;
+    int b5 = color & 31;
+    rgb[0] = (r5 << 3) | (r5 >> 2);
+    rgb[1] = (g6 << 2) | (g6 >> 4);
+    rgb[2] = (b5 << 3) | (b5 >> 2);
+}
+
+/*
+ * Pick the closest palette entry for each pixel, returning the total error
+ */
+static int ChooseColorIndices(const GLubyte rgba[16][4], int color0, int color1, int indices[16])
+{
+    // Four color mode palette: both endpoints, then 1/3 and 2/3 between them
+    int palette[4][3];
+    From565(color0, palette[0]);
+    From565(color1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    int total = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int best = 0;
+        int bestError = 0x7FFFFFFF;
+        for (int p = 0; p < 4; p++)
+        {
+            int dr = rgba[i][0] - palette[p][0];
+            int dg = rgba[i][1] - palette[p][1];
+            int db = rgba[i][2] - palette[p][2];
+            int error = dr * dr + dg * dg + db * db;
+            if (error < bestError)
+            {
+                best = p;
+                bestError = error;
+            }
+        }
+        indices[i] = best;
+        total += bestError;
+    }
+    return total;
+}
+
+/*
+ * Encode color block
+ */
+void BlockCompressor::EncodeColorBlock(const GLubyte rgba[16][4], GLubyte* block)
+{
+    // Principal axis of the colors, found by power iteration on their
+    // covariance.  Starting from the bounding box diagonal converges quickly
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    float low[3]  = { 255.0f, 255.0f, 255.0f };
+    float high[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            mean[c] += rgba[i][c];
+            low[c]   = rgba[i][c] < low[c]  ? rgba[i][c] : low[c];
+            high[c]  = rgba[i][c] > high[c] ? rgba[i][c] : high[c];
+        }
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        mean[c] /= 16.0f;
+    }
+
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; i++)
+    {
+        float r = rgba[i][0] - mean[0];
+        float g = rgba[i][1] - mean[1];
+        float b = rgba[i][2] - mean[2];
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[3] += g * g;
+        cov[4] += g * b;
+        cov[5] += b * b;
+    }
+
+    float axis[3] = { high[0] - low[0], high[1] - low[1], high[2] - low[2] };
+    for (int iteration = 0; iteration < 4; iteration++)
+    {
+        float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        float largest = x * x > y * y ? x : y;
+        largest = largest * largest > z * z ? largest : z;
+        if (largest == 0.0f)
+        {
+            break;
+        }
+        axis[0] = x / largest;
+        axis[1] = y / largest;
+        axis[2] = z / largest;
+    }
+
+    // The pixels furthest apart along the axis become the endpoints
+    int minPixel = 0;
+    int maxPixel = 0;
+    float minProjection = 1e30f;
+    float maxProjection = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+        float projection = rgba[i][0] * axis[0] + rgba[i][1] * axis[1] + rgba[i][2] * axis[2];
+        if (projection < minProjection)
+        {
+            minProjection = projection;
+            minPixel = i;
+        }
+        if (projection > maxProjection)
+        {
+            maxProjection = projection;
+            maxPixel = i;
+        }
+    }
+
+    int color0 = To565(rgba[maxPixel][0], rgba[maxPixel][1], rgba[maxPixel][2]);
+    int color1 = To565(rgba[minPixel][0], rgba[minPixel][1], rgba[minPixel][2]);
+    int indices[16];
+    int error = ChooseColorIndices(rgba, color0, color1, indices);
+
+    // Refine the endpoints with a least squares fit to the chosen indices,
+    // keeping the result only if it is better
+    if (color0 != color1)
+    {
+        static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[3] = { 0.0f, 0.0f, 0.0f };
+        float bx[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++)
+        {
+            float a = weights[indices[i]];
+            float b = 1.0f - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < 3; c++)
+            {
+                ax[c] += a * rgba[i][c];
+                bx[c] += b * rgba[i][c];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (determinant != 0.0f)
+        {
+            float end0[3];
+            float end1[3];
+            for (int c = 0; c < 3; c++)
+            {
+                end0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+                end1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+            }
+
+            int refined0 = To565(end0[0], end0[1], end0[2]);
+            int refined1 = To565(end1[0], end1[1], end1[2]);
+            int refinedIndices[16];
+            int refinedError = ChooseColorIndices(rgba, refined0, refined1, refinedIndices);
+            if (refinedError < error)
+            {
+                color0 = refined0;
+                color1 = refined1;
+                error  = refinedError;
+                for (int i = 0; i < 16; i++)
+                {
+                    indices[i] = refinedIndices[i];
+                }
+            }
+        }
+    }
+
+    // color0 must be the larger for the four color mode.  Swapping the
+    // endpoints swaps indices 0 with 1 and 2 with 3
+    if (color0 < color1)
+    {
+        int swap = color0;
+        color0 = color1;
+        color1 = swap;
+        for (int i = 0; i < 16; i++)
+        {
+            indices[i] ^= 1;
+        }
+    }
+    else if (color0 == color1)
+    {
+        // Equal endpoints select the three color mode, where index 3 is
+        // transparent, so only index 0 may be used
+        for (int i = 0; i < 16; i++)
+        {
+            indices[i] = 0;
+        }
+    }
+
+    GLuint bits = 0;
+    for (int i = 15; i >= 0; i--)
+    {
+        bits = (bits << 2) | indices[i];
+    }
+    block[0] = (GLubyte)(color0 & 0xFF);
+    block[1] = (GLubyte)(color0 >> 8);
+    block[2] = (GLubyte)(color1 & 0xFF);
+    block[3] = (GLubyte)(color1 >> 8);
+    block[4] = (GLubyte)(bits & 0xFF);
+    block[5] = (GLubyte)((bits >> 8) & 0xFF);
+    block[6] = (GLubyte)((bits >> 16) & 0xFF);
+    block[7] = (GLubyte)(bits >> 24);
+}
+
+/*
+ * Encode channel block
+ */
+void BlockCompressor::EncodeChannelBlock(const GLubyte rgba[16][4], int channel, GLubyte* block)
+{
+    int low = 255;
+    int high = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        low  = rgba[i][channel] < low  ? rgba[i][channel] : low;
+        high = rgba[i][channel] > high ? rgba[i][channel] : high;
+    }
+
+    // Eight value mode needs the first endpoint to be the larger.  Index 0
+    // and 1 are the endpoints, and 2 to 7 step from the first to the second
+    int palette[8];
+    palette[0] = high;
+    palette[1] = low;
+    for (int i = 1; i < 7; i++)
+    {
+        palette[i + 1] = ((7 - i) * high + i * low) / 7;
+    }
+
+    // 48 bits of indices, 3 per pixel
+    unsigned long long bits = 0;
+    for (int i = 15; i >= 0; i--)
+    {
+        int best = 0;
+        int bestError = 256;
+        if (high != low)
+        {
+            for (int p = 0; p < 8; p++)
+            {
+                int error = rgba[i][channel] - palette[p];
+                error = error < 0 ? -error : error;
+                if (error < bestError)
+                {
+                    best = p;
+                    bestError = error;
+                }
+            }
+        }
+        bits = (bits << 3) | best;
+    }
+
+    block[0] = (GLubyte)high;
+    block[1] = (GLubyte)low;
+    for (int i = 0; i < 6; i++)
+    {
+        block[2 + i] = (GLubyte)((bits >> (8 * i)) & 0xFF);
+    }
+}
+
+/*
+ * Compress rows
+ */
+void BlockCompressor::CompressRows(
+    const GLubyte* pixels,
+    int components,
+    int width,
+    int height,
+    GLenum format,
+    int firstRow,
+    int lastRow,
+    GLubyte* blocks)
+{
+    int blockSize = CompressedImage::BlockSize(format);
+    int blocksWide = (width + 3) / 4;
+    GLubyte rgba[16][4];
+
+    for (int by = firstRow; by < lastRow; by++)
+    {
+        GLubyte* out = blocks + by * blocksWide * blockSize;
+        for (int bx = 0; bx < blocksWide; bx++)
+        {
+            // Gather the block, repeating the edge pixels of partial blocks
+            for (int y = 0; y < 4; y++)
+            {
+                int py = by * 4 + y < height ? by * 4 + y : height - 1;
+                for (int x = 0; x < 4; x++)
+                {
+                    int px = bx * 4 + x < width ? bx * 4 + x : width - 1;
+                    const GLubyte* pixel = pixels + (py * width + px) * components;
+                    GLubyte* texel = rgba[y * 4 + x];
+                    texel[0] = pixel[0];
+                    texel[1] = components > 1 ? pixel[1] : 0;
+                    texel[2] = components > 2 ? pixel[2] : 0;
+                    texel[3] = components > 3 ? pixel[3] : 255;
+                }
+            }
+
+            switch (format)
+            {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+                EncodeColorBlock(rgba, out);
+                break;
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+                EncodeChannelBlock(rgba, 3, out);
+                EncodeColorBlock(rgba, out + 8);
+                break;
+            case GL_COMPRESSED_RED_RGTC1:
+                EncodeChannelBlock(rgba, 0, out);
+                break;
+            case GL_COMPRESSED_RG_RGTC2:
+                EncodeChannelBlock(rgba, 0, out);
+                EncodeChannelBlock(rgba, 1, out + 8);
+                break;
+            default:
+                assert(false);
+            }
+            out += blockSize;
+        }
+    }
+}
+
+/*
+ * Compress
+ */
+void BlockCompressor::Compress(
+    const GLubyte* pixels,
+    int components,
+    int width,
+    int height,
+    GLenum format,
+    GLubyte* blocks)
+{
+    assert(pixels != NULL && blocks != NULL);
+    assert(components >= 1 && components <= 4);
+    assert(width > 0 && height > 0);
+    assert(IsFormatSupported(format));
+
+    // A few chunks per thread keeps the threads busy when some rows of
+    // blocks take longer than others.  Called from a worker, such as a
+    // background load, every chunk runs on that worker
+    ThreadPool& pool = ThreadPool::GetShared();
+    int blocksHigh = (height + 3) / 4;
+    int numChunks = (int)pool.GetNumThreads() * 4;
+    int rowsPerChunk = (blocksHigh + numChunks - 1) / numChunks;
+    numChunks = (blocksHigh + rowsPerChunk - 1) / rowsPerChunk;
+
+    pool.RunParallel(numChunks, [=](int chunk)
+    {
+        int first = chunk * rowsPerChunk;
+        int last = first + rowsPerChunk < blocksHigh ? first + rowsPerChunk : blocksHigh;
+        CompressRows(pixels, components, width, height, format, first, last, blocks);
+    });
+}
+
+/*
+ * Compress with mipmaps
+ */
+CompressedImage* BlockCompressor::CompressWithMipmaps(
+    const GLubyte* pixels,
+    int components,
+    int width,
+    int height,
+    GLenum format)
+{
+    assert(pixels != NULL);
+
+    CompressedImage* image = new CompressedImage(format, width, height);
+
+    // Levels are filtered with the same settings as uncompressed textures
+    const GLubyte* faces[] = { pixels };
+    MipmapBuilder::Chain* chain = MipmapBuilder::Build(faces, 1, components, width, height,
+        MipmapBuilder::GetFilter(), MipmapBuilder::IsGammaCorrect());
+    assert(chain->GetNumLevels() == image->GetNumLevels());
+
+    for (int level = 0; level < image->GetNumLevels(); level++)
+    {
+        const CompressedImage::Level& info = image->GetLevel(level);
+        const GLubyte* source = level == 0 ? pixels : chain->GetLevelData(level);
+        Compress(source, components, info.width, info.height, format, image->GetLevelData(level));
+    }
+
+    delete chain;
+    return image;
+}
+
+/*
+ * Is format supported
+ */
+bool BlockCompressor::IsFormatSupported(GLenum format)
+{
+    return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT        ||
+           format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT       ||
+           format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT       ||
+           format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT ||
+           format == GL_COMPRESSED_RED_RGTC1                ||
+           format == GL_COMPRESSED_RG_RGTC2;
+}
@@ -0,0 +1,593 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include "CompressedImage.h"
+
+/*
+ * KTX file identifier
+ */
+static const GLubyte ktxIdentifier[12] =
+{
+    0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+/*
+ * Key/value pair written to KTX files, saying that rows start at the bottom
+ */
+static const char ktxOrientation[] = "KTXorientation\0S=r,T=u";
+
+/*
+ * DDS constants
+ */
+static const GLuint ddsFourCCFlag   = 0x4;
+static const GLuint ddsAlphaFlag    = 0x1;
+static const GLuint ddsMipCountFlag = 0x20000;
+static const GLuint ddsCubemapFlag  = 0x200;
+static const GLuint ddsDX10CubeFlag = 0x4;
+
+/*
+ * Make a four character code
+ */
+static GLuint FourCC(char a, char b, char c, char d)
+{
+    return (GLuint)(GLubyte)a | ((GLuint)(GLubyte)b << 8) |
+        ((GLuint)(GLubyte)c << 16) | ((GLuint)(GLubyte)d << 24);
+}
+
+/*
+ * Swap the byte order of a 32 bit value
+ */
+static GLuint SwapBytes(GLuint value)
+{
+    return (value >> 24) | ((value >> 8) & 0xFF00) |
+        ((value << 8) & 0xFF0000) | (value << 24);
+}
+
+/*
+ * Get the uncompressed base format of a compressed format, for KTX headers
+ */
+static GLenum BaseFormat(GLenum format)
+{
+    switch (format)
+    {
+    case GL_COMPRESSED_RED_RGTC1:
+    case GL_COMPRESSED_SIGNED_RED_RGTC1:
+    case GL_COMPRESSED_R11_EAC:
+        return GL_RED;
+    case GL_COMPRESSED_RG_RGTC2:
+    case GL_COMPRESSED_SIGNED_RG_RGTC2:
+    case GL_COMPRESSED_RG11_EAC:
+        return GL_RG;
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGB8_ETC2:
+    case GL_COMPRESSED_SRGB8_ETC2:
+        return GL_RGB;
+    default:
+        return GL_RGBA;
+    }
+}
+
+/*
+ * Construct CompressedImage from file name
+ */
+CompressedImage::CompressedImage(const char* filename)
+    : format(GL_NONE),
+    width(0),
+    height(0),
+    numLevels(0),
+    numFaces(0)
+{
+    assert(filename);
+
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        std::cerr << "Unable to open compressed image " << filename << std::endl;
+        return;
+    }
+
+    // Both containers start with a fixed identifier
+    GLubyte identifier[12];
+    bool loaded = false;
+    if (fread(identifier, 1, 4, file) != 4)
+    {
+        std::cerr << "Compressed image is empty: " << filename << std::endl;
+    }
+    else if (memcmp(identifier, ktxIdentifier, 4) == 0)
+    {
+        if (fread(identifier + 4, 1, 8, file) == 8 &&
+            memcmp(identifier, ktxIdentifier, 12) == 0)
+        {
+            loaded = ReadKTX(file, filename);
+        }
+        else
+        {
+            std::cerr << "Corrupt KTX identifier: " << filename << std::endl;
+        }
+    }
+    else if (memcmp(identifier, "DDS ", 4) == 0)
+    {
+        loaded = ReadDDS(file, filename);
+    }
+    else
+    {
+        std::cerr << "Not a KTX or DDS file: " << filename << std::endl;
+    }
+    fclose(file);
+
+    // Leave the image empty if anything went wrong
+    if (!loaded)
+    {
+        levels.clear();
+        data.clear();
+    }
+}
+
+/*
+ * Construct empty CompressedImage
+ */
+CompressedImage::CompressedImage(GLenum format, int width, int height, int numLevels, int numFaces)
+    : format(format),
+    width(width),
+    height(height),
+    numLevels(numLevels),
+    numFaces(numFaces)
+{
+    assert(width > 0 && height > 0);
+    assert(numLevels >= 0);
+    assert(numFaces == 1 || numFaces == 6);
+
+    bool known = AllocateLevels();
+    assert(known);
+    (void)known;
+}
+
+/*
+ * Destructor
+ */
+CompressedImage::~CompressedImage()
+{
+}
+
+/*
+ * Save KTX
+ */
+bool CompressedImage::SaveKTX(const char* filename) const
+{
+    assert(filename);
+    assert(IsValid());
+
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        std::cerr << "Unable to open " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    // Key/value data is padded to 4 bytes
+    GLuint pairSize = sizeof(ktxOrientation);
+    GLuint pairPadding = (4 - (pairSize & 3)) & 3;
+    GLuint header[13] =
+    {
+        0x04030201,                // endianness
+        0,                         // glType, 0 when compressed
+        1,                         // glTypeSize
+        0,                         // glFormat, 0 when compressed
+        format,                    // glInternalFormat
+        BaseFormat(format),        // glBaseInternalFormat
+        (GLuint)width,             // pixelWidth
+        (GLuint)height,            // pixelHeight
+        0,                         // pixelDepth
+        0,                         // numberOfArrayElements
+        (GLuint)numFaces,          // numberOfFaces
+        (GLuint)numLevels,         // numberOfMipmapLevels
+        4 + pairSize + pairPadding // bytesOfKeyValueData
+    };
+    const GLubyte padding[4] = { 0, 0, 0, 0 };
+
+    bool ok = fwrite(ktxIdentifier, sizeof(ktxIdentifier), 1, file) == 1 &&
+        fwrite(header, sizeof(header), 1, file) == 1 &&
+        fwrite(&pairSize, 4, 1, file) == 1 &&
+        fwrite(ktxOrientation, pairSize, 1, file) == 1 &&
+        fwrite(padding, 1, pairPadding, file) == pairPadding;
+
+    // Each level is written for every face in turn.  Block sizes are
+    // multiples of 4 bytes, so no further padding is needed
+    for (int level = 0; ok && level < numLevels; level++)
+    {
+        GLuint imageSize = GetLevel(level).size;
+        ok = fwrite(&imageSize, 4, 1, file) == 1;
+        for (int face = 0; ok && face < numFaces; face++)
+        {
+            ok = fwrite(GetLevelData(level, face), imageSize, 1, file) == 1;
+        }
+    }
+
+    fclose(file);
+    if (!ok)
+    {
+        std::cerr << "Unable to write " << filename << std::endl;
+    }
+    return ok;
+}
+
+/*
+ * Get level
+ */
+const CompressedImage::Level& CompressedImage::GetLevel(int level, int face) const
+{
+    assert(level >= 0 && level < numLevels);
+    assert(face >= 0 && face < numFaces);
+    return levels[face * numLevels + level];
+}
+
+/*
+ * Get level data
+ */
+const GLubyte* CompressedImage::GetLevelData(int level, int face) const
+{
+    return &data[GetLevel(level, face).offset];
+}
+
+/*
+ * Get level data for writing
+ */
+GLubyte* CompressedImage::GetLevelData(int level, int face)
+{
+    return &data[GetLevel(level, face).offset];
+}
+
+/*
+ * Block size
+ */
+GLsizei CompressedImage::BlockSize(GLenum format)
+{
+    switch (format)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RED_RGTC1:
+    case GL_COMPRESSED_SIGNED_RED_RGTC1:
+    case GL_COMPRESSED_RGB8_ETC2:
+    case GL_COMPRESSED_SRGB8_ETC2:
+    case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+    case GL_COMPRESSED_R11_EAC:
+        return 8;
+
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_RG_RGTC2:
+    case GL_COMPRESSED_SIGNED_RG_RGTC2:
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+    case GL_COMPRESSED_RGBA8_ETC2_EAC:
+    case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+    case GL_COMPRESSED_RG11_EAC:
+        return 16;
+
+    default:
+        // Not a 4x4 block format we know of
+        return 0;
+    }
+}
+
+/*
+ * Image size
+ */
+GLsizei CompressedImage::ImageSize(GLenum format, int width, int height)
+{
+    // Partial blocks at the edges still take a whole block
+    return ((width + 3) / 4) * ((height + 3) / 4) * BlockSize(format);
+}
+
+/*
+ * Is format supported
+ */
+bool CompressedImage::IsFormatSupported(GLenum format)
+{
+    switch (format)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        return GLEW_EXT_texture_compression_s3tc != GL_FALSE;
+
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+        return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+
+    case GL_COMPRESSED_RED_RGTC1:
+    case GL_COMPRESSED_SIGNED_RED_RGTC1:
+    case GL_COMPRESSED_RG_RGTC2:
+    case GL_COMPRESSED_SIGNED_RG_RGTC2:
+        return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+        return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+
+    case GL_COMPRESSED_RGB8_ETC2:
+    case GL_COMPRESSED_SRGB8_ETC2:
+    case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+    case GL_COMPRESSED_RGBA8_ETC2_EAC:
+    case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+    case GL_COMPRESSED_R11_EAC:
+    case GL_COMPRESSED_RG11_EAC:
+        return GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility;
+
+    default:
+        return false;
+    }
+}
+
+/*
+ * Is compressed file
+ */
+bool CompressedImage::IsCompressedFile(const char* filename)
+{
+    assert(filename);
+
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    GLubyte identifier[4];
+    bool compressed = fread(identifier, 1, 4, file) == 4 &&
+        (memcmp(identifier, ktxIdentifier, 4) == 0 || memcmp(identifier, "DDS ", 4) == 0);
+    fclose(file);
+    return compressed;
+}
+
+/*
+ * Allocate levels
+ */
+bool CompressedImage::AllocateLevels()
+{
+    // Sizes read from a corrupt file are rejected before they are allocated
+    const int maxSize = 65536;
+    if (BlockSize(format) == 0 || width <= 0 || height <= 0 || width > maxSize || height > maxSize)
+    {
+        return false;
+    }
+
+    // A full chain halves the size until both sides reach 1.  Longer chains
+    // would shift the sizes by 32 bits or more
+    int fullChain = 1;
+    for (int size = width > height ? width : height; size > 1; size >>= 1)
+    {
+        fullChain++;
+    }
+    if (numLevels == 0)
+    {
+        numLevels = fullChain;
+    }
+    if (numLevels < 0 || numLevels > fullChain)
+    {
+        return false;
+    }
+
+    levels.resize(numFaces * numLevels);
+    size_t offset = 0;
+    for (int face = 0; face < numFaces; face++)
+    {
+        for (int level = 0; level < numLevels; level++)
+        {
+            Level& entry = levels[face * numLevels + level];
+            entry.width  = width  >> level > 0 ? width  >> level : 1;
+            entry.height = height >> level > 0 ? height >> level : 1;
+            entry.size   = ImageSize(format, entry.width, entry.height);
+            entry.offset = offset;
+            offset += entry.size;
+        }
+    }
+    data.resize(offset);
+    return true;
+}
+
+/*
+ * Read KTX
+ */
+bool CompressedImage::ReadKTX(FILE* file, const char* filename)
+{
+    // Fields following the identifier, in the order they are stored
+    enum
+    {
+        endianness, glType, glTypeSize, glFormat, glInternalFormat,
+        glBaseInternalFormat, pixelWidth, pixelHeight, pixelDepth,
+        numberOfArrayElements, numberOfFaces, numberOfMipmapLevels,
+        bytesOfKeyValueData, headerSize
+    };
+    GLuint header[headerSize];
+    if (fread(header, sizeof(header), 1, file) != 1)
+    {
+        std::cerr << "Truncated KTX header: " << filename << std::endl;
+        return false;
+    }
+
+    // Files written on a machine of the other endianness are byte swapped
+    bool swap = header[endianness] == 0x01020304;
+    if (swap)
+    {
+        for (int i = 0; i < headerSize; i++)
+        {
+            header[i] = SwapBytes(header[i]);
+        }
+    }
+    if (header[endianness] != 0x04030201)
+    {
+        std::cerr << "Corrupt KTX header: " << filename << std::endl;
+        return false;
+    }
+    if (header[glType] != 0 || header[glFormat] != 0)
+    {
+        std::cerr << "KTX file is not compressed: " << filename << std::endl;
+        return false;
+    }
+    if (header[pixelDepth] > 1 || header[numberOfArrayElements] != 0 ||
+        (header[numberOfFaces] != 1 && header[numberOfFaces] != 6))
+    {
+        std::cerr << "Only 2D and cube map KTX files are supported: " << filename << std::endl;
+        return false;
+    }
+
+    format    = header[glInternalFormat];
+    width     = header[pixelWidth];
+    height    = header[pixelHeight] > 0 ? header[pixelHeight] : 1;
+    numFaces  = header[numberOfFaces];
+    numLevels = header[numberOfMipmapLevels] > 0 ? header[numberOfMipmapLevels] : 1;
+    if (!AllocateLevels())
+    {
+        std::cerr << "Unsupported KTX format 0x" << std::hex << format << std::dec
+            << " or corrupt header: " << filename << std::endl;
+        return false;
+    }
+
+    // Key/value pairs such as the orientation are skipped
+    fseek(file, header[bytesOfKeyValueData], SEEK_CUR);
+
+    for (int level = 0; level < numLevels; level++)
+    {
+        GLuint imageSize;
+        if (fread(&imageSize, 4, 1, file) != 1)
+        {
+            std::cerr << "Truncated KTX file: " << filename << std::endl;
+            return false;
+        }
+        if (swap)
+        {
+            imageSize = SwapBytes(imageSize);
+        }
+        if (imageSize != (GLuint)GetLevel(level).size)
+        {
+            std::cerr << "KTX level " << level << " has the wrong size: " << filename << std::endl;
+            return false;
+        }
+        for (int face = 0; face < numFaces; face++)
+        {
+            if (fread(GetLevelData(level, face), imageSize, 1, file) != 1)
+            {
+                std::cerr << "Truncated KTX file: " << filename << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Read DDS
+ */
+bool CompressedImage::ReadDDS(FILE* file, const char* filename)
+{
+    // DDS_HEADER, which is always little endian
+    enum
+    {
+        size, flags, ddsHeight, ddsWidth, pitchOrLinearSize, depth,
+        mipMapCount, pfSize = 18, pfFlags, pfFourCC, caps = 26, caps2,
+        headerSize = 31
+    };
+    GLuint header[headerSize];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[size] != 124)
+    {
+        std::cerr << "Corrupt DDS header: " << filename << std::endl;
+        return false;
+    }
+    if ((header[pfFlags] & ddsFourCCFlag) == 0)
+    {
+        std::cerr << "DDS file is not compressed: " << filename << std::endl;
+        return false;
+    }
+
+    bool cube = (header[caps2] & ddsCubemapFlag) != 0;
+    GLuint fourCC = header[pfFourCC];
+    if (fourCC == FourCC('D', 'X', 'T', '1'))
+    {
+        format = (header[pfFlags] & ddsAlphaFlag) != 0 ?
+            GL_COMPRESSED_RGBA_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    }
+    else if (fourCC == FourCC('D', 'X', 'T', '3'))
+    {
+        format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+    }
+    else if (fourCC == FourCC('D', 'X', 'T', '5'))
+    {
+        format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    }
+    else if (fourCC == FourCC('A', 'T', 'I', '1') || fourCC == FourCC('B', 'C', '4', 'U'))
+    {
+        format = GL_COMPRESSED_RED_RGTC1;
+    }
+    else if (fourCC == FourCC('A', 'T', 'I', '2') || fourCC == FourCC('B', 'C', '5', 'U'))
+    {
+        format = GL_COMPRESSED_RG_RGTC2;
+    }
+    else if (fourCC == FourCC('D', 'X', '1', '0'))
+    {
+        // DDS_HEADER_DXT10 follows with a DXGI_FORMAT
+        enum { dxgiFormat, resourceDimension, miscFlag, arraySize, miscFlags2, dx10Size };
+        GLuint dx10[dx10Size];
+        if (fread(dx10, sizeof(dx10), 1, file) != 1)
+        {
+            std::cerr << "Truncated DDS header: " << filename << std::endl;
+            return false;
+        }
+        if (dx10[arraySize] > 1)
+        {
+            std::cerr << "DDS texture arrays are not supported: " << filename << std::endl;
+            return false;
+        }
+        cube = (dx10[miscFlag] & ddsDX10CubeFlag) != 0;
+        switch (dx10[dxgiFormat])
+        {
+        case 71: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;        break; // BC1_UNORM
+        case 72: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;  break; // BC1_UNORM_SRGB
+        case 74: format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;        break; // BC2_UNORM
+        case 75: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;  break; // BC2_UNORM_SRGB
+        case 77: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;        break; // BC3_UNORM
+        case 78: format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;  break; // BC3_UNORM_SRGB
+        case 80: format = GL_COMPRESSED_RED_RGTC1;                 break; // BC4_UNORM
+        case 81: format = GL_COMPRESSED_SIGNED_RED_RGTC1;          break; // BC4_SNORM
+        case 83: format = GL_COMPRESSED_RG_RGTC2;                  break; // BC5_UNORM
+        case 84: format = GL_COMPRESSED_SIGNED_RG_RGTC2;           break; // BC5_SNORM
+        case 98: format = GL_COMPRESSED_RGBA_BPTC_UNORM;           break; // BC7_UNORM
+        case 99: format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;     break; // BC7_UNORM_SRGB
+        default:
+            std::cerr << "Unsupported DXGI format " << dx10[dxgiFormat] << ": " << filename << std::endl;
+            return false;
+        }
+    }
+    else
+    {
+        std::cerr << "Unsupported DDS format: " << filename << std::endl;
+        return false;
+    }
+
+    width     = header[ddsWidth];
+    height    = header[ddsHeight];
+    numFaces  = cube ? 6 : 1;
+    numLevels = (header[flags] & ddsMipCountFlag) != 0 && header[mipMapCount] > 0 ?
+        header[mipMapCount] : 1;
+    if (!AllocateLevels())
+    {
+        std::cerr << "Corrupt DDS header: " << filename << std::endl;
+        return false;
+    }
+
+    // Faces are stored one after another with all of their levels, the
+    // same layout the levels are kept in
+    if (fread(&data[0], data.size(), 1, file) != 1)
+    {
+        std::cerr << "Truncated DDS file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
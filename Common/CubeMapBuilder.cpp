@@ -0,0 +1,702 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sys/stat.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CUBE_MAP_BUILDER_SSE2
+#include <emmintrin.h>
+#endif
+#include "CubeMapBuilder.h"
+#include "HalfFloat.h"
+#include "MipmapBuilder.h"
+#include "stb_image.h"
+#include "ThreadPool.h"
+
+/*
+ * Cube maps built since the last reset
+ */
+CubeMapBuilder::Stats CubeMapBuilder::stats;
+
+/*
+ * Guards the stats, since cube maps may be built on worker threads
+ */
+static std::mutex statsMutex;
+
+/*
+ * Rows of a face each task resamples at least
+ */
+static const int minRowsPerBand = 16;
+
+/*
+ * Identifies cached cube map files, and changes whenever the layout does
+ */
+static const char         cacheMagic[4] = { 'C', 'U', 'B', 'E' };
+static const unsigned int cacheVersion  = 1;
+
+/*
+ * Largest face a cached cube map file may hold, past any GL's cube map limit
+ */
+static const int maxCacheSize = 65536;
+
+/*
+ * Header of a cached cube map file, followed by the levels of each face
+ */
+struct CacheHeader
+{
+    char               magic[4];   //!< cacheMagic
+    unsigned int       version;    //!< cacheVersion
+    unsigned long long key;        //!< Hash of the panorama's file and settings
+    GLenum             dataType;   //!< Type of each component
+    int                components; //!< Components in each pixel
+    int                size;       //!< Width and height of level 0
+    int                numLevels;  //!< Levels of each face
+};
+
+/*
+ * Gets the levels of a face a cube map of this size can have
+ */
+static int MaxLevels(int size)
+{
+    int numLevels = 1;
+    while (size >> numLevels > 0)
+    {
+        numLevels++;
+    }
+    return numLevels;
+}
+
+/*
+ * Gets the bytes of face data following a cache header
+ */
+static unsigned long long CacheDataSize(const CacheHeader& header)
+{
+    unsigned long long pixelSize = header.components * (header.dataType == GL_HALF_FLOAT ? sizeof(GLushort) : sizeof(GLubyte));
+    unsigned long long faceSize = 0;
+    for (int level = 0; level < header.numLevels; level++)
+    {
+        unsigned long long levelSize = std::max(header.size >> level, 1);
+        faceSize += levelSize * levelSize * pixelSize;
+    }
+    return faceSize * 6;
+}
+
+/*
+ * Adds bytes to a 64-bit FNV-1a hash
+ */
+static unsigned long long HashBytes(unsigned long long hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * Milliseconds elapsed since a point in time
+ */
+static double MillisecondsSince(const std::chrono::high_resolution_clock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+}
+
+/*
+ * Direction through a point of a face, from coordinates running from -1 to
+ * 1 across it.  The inverse of the face selection in the OpenGL spec
+ */
+static void GetDirection(int face, float s, float t, float* x, float* y, float* z)
+{
+    switch (face)
+    {
+    case 0:  *x =  1.0f; *y = -t;    *z = -s;    break;
+    case 1:  *x = -1.0f; *y = -t;    *z =  s;    break;
+    case 2:  *x =  s;    *y =  1.0f; *z =  t;    break;
+    case 3:  *x =  s;    *y = -1.0f; *z = -t;    break;
+    case 4:  *x =  s;    *y = -t;    *z =  1.0f; break;
+    default: *x = -s;    *y = -t;    *z = -1.0f; break;
+    }
+}
+
+#ifdef CUBE_MAP_BUILDER_SSE2
+
+/*
+ * Loads the components of a pixel into the lanes of a register, leaving
+ * the lanes past them 0
+ */
+static inline __m128 LoadTexel(const GLubyte* texel, int components)
+{
+    int bits = 0;
+    memcpy(&bits, texel, components);
+    __m128i zero  = _mm_setzero_si128();
+    __m128i bytes = _mm_cvtsi32_si128(bits);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+}
+
+static inline __m128 LoadTexel(const float* texel, int components)
+{
+    float values[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    memcpy(values, texel, components * sizeof(float));
+    return _mm_loadu_ps(values);
+}
+
+#endif
+
+/*
+ * Converts pixels of 4 floats to bytes with the given number of components
+ */
+static void ToBytes(const float* pixels, int components, int count, GLubyte* result)
+{
+    for (int i = 0; i < count; i++)
+    {
+        for (int c = 0; c < components; c++)
+        {
+            float value = pixels[i * 4 + c] + 0.5f;
+            result[i * components + c] = (GLubyte)std::min(std::max(value, 0.0f), 255.0f);
+        }
+    }
+}
+
+/*
+ * Converts pixels of 4 floats to half floats with the given number of
+ * components
+ */
+static void ToHalves(const float* pixels, int components, int count, GLushort* result)
+{
+    if (components == 4)
+    {
+        FloatToHalf(pixels, result, (size_t)count * 4);
+        return;
+    }
+
+    std::vector<float> packed((size_t)count * components);
+    for (int i = 0; i < count; i++)
+    {
+        for (int c = 0; c < components; c++)
+        {
+            packed[(size_t)i * components + c] = pixels[i * 4 + c];
+        }
+    }
+    FloatToHalf(&packed[0], result, packed.size());
+}
+
+/*
+ * Faces constructor
+ */
+CubeMapBuilder::Faces::Faces(GLenum dataType, int components, int size, int numLevels)
+    : dataType(dataType),
+    components(components),
+    size(size),
+    faceSize(0),
+    offsets(),
+    data()
+{
+    assert(dataType == GL_UNSIGNED_BYTE || dataType == GL_HALF_FLOAT);
+    assert(components >= 1 && components <= 4);
+    assert(size > 0 && numLevels >= 1);
+
+    size_t pixelSize = components * (dataType == GL_HALF_FLOAT ? sizeof(GLushort) : sizeof(GLubyte));
+    for (int level = 0; level < numLevels; level++)
+    {
+        offsets.push_back(faceSize);
+        faceSize += (size_t)GetSize(level) * GetSize(level) * pixelSize;
+    }
+    data.resize(faceSize * 6);
+}
+
+/*
+ * Get level data
+ */
+const GLubyte* CubeMapBuilder::Faces::GetLevelData(int level, int face) const
+{
+    assert(level >= 0 && level < GetNumLevels() && face >= 0 && face < 6);
+    return &data[face * faceSize + offsets[level]];
+}
+
+/*
+ * Get level data for writing
+ */
+GLubyte* CubeMapBuilder::Faces::GetLevelData(int level, int face)
+{
+    assert(level >= 0 && level < GetNumLevels() && face >= 0 && face < 6);
+    return &data[face * faceSize + offsets[level]];
+}
+
+/*
+ * Upload faces
+ */
+void CubeMapBuilder::Faces::Upload(GLint internalFormat, GLenum format) const
+{
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int face = 0; face < 6; face++)
+    {
+        for (int level = 0; level < GetNumLevels(); level++)
+        {
+            glTexImage2D(
+                GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+                level,
+                internalFormat,
+                GetSize(level),
+                GetSize(level),
+                0,
+                format,
+                dataType,
+                GetLevelData(level, face));
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+}
+
+/*
+ * Build cube map
+ */
+CubeMapBuilder::Faces* CubeMapBuilder::Build(
+    const GLvoid* pixels,
+    GLenum dataType,
+    int components,
+    int width,
+    int height,
+    int faceSize,
+    bool mipmaps)
+{
+    return BuildFaces(pixels, (ptrdiff_t)width * components, dataType, components,
+        width, height, faceSize, mipmaps);
+}
+
+/*
+ * Build cube map through the cache
+ */
+CubeMapBuilder::Faces* CubeMapBuilder::BuildCached(const char* filename, int faceSize, bool mipmaps)
+{
+    assert(filename);
+
+    unsigned long long key = 0;
+    std::string cacheFilename;
+    if (!MipmapBuilder::GetCacheDirectory().empty() &&
+        GetCacheKey(filename, faceSize, mipmaps, &key))
+    {
+        std::chrono::high_resolution_clock::time_point start =
+            std::chrono::high_resolution_clock::now();
+
+        char name[32];
+        sprintf(name, "%016llx.cube", key);
+        cacheFilename = MipmapBuilder::GetCacheDirectory() + name;
+
+        Faces* faces = LoadFaces(cacheFilename, key);
+
+        std::unique_lock<std::mutex> lock(statsMutex);
+        stats.loadMilliseconds += MillisecondsSince(start);
+        if (faces != NULL)
+        {
+            stats.cacheHits++;
+            return faces;
+        }
+    }
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now();
+
+    // stb_image decodes floats top-down, so those rows are read upwards
+    // from the end instead of being flipped first
+    int width;
+    int height;
+    int components;
+    Faces* faces = NULL;
+    if (stbi_is_hdr(filename))
+    {
+        float* pixels = stbi_loadf(filename, &width, &height, &components, 0);
+        if (pixels != NULL)
+        {
+            ptrdiff_t rowLength = (ptrdiff_t)width * components;
+            faces = BuildFaces(pixels + (height - 1) * rowLength, -rowLength, GL_FLOAT, components,
+                width, height, faceSize > 0 ? faceSize : GetFaceSize(width), mipmaps);
+            stbi_image_free(pixels);
+        }
+    }
+    else
+    {
+        int flipPass;
+        GLubyte* pixels = stbi_load_bottom_up(filename, &width, &height, &components, 0, &flipPass);
+        if (pixels != NULL)
+        {
+            faces = Build(pixels, GL_UNSIGNED_BYTE, components, width, height,
+                faceSize > 0 ? faceSize : GetFaceSize(width), mipmaps);
+            stbi_image_free(pixels);
+        }
+    }
+
+    if (faces == NULL)
+    {
+        std::cerr << "Unable to load panorama " << filename << ": " << stbi_failure_reason() << std::endl;
+        return NULL;
+    }
+
+    if (!cacheFilename.empty())
+    {
+        SaveFaces(cacheFilename, key, *faces);
+    }
+
+    std::unique_lock<std::mutex> lock(statsMutex);
+    stats.built++;
+    stats.buildMilliseconds += MillisecondsSince(start);
+    return faces;
+}
+
+/*
+ * Get face size
+ */
+int CubeMapBuilder::GetFaceSize(int panoramaWidth)
+{
+    int size = 1;
+    while (size * 2 <= panoramaWidth / 4)
+    {
+        size *= 2;
+    }
+    return size;
+}
+
+/*
+ * Reset stats
+ */
+void CubeMapBuilder::ResetStats()
+{
+    std::unique_lock<std::mutex> lock(statsMutex);
+    stats = Stats();
+}
+
+/*
+ * Sample rows of a face
+ */
+template<class T>
+void CubeMapBuilder::SampleRows(
+    const T* bottomRow,
+    ptrdiff_t rowStride,
+    int components,
+    int width,
+    int height,
+    int face,
+    int size,
+    int firstRow,
+    int lastRow,
+    float* result)
+{
+    const float pi = 3.14159265f;
+
+    for (int row = firstRow; row < lastRow; row++)
+    {
+        float t = 2.0f * (row + 0.5f) / size - 1.0f;
+        for (int column = 0; column < size; column++)
+        {
+            float s = 2.0f * (column + 0.5f) / size - 1.0f;
+            float x, y, z;
+            GetDirection(face, s, t, &x, &y, &z);
+
+            // Longitude runs across the panorama and latitude up it, so the
+            // direction gives a position in pixels
+            float u = (atan2f(z, x) / (2.0f * pi) + 0.5f) * width - 0.5f;
+            float v = (asinf(y / sqrtf(x * x + y * y + z * z)) / pi + 0.5f) * height - 0.5f;
+            int x0 = (int)floorf(u);
+            int y0 = (int)floorf(v);
+            float fx = u - x0;
+            float fy = v - y0;
+
+            // The panorama wraps around horizontally and is clamped at the
+            // poles
+            x0 = (x0 % width + width) % width;
+            int x1 = x0 + 1 < width ? x0 + 1 : 0;
+            int y1 = std::min(std::max(y0 + 1, 0), height - 1);
+            y0 = std::min(std::max(y0, 0), height - 1);
+
+            const T* row0 = bottomRow + y0 * rowStride;
+            const T* row1 = bottomRow + y1 * rowStride;
+            float* pixel = result + ((size_t)(row - firstRow) * size + column) * 4;
+#ifdef CUBE_MAP_BUILDER_SSE2
+            __m128 a = LoadTexel(row0 + x0 * components, components);
+            __m128 b = LoadTexel(row0 + x1 * components, components);
+            __m128 c = LoadTexel(row1 + x0 * components, components);
+            __m128 d = LoadTexel(row1 + x1 * components, components);
+            __m128 wx = _mm_set1_ps(fx);
+            __m128 bottom = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), wx));
+            __m128 top    = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), wx));
+            _mm_storeu_ps(pixel, _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(top, bottom), _mm_set1_ps(fy))));
+#else
+            for (int i = 0; i < 4; i++)
+            {
+                if (i < components)
+                {
+                    float bottom = row0[x0 * components + i] + (row0[x1 * components + i] - row0[x0 * components + i]) * fx;
+                    float top    = row1[x0 * components + i] + (row1[x1 * components + i] - row1[x0 * components + i]) * fx;
+                    pixel[i] = bottom + (top - bottom) * fy;
+                }
+                else
+                {
+                    pixel[i] = 0.0f;
+                }
+            }
+#endif
+        }
+    }
+}
+
+/*
+ * Build faces
+ */
+CubeMapBuilder::Faces* CubeMapBuilder::BuildFaces(
+    const GLvoid* bottomRow,
+    ptrdiff_t rowStride,
+    GLenum dataType,
+    int components,
+    int width,
+    int height,
+    int faceSize,
+    bool mipmaps)
+{
+    assert(bottomRow != NULL);
+    assert(dataType == GL_UNSIGNED_BYTE || dataType == GL_FLOAT);
+    assert(components >= 1 && components <= 4);
+    assert(width > 0 && height > 0 && faceSize > 0);
+
+    // 8-bit levels come from MipmapBuilder, so they are only built here
+    // when textures build their levels on the CPU
+    bool hdr = dataType == GL_FLOAT;
+    int numLevels = 1;
+    if (mipmaps && (hdr || MipmapBuilder::IsEnabled()))
+    {
+        while (faceSize >> numLevels > 0)
+        {
+            numLevels++;
+        }
+    }
+    Faces* faces = new Faces(hdr ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE, components, faceSize, numLevels);
+
+    // Half floats are filtered down from the float pixels of the level above
+    std::vector<std::vector<float> > current(hdr && numLevels > 1 ? 6 : 0);
+    for (size_t face = 0; face < current.size(); face++)
+    {
+        current[face].resize((size_t)faceSize * faceSize * 4);
+    }
+
+    // A few bands per thread keeps the threads busy
+    ThreadPool& pool = ThreadPool::GetShared();
+    int bandsPerFace = std::max((int)pool.GetNumThreads() * 4 / 6, 1);
+    int rowsPerBand = std::max((faceSize + bandsPerFace - 1) / bandsPerFace, minRowsPerBand);
+    int numBands = (faceSize + rowsPerBand - 1) / rowsPerBand;
+    pool.RunParallel(6 * numBands, [&](int index)
+    {
+        int face  = index / numBands;
+        int first = index % numBands * rowsPerBand;
+        int last  = std::min(first + rowsPerBand, faceSize);
+        int count = (last - first) * faceSize;
+
+        std::vector<float> band;
+        float* sampled;
+        if (current.empty())
+        {
+            band.resize((size_t)count * 4);
+            sampled = &band[0];
+        }
+        else
+        {
+            sampled = &current[face][(size_t)first * faceSize * 4];
+        }
+
+        if (hdr)
+        {
+            SampleRows((const float*)bottomRow, rowStride, components, width, height,
+                face, faceSize, first, last, sampled);
+            ToHalves(sampled, components, count,
+                (GLushort*)faces->GetLevelData(0, face) + (size_t)first * faceSize * components);
+        }
+        else
+        {
+            SampleRows((const GLubyte*)bottomRow, rowStride, components, width, height,
+                face, faceSize, first, last, sampled);
+            ToBytes(sampled, components, count,
+                faces->GetLevelData(0, face) + (size_t)first * faceSize * components);
+        }
+    });
+
+    if (numLevels == 1)
+    {
+        return faces;
+    }
+
+    if (!hdr)
+    {
+        const GLubyte* levelZero[6];
+        for (int face = 0; face < 6; face++)
+        {
+            levelZero[face] = faces->GetLevelData(0, face);
+        }
+
+        MipmapBuilder::Chain* levels = MipmapBuilder::Build(levelZero, 6, components,
+            faceSize, faceSize, MipmapBuilder::GetFilter(), MipmapBuilder::IsGammaCorrect());
+        for (int level = 1; level < numLevels; level++)
+        {
+            for (int face = 0; face < 6; face++)
+            {
+                memcpy(faces->GetLevelData(level, face), levels->GetLevelData(level, face),
+                    (size_t)faces->GetSize(level) * faces->GetSize(level) * components);
+            }
+        }
+        delete levels;
+        return faces;
+    }
+
+    // Each half float level averages 2x2 pixels of the one above it, in
+    // floating point so the rounding doesn't add up down the chain
+    std::vector<std::vector<float> > next(6);
+    for (int level = 1; level < numLevels; level++)
+    {
+        int sourceSize = faces->GetSize(level - 1);
+        int levelSize  = faces->GetSize(level);
+        for (int face = 0; face < 6; face++)
+        {
+            next[face].resize((size_t)levelSize * levelSize * 4);
+        }
+
+        rowsPerBand = std::max((levelSize + bandsPerFace - 1) / bandsPerFace, minRowsPerBand);
+        numBands = (levelSize + rowsPerBand - 1) / rowsPerBand;
+        pool.RunParallel(6 * numBands, [&](int index)
+        {
+            int face  = index / numBands;
+            int first = index % numBands * rowsPerBand;
+            int last  = std::min(first + rowsPerBand, levelSize);
+            const float* source = &current[face][0];
+            for (int row = first; row < last; row++)
+            {
+                const float* row0 = source + (size_t)(2 * row) * sourceSize * 4;
+                const float* row1 = source + (size_t)std::min(2 * row + 1, sourceSize - 1) * sourceSize * 4;
+                float* pixel = &next[face][(size_t)row * levelSize * 4];
+                for (int column = 0; column < levelSize; column++)
+                {
+                    int x0 = 2 * column * 4;
+                    int x1 = std::min(2 * column + 1, sourceSize - 1) * 4;
+                    for (int i = 0; i < 4; i++)
+                    {
+                        pixel[i] = 0.25f * (row0[x0 + i] + row0[x1 + i] + row1[x0 + i] + row1[x1 + i]);
+                    }
+                    pixel += 4;
+                }
+            }
+
+            ToHalves(&next[face][(size_t)first * levelSize * 4], components, (last - first) * levelSize,
+                (GLushort*)faces->GetLevelData(level, face) + (size_t)first * levelSize * components);
+        });
+
+        current.swap(next);
+    }
+
+    return faces;
+}
+
+/*
+ * Get cache key
+ */
+bool CubeMapBuilder::GetCacheKey(const char* filename, int faceSize, bool mipmaps, unsigned long long* key)
+{
+    struct stat info;
+    if (stat(filename, &info) != 0)
+    {
+        return false;
+    }
+
+    // The 8-bit levels depend on MipmapBuilder's settings
+    long long file[] = { (long long)info.st_size, (long long)info.st_mtime };
+    int settings[] = { faceSize, mipmaps ? 1 : 0, MipmapBuilder::IsEnabled() ? 1 : 0,
+        (int)MipmapBuilder::GetFilter(), MipmapBuilder::IsGammaCorrect() ? 1 : 0 };
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    hash = HashBytes(hash, filename, strlen(filename));
+    hash = HashBytes(hash, file, sizeof(file));
+    hash = HashBytes(hash, settings, sizeof(settings));
+    *key = hash;
+    return true;
+}
+
+/*
+ * Load cached faces
+ */
+CubeMapBuilder::Faces* CubeMapBuilder::LoadFaces(const std::string& filename, unsigned long long key)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+    {
+        return NULL;
+    }
+
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    // A different header means another panorama hashed to the same name, or
+    // the file is from an older version; either way it is rebuilt. The size
+    // and levels are checked against the file before anything is allocated,
+    // so a damaged file is rebuilt too
+    CacheHeader header;
+    Faces* faces = NULL;
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+        header.version == cacheVersion &&
+        header.key == key &&
+        (header.dataType == GL_UNSIGNED_BYTE || header.dataType == GL_HALF_FLOAT) &&
+        header.components >= 1 && header.components <= 4 &&
+        header.size > 0 && header.size <= maxCacheSize &&
+        header.numLevels >= 1 && header.numLevels <= MaxLevels(header.size) &&
+        CacheDataSize(header) <= (unsigned long long)info.st_size - sizeof(header))
+    {
+        faces = new Faces(header.dataType, header.components, header.size, header.numLevels);
+        if (fread(&faces->data[0], faces->data.size(), 1, file) != 1)
+        {
+            delete faces;
+            faces = NULL;
+        }
+    }
+
+    fclose(file);
+    return faces;
+}
+
+/*
+ * Save cached faces
+ */
+void CubeMapBuilder::SaveFaces(const std::string& filename, unsigned long long key, const Faces& faces)
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+    {
+        return;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version    = cacheVersion;
+    header.key        = key;
+    header.dataType   = faces.GetDataType();
+    header.components = faces.GetComponents();
+    header.size       = faces.GetSize(0);
+    header.numLevels  = faces.GetNumLevels();
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(&faces.data[0], faces.data.size(), 1, file) == 1;
+    fclose(file);
+
+    // Don't leave a partial file to be read next time
+    if (!written)
+    {
+        remove(filename.c_str());
+    }
+}
@@ -54,14 +54,14 @@ DepthTexture2D::~DepthTexture2D()
 }
 
 /*
- * Set texture parameters
+ * Get sampler parameters
  */
-void DepthTexture2D::SetTextureParams()
+void DepthTexture2D::GetSamplerParams(SamplerParams& params) const
 {
-    // Set depth parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, compareFunc);
+    // Call base method to get the rest of the parameters
+    Texture2D::GetSamplerParams(params);
 
-    // Call base method to set the rest of the parameters
-    Texture2D::SetTextureParams();
+    // Set depth parameters
+    params.compareMode = GL_COMPARE_REF_TO_TEXTURE;
+    params.compareFunc = compareFunc;
 }
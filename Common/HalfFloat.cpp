@@ -0,0 +1,75 @@
+#include <cassert>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HALF_FLOAT_SSE2
+#include <emmintrin.h>
+#endif
+#include "HalfFloat.h"
+
+#ifdef HALF_FLOAT_SSE2
+
+/*
+ * Converts four floats to half floats, sign-extended to 32 bits so they can
+ * be packed with signed saturation.  Each case of the scalar conversion is
+ * computed for every lane, then the right one is selected
+ */
+static __m128i FloatToHalf4(__m128 value)
+{
+    // Smallest magnitudes that become infinity and normal half floats
+    const __m128i infinityFloor = _mm_set1_epi32((127 + 16) << 23);
+    const __m128i normalFloor   = _mm_set1_epi32((127 - 14) << 23);
+
+    // Adding this float shifts a denormal result's bits to the bottom of the
+    // mantissa, rounded by the FPU
+    const __m128i denormalMagic = _mm_set1_epi32((127 - 15 + 23 - 10 + 1) << 23);
+
+    // Rebiases the exponent and adds just under half of the dropped bits
+    const __m128i normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+    __m128  sign        = _mm_and_ps(value, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+    __m128  magnitude   = _mm_xor_ps(value, sign);
+    __m128i bits        = _mm_castps_si128(magnitude);
+
+    // Infinity and NaN, and values too large, keeping NaNs quiet
+    __m128i isNan       = _mm_castps_si128(_mm_cmpunord_ps(magnitude, magnitude));
+    __m128i special     = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(isNan, _mm_set1_epi32(0x200)));
+    __m128i isFinite    = _mm_cmpgt_epi32(infinityFloor, bits);
+
+    // Values too small for a normal half float
+    __m128i isDenormal  = _mm_cmpgt_epi32(normalFloor, bits);
+    __m128i denormal    = _mm_sub_epi32(
+        _mm_castps_si128(_mm_add_ps(magnitude, _mm_castsi128_ps(denormalMagic))), denormalMagic);
+
+    // Normal values round to nearest, with ties going to the even mantissa
+    // by adding one more when the lowest kept bit is set
+    __m128i odd         = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+    __m128i normal      = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(bits, normalBias), odd), 13);
+
+    __m128i finite      = _mm_or_si128(_mm_and_si128(isDenormal, denormal), _mm_andnot_si128(isDenormal, normal));
+    __m128i result      = _mm_or_si128(_mm_and_si128(isFinite, finite), _mm_andnot_si128(isFinite, special));
+    return _mm_or_si128(result, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+
+#endif
+
+/*
+ * Float to half for an array
+ */
+void FloatToHalf(const float* values, GLushort* halves, size_t count)
+{
+    assert(values && halves);
+
+    size_t i = 0;
+#ifdef HALF_FLOAT_SSE2
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i low  = FloatToHalf4(_mm_loadu_ps(values + i));
+        __m128i high = FloatToHalf4(_mm_loadu_ps(values + i + 4));
+        _mm_storeu_si128((__m128i*)(halves + i), _mm_packs_epi32(low, high));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        halves[i] = FloatToHalf(values[i]);
+    }
+}
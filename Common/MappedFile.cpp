@@ -0,0 +1,106 @@
+#include <cassert>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "MappedFile.h"
+
+#ifdef _WIN32
+
+/*
+ * Constructor
+ */
+MappedFile::MappedFile(const char* filename)
+    : data(NULL),
+    size(0),
+    file(INVALID_HANDLE_VALUE),
+    mapping(NULL)
+{
+    assert(filename);
+
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER fileSize;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        return;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        return;
+    }
+
+    data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    size = data != NULL ? (size_t)fileSize.QuadPart : 0;
+}
+
+/*
+ * Destructor
+ */
+MappedFile::~MappedFile()
+{
+    if (data != NULL)
+    {
+        UnmapViewOfFile(data);
+    }
+    if (mapping != NULL)
+    {
+        CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file);
+    }
+}
+
+#else
+
+/*
+ * Constructor
+ */
+MappedFile::MappedFile(const char* filename)
+    : data(NULL),
+    size(0)
+{
+    assert(filename);
+
+    int descriptor = open(filename, O_RDONLY);
+    if (descriptor < 0)
+    {
+        return;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    struct stat info;
+    if (fstat(descriptor, &info) == 0 && info.st_size > 0)
+    {
+        void* mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapped != MAP_FAILED)
+        {
+            data = (const unsigned char*)mapped;
+            size = (size_t)info.st_size;
+        }
+    }
+    close(descriptor);
+}
+
+/*
+ * Destructor
+ */
+MappedFile::~MappedFile()
+{
+    if (data != NULL)
+    {
+        munmap((void*)data, size);
+    }
+}
+
+#endif
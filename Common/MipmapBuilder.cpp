@@ -0,0 +1,923 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MIPMAP_BUILDER_SSE
+#include <xmmintrin.h>
+#endif
+#include "MipmapBuilder.h"
+#include "ThreadPool.h"
+
+/*
+ * Settings used by BuildCached
+ */
+bool                  MipmapBuilder::enabled        = true;
+MipmapBuilder::Filter MipmapBuilder::filter         = MipmapBuilder::FILTER_KAISER;
+bool                  MipmapBuilder::gammaCorrect   = true;
+std::string           MipmapBuilder::cacheDirectory;
+
+/*
+ * Chains built since the last reset
+ */
+MipmapBuilder::Stats MipmapBuilder::stats;
+
+/*
+ * Guards the stats, which are updated by chains built on worker threads
+ */
+static std::mutex statsMutex;
+
+/*
+ * Shape of the Kaiser filter: its radius in output pixels, and how quickly
+ * the window falls off
+ */
+static const double kaiserRadius = 3.0;
+static const double kaiserBeta   = 4.0;
+
+/*
+ * Rows of output each task resamples at least, so the source rows shared
+ * with the neighbouring bands aren't filtered too many times over
+ */
+static const int minRowsPerBand = 16;
+
+/*
+ * Identifies cached chain files, and changes whenever the layout does
+ */
+static const char         cacheMagic[4] = { 'M', 'I', 'P', 'C' };
+static const unsigned int cacheVersion  = 1;
+
+/*
+ * Header of a cached chain file, followed by the generated levels
+ */
+struct CacheHeader
+{
+    char               magic[4];   //!< cacheMagic
+    unsigned int       version;    //!< cacheVersion
+    unsigned long long key;        //!< Hash of the source pixels and settings
+    int                width;      //!< Width of the source image
+    int                height;     //!< Height of the source image
+    int                components; //!< Bytes in each pixel
+    int                numFaces;   //!< 1, or 6 for a cube map
+};
+
+/*
+ * Conversions between sRGB encoded bytes and linear light
+ */
+struct SrgbTables
+{
+    float toLinear[256];   //!< Linear value of each byte
+    float thresholds[255]; //!< Linear value halfway between each pair of bytes
+
+    SrgbTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            toLinear[i] = (float)Decode(i / 255.0);
+        }
+        for (int i = 0; i < 255; i++)
+        {
+            thresholds[i] = (float)Decode((i + 0.5) / 255.0);
+        }
+    }
+
+    static double Decode(double value)
+    {
+        return value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4);
+    }
+};
+
+/*
+ * sRGB tables, built before main so the worker threads never race to
+ * initialize them
+ */
+static const SrgbTables srgbTables;
+
+/*
+ * Adds bytes to a 64-bit FNV-1a hash
+ */
+static unsigned long long HashBytes(unsigned long long hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * Milliseconds elapsed since a point in time
+ */
+static double MillisecondsSince(const std::chrono::high_resolution_clock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+}
+
+/*
+ * Normalized sinc function
+ */
+static double Sinc(double x)
+{
+    if (fabs(x) < 1.0e-9)
+    {
+        return 1.0;
+    }
+    const double pi = 3.14159265358979323846;
+    return sin(pi * x) / (pi * x);
+}
+
+/*
+ * Modified Bessel function of the first kind, order 0
+ */
+static double BesselI0(double x)
+{
+    double sum  = 1.0;
+    double term = 1.0;
+    for (int k = 1; term > sum * 1.0e-12; k++)
+    {
+        term *= (x * x / 4.0) / (k * k);
+        sum  += term;
+    }
+    return sum;
+}
+
+/*
+ * Kaiser window, for x from -1 to 1
+ */
+static double Kaiser(double x)
+{
+    if (fabs(x) >= 1.0)
+    {
+        return 0.0;
+    }
+    return BesselI0(kaiserBeta * sqrt(1.0 - x * x)) / BesselI0(kaiserBeta);
+}
+
+/*
+ * Chain constructor
+ */
+MipmapBuilder::Chain::Chain(int components, int width, int height, int numFaces)
+    : components(components),
+    numFaces(numFaces),
+    faceSize(0),
+    levels(),
+    data()
+{
+    assert(components >= 1 && components <= 4);
+    assert(width > 0 && height > 0);
+    assert(numFaces == 1 || numFaces == 6);
+
+    // Levels halve in size, rounding down, until both sides reach 1
+    Level level = { width, height, 0 };
+    levels.push_back(level);
+    while (level.width > 1 || level.height > 1)
+    {
+        level.width  = std::max(level.width / 2, 1);
+        level.height = std::max(level.height / 2, 1);
+        level.offset = faceSize;
+        faceSize += (size_t)level.width * level.height * components;
+        levels.push_back(level);
+    }
+    data.resize(faceSize * numFaces);
+}
+
+/*
+ * Get level data
+ */
+const GLubyte* MipmapBuilder::Chain::GetLevelData(int level, int face) const
+{
+    assert(level >= 1 && level < GetNumLevels());
+    assert(face >= 0 && face < numFaces);
+    return &data[face * faceSize + levels[level].offset];
+}
+
+/*
+ * Get level data for writing
+ */
+GLubyte* MipmapBuilder::Chain::GetLevelData(int level, int face)
+{
+    assert(level >= 1 && level < GetNumLevels());
+    assert(face >= 0 && face < numFaces);
+    return &data[face * faceSize + levels[level].offset];
+}
+
+/*
+ * Upload levels
+ */
+void MipmapBuilder::Chain::Upload(GLenum target, int face, GLint internalFormat, GLenum format) const
+{
+    // Rows of odd sized levels aren't padded to 4 bytes
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int level = 1; level < GetNumLevels(); level++)
+    {
+        if (target == GL_TEXTURE_1D)
+        {
+            assert(levels[0].height == 1 && numFaces == 1);
+            glTexImage1D(
+                target,
+                level,
+                internalFormat,
+                levels[level].width,
+                0,
+                format,
+                GL_UNSIGNED_BYTE,
+                GetLevelData(level, face));
+            continue;
+        }
+
+        glTexImage2D(
+            target,
+            level,
+            internalFormat,
+            levels[level].width,
+            levels[level].height,
+            0,
+            format,
+            GL_UNSIGNED_BYTE,
+            GetLevelData(level, face));
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+}
+
+/*
+ * Build mip chain
+ */
+MipmapBuilder::Chain* MipmapBuilder::Build(
+    const GLubyte* const* faces,
+    int numFaces,
+    int components,
+    int width,
+    int height,
+    Filter filter,
+    bool gammaCorrect)
+{
+    assert(faces != NULL);
+    Chain* chain = new Chain(components, width, height, numFaces);
+    bool linear = gammaCorrect && components >= 3;
+
+    // A few bands per thread keeps the threads busy, but bands that are too
+    // short spend most of their time on the rows they share
+    int numThreads = (int)ThreadPool::GetShared().GetNumThreads();
+    int bandsPerLevel = std::max(numThreads * 4 / numFaces, 1);
+
+    // Every level is kept as floats until the next one is made from it, so
+    // rounding to bytes doesn't add up down the chain
+    std::vector<std::vector<float> > current(numFaces);
+    std::vector<std::vector<float> > next(numFaces);
+    for (int face = 0; face < numFaces; face++)
+    {
+        assert(faces[face] != NULL);
+        current[face].resize((size_t)width * height * 4);
+    }
+
+    int rowsPerBand = std::max((height + bandsPerLevel - 1) / bandsPerLevel, minRowsPerBand);
+    int numBands = (height + rowsPerBand - 1) / rowsPerBand;
+    ThreadPool::GetShared().RunParallel(numFaces * numBands, [&](int index)
+    {
+        int face  = index / numBands;
+        int first = index % numBands * rowsPerBand;
+        int last  = std::min(first + rowsPerBand, height);
+        ToFloat(faces[face] + (size_t)first * width * components, components,
+            (last - first) * width, linear, &current[face][(size_t)first * width * 4]);
+    });
+
+    for (int level = 1; level < chain->GetNumLevels(); level++)
+    {
+        int sourceWidth  = chain->GetWidth(level - 1);
+        int sourceHeight = chain->GetHeight(level - 1);
+        int levelWidth   = chain->GetWidth(level);
+        int levelHeight  = chain->GetHeight(level);
+
+        Weights columns;
+        Weights rows;
+        ComputeWeights(sourceWidth, levelWidth, filter, columns);
+        ComputeWeights(sourceHeight, levelHeight, filter, rows);
+
+        for (int face = 0; face < numFaces; face++)
+        {
+            next[face].resize((size_t)levelWidth * levelHeight * 4);
+        }
+
+        rowsPerBand = std::max((levelHeight + bandsPerLevel - 1) / bandsPerLevel, minRowsPerBand);
+        numBands = (levelHeight + rowsPerBand - 1) / rowsPerBand;
+        ThreadPool::GetShared().RunParallel(numFaces * numBands, [&](int index)
+        {
+            int face  = index / numBands;
+            int first = index % numBands * rowsPerBand;
+            int last  = std::min(first + rowsPerBand, levelHeight);
+            ResampleRows(&current[face][0], sourceWidth, columns, rows, levelWidth,
+                first, last, &next[face][0]);
+            ToBytes(&next[face][(size_t)first * levelWidth * 4], components,
+                (last - first) * levelWidth, linear,
+                chain->GetLevelData(level, face) + (size_t)first * levelWidth * components);
+        });
+
+        current.swap(next);
+    }
+
+    return chain;
+}
+
+/*
+ * Build mip chain through the cache
+ */
+MipmapBuilder::Chain* MipmapBuilder::BuildCached(
+    const GLubyte* const* faces,
+    int numFaces,
+    int components,
+    int width,
+    int height)
+{
+    unsigned long long key = 0;
+    std::string filename;
+    if (!cacheDirectory.empty())
+    {
+        std::chrono::high_resolution_clock::time_point start =
+            std::chrono::high_resolution_clock::now();
+
+        char name[32];
+        key = GetCacheKey(faces, numFaces, components, width, height);
+        sprintf(name, "%016llx.mip", key);
+        filename = cacheDirectory + name;
+
+        Chain* chain = LoadChain(filename, key, numFaces, components, width, height);
+
+        std::unique_lock<std::mutex> lock(statsMutex);
+        stats.loadMilliseconds += MillisecondsSince(start);
+        if (chain != NULL)
+        {
+            stats.cacheHits++;
+            return chain;
+        }
+    }
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now();
+
+    Chain* chain = Build(faces, numFaces, components, width, height, filter, gammaCorrect);
+    if (!filename.empty())
+    {
+        SaveChain(filename, key, *chain);
+    }
+
+    std::unique_lock<std::mutex> lock(statsMutex);
+    stats.built++;
+    stats.buildMilliseconds += MillisecondsSince(start);
+    return chain;
+}
+
+/*
+ * Build volume
+ */
+void MipmapBuilder::BuildVolume(
+    const GLubyte* const* slices,
+    int components,
+    int width,
+    int height,
+    int depth,
+    bool gammaCorrect,
+    std::vector<std::vector<GLubyte> >& levels)
+{
+    assert(slices != NULL);
+    assert(components >= 1 && components <= 4);
+    assert(width > 0 && height > 0 && depth > 0);
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now();
+
+    bool linear = gammaCorrect && components >= 3;
+    levels.clear();
+
+    // As in Build, each level is kept as floats until the next one is made
+    // from it.  The source is converted a pair of slices at a time instead
+    std::vector<float> current;
+    std::vector<float> next;
+    int levelWidth  = width;
+    int levelHeight = height;
+    int levelDepth  = depth;
+    while (levelWidth > 1 || levelHeight > 1 || levelDepth > 1)
+    {
+        int sourceWidth  = levelWidth;
+        int sourceHeight = levelHeight;
+        int sourceDepth  = levelDepth;
+        levelWidth  = std::max(levelWidth  / 2, 1);
+        levelHeight = std::max(levelHeight / 2, 1);
+        levelDepth  = std::max(levelDepth  / 2, 1);
+
+        size_t sourcePixels = (size_t)sourceWidth * sourceHeight;
+        size_t slicePixels  = (size_t)levelWidth * levelHeight;
+        bool fromSource = levels.empty();
+        next.resize(slicePixels * levelDepth * 4);
+        levels.push_back(std::vector<GLubyte>(slicePixels * levelDepth * components));
+        GLubyte* bytes = &levels.back()[0];
+
+        ThreadPool::GetShared().RunParallel(levelDepth, [&](int z)
+        {
+            int lowerSlice = 2 * z;
+            int upperSlice = std::min(2 * z + 1, sourceDepth - 1);
+
+            std::vector<float> converted;
+            const float* lower;
+            const float* upper;
+            if (fromSource)
+            {
+                converted.resize(sourcePixels * 8);
+                ToFloat(slices[lowerSlice], components, (int)sourcePixels, linear, &converted[0]);
+                ToFloat(slices[upperSlice], components, (int)sourcePixels, linear, &converted[sourcePixels * 4]);
+                lower = &converted[0];
+                upper = &converted[sourcePixels * 4];
+            }
+            else
+            {
+                lower = &current[lowerSlice * sourcePixels * 4];
+                upper = &current[upperSlice * sourcePixels * 4];
+            }
+
+            float* result = &next[z * slicePixels * 4];
+            for (int y = 0; y < levelHeight; y++)
+            {
+                size_t below = (size_t)(2 * y) * sourceWidth;
+                size_t above = (size_t)std::min(2 * y + 1, sourceHeight - 1) * sourceWidth;
+                for (int x = 0; x < levelWidth; x++)
+                {
+                    int left  = 2 * x;
+                    int right = std::min(2 * x + 1, sourceWidth - 1);
+                    size_t corners[] = { below + left, below + right, above + left, above + right };
+                    float* pixel = result + ((size_t)y * levelWidth + x) * 4;
+                    for (int c = 0; c < 4; c++)
+                    {
+                        float sum = 0.0f;
+                        for (int i = 0; i < 4; i++)
+                        {
+                            sum += lower[corners[i] * 4 + c] + upper[corners[i] * 4 + c];
+                        }
+                        pixel[c] = sum * 0.125f;
+                    }
+                }
+            }
+            ToBytes(result, components, (int)slicePixels, linear, bytes + z * slicePixels * components);
+        });
+
+        current.swap(next);
+    }
+
+    std::unique_lock<std::mutex> lock(statsMutex);
+    stats.built++;
+    stats.buildMilliseconds += MillisecondsSince(start);
+}
+
+/*
+ * Resize image
+ */
+void MipmapBuilder::Resize(
+    const GLubyte* pixels,
+    int components,
+    int width,
+    int height,
+    int newWidth,
+    int newHeight,
+    Filter filter,
+    bool gammaCorrect,
+    GLubyte* result)
+{
+    assert(pixels != NULL && result != NULL);
+    assert(components >= 1 && components <= 4);
+    assert(width > 0 && height > 0 && newWidth > 0 && newHeight > 0);
+
+    bool linear = gammaCorrect && components >= 3;
+    std::vector<float> source((size_t)width * height * 4);
+    std::vector<float> resized((size_t)newWidth * newHeight * 4);
+    ToFloat(pixels, components, width * height, linear, &source[0]);
+
+    Weights columns;
+    Weights rows;
+    ComputeWeights(width, newWidth, filter, columns);
+    ComputeWeights(height, newHeight, filter, rows);
+
+    int numBands = std::max((int)ThreadPool::GetShared().GetNumThreads() * 4, 1);
+    int rowsPerBand = std::max((newHeight + numBands - 1) / numBands, minRowsPerBand);
+    numBands = (newHeight + rowsPerBand - 1) / rowsPerBand;
+    ThreadPool::GetShared().RunParallel(numBands, [&](int index)
+    {
+        int first = index * rowsPerBand;
+        int last  = std::min(first + rowsPerBand, newHeight);
+        ResampleRows(&source[0], width, columns, rows, newWidth, first, last, &resized[0]);
+        ToBytes(&resized[(size_t)first * newWidth * 4], components, (last - first) * newWidth,
+            linear, result + (size_t)first * newWidth * components);
+    });
+}
+
+/*
+ * Halve row
+ */
+void MipmapBuilder::HalveRow(
+    const GLubyte* lower,
+    const GLubyte* upper,
+    int components,
+    int width,
+    bool gammaCorrect,
+    GLubyte* result)
+{
+    assert(lower != NULL && upper != NULL && result != NULL);
+    assert(components >= 1 && components <= 4);
+    assert(width > 0);
+
+    bool linear = gammaCorrect && components >= 3;
+    std::vector<float> rows((size_t)width * 8);
+    ToFloat(lower, components, width, linear, &rows[0]);
+    ToFloat(upper, components, width, linear, &rows[(size_t)width * 4]);
+
+    // A single column is averaged with itself
+    int newWidth = std::max(width / 2, 1);
+    std::vector<float> halved((size_t)newWidth * 4);
+    const float* below = &rows[0];
+    const float* above = &rows[(size_t)width * 4];
+    for (int x = 0; x < newWidth; x++)
+    {
+        int left  = 2 * x * 4;
+        int right = std::min(2 * x + 1, width - 1) * 4;
+        for (int c = 0; c < 4; c++)
+        {
+            halved[x * 4 + c] = 0.25f * (below[left + c] + below[right + c] + above[left + c] + above[right + c]);
+        }
+    }
+    ToBytes(&halved[0], components, newWidth, linear, result);
+}
+
+/*
+ * Set cache directory
+ */
+void MipmapBuilder::SetCacheDirectory(const char* directory)
+{
+    cacheDirectory = directory ? directory : "";
+    if (cacheDirectory.empty())
+    {
+        return;
+    }
+
+    // Create the directory if needed.  If that fails, saving chains will
+    // fail as well and they are simply built every run
+#ifdef _WIN32
+    _mkdir(cacheDirectory.c_str());
+#else
+    mkdir(cacheDirectory.c_str(), 0755);
+#endif
+
+    char last = cacheDirectory[cacheDirectory.size() - 1];
+    if (last != '/' && last != '\\')
+    {
+        cacheDirectory += '/';
+    }
+}
+
+/*
+ * Reset stats
+ */
+void MipmapBuilder::ResetStats()
+{
+    std::unique_lock<std::mutex> lock(statsMutex);
+    stats = Stats();
+}
+
+/*
+ * Compute resampling weights
+ */
+void MipmapBuilder::ComputeWeights(int sourceSize, int size, Filter filter, Weights& weights)
+{
+    // Each output pixel covers scale source pixels.  When enlarging, the
+    // filter still spans a whole source pixel, so it interpolates between
+    // neighbours instead of picking the nearest one
+    double scale = (double)sourceSize / size;
+    double footprint = std::max(scale, 1.0);
+    double radius = filter == FILTER_BOX ? footprint * 0.5 : footprint * kaiserRadius;
+
+    weights.first.resize(size);
+    weights.count.resize(size);
+    weights.offset.resize(size);
+    weights.weights.clear();
+
+    std::vector<double> taps;
+    for (int i = 0; i < size; i++)
+    {
+        double center = (i + 0.5) * scale;
+        int low  = (int)floor(center - radius);
+        int high = (int)ceil(center + radius);
+
+        taps.assign(high - low, 0.0);
+        double sum = 0.0;
+        for (int s = low; s < high; s++)
+        {
+            double weight;
+            if (filter == FILTER_BOX)
+            {
+                // How much of the source pixel the output pixel covers
+                weight = std::min(center + radius, s + 1.0) - std::max(center - radius, (double)s);
+            }
+            else
+            {
+                double t = (s + 0.5 - center) / footprint;
+                weight = Sinc(t) * Kaiser(t / kaiserRadius);
+            }
+            taps[s - low] = weight;
+            sum += weight;
+        }
+
+        // Pixels past the edges repeat the edge pixel, so their weights
+        // are moved onto it
+        int first = std::max(low, 0);
+        int last  = std::min(high, sourceSize) - 1;
+        std::vector<double> clamped(taps.begin() + (first - low), taps.begin() + (last - low + 1));
+        for (int s = low; s < first; s++)
+        {
+            clamped.front() += taps[s - low];
+        }
+        for (int s = last + 1; s < high; s++)
+        {
+            clamped.back() += taps[s - low];
+        }
+
+        // The ends of the Kaiser filter fall on zeros of the sinc
+        size_t begin = 0;
+        size_t end = clamped.size();
+        while (end - begin > 1 && fabs(clamped[begin]) < 1.0e-7 * sum)
+        {
+            begin++;
+        }
+        while (end - begin > 1 && fabs(clamped[end - 1]) < 1.0e-7 * sum)
+        {
+            end--;
+        }
+
+        weights.first[i]  = first + (int)begin;
+        weights.count[i]  = (int)(end - begin);
+        weights.offset[i] = (int)weights.weights.size();
+        for (size_t n = begin; n < end; n++)
+        {
+            weights.weights.push_back((float)(clamped[n] / sum));
+        }
+    }
+}
+
+/*
+ * Resample rows
+ */
+void MipmapBuilder::ResampleRows(
+    const float* source,
+    int sourceWidth,
+    const Weights& columns,
+    const Weights& rows,
+    int width,
+    int firstRow,
+    int lastRow,
+    float* result)
+{
+    // Source rows read by any row of the band
+    int firstSource = rows.first[firstRow];
+    int lastSource = firstSource;
+    for (int y = firstRow; y < lastRow; y++)
+    {
+        firstSource = std::min(firstSource, rows.first[y]);
+        lastSource  = std::max(lastSource, rows.first[y] + rows.count[y]);
+    }
+
+    // Resample those rows horizontally first, then combine them vertically
+    std::vector<float> band((size_t)(lastSource - firstSource) * width * 4);
+    for (int y = firstSource; y < lastSource; y++)
+    {
+        const float* in = source + (size_t)y * sourceWidth * 4;
+        float* out = &band[(size_t)(y - firstSource) * width * 4];
+        for (int x = 0; x < width; x++)
+        {
+            const float* weight = &columns.weights[columns.offset[x]];
+            const float* pixel  = in + columns.first[x] * 4;
+            int count = columns.count[x];
+#ifdef MIPMAP_BUILDER_SSE
+            __m128 sum = _mm_setzero_ps();
+            for (int n = 0; n < count; n++)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weight[n]), _mm_loadu_ps(pixel + n * 4)));
+            }
+            _mm_storeu_ps(out + x * 4, sum);
+#else
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int n = 0; n < count; n++)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    sum[c] += weight[n] * pixel[n * 4 + c];
+                }
+            }
+            memcpy(out + x * 4, sum, sizeof(sum));
+#endif
+        }
+    }
+
+    for (int y = firstRow; y < lastRow; y++)
+    {
+        const float* weight = &rows.weights[rows.offset[y]];
+        const float* in = &band[(size_t)(rows.first[y] - firstSource) * width * 4];
+        float* out = result + (size_t)y * width * 4;
+        int count = rows.count[y];
+        size_t stride = (size_t)width * 4;
+
+        // Sharp filters overshoot near edges, which is clamped here so it
+        // doesn't carry into the next level
+#ifdef MIPMAP_BUILDER_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one  = _mm_set1_ps(1.0f);
+        for (int x = 0; x < width; x++)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int n = 0; n < count; n++)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weight[n]),
+                    _mm_loadu_ps(in + n * stride + x * 4)));
+            }
+            _mm_storeu_ps(out + x * 4, _mm_min_ps(_mm_max_ps(sum, zero), one));
+        }
+#else
+        for (int x = 0; x < width * 4; x++)
+        {
+            float sum = 0.0f;
+            for (int n = 0; n < count; n++)
+            {
+                sum += weight[n] * in[n * stride + x];
+            }
+            out[x] = std::min(std::max(sum, 0.0f), 1.0f);
+        }
+#endif
+    }
+}
+
+/*
+ * Convert to floats
+ */
+void MipmapBuilder::ToFloat(
+    const GLubyte* pixels,
+    int components,
+    int count,
+    bool gammaCorrect,
+    float* result)
+{
+    const float* toLinear = srgbTables.toLinear;
+
+    // Alpha stays linear
+    int colorComponents = gammaCorrect ? std::min(components, 3) : 0;
+    for (int i = 0; i < count; i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            float value = 0.0f;
+            if (c < colorComponents)
+            {
+                value = toLinear[pixels[c]];
+            }
+            else if (c < components)
+            {
+                value = pixels[c] / 255.0f;
+            }
+            result[c] = value;
+        }
+        pixels += components;
+        result += 4;
+    }
+}
+
+/*
+ * Convert to bytes
+ */
+void MipmapBuilder::ToBytes(
+    const float* pixels,
+    int components,
+    int count,
+    bool gammaCorrect,
+    GLubyte* result)
+{
+    const float* thresholds = srgbTables.thresholds;
+
+    int colorComponents = gammaCorrect ? std::min(components, 3) : 0;
+    for (int i = 0; i < count; i++)
+    {
+        for (int c = 0; c < components; c++)
+        {
+            if (c < colorComponents)
+            {
+                // The byte whose range holds the value
+                result[c] = (GLubyte)(std::upper_bound(thresholds, thresholds + 255, pixels[c]) - thresholds);
+            }
+            else
+            {
+                result[c] = (GLubyte)(pixels[c] * 255.0f + 0.5f);
+            }
+        }
+        pixels += 4;
+        result += components;
+    }
+}
+
+/*
+ * Get cache key
+ */
+unsigned long long MipmapBuilder::GetCacheKey(
+    const GLubyte* const* faces,
+    int numFaces,
+    int components,
+    int width,
+    int height)
+{
+    int settings[] = { width, height, components, numFaces, (int)filter, gammaCorrect ? 1 : 0 };
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    hash = HashBytes(hash, settings, sizeof(settings));
+    for (int face = 0; face < numFaces; face++)
+    {
+        hash = HashBytes(hash, faces[face], (size_t)width * height * components);
+    }
+    return hash;
+}
+
+/*
+ * Load cached chain
+ */
+MipmapBuilder::Chain* MipmapBuilder::LoadChain(
+    const std::string& filename,
+    unsigned long long key,
+    int numFaces,
+    int components,
+    int width,
+    int height)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    // A different header means another image hashed to the same name, or
+    // the file is from an older version; either way it is rebuilt
+    CacheHeader header;
+    Chain* chain = NULL;
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+        header.version == cacheVersion &&
+        header.key == key &&
+        header.width == width &&
+        header.height == height &&
+        header.components == components &&
+        header.numFaces == numFaces)
+    {
+        chain = new Chain(components, width, height, numFaces);
+        if (!chain->data.empty() &&
+            fread(&chain->data[0], chain->data.size(), 1, file) != 1)
+        {
+            delete chain;
+            chain = NULL;
+        }
+    }
+
+    fclose(file);
+    return chain;
+}
+
+/*
+ * Save cached chain
+ */
+void MipmapBuilder::SaveChain(const std::string& filename, unsigned long long key, const Chain& chain)
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+    {
+        return;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version    = cacheVersion;
+    header.key        = key;
+    header.width      = chain.GetWidth(0);
+    header.height     = chain.GetHeight(0);
+    header.components = chain.GetComponents();
+    header.numFaces   = chain.GetNumFaces();
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        (chain.data.empty() || fwrite(&chain.data[0], chain.data.size(), 1, file) == 1);
+    fclose(file);
+
+    // Don't leave a partial file to be read next time
+    if (!written)
+    {
+        remove(filename.c_str());
+    }
+}
@@ -0,0 +1,106 @@
+#include <cassert>
+#include <iostream>
+#include "ProgramPipeline.h"
+
+/*
+ * The currently bound pipeline
+ */
+GLuint ProgramPipeline::activePipelineId = 0;
+
+/*
+ * Program pipeline constructor
+ */
+ProgramPipeline::ProgramPipeline()
+    : pipelineId(0),
+    vertexStage(NULL),
+    fragStage(NULL),
+    geoStage(NULL)
+{
+    if (!IsSupported())
+    {
+        std::cerr << "Program pipelines need OpenGL 4.1 or " <<
+            "ARB_separate_shader_objects" << std::endl;
+        return;
+    }
+
+    glGenProgramPipelines(1, &pipelineId);
+}
+
+/*
+ * Destructor
+ */
+ProgramPipeline::~ProgramPipeline()
+{
+    if (IsBound())
+    {
+        Unbind();
+    }
+
+    glDeleteProgramPipelines(1, &pipelineId);
+}
+
+/*
+ * Set stage
+ */
+void ProgramPipeline::SetStage(const Shader* stage)
+{
+    assert(stage && stage->IsSeparable());
+
+    // Find which stage the shader provides
+    const Shader** current;
+    switch (stage->GetStageBits())
+    {
+    case GL_VERTEX_SHADER_BIT:   current = &vertexStage; break;
+    case GL_FRAGMENT_SHADER_BIT: current = &fragStage;   break;
+    case GL_GEOMETRY_SHADER_BIT: current = &geoStage;    break;
+    default:
+        assert(!"Separable shaders hold a single stage");
+        return;
+    }
+
+    if (*current == stage)
+    {
+        return;
+    }
+
+    glUseProgramStages(pipelineId, stage->GetStageBits(), stage->GetProgramId());
+    *current = stage;
+}
+
+/*
+ * Bind
+ */
+void ProgramPipeline::Bind()
+{
+    if (!IsBound())
+    {
+        Shader::Unbind();
+        glBindProgramPipeline(pipelineId);
+        activePipelineId = pipelineId;
+    }
+}
+
+/*
+ * Unbind
+ */
+void ProgramPipeline::Unbind()
+{
+    glBindProgramPipeline(0);
+    activePipelineId = 0;
+}
+
+/*
+ * Is bound
+ */
+bool ProgramPipeline::IsBound() const
+{
+    return activePipelineId == pipelineId;
+}
+
+/*
+ * Is supported
+ */
+bool ProgramPipeline::IsSupported()
+{
+    return GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects;
+}
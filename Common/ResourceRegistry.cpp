@@ -0,0 +1,494 @@
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+#include <ObjFile.h>
+#include "ResourceRegistry.h"
+#include "Texture2D.h"
+#include "TextureCube.h"
+#include "TextureUploader.h"
+#include "ThreadPool.h"
+
+/*
+ * Loaded resources by key
+ */
+std::map<std::string, std::weak_ptr<ResourceRegistry::Slot> > ResourceRegistry::slots;
+
+/*
+ * Textures still being decoded
+ */
+std::vector<std::shared_ptr<ResourceRegistry::PendingTexture> > ResourceRegistry::pending;
+
+/*
+ * Sharing statistics
+ */
+unsigned int ResourceRegistry::hits        = 0;
+unsigned int ResourceRegistry::misses      = 0;
+GLsizeiptr   ResourceRegistry::memorySaved = 0;
+
+/*
+ * Guards the decoded images of pending textures, which are written by the
+ * workers and read by the main thread
+ */
+static std::mutex decodeMutex;
+static std::condition_variable decodeDone;
+
+/*
+ * A texture whose image is being decoded on the thread pool
+ */
+struct ResourceRegistry::PendingTexture
+{
+    std::weak_ptr<TypedSlot<Texture2D> > slot; //!< Slot to fill, dropped if
+                                               //!< every handle is released
+    std::string filename;  //!< File being decoded
+    GLenum      minFilter; //!< Texture parameters
+    GLenum      magFilter;
+    GLenum      wrapS;
+    GLenum      wrapT;
+    float       aniso;
+    GLubyte*    pixels;    //!< Decoded image, allocated with malloc
+    int         width;     //!< Width of the image in pixels
+    int         height;    //!< Height of the image in pixels
+    GLenum      format;    //!< Format of the image
+    bool        decoded;   //!< Set by the worker once the image is ready
+};
+
+/*
+ * Slot constructor
+ */
+ResourceRegistry::Slot::Slot()
+    : state(LOADING),
+    memoryUsed(0),
+    hits(0)
+{
+}
+
+/*
+ * Slot destructor
+ */
+ResourceRegistry::Slot::~Slot()
+{
+}
+
+/*
+ * Load 2D texture
+ */
+ResourceRegistry::Handle<Texture2D> ResourceRegistry::LoadTexture2D(
+    const char* filename,
+    GLenum minFilter,
+    GLenum magFilter,
+    GLenum wrapS,
+    GLenum wrapT,
+    float  aniso,
+    bool   async)
+{
+    assert(filename);
+
+    std::ostringstream parameters;
+    parameters << minFilter << ',' << magFilter << ',' << wrapS << ',' << wrapT << ',' << aniso;
+    bool found;
+    std::string key = MakeKey("Texture2D", &filename, 1, parameters.str(), &found);
+
+    Handle<Texture2D> handle;
+    if (Find(key, handle))
+    {
+        return handle;
+    }
+    handle.slot = Insert<Texture2D>(key);
+
+    // A missing file is reported by the constructor, which falls back to
+    // the error texture, so there is nothing to decode in the background
+    if (!async || !found)
+    {
+        handle.slot->resource = new Texture2D(filename, minFilter, magFilter, wrapS, wrapT, aniso);
+        handle.slot->state = found ? READY : FAILED;
+        handle.slot->memoryUsed = GetResourceMemory(handle.slot->resource);
+        return handle;
+    }
+
+    // Decoded straight into a pixel buffer where possible, so creating the
+    // texture doesn't stall on the copy
+    if (TextureUploader::IsSupported())
+    {
+        std::weak_ptr<TypedSlot<Texture2D> > weakSlot = handle.slot;
+        TextureUploader::Load(filename, minFilter, magFilter, wrapS, wrapT, aniso,
+            [weakSlot](Texture2D* texture)
+        {
+            std::shared_ptr<TypedSlot<Texture2D> > slot = weakSlot.lock();
+            if (!slot)
+            {
+                delete texture;
+                return;
+            }
+            // Measured by Update, which also counts the hits made while loading
+            slot->resource = texture;
+            slot->state = READY;
+        });
+        return handle;
+    }
+
+    std::shared_ptr<PendingTexture> load = std::make_shared<PendingTexture>();
+    load->slot      = handle.slot;
+    load->filename  = filename;
+    load->minFilter = minFilter;
+    load->magFilter = magFilter;
+    load->wrapS     = wrapS;
+    load->wrapT     = wrapT;
+    load->aniso     = aniso;
+    load->pixels    = NULL;
+    load->width     = 0;
+    load->height    = 0;
+    load->format    = GL_NONE;
+    load->decoded   = false;
+    pending.push_back(load);
+
+    ThreadPool::GetShared().Submit([load]()
+    {
+        int width, height;
+        GLenum format;
+        GLubyte* pixels = Texture::LoadFile(load->filename.c_str(), &width, &height, &format);
+
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        load->pixels  = pixels;
+        load->width   = width;
+        load->height  = height;
+        load->format  = format;
+        load->decoded = true;
+        decodeDone.notify_all();
+    });
+    return handle;
+}
+
+/*
+ * Load cube texture
+ */
+ResourceRegistry::Handle<TextureCube> ResourceRegistry::LoadTextureCube(
+    const char* posXFilename,
+    const char* negXFilename,
+    const char* posYFilename,
+    const char* negYFilename,
+    const char* posZFilename,
+    const char* negZFilename,
+    GLenum minFilter,
+    GLenum magFilter,
+    GLenum wrapS,
+    GLenum wrapT,
+    GLenum wrapR,
+    float  aniso)
+{
+    const char* filenames[] =
+    {
+        posXFilename, negXFilename, posYFilename, negYFilename, posZFilename, negZFilename
+    };
+
+    std::ostringstream parameters;
+    parameters << minFilter << ',' << magFilter << ',' << wrapS << ',' << wrapT << ','
+        << wrapR << ',' << aniso;
+    bool found;
+    std::string key = MakeKey("TextureCube", filenames, 6, parameters.str(), &found);
+
+    Handle<TextureCube> handle;
+    if (Find(key, handle))
+    {
+        return handle;
+    }
+    handle.slot = Insert<TextureCube>(key);
+    handle.slot->resource = new TextureCube(
+        posXFilename, negXFilename, posYFilename, negYFilename, posZFilename, negZFilename,
+        minFilter, magFilter, wrapS, wrapT, wrapR, aniso);
+    handle.slot->state = found ? READY : FAILED;
+    handle.slot->memoryUsed = GetResourceMemory(handle.slot->resource);
+    return handle;
+}
+
+/*
+ * Load obj file
+ */
+ResourceRegistry::Handle<ObjFile> ResourceRegistry::LoadObjFile(const char* filename)
+{
+    assert(filename);
+
+    bool found;
+    std::string key = MakeKey("ObjFile", &filename, 1, "", &found);
+
+    Handle<ObjFile> handle;
+    if (Find(key, handle))
+    {
+        return handle;
+    }
+    handle.slot = Insert<ObjFile>(key);
+    handle.slot->resource = new ObjFile(filename);
+    handle.slot->state = found ? READY : FAILED;
+    handle.slot->memoryUsed = GetResourceMemory(handle.slot->resource);
+    return handle;
+}
+
+/*
+ * Load shader program
+ */
+ResourceRegistry::Handle<Shader> ResourceRegistry::LoadShader(
+    const char* vertexShaderPath,
+    const char* fragShaderPath,
+    const char* geoShaderPath)
+{
+    assert(vertexShaderPath && fragShaderPath);
+
+    const char* paths[] = { vertexShaderPath, fragShaderPath, geoShaderPath };
+    bool found;
+    std::string key = MakeKey("Shader", paths, geoShaderPath != NULL ? 3 : 2, "", &found);
+
+    Handle<Shader> handle;
+    if (Find(key, handle))
+    {
+        return handle;
+    }
+    handle.slot = Insert<Shader>(key);
+    handle.slot->resource = new Shader(vertexShaderPath, fragShaderPath, geoShaderPath);
+    handle.slot->state = found ? READY : FAILED;
+    return handle;
+}
+
+/*
+ * Load separable shader stage
+ */
+ResourceRegistry::Handle<Shader> ResourceRegistry::LoadShader(
+    GLenum stage,
+    const char* shaderPath,
+    const Shader::Defines& defines)
+{
+    assert(shaderPath);
+
+    std::ostringstream parameters;
+    parameters << stage;
+    for (size_t i = 0; i < defines.size(); i++)
+    {
+        parameters << ',' << defines[i];
+    }
+    bool found;
+    std::string key = MakeKey("ShaderStage", &shaderPath, 1, parameters.str(), &found);
+
+    Handle<Shader> handle;
+    if (Find(key, handle))
+    {
+        return handle;
+    }
+    handle.slot = Insert<Shader>(key);
+    handle.slot->resource = new Shader(stage, shaderPath, defines);
+    handle.slot->state = found ? READY : FAILED;
+    return handle;
+}
+
+/*
+ * Finish decoded textures
+ */
+size_t ResourceRegistry::Update()
+{
+    size_t uploading = TextureUploader::Update();
+
+    size_t i = 0;
+    while (i < pending.size())
+    {
+        bool decoded;
+        {
+            std::unique_lock<std::mutex> lock(decodeMutex);
+            decoded = pending[i]->decoded;
+        }
+
+        if (decoded)
+        {
+            FinishTexture(*pending[i]);
+            pending.erase(pending.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    // Drop the entries of resources whose last handle was released.  The
+    // rest are remeasured, since a lazy texture only reaches its full size
+    // once its image is swapped in, and every hit saved a copy of that size
+    std::map<std::string, std::weak_ptr<Slot> >::iterator it = slots.begin();
+    while (it != slots.end())
+    {
+        std::shared_ptr<Slot> slot = it->second.lock();
+        if (!slot)
+        {
+            slots.erase(it++);
+            continue;
+        }
+
+        GLsizeiptr memoryUsed = slot->MeasureMemory();
+        memorySaved += (memoryUsed - slot->memoryUsed) * slot->hits;
+        slot->memoryUsed = memoryUsed;
+        ++it;
+    }
+
+    return pending.size() + uploading;
+}
+
+/*
+ * Wait for all pending loads
+ */
+void ResourceRegistry::WaitAll()
+{
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        while (!pending[i]->decoded)
+        {
+            decodeDone.wait(lock);
+        }
+    }
+    TextureUploader::WaitAll();
+    Update();
+}
+
+/*
+ * Get canonical path
+ */
+std::string ResourceRegistry::GetCanonicalPath(const char* path)
+{
+    assert(path);
+
+#ifdef _WIN32
+    // _fullpath doesn't check that the file exists
+    if (FILE* file = fopen(path, "rb"))
+    {
+        fclose(file);
+    }
+    else
+    {
+        return std::string();
+    }
+
+    char buffer[_MAX_PATH];
+    if (_fullpath(buffer, path, _MAX_PATH) == NULL)
+    {
+        return std::string();
+    }
+
+    // Paths aren't case sensitive, so fold them to share a key
+    for (char* c = buffer; *c != '\0'; c++)
+    {
+        *c = *c == '/' ? '\\' : (char)tolower(*c);
+    }
+    return buffer;
+#else
+    char* resolved = realpath(path, NULL);
+    if (resolved == NULL)
+    {
+        return std::string();
+    }
+    std::string canonical = resolved;
+    free(resolved);
+    return canonical;
+#endif
+}
+
+/*
+ * Get number of loaded resources
+ */
+size_t ResourceRegistry::GetNumResources()
+{
+    size_t count = 0;
+    std::map<std::string, std::weak_ptr<Slot> >::const_iterator it;
+    for (it = slots.begin(); it != slots.end(); ++it)
+    {
+        if (!it->second.expired())
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Reset statistics
+ */
+void ResourceRegistry::ResetStats()
+{
+    hits        = 0;
+    misses      = 0;
+    memorySaved = 0;
+
+    std::map<std::string, std::weak_ptr<Slot> >::iterator it;
+    for (it = slots.begin(); it != slots.end(); ++it)
+    {
+        std::shared_ptr<Slot> slot = it->second.lock();
+        if (slot)
+        {
+            slot->hits = 0;
+        }
+    }
+}
+
+/*
+ * Make resource key
+ */
+std::string ResourceRegistry::MakeKey(
+    const char* type,
+    const char* const* paths,
+    int count,
+    const std::string& parameters,
+    bool* found)
+{
+    std::string key = type;
+    *found = true;
+    for (int i = 0; i < count; i++)
+    {
+        std::string canonical = GetCanonicalPath(paths[i]);
+        if (canonical.empty())
+        {
+            // Still keyed by its name, so the error is only reported once
+            *found = false;
+            canonical = paths[i];
+        }
+        key += '|';
+        key += canonical;
+    }
+    key += '|';
+    key += parameters;
+    return key;
+}
+
+/*
+ * Finish texture
+ */
+void ResourceRegistry::FinishTexture(PendingTexture& load)
+{
+    std::shared_ptr<TypedSlot<Texture2D> > slot = load.slot.lock();
+    if (slot)
+    {
+        slot->resource = new Texture2D(load.pixels, load.format, load.width, load.height,
+            load.minFilter, load.magFilter, load.wrapS, load.wrapT, load.aniso);
+        slot->state = READY;
+    }
+    free(load.pixels);
+    load.pixels = NULL;
+}
+
+/*
+ * Get texture memory
+ */
+GLsizeiptr ResourceRegistry::GetResourceMemory(const Texture* texture)
+{
+    return texture->GetMemoryUsed();
+}
+
+/*
+ * Get model memory
+ */
+GLsizeiptr ResourceRegistry::GetResourceMemory(const ObjFile* model)
+{
+    GLsizeiptr vertexSize = 0;
+    if (model->GetVertices() != NULL)   vertexSize += sizeof(vec3);
+    if (model->GetNormals() != NULL)    vertexSize += sizeof(vec3);
+    if (model->GetTexCoords() != NULL)  vertexSize += sizeof(vec2);
+    if (model->GetTangents() != NULL)   vertexSize += sizeof(vec3);
+
+    return vertexSize * model->GetNumVertices() +
+        sizeof(unsigned int) * model->GetNumIndices();
+}
@@ -1,6 +1,14 @@
 #include <cassert>
+#include <cstdlib>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <string>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 #include "Shader.h"
 
 /*
@@ -8,30 +16,323 @@
  */
 GLuint Shader::activeProgramId = 0;
 
+/*
+ * Uniform upload counters
+ */
+unsigned int Shader::uploadsIssued  = 0;
+unsigned int Shader::uploadsSkipped = 0;
+
+/*
+ * Uniform block names assigned to shared binding points
+ */
+std::map<std::string, GLuint> Shader::sharedBlockBindings;
+
+/*
+ * Program binary cache
+ */
+std::string Shader::cacheDirectory;
+Shader::ProgramCacheStats Shader::cacheStats;
+
+/*
+ * Asynchronous builds
+ */
+bool Shader::asyncCompile = false;
+
+/*
+ * Compiled shader stages shared between programs
+ */
+std::map<Shader::StageKey, Shader::StageEntry> Shader::compiledStages;
+
+/*
+ * Identifies program cache files, and the version of their layout
+ */
+static const GLuint programCacheMagic   = 0x43505347; // "GSPC"
+static const GLuint programCacheVersion = 1;
+
+/*
+ * Header at the start of each program cache file, followed by the binary
+ */
+struct ProgramCacheHeader
+{
+    GLuint             magic;   //!< Always programCacheMagic
+    GLuint             version; //!< Always programCacheVersion
+    unsigned long long key;     //!< Hash of the sources and driver strings
+    GLenum             format;  //!< Format of the binary, from glGetProgramBinary
+    GLint              length;  //!< Length of the binary in bytes
+};
+
+/*
+ * KHR_parallel_shader_compile isn't known to the bundled GLEW, so its
+ * tokens are defined here and its entry point is looked up by name
+ */
+#ifndef GL_KHR_parallel_shader_compile
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR           0x91B1
+typedef void (GLAPIENTRY * PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) (GLuint count);
+#endif
+
+/*
+ * Whether the driver supports parallel shader compiling, -1 until checked
+ */
+static int parallelCompileSupport = -1;
+
+/*
+ * A build submitted to the driver whose results haven't been checked
+ */
+struct Shader::PendingBuild
+{
+    int                numStages;    //!< Number of stages in the program
+    GLuint             shaderIds[3]; //!< OpenGL IDs of the stages
+    std::string        paths[3];     //!< Source file of each stage, for error messages
+    bool               cacheable;    //!< Whether to save the binary once linked
+    unsigned long long cacheKey;     //!< Cache key of the program
+};
+
+/*
+ * Adds bytes to a 64-bit FNV-1a hash
+ */
+static unsigned long long HashBytes(unsigned long long hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * Adds a string, including its terminator, to a hash.
+ * A NULL string is hashed as an empty one.
+ */
+static unsigned long long HashString(unsigned long long hash, const char* str)
+{
+    if (str == NULL)
+    {
+        str = "";
+    }
+    return HashBytes(hash, str, strlen(str) + 1);
+}
+
+/*
+ * Milliseconds elapsed since a point in time
+ */
+static double MillisecondsSince(const std::chrono::high_resolution_clock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count();
+}
+
 /*
  * Shader constructor
  */
 Shader::Shader(const char* vertexShaderPath,
                const char* fragShaderPath,
                const char* geoShaderPath)
-               : uniforms(),
-               attributes()
+               : vertexId(0),
+               fragId(0),
+               geoId(0),
+               programId(0),
+               separable(false),
+               stageBits(0),
+               pending(NULL),
+               uniforms(),
+               attributes(),
+               uniformBlocks(),
+               shadowValues()
+{
+    Build(vertexShaderPath, fragShaderPath, geoShaderPath, Defines());
+}
+
+/*
+ * Shader constructor with defines
+ */
+Shader::Shader(const char* vertexShaderPath,
+               const char* fragShaderPath,
+               const Defines& defines,
+               const char* geoShaderPath)
+               : vertexId(0),
+               fragId(0),
+               geoId(0),
+               programId(0),
+               separable(false),
+               stageBits(0),
+               pending(NULL),
+               uniforms(),
+               attributes(),
+               uniformBlocks(),
+               shadowValues()
+{
+    Build(vertexShaderPath, fragShaderPath, geoShaderPath, defines);
+}
+
+/*
+ * Separable shader stage constructor
+ */
+Shader::Shader(GLenum stage, const char* shaderPath, const Defines& defines)
+               : vertexId(0),
+               fragId(0),
+               geoId(0),
+               programId(0),
+               separable(true),
+               stageBits(0),
+               pending(NULL),
+               uniforms(),
+               attributes(),
+               uniformBlocks(),
+               shadowValues()
+{
+    assert(shaderPath);
+    assert(stage == GL_VERTEX_SHADER ||
+           stage == GL_FRAGMENT_SHADER ||
+           stage == GL_GEOMETRY_SHADER);
+
+    Build(&stage, &shaderPath, 1, defines);
+}
+
+/*
+ * Build
+ */
+void Shader::Build(const char* vertexShaderPath,
+                   const char* fragShaderPath,
+                   const char* geoShaderPath,
+                   const Defines& defines)
 {
     assert(vertexShaderPath && fragShaderPath);
 
-    // Compile the individual shaders, or load them if they have been previously
-    // compiled for other shader programs
-    vertexId  = CompileShader(GL_VERTEX_SHADER, vertexShaderPath);
-    fragId    = CompileShader(GL_FRAGMENT_SHADER, fragShaderPath);
-    geoId     = geoShaderPath ?
-                CompileShader(GL_GEOMETRY_SHADER, geoShaderPath) :
-                0;
-    
-    // Link the shader program
-    programId = LinkProgram(vertexId, fragId, geoId);
-
-    // If any of the above steps failed, programId will be 0.
-    // Otherwise, look up all the uniforms in the shader
+    GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+    const char* paths[] = { vertexShaderPath, fragShaderPath, geoShaderPath };
+    Build(stages, paths, geoShaderPath ? 3 : 2, defines);
+}
+
+/*
+ * Build stages
+ */
+void Shader::Build(const GLenum* stages,
+                   const char* const* paths,
+                   int numStages,
+                   const Defines& defines)
+{
+    // The cache keys below hash the preprocessed sources, so they cover
+    // included files and defines as well
+    std::string sources[3];
+    bool loaded = true;
+    for (int i = 0; i < numStages && loaded; i++)
+    {
+        loaded = PreprocessSource(paths[i], defines, sources[i]);
+    }
+
+    for (int i = 0; i < numStages; i++)
+    {
+        switch (stages[i])
+        {
+        case GL_VERTEX_SHADER:   stageBits |= GL_VERTEX_SHADER_BIT;   break;
+        case GL_FRAGMENT_SHADER: stageBits |= GL_FRAGMENT_SHADER_BIT; break;
+        case GL_GEOMETRY_SHADER: stageBits |= GL_GEOMETRY_SHADER_BIT; break;
+        }
+    }
+
+    // Use the program binary from a previous run if the sources and driver
+    // haven't changed
+    unsigned long long cacheKey = 0;
+    bool cacheable = loaded &&
+                     !cacheDirectory.empty() &&
+                     GetProgramCacheKey(stages, sources, numStages, separable, cacheKey);
+    if (cacheable)
+    {
+        std::chrono::high_resolution_clock::time_point start =
+            std::chrono::high_resolution_clock::now();
+        programId = LoadProgramBinary(cacheKey, separable);
+        cacheStats.loadMilliseconds += MillisecondsSince(start);
+    }
+
+    if (programId != 0)
+    {
+        cacheStats.hits++;
+        GetShaderInfo();
+    }
+    else if (loaded)
+    {
+        std::chrono::high_resolution_clock::time_point start =
+            std::chrono::high_resolution_clock::now();
+
+        pending = new PendingBuild();
+        pending->numStages = numStages;
+        pending->cacheable = cacheable;
+        pending->cacheKey  = cacheKey;
+
+        // Compile the individual shaders, or reuse them if they have been
+        // previously compiled for other shader programs
+        for (int i = 0; i < numStages; i++)
+        {
+            GLuint shaderId = AcquireShader(stages[i], paths[i], sources[i], defines);
+            pending->shaderIds[i] = shaderId;
+            pending->paths[i]     = paths[i];
+            switch (stages[i])
+            {
+            case GL_VERTEX_SHADER:   vertexId = shaderId; break;
+            case GL_FRAGMENT_SHADER: fragId   = shaderId; break;
+            case GL_GEOMETRY_SHADER: geoId    = shaderId; break;
+            }
+        }
+
+        // Link the shader program
+        programId = LinkProgram(pending->shaderIds, numStages, separable, cacheable);
+
+        cacheStats.compileMilliseconds += MillisecondsSince(start);
+        cacheStats.misses++;
+
+        // Checking the results waits for the driver, so asynchronous builds
+        // leave that until the program is needed
+        if (!asyncCompile)
+        {
+            FinishBuild();
+        }
+    }
+}
+
+/*
+ * Finish build
+ */
+void Shader::FinishBuild()
+{
+    if (pending == NULL)
+    {
+        return;
+    }
+
+    std::chrono::high_resolution_clock::time_point start =
+        std::chrono::high_resolution_clock::now();
+
+    // Report the errors of every stage before giving up on the program
+    bool compiled = true;
+    for (int i = 0; i < pending->numStages; i++)
+    {
+        compiled = CheckShader(pending->shaderIds[i], pending->paths[i].c_str()) && compiled;
+    }
+
+    bool linked = compiled && CheckProgram(programId);
+    cacheStats.compileMilliseconds += MillisecondsSince(start);
+
+    if (linked)
+    {
+        if (pending->cacheable)
+        {
+            SaveProgramBinary(programId, pending->cacheKey);
+        }
+    }
+    else
+    {
+        // 0 represents an empty program from a failed build
+        glDeleteProgram(programId);
+        programId = 0;
+    }
+
+    delete pending;
+    pending = NULL;
+
+    // Look up all the uniforms in the shader
     if (programId != 0)
     {
         GetShaderInfo();
@@ -48,6 +349,9 @@ Shader::~Shader()
         Unbind();
     }
 
+    // A build that was never finished doesn't need checking
+    delete pending;
+
     // Delete the shader program.
     // This will automatically detach any linked shaders,
     // but will not delete them.
@@ -56,17 +360,17 @@ Shader::~Shader()
         glDeleteProgram(programId);
     }
 
-    // Delete the individual shader programs
-    glDeleteShader(vertexId);
-    glDeleteShader(fragId);
-    if (geoId != 0)
-    {
-        glDeleteShader(geoId);
-    }
+    // Release the individual shaders, which are deleted once no other
+    // program uses them.  Programs loaded from the binary cache don't have any
+    ReleaseShader(vertexId);
+    ReleaseShader(fragId);
+    ReleaseShader(geoId);
 
     // Delete all info objects
     uniforms.clear();
     attributes.clear();
+    uniformBlocks.clear();
+    shadowValues.clear();
 }
 
 /*
@@ -74,6 +378,7 @@ Shader::~Shader()
  */
 void Shader::Bind()
 {
+    WaitUntilBuilt();
     if (!IsBound())
     {
         glUseProgram(programId);
@@ -111,6 +416,7 @@ GLint Shader::GetAttributeLocation(const char* name) const
  */
 GLint Shader::GetAttributeLocation(const std::string& name) const
 {
+    WaitUntilBuilt();
     if (attributes.count(name) != 0)
     {
         return attributes.at(name).location;
@@ -137,7 +443,7 @@ GLint Shader::GetAttributeLocation(const std::string& name) const
  */
 GLint Shader::GetUniformLocation(const char* name) const
 {
-    return GetUniformLocation(std::string(name));
+    return GetUniformHandle(std::string(name)).location;
 }
 
 /*
@@ -145,9 +451,31 @@ GLint Shader::GetUniformLocation(const char* name) const
  */
 GLint Shader::GetUniformLocation(const std::string& name) const
 {
-    if (uniforms.count(name) != 0)
+    return GetUniformHandle(name).location;
+}
+
+/*
+ * Get uniform handle c-string
+ */
+Shader::UniformHandle Shader::GetUniformHandle(const char* name) const
+{
+    return GetUniformHandle(std::string(name));
+}
+
+/*
+ * Get uniform handle string
+ */
+Shader::UniformHandle Shader::GetUniformHandle(const std::string& name) const
+{
+    WaitUntilBuilt();
+    UniformMap::const_iterator it = uniforms.find(name);
+    if (it != uniforms.end())
     {
-        return uniforms.at(name).location;
+        return UniformHandle(
+            it->second.location,
+            it->second.type,
+            it->second.shadowOffset,
+            it->second.shadowSize);
     }
     else
     {
@@ -164,7 +492,7 @@ GLint Shader::GetUniformLocation(const std::string& name) const
 
         // Add the uniform to our map to prevent duplicate warnings
         uniforms[name] = UniformInfo(0, 0, location);
-        return location;
+        return UniformHandle(location, 0);
     }
 }
 
@@ -173,11 +501,7 @@ GLint Shader::GetUniformLocation(const std::string& name) const
  */
 void Shader::SetUniform(const char* name, float v0)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform1f(GetUniformLocation(name), v0);
-    }
+    SetUniform(GetUniformHandle(name), v0);
 }
 
 /*
@@ -185,11 +509,7 @@ void Shader::SetUniform(const char* name, float v0)
  */
 void Shader::SetUniform(const char* name, float v0, float v1)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform2f(GetUniformLocation(name), v0, v1);
-    }
+    SetUniform(GetUniformHandle(name), v0, v1);
 }
 
 /*
@@ -197,11 +517,7 @@ void Shader::SetUniform(const char* name, float v0, float v1)
  */
 void Shader::SetUniform(const char* name, float v0, float v1, float v2)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform3f(GetUniformLocation(name), v0, v1, v2);
-    }
+    SetUniform(GetUniformHandle(name), v0, v1, v2);
 }
 
 /*
@@ -209,11 +525,7 @@ void Shader::SetUniform(const char* name, float v0, float v1, float v2)
  */
 void Shader::SetUniform(const char* name, float v0, float v1, float v2, float v3)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform4f(GetUniformLocation(name), v0, v1, v2, v3);
-    }
+    SetUniform(GetUniformHandle(name), v0, v1, v2, v3);
 }
 
 /*
@@ -221,11 +533,7 @@ void Shader::SetUniform(const char* name, float v0, float v1, float v2, float v3
  */
 void Shader::SetUniform(const char* name, int v0)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform1i(GetUniformLocation(name), v0);
-    }
+    SetUniform(GetUniformHandle(name), v0);
 }
 
 /*
@@ -233,11 +541,7 @@ void Shader::SetUniform(const char* name, int v0)
  */
 void Shader::SetUniform(const char* name, int v0, int v1)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform2i(GetUniformLocation(name), v0, v1);
-    }
+    SetUniform(GetUniformHandle(name), v0, v1);
 }
 
 /*
@@ -245,11 +549,7 @@ void Shader::SetUniform(const char* name, int v0, int v1)
  */
 void Shader::SetUniform(const char* name, int v0, int v1, int v2)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform3i(GetUniformLocation(name), v0, v1, v2);
-    }
+    SetUniform(GetUniformHandle(name), v0, v1, v2);
 }
 
 /*
@@ -257,11 +557,7 @@ void Shader::SetUniform(const char* name, int v0, int v1, int v2)
  */
 void Shader::SetUniform(const char* name, int v0, int v1, int v2, int v3)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform4i(GetUniformLocation(name), v0, v1, v2, v3);
-    }
+    SetUniform(GetUniformHandle(name), v0, v1, v2, v3);
 }
 
 /*
@@ -269,11 +565,7 @@ void Shader::SetUniform(const char* name, int v0, int v1, int v2, int v3)
  */
 void Shader::SetUniform(const char* name, const vec2& vec2)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform2f(GetUniformLocation(name), vec2[0], vec2[1]);
-    }
+    SetUniform(GetUniformHandle(name), vec2);
 }
 
 /*
@@ -281,11 +573,7 @@ void Shader::SetUniform(const char* name, const vec2& vec2)
  */
 void Shader::SetUniform(const char* name, const vec3& vec3)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform3f(GetUniformLocation(name), vec3[0], vec3[1], vec3[2]);
-    }
+    SetUniform(GetUniformHandle(name), vec3);
 }
 
 /*
@@ -293,11 +581,7 @@ void Shader::SetUniform(const char* name, const vec3& vec3)
  */
 void Shader::SetUniform(const char* name, const vec4& vec4)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniform4f(GetUniformLocation(name), vec4[0], vec4[1], vec4[2], vec4[3]);
-    }
+    SetUniform(GetUniformHandle(name), vec4);
 }
 
 /*
@@ -305,11 +589,7 @@ void Shader::SetUniform(const char* name, const vec4& vec4)
  */
 void Shader::SetUniform(const char* name, const mat2& matrix)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniformMatrix2fv(GetUniformLocation(name), 1, GL_TRUE, matrix);
-    }
+    SetUniform(GetUniformHandle(name), matrix);
 }
 
 /*
@@ -317,11 +597,7 @@ void Shader::SetUniform(const char* name, const mat2& matrix)
  */
 void Shader::SetUniform(const char* name, const mat3& matrix)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniformMatrix3fv(GetUniformLocation(name), 1, GL_TRUE, matrix);
-    }
+    SetUniform(GetUniformHandle(name), matrix);
 }
 
 /*
@@ -329,125 +605,904 @@ void Shader::SetUniform(const char* name, const mat3& matrix)
  */
 void Shader::SetUniform(const char* name, const mat4& matrix)
 {
-    assert(IsBound());
-    if (programId != 0)
-    {
-        glUniformMatrix4fv(GetUniformLocation(name), 1, GL_TRUE, matrix);
-    }
+    SetUniform(GetUniformHandle(name), matrix);
 }
 
 /*
- * Get parameter info for the shader
+ * Set uniform 1f by handle
  */
-void Shader::GetShaderInfo()
+void Shader::SetUniform(const UniformHandle& handle, float v0)
 {
-    GLint numUniforms;
-    glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &numUniforms);
-
-    GLint maxUniformNameLength;
-    glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxUniformNameLength);
-
-    // Read all the active uniforms
-    for (int i = 0; i < numUniforms; i++)
+    assert(separable || IsBound());
+    GLfloat value[] = { v0 };
+    if (programId != 0 && UniformChanged(handle, value, sizeof(value)))
     {
-        char* name = new char[maxUniformNameLength];
-        GLenum type;
-        GLint size;
-        glGetActiveUniform(
-            programId,
-            i,
-            maxUniformNameLength,
-            NULL,
-            &size,
-            &type,
-            name);
-
-        // Look up the location of the uniform
-        GLuint location = glGetUniformLocation(programId, name);
-
-        // Copy the name to a string object
-        std::string str(name);
-        str.shrink_to_fit();
-        delete[] name;
-        
-        // Add to the uniforms array
-        uniforms[str] = UniformInfo(size, type, location);
+        if (separable)
+        {
+            glProgramUniform1f(programId, handle.location, v0);
+        }
+        else
+        {
+            glUniform1f(handle.location, v0);
+        }
     }
+}
 
-    GLint numAttributes;
-    glGetProgramiv(programId, GL_ACTIVE_ATTRIBUTES, &numAttributes);
-
-    GLint maxAttributeNameLength;
-    glGetProgramiv(programId, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxAttributeNameLength);
-
-    // Read all the active attributes
-    for (int i = 0; i < numAttributes; i++)
+/*
+ * Set uniform 2f by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, float v0, float v1)
+{
+    assert(separable || IsBound());
+    GLfloat value[] = { v0, v1 };
+    if (programId != 0 && UniformChanged(handle, value, sizeof(value)))
     {
-        char* name = new char[maxAttributeNameLength];
-        GLenum type;
-        GLint size;
-        glGetActiveAttrib(
-            programId,
-            i,
-            maxAttributeNameLength,
-            NULL,
-            &size,
-            &type,
-            name);
-
-        // Look up the location of the attribute
-        GLuint location = glGetAttribLocation(programId, name);
-
-        // Copy the name to a string object
-        std::string str(name);
-        str.shrink_to_fit();
-        delete[] name;
-
-        attributes[str] = AttributeInfo(size, type, location);
+        if (separable)
+        {
+            glProgramUniform2f(programId, handle.location, v0, v1);
+        }
+        else
+        {
+            glUniform2f(handle.location, v0, v1);
+        }
     }
 }
 
 /*
- * Compile shader
+ * Set uniform 3f by handle
  */
-GLuint Shader::CompileShader(GLenum shaderType, const char* srcPath) 
+void Shader::SetUniform(const UniformHandle& handle, float v0, float v1, float v2)
 {
-    // Load the shader source file to memory
-    FILE* file = fopen(srcPath, "rb");
-    if (file == NULL)
+    assert(separable || IsBound());
+    GLfloat value[] = { v0, v1, v2 };
+    if (programId != 0 && UniformChanged(handle, value, sizeof(value)))
+    {
+        if (separable)
+        {
+            glProgramUniform3f(programId, handle.location, v0, v1, v2);
+        }
+        else
+        {
+            glUniform3f(handle.location, v0, v1, v2);
+        }
+    }
+}
+
+/*
+ * Set uniform 4f by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, float v0, float v1, float v2, float v3)
+{
+    assert(separable || IsBound());
+    GLfloat value[] = { v0, v1, v2, v3 };
+    if (programId != 0 && UniformChanged(handle, value, sizeof(value)))
+    {
+        if (separable)
+        {
+            glProgramUniform4f(programId, handle.location, v0, v1, v2, v3);
+        }
+        else
+        {
+            glUniform4f(handle.location, v0, v1, v2, v3);
+        }
+    }
+}
+
+/*
+ * Set uniform 1i by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, int v0)
+{
+    assert(separable || IsBound());
+    GLint value[] = { v0 };
+    if (programId != 0 && UniformChanged(handle, value, sizeof(value)))
+    {
+        if (separable)
+        {
+            glProgramUniform1i(programId, handle.location, v0);
+        }
+        else
+        {
+            glUniform1i(handle.location, v0);
+        }
+    }
+}
+
+/*
+ * Set uniform 2i by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, int v0, int v1)
+{
+    assert(separable || IsBound());
+    GLint value[] = { v0, v1 };
+    if (programId != 0 && UniformChanged(handle, value, sizeof(value)))
+    {
+        if (separable)
+        {
+            glProgramUniform2i(programId, handle.location, v0, v1);
+        }
+        else
+        {
+            glUniform2i(handle.location, v0, v1);
+        }
+    }
+}
+
+/*
+ * Set uniform 3i by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, int v0, int v1, int v2)
+{
+    assert(separable || IsBound());
+    GLint value[] = { v0, v1, v2 };
+    if (programId != 0 && UniformChanged(handle, value, sizeof(value)))
+    {
+        if (separable)
+        {
+            glProgramUniform3i(programId, handle.location, v0, v1, v2);
+        }
+        else
+        {
+            glUniform3i(handle.location, v0, v1, v2);
+        }
+    }
+}
+
+/*
+ * Set uniform 4i by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, int v0, int v1, int v2, int v3)
+{
+    assert(separable || IsBound());
+    GLint value[] = { v0, v1, v2, v3 };
+    if (programId != 0 && UniformChanged(handle, value, sizeof(value)))
+    {
+        if (separable)
+        {
+            glProgramUniform4i(programId, handle.location, v0, v1, v2, v3);
+        }
+        else
+        {
+            glUniform4i(handle.location, v0, v1, v2, v3);
+        }
+    }
+}
+
+/*
+ * Set uniform vec2 by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, const vec2& vec2)
+{
+    assert(separable || IsBound());
+    if (programId != 0 && UniformChanged(handle, (const GLfloat*)vec2, sizeof(vec2)))
+    {
+        if (separable)
+        {
+            glProgramUniform2f(programId, handle.location, vec2[0], vec2[1]);
+        }
+        else
+        {
+            glUniform2f(handle.location, vec2[0], vec2[1]);
+        }
+    }
+}
+
+/*
+ * Set uniform vec3 by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, const vec3& vec3)
+{
+    assert(separable || IsBound());
+    if (programId != 0 && UniformChanged(handle, (const GLfloat*)vec3, sizeof(vec3)))
+    {
+        if (separable)
+        {
+            glProgramUniform3f(programId, handle.location, vec3[0], vec3[1], vec3[2]);
+        }
+        else
+        {
+            glUniform3f(handle.location, vec3[0], vec3[1], vec3[2]);
+        }
+    }
+}
+
+/*
+ * Set uniform vec4 by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, const vec4& vec4)
+{
+    assert(separable || IsBound());
+    if (programId != 0 && UniformChanged(handle, (const GLfloat*)vec4, sizeof(vec4)))
+    {
+        if (separable)
+        {
+            glProgramUniform4f(programId, handle.location, vec4[0], vec4[1], vec4[2], vec4[3]);
+        }
+        else
+        {
+            glUniform4f(handle.location, vec4[0], vec4[1], vec4[2], vec4[3]);
+        }
+    }
+}
+
+/*
+ * Set uniform mat2 by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, const mat2& matrix)
+{
+    assert(separable || IsBound());
+    if (programId != 0 && UniformChanged(handle, (const GLfloat*)matrix, sizeof(mat2)))
+    {
+        if (separable)
+        {
+            glProgramUniformMatrix2fv(programId, handle.location, 1, GL_TRUE, matrix);
+        }
+        else
+        {
+            glUniformMatrix2fv(handle.location, 1, GL_TRUE, matrix);
+        }
+    }
+}
+
+/*
+ * Set uniform mat3 by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, const mat3& matrix)
+{
+    assert(separable || IsBound());
+    if (programId != 0 && UniformChanged(handle, (const GLfloat*)matrix, sizeof(mat3)))
+    {
+        if (separable)
+        {
+            glProgramUniformMatrix3fv(programId, handle.location, 1, GL_TRUE, matrix);
+        }
+        else
+        {
+            glUniformMatrix3fv(handle.location, 1, GL_TRUE, matrix);
+        }
+    }
+}
+
+/*
+ * Set uniform mat4 by handle
+ */
+void Shader::SetUniform(const UniformHandle& handle, const mat4& matrix)
+{
+    assert(separable || IsBound());
+    if (programId != 0 && UniformChanged(handle, (const GLfloat*)matrix, sizeof(mat4)))
+    {
+        if (separable)
+        {
+            glProgramUniformMatrix4fv(programId, handle.location, 1, GL_TRUE, matrix);
+        }
+        else
+        {
+            glUniformMatrix4fv(handle.location, 1, GL_TRUE, matrix);
+        }
+    }
+}
+
+/*
+ * Set shared uniform block binding
+ */
+void Shader::SetUniformBlockBinding(const char* blockName, GLuint binding)
+{
+    assert(blockName);
+    sharedBlockBindings[std::string(blockName)] = binding;
+}
+
+/*
+ * Bind uniform block
+ */
+void Shader::BindUniformBlock(const char* blockName, GLuint binding)
+{
+    WaitUntilBuilt();
+    UniformBlockMap::iterator it = uniformBlocks.find(std::string(blockName));
+    if (it == uniformBlocks.end())
+    {
+        std::cerr << "Uniform block " << blockName <<
+            " is not referenced in the shaders" << std::endl;
+        return;
+    }
+
+    glUniformBlockBinding(programId, it->second.index, binding);
+    it->second.binding = binding;
+}
+
+/*
+ * Get uniform block size
+ */
+GLint Shader::GetUniformBlockSize(const char* blockName) const
+{
+    WaitUntilBuilt();
+    UniformBlockMap::const_iterator it = uniformBlocks.find(std::string(blockName));
+    return it != uniformBlocks.end() ? it->second.dataSize : 0;
+}
+
+/*
+ * Get uniform block binding
+ */
+GLint Shader::GetUniformBlockBinding(const char* blockName) const
+{
+    WaitUntilBuilt();
+    UniformBlockMap::const_iterator it = uniformBlocks.find(std::string(blockName));
+    return it != uniformBlocks.end() ? (GLint)it->second.binding : -1;
+}
+
+/*
+ * Get uniform block offset
+ */
+GLint Shader::GetUniformBlockOffset(const char* name) const
+{
+    WaitUntilBuilt();
+    GLuint index = GL_INVALID_INDEX;
+    glGetUniformIndices(programId, 1, &name, &index);
+    if (index == GL_INVALID_INDEX)
+    {
+        return -1;
+    }
+
+    GLint offset = -1;
+    glGetActiveUniformsiv(programId, 1, &index, GL_UNIFORM_OFFSET, &offset);
+    return offset;
+}
+
+/*
+ * Invalidate uniform values
+ */
+void Shader::InvalidateUniformValues()
+{
+    for (UniformMap::const_iterator it = uniforms.begin();
+         it != uniforms.end();
+         it++)
+    {
+        if (it->second.shadowOffset >= 0)
+        {
+            shadowValues[it->second.shadowOffset] = 0;
+        }
+    }
+}
+
+/*
+ * Reset uniform counters
+ */
+void Shader::ResetUniformCounters()
+{
+    uploadsIssued  = 0;
+    uploadsSkipped = 0;
+}
+
+/*
+ * Set program cache directory
+ */
+void Shader::SetProgramCacheDirectory(const char* directory)
+{
+    cacheDirectory = directory ? directory : "";
+    if (cacheDirectory.empty())
+    {
+        return;
+    }
+
+    // Create the directory if needed.  If that fails, saving binaries will
+    // fail as well and the shaders are simply compiled every run
+#ifdef _WIN32
+    _mkdir(cacheDirectory.c_str());
+#else
+    mkdir(cacheDirectory.c_str(), 0755);
+#endif
+
+    char last = cacheDirectory[cacheDirectory.size() - 1];
+    if (last != '/' && last != '\\')
+    {
+        cacheDirectory += '/';
+    }
+}
+
+/*
+ * Reset program cache stats
+ */
+void Shader::ResetProgramCacheStats()
+{
+    cacheStats = ProgramCacheStats();
+}
+
+/*
+ * Set async compile
+ */
+void Shader::SetAsyncCompile(bool enable)
+{
+    asyncCompile = enable;
+    if (!enable || !IsParallelCompileSupported())
+    {
+        return;
+    }
+
+    // Let the driver pick how many compiler threads to use
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads =
+        (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glutGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    if (maxShaderCompilerThreads == NULL)
+    {
+        maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)
+            glutGetProcAddress("glMaxShaderCompilerThreadsARB");
+    }
+    if (maxShaderCompilerThreads != NULL)
+    {
+        maxShaderCompilerThreads(0xFFFFFFFF);
+    }
+}
+
+/*
+ * Is parallel compile supported
+ */
+bool Shader::IsParallelCompileSupported()
+{
+    if (parallelCompileSupport < 0)
+    {
+        parallelCompileSupport = 0;
+
+        GLint numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (GLint i = 0; i < numExtensions; i++)
+        {
+            const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (name != NULL &&
+                (strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+                 strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+            {
+                parallelCompileSupport = 1;
+                break;
+            }
+        }
+    }
+    return parallelCompileSupport == 1;
+}
+
+/*
+ * Is ready
+ */
+bool Shader::IsReady()
+{
+    if (pending == NULL)
+    {
+        return true;
+    }
+
+    // Querying anything but the completion status would wait for the driver
+    if (IsParallelCompileSupported())
+    {
+        GLint complete = GL_FALSE;
+        glGetProgramiv(programId, GL_COMPLETION_STATUS_KHR, &complete);
+        if (complete != GL_TRUE)
+        {
+            return false;
+        }
+    }
+
+    FinishBuild();
+    return true;
+}
+
+/*
+ * Uniform changed
+ */
+bool Shader::UniformChanged(const UniformHandle& handle, const void* value, GLsizei size)
+{
+    // Uniforms that don't exist never need uploading
+    if (handle.location == -1)
+    {
+        return false;
+    }
+
+    // Only shadow values that exactly match the uniform's type.
+    // Anything else goes straight to OpenGL, which will report any mismatch
+    if (handle.shadowOffset < 0 || handle.shadowSize != size)
+    {
+        uploadsIssued++;
+        return true;
+    }
+
+    assert(handle.shadowOffset + 4 + size <= (GLint)shadowValues.size());
+    GLubyte* slot = &shadowValues[handle.shadowOffset];
+
+    // The first byte flags whether the slot holds a value yet
+    if (slot[0] != 0 && memcmp(slot + 4, value, size) == 0)
+    {
+        uploadsSkipped++;
+        return false;
+    }
+
+    slot[0] = 1;
+    memcpy(slot + 4, value, size);
+    uploadsIssued++;
+    return true;
+}
+
+/*
+ * Uniform type size
+ */
+GLsizei Shader::UniformTypeSize(GLenum type)
+{
+    switch (type)
+    {
+    case GL_FLOAT:
+    case GL_INT:
+    case GL_BOOL:
+        return 4;
+    case GL_FLOAT_VEC2:
+    case GL_INT_VEC2:
+    case GL_BOOL_VEC2:
+        return 8;
+    case GL_FLOAT_VEC3:
+    case GL_INT_VEC3:
+    case GL_BOOL_VEC3:
+        return 12;
+    case GL_FLOAT_VEC4:
+    case GL_INT_VEC4:
+    case GL_BOOL_VEC4:
+    case GL_FLOAT_MAT2:
+        return 16;
+    case GL_FLOAT_MAT3:
+        return 36;
+    case GL_FLOAT_MAT4:
+        return 64;
+
+    case GL_SAMPLER_1D:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_3D:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_1D_SHADOW:
+    case GL_SAMPLER_2D_SHADOW:
+    case GL_SAMPLER_1D_ARRAY:
+    case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_CUBE_SHADOW:
+    case GL_SAMPLER_2D_ARRAY_SHADOW:
+    case GL_SAMPLER_BUFFER:
+        // Samplers are set with glUniform1i
+        return 4;
+
+    default:
+        // Unsigned, double and non-square matrix uniforms have no
+        // SetUniform overload, don't shadow them
+        return 0;
+    }
+}
+
+/*
+ * Get parameter info for the shader
+ */
+void Shader::GetShaderInfo()
+{
+    GLint numUniforms;
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &numUniforms);
+
+    GLint maxUniformNameLength;
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxUniformNameLength);
+
+    // Read all the active uniforms
+    for (int i = 0; i < numUniforms; i++)
+    {
+        char* name = new char[maxUniformNameLength];
+        GLenum type;
+        GLint size;
+        glGetActiveUniform(
+            programId,
+            i,
+            maxUniformNameLength,
+            NULL,
+            &size,
+            &type,
+            name);
+
+        // Look up the location of the uniform
+        GLuint location = glGetUniformLocation(programId, name);
+
+        // Copy the name to a string object
+        std::string str(name);
+        str.shrink_to_fit();
+        delete[] name;
+
+        // Reserve a slot for the last value set, if it can be shadowed.
+        // Only the first element of arrays is set by name, so one value
+        // is enough.  Uniform block members have no location
+        GLint   shadowOffset = -1;
+        GLsizei shadowSize   = UniformTypeSize(type);
+        if (shadowSize != 0 && (GLint)location != -1)
+        {
+            shadowOffset = (GLint)shadowValues.size();
+            shadowValues.resize(shadowValues.size() + 4 + shadowSize, 0);
+        }
+        
+        // Add to the uniforms array
+        uniforms[str] = UniformInfo(size, type, location, shadowOffset, shadowSize);
+    }
+
+    GLint numBlocks;
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORM_BLOCKS, &numBlocks);
+
+    GLint maxBlockNameLength;
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxBlockNameLength);
+
+    // Read all the active uniform blocks
+    for (int i = 0; i < numBlocks; i++)
+    {
+        char* name = new char[maxBlockNameLength];
+        glGetActiveUniformBlockName(
+            programId,
+            i,
+            maxBlockNameLength,
+            NULL,
+            name);
+
+        GLint dataSize;
+        glGetActiveUniformBlockiv(programId, i, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+
+        std::string str(name);
+        delete[] name;
+
+        // Connect the block to its shared binding point if one was assigned,
+        // otherwise keep the binding the program was linked with
+        GLint binding;
+        std::map<std::string, GLuint>::const_iterator shared =
+            sharedBlockBindings.find(str);
+        if (shared != sharedBlockBindings.end())
+        {
+            binding = (GLint)shared->second;
+            glUniformBlockBinding(programId, i, shared->second);
+        }
+        else
+        {
+            glGetActiveUniformBlockiv(programId, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+        }
+
+        uniformBlocks[str] = UniformBlockInfo(i, dataSize, (GLuint)binding);
+    }
+
+    GLint numAttributes;
+    glGetProgramiv(programId, GL_ACTIVE_ATTRIBUTES, &numAttributes);
+
+    GLint maxAttributeNameLength;
+    glGetProgramiv(programId, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxAttributeNameLength);
+
+    // Read all the active attributes
+    for (int i = 0; i < numAttributes; i++)
+    {
+        char* name = new char[maxAttributeNameLength];
+        GLenum type;
+        GLint size;
+        glGetActiveAttrib(
+            programId,
+            i,
+            maxAttributeNameLength,
+            NULL,
+            &size,
+            &type,
+            name);
+
+        // Look up the location of the attribute
+        GLuint location = glGetAttribLocation(programId, name);
+
+        // Copy the name to a string object
+        std::string str(name);
+        str.shrink_to_fit();
+        delete[] name;
+
+        attributes[str] = AttributeInfo(size, type, location);
+    }
+}
+
+/*
+ * Load source
+ */
+bool Shader::LoadSource(const char* srcPath, std::string& source)
+{
+    // Load the shader source file to memory
+    FILE* file = fopen(srcPath, "rb");
+    if (file == NULL)
     {
         std::cerr << "Couldn't open shader file " << srcPath << std::endl;
-        return 0;
+        return false;
     }
 
     fseek(file, 0, SEEK_END);
-    GLint size = (GLint)ftell(file);
+    long size = ftell(file);
     fseek(file, 0, SEEK_SET);
-    char* src = new char[size+1];
+    source.resize(size);
 
-    if (fread(src, size, 1, file) != 1)
+    if (size > 0 && fread(&source[0], size, 1, file) != 1)
     {
         std::cerr << "Error reading shader file " << srcPath << std::endl;
         fclose(file);
-        delete[] src;
-        return 0;
+        source.clear();
+        return false;
     }
     fclose(file);
 
-    src[size] = '\0';
+    return true;
+}
+
+/*
+ * Preprocess source
+ */
+bool Shader::PreprocessSource(const char* srcPath, const Defines& defines, std::string& source)
+{
+    source.clear();
+    std::vector<std::string> files;
+    int lineBias = 0;
+    if (!ExpandIncludes(srcPath, source, files, 0, lineBias))
+    {
+        source.clear();
+        return false;
+    }
+
+    if (defines.empty())
+    {
+        return true;
+    }
+
+    // Nothing but comments and whitespace may come before #version, so the
+    // defines go right after it.  Without a #version they go at the top
+    size_t insertAt = 0;
+    int    nextLine = 1;
+    size_t version  = source.find("#version");
+    if (version != std::string::npos)
+    {
+        size_t end = source.find('\n', version);
+        insertAt = end == std::string::npos ? source.size() : end + 1;
+        for (size_t i = 0; i < insertAt; i++)
+        {
+            if (source[i] == '\n')
+            {
+                nextLine++;
+            }
+        }
+    }
+
+    std::string block;
+    if (insertAt == source.size() && insertAt > 0 && source[insertAt - 1] != '\n')
+    {
+        block += '\n';
+    }
+    for (size_t i = 0; i < defines.size(); i++)
+    {
+        block += "#define " + defines[i] + "\n";
+    }
+    char line[32];
+    sprintf(line, "#line %d 0\n", nextLine + lineBias);
+    block += line;
+
+    source.insert(insertAt, block);
+    return true;
+}
+
+/*
+ * Expand includes
+ */
+bool Shader::ExpandIncludes(
+    const std::string& srcPath,
+    std::string& output,
+    std::vector<std::string>& files,
+    int depth,
+    int& lineBias)
+{
+    if (depth > 16)
+    {
+        std::cerr << "Shader includes nested too deeply at " << srcPath <<
+            ", is there an include cycle?" << std::endl;
+        return false;
+    }
+
+    std::string source;
+    if (!LoadSource(srcPath.c_str(), source))
+    {
+        return false;
+    }
+
+    int fileIndex = (int)files.size();
+    files.push_back(srcPath);
+
+    // Some editors save a UTF-8 byte order mark, which GLSL compilers reject
+    size_t pos = 0;
+    if (source.compare(0, 3, "\xEF\xBB\xBF") == 0)
+    {
+        pos = 3;
+    }
+
+    // Included paths are relative to the directory of this file
+    size_t slash = srcPath.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? "" : srcPath.substr(0, slash + 1);
+
+    int lineNumber = 1;
+    while (pos < source.size())
+    {
+        size_t end = source.find('\n', pos);
+        size_t next = end == std::string::npos ? source.size() : end + 1;
+
+        // Look for #include "file", allowing whitespace around the #
+        size_t start = source.find_first_not_of(" \t", pos);
+        bool isInclude = start != std::string::npos &&
+                         start < next &&
+                         source[start] == '#';
+        std::string includePath;
+        if (isInclude && depth == 0 && source.compare(start, 8, "#version") == 0)
+        {
+            lineBias = atoi(source.c_str() + start + 8) < 330 ? -1 : 0;
+            isInclude = false;
+        }
+        if (isInclude)
+        {
+            size_t keyword = source.find_first_not_of(" \t", start + 1);
+            isInclude = keyword < next && source.compare(keyword, 7, "include") == 0;
+            if (isInclude)
+            {
+                size_t open  = source.find_first_of("\"<", keyword + 7);
+                size_t close = open < next ? source.find_first_of("\">", open + 1) : std::string::npos;
+                if (close >= next)
+                {
+                    std::cerr << srcPath << "(" << lineNumber <<
+                        "): malformed #include" << std::endl;
+                    return false;
+                }
+                includePath = source.substr(open + 1, close - open - 1);
+            }
+        }
+
+        if (isInclude)
+        {
+            output += "// " + includePath + "\n";
+            char line[32];
+            sprintf(line, "#line %d %d\n", 1 + lineBias, (int)files.size());
+            output += line;
+
+            if (!ExpandIncludes(directory + includePath, output, files, depth + 1, lineBias))
+            {
+                std::cerr << "  included from " << srcPath << "(" << lineNumber <<
+                    ")" << std::endl;
+                return false;
+            }
+
+            if (output.empty() || output[output.size() - 1] != '\n')
+            {
+                output += '\n';
+            }
+            sprintf(line, "#line %d %d\n", lineNumber + 1 + lineBias, fileIndex);
+            output += line;
+        }
+        else
+        {
+            output.append(source, pos, next - pos);
+        }
+
+        pos = next;
+        lineNumber++;
+    }
+
+    return true;
+}
 
+/*
+ * Compile shader
+ */
+GLuint Shader::CompileShader(GLenum shaderType, const std::string& source)
+{
     // Create the shader
     GLuint shaderId = glCreateShader(shaderType);
 
     // Attach the source code to the shader
-    glShaderSource(shaderId, 1, (const GLchar**)&src, &size);
+    const GLchar* src = source.c_str();
+    GLint size = (GLint)source.size();
+    glShaderSource(shaderId, 1, &src, &size);
 
-    // The source code is copied to the shader, we no longer need the buffer
-    delete[] src;
-
-    // Compile the shader
+    // Compile the shader.  Any query about the shader would wait for the
+    // compile to finish, so the status is checked separately
     glCompileShader(shaderId);
+    return shaderId;
+}
 
+/*
+ * Check shader
+ */
+bool Shader::CheckShader(GLuint shaderId, const char* srcPath)
+{
     // Check for errors
     GLint compileStatus;
     glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
@@ -463,39 +1518,140 @@ GLuint Shader::CompileShader(GLenum shaderType, const char* srcPath)
 
         // Free used memory
         delete[] log;
-        glDeleteShader(shaderId);
-        return 0;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Stage key comparison
+ */
+bool Shader::StageKey::operator<(const StageKey& other) const
+{
+    if (stage != other.stage)
+    {
+        return stage < other.stage;
+    }
+    if (sourceHash != other.sourceHash)
+    {
+        return sourceHash < other.sourceHash;
+    }
+    if (path != other.path)
+    {
+        return path < other.path;
+    }
+    return defines < other.defines;
+}
+
+/*
+ * Acquire shader
+ */
+GLuint Shader::AcquireShader(
+    GLenum shaderType,
+    const char* srcPath,
+    const std::string& source,
+    const Defines& defines)
+{
+    StageKey key;
+    key.stage      = shaderType;
+    key.path       = srcPath;
+    key.sourceHash = HashBytes(0xcbf29ce484222325ULL, source.data(), source.size());
+    for (size_t i = 0; i < defines.size(); i++)
+    {
+        key.defines += defines[i];
+        key.defines += '\n';
     }
 
+    std::map<StageKey, StageEntry>::iterator it = compiledStages.find(key);
+    if (it != compiledStages.end())
+    {
+        it->second.refCount++;
+        cacheStats.stagesShared++;
+        return it->second.id;
+    }
+
+    // The stage is shared before its compile has finished, so failed
+    // stages are shared too and every program using one reports the errors
+    GLuint shaderId = CompileShader(shaderType, source);
+    cacheStats.stagesCompiled++;
+
+    StageEntry entry = { shaderId, 1 };
+    compiledStages[key] = entry;
     return shaderId;
 }
 
 /*
- * Link shader program
+ * Release shader
  */
-GLuint Shader::LinkProgram(GLuint vertexId, GLuint fragId, GLuint geoId)
+void Shader::ReleaseShader(GLuint shaderId)
 {
-    // Don't try to link if the vertex or fragment shader failed to compile
-    if (vertexId == 0 || fragId == 0)
+    if (shaderId == 0)
     {
-        // 0 represents an empty program from a failed link
-        return 0;
+        return;
+    }
+
+    for (std::map<StageKey, StageEntry>::iterator it = compiledStages.begin();
+         it != compiledStages.end();
+         it++)
+    {
+        if (it->second.id == shaderId)
+        {
+            if (--it->second.refCount == 0)
+            {
+                glDeleteShader(shaderId);
+                compiledStages.erase(it);
+            }
+            return;
+        }
     }
 
+    // Not shared, delete it right away
+    glDeleteShader(shaderId);
+}
+
+/*
+ * Link shader program
+ */
+GLuint Shader::LinkProgram(
+    const GLuint* shaderIds,
+    int numShaders,
+    bool separable,
+    bool retrievable)
+{
     // Create the shader program
     GLuint programId = glCreateProgram();
 
     // Attach the shaders
-    glAttachShader(programId, vertexId);
-    glAttachShader(programId, fragId);
-    if (geoId)
+    for (int i = 0; i < numShaders; i++)
+    {
+        glAttachShader(programId, shaderIds[i]);
+    }
+
+    // A separable program holds only some of the stages, and is combined
+    // with others in a program pipeline
+    if (separable)
     {
-        glAttachShader(programId, geoId);
+        glProgramParameteri(programId, GL_PROGRAM_SEPARABLE, GL_TRUE);
     }
 
-    // Link the shader program
+    // Ask the driver to keep the binary around if it will be cached
+    if (retrievable)
+    {
+        glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Link the shader program.  Like compiling, the driver may finish
+    // the link in the background
     glLinkProgram(programId);
+    return programId;
+}
 
+/*
+ * Check program
+ */
+bool Shader::CheckProgram(GLuint programId)
+{
     // Check for errors
     GLint linkStatus;
     glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
@@ -505,14 +1661,164 @@ GLuint Shader::LinkProgram(GLuint vertexId, GLuint fragId, GLuint geoId)
         GLint logLength;
         glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &logLength);
         char* log = new char[logLength];
-        glGetShaderInfoLog(programId, logLength, NULL, log);
+        glGetProgramInfoLog(programId, logLength, NULL, log);
         std::cerr<< "Link of shader program failed:" << std::endl;
         std::cerr << log << std::endl;
 
         // Free used memory
         delete[] log;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Get program cache key
+ */
+bool Shader::GetProgramCacheKey(
+    const GLenum* stages,
+    const std::string* sources,
+    int numSources,
+    bool separable,
+    unsigned long long& key)
+{
+    if (!GLEW_ARB_get_program_binary && !GLEW_VERSION_4_1)
+    {
+        return false;
+    }
+
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (numFormats == 0)
+    {
+        return false;
+    }
+
+    // A binary is only valid for the exact driver that produced it
+    key = 0xcbf29ce484222325ULL;
+    key = HashString(key, (const char*)glGetString(GL_VENDOR));
+    key = HashString(key, (const char*)glGetString(GL_RENDERER));
+    key = HashString(key, (const char*)glGetString(GL_VERSION));
+    key = HashString(key, (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
+    key = HashBytes(key, &separable, sizeof(separable));
+
+    for (int i = 0; i < numSources; i++)
+    {
+        GLuint length = (GLuint)sources[i].size();
+        key = HashBytes(key, &stages[i], sizeof(stages[i]));
+        key = HashBytes(key, &length, sizeof(length));
+        key = HashBytes(key, sources[i].data(), sources[i].size());
+    }
+
+    return true;
+}
+
+/*
+ * Get program cache file
+ */
+std::string Shader::GetProgramCacheFile(unsigned long long key)
+{
+    char name[32];
+    sprintf(name, "%016llx.bin", key);
+    return cacheDirectory + name;
+}
+
+/*
+ * Load program binary
+ */
+GLuint Shader::LoadProgramBinary(unsigned long long key, bool separable)
+{
+    FILE* file = fopen(GetProgramCacheFile(key).c_str(), "rb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    // The file name is derived from the key, but check the header anyway to
+    // reject files from an older layout or that were cut short
+    ProgramCacheHeader header;
+    std::vector<GLubyte> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                 header.magic == programCacheMagic &&
+                 header.version == programCacheVersion &&
+                 header.key == key &&
+                 header.length > 0;
+    if (valid)
+    {
+        binary.resize(header.length);
+        valid = fread(&binary[0], header.length, 1, file) == 1;
+    }
+    fclose(file);
+
+    if (!valid)
+    {
+        return 0;
+    }
+
+    // Separable must be set before loading for the binary to be usable in
+    // a program pipeline
+    GLuint programId = glCreateProgram();
+    if (separable)
+    {
+        glProgramParameteri(programId, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    }
+    glProgramBinary(programId, header.format, &binary[0], header.length);
+
+    // The driver may still reject a binary, in which case the caller
+    // compiles from source and overwrites the file
+    GLint linkStatus;
+    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
+    if (linkStatus != GL_TRUE)
+    {
         glDeleteProgram(programId);
         return 0;
     }
+
     return programId;
 }
+
+/*
+ * Save program binary
+ */
+void Shader::SaveProgramBinary(GLuint programId, unsigned long long key)
+{
+    GLint length = 0;
+    glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+    {
+        return;
+    }
+
+    ProgramCacheHeader header;
+    header.magic   = programCacheMagic;
+    header.version = programCacheVersion;
+    header.key     = key;
+    header.format  = 0;
+    header.length  = length;
+
+    std::vector<GLubyte> binary(length);
+    glGetProgramBinary(programId, length, &header.length, &header.format, &binary[0]);
+    if (header.length <= 0)
+    {
+        return;
+    }
+
+    std::string cacheFile = GetProgramCacheFile(key);
+    FILE* file = fopen(cacheFile.c_str(), "wb");
+    if (file == NULL)
+    {
+        std::cerr << "Couldn't write program cache file " << cacheFile << std::endl;
+        return;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(&binary[0], header.length, 1, file) == 1;
+    fclose(file);
+
+    // Don't leave a partial file behind for the next run to trip over
+    if (!written)
+    {
+        std::cerr << "Error writing program cache file " << cacheFile << std::endl;
+        remove(cacheFile.c_str());
+    }
+}
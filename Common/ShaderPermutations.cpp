@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cassert>
+#include "ShaderPermutations.h"
+
+/*
+ * Shader permutations constructor
+ */
+ShaderPermutations::ShaderPermutations(const char* vertexShaderPath,
+                                       const char* fragShaderPath,
+                                       const char* geoShaderPath)
+    : stage(0),
+    vertexPath(vertexShaderPath),
+    fragPath(fragShaderPath),
+    geoPath(geoShaderPath ? geoShaderPath : ""),
+    shaders(),
+    pending()
+{
+    assert(vertexShaderPath && fragShaderPath);
+}
+
+/*
+ * Separable shader permutations constructor
+ */
+ShaderPermutations::ShaderPermutations(GLenum stage, const char* shaderPath)
+    : stage(stage),
+    vertexPath(shaderPath),
+    fragPath(),
+    geoPath(),
+    shaders(),
+    pending()
+{
+    assert(shaderPath);
+}
+
+/*
+ * Destructor
+ */
+ShaderPermutations::~ShaderPermutations()
+{
+    for (std::map<std::string, Shader*>::iterator it = shaders.begin();
+         it != shaders.end();
+         it++)
+    {
+        delete it->second;
+    }
+    shaders.clear();
+}
+
+/*
+ * Get
+ */
+Shader* ShaderPermutations::Get(const Shader::Defines& defines)
+{
+    Shader::Defines sorted;
+    std::string key = MakeKey(defines, sorted);
+
+    std::map<std::string, Shader*>::iterator it = shaders.find(key);
+    if (it != shaders.end())
+    {
+        return it->second;
+    }
+
+    Shader* shader;
+    if (stage != 0)
+    {
+        shader = new Shader(stage, vertexPath.c_str(), sorted);
+    }
+    else
+    {
+        shader = new Shader(
+            vertexPath.c_str(),
+            fragPath.c_str(),
+            sorted,
+            geoPath.empty() ? NULL : geoPath.c_str());
+    }
+    shaders[key] = shader;
+    return shader;
+}
+
+/*
+ * Prefetch
+ */
+void ShaderPermutations::Prefetch(const Shader::Defines& defines)
+{
+    pending.push_back(defines);
+}
+
+/*
+ * Compile pending
+ */
+size_t ShaderPermutations::CompilePending(size_t maxShaders)
+{
+    for (size_t i = 0; i < maxShaders && !pending.empty(); i++)
+    {
+        Get(pending.front());
+        pending.pop_front();
+    }
+
+    // Polling doesn't block, so builds still running are left alone
+    size_t building = 0;
+    for (std::map<std::string, Shader*>::iterator it = shaders.begin();
+         it != shaders.end();
+         it++)
+    {
+        if (!it->second->IsReady())
+        {
+            building++;
+        }
+    }
+    return pending.size() + building;
+}
+
+/*
+ * Make key
+ */
+std::string ShaderPermutations::MakeKey(const Shader::Defines& defines, Shader::Defines& sorted)
+{
+    sorted = defines;
+    std::sort(sorted.begin(), sorted.end());
+
+    std::string key;
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        key += sorted[i];
+        key += '\n';
+    }
+    return key;
+}
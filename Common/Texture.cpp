@@ -1,7 +1,16 @@
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "HalfFloat.h"
 #include "stb_image.h"
 #include "Texture.h"
+#include "TgaDecoder.h"
+#include "ThreadPool.h"
 
 /*
  * Active texture ID for each unit
@@ -12,6 +21,42 @@ GLuint Texture::activeTextures[32] =
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+/*
+ * Sampler bound to each unit
+ */
+GLuint Texture::activeSamplers[32] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/*
+ * Texture unit selected with glActiveTexture, GL_TEXTURE0 initially
+ */
+int Texture::activeUnit = 0;
+
+/*
+ * Bind counters
+ */
+unsigned int Texture::bindsIssued = 0;
+unsigned int Texture::bindsElided = 0;
+
+/*
+ * Video memory used by all textures
+ */
+GLsizeiptr Texture::totalMemoryUsed = 0;
+
+/*
+ * Image loading statistics, updated from the decoding threads
+ */
+static std::atomic<unsigned long long> bytesLoaded(0);
+static std::atomic<unsigned long long> flipBytesSaved(0);
+
+/*
+ * Sampler objects shared between textures
+ */
+std::map<Texture::SamplerParams, Texture::SamplerEntry> Texture::samplers;
+
 /*
  * Look-up table of texture unit enum values
  */
@@ -56,12 +101,17 @@ const GLenum Texture::textureUnits[32] =
  */
 Texture::Texture(GLenum target)
     : target(target),
-    textureUnit(-1)
+    textureUnit(-1),
+    samplerId(0),
+    paramsApplied(false),
+    loadOnBind(false),
+    memoryUsed(0)
 {
     // We need to use a texture unit in the process of initializing the texture.
     // If there was a texture already bound to 0, it will be unbound
     activeTextures[0] = 0;
     glActiveTexture(textureUnits[0]);
+    activeUnit = 0;
 
     // Create and bind the texture object
     glGenTextures(1, &textureId);
@@ -75,8 +125,21 @@ Texture::Texture(GLenum target)
  */
 Texture::~Texture()
 {
+    // Deleting the texture unbinds it from every unit, and its ID may be
+    // reused by a new texture
+    for (int i = 0; i < 32; i++)
+    {
+        if (activeTextures[i] == textureId)
+        {
+            activeTextures[i] = 0;
+        }
+    }
+
     // Delete the texture object
     glDeleteTextures(1, &textureId);
+    totalMemoryUsed -= memoryUsed;
+
+    ReleaseSampler(samplerId);
 }
 
 /*
@@ -93,18 +156,306 @@ bool Texture::IsBound() const
  */
 void Texture::Bind(int textureUnit)
 {
-    // Set the texture unit active
-    glActiveTexture(textureUnits[textureUnit]);
+    assert(textureUnit >= 0 && textureUnit < 32);
 
-    // Attach our texture object
-    glBindTexture(target, textureId);
+    // Callers such as the upload helpers go on to change the texture
+    // through the active unit, so it is selected even when the bind is
+    // skipped
+    this->textureUnit = textureUnit;
+    if (activeUnit != textureUnit)
+    {
+        glActiveTexture(textureUnits[textureUnit]);
+        activeUnit = textureUnit;
+    }
 
-    // Set the texture parameters on the current texture unit
-    SetTextureParams();
+    // Nothing else to do if the unit already holds the texture and its
+    // sampler
+    if (paramsApplied &&
+        activeTextures[textureUnit] == textureId &&
+        activeSamplers[textureUnit] == samplerId)
+    {
+        bindsElided++;
+    }
+    else
+    {
+        // Attach our texture object
+        glBindTexture(target, textureId);
+        Texture::activeTextures[textureUnit] = textureId;
 
-    // Keep track of where we are bound to help with debugging
-    this->textureUnit = textureUnit;
-    Texture::activeTextures[textureUnit] = textureId;
+        // The parameters come from the derived class, so they can't be looked
+        // up in the constructor
+        if (!paramsApplied)
+        {
+            SamplerParams params;
+            GetSamplerParams(params);
+            if (AreSamplersSupported())
+            {
+                samplerId = AcquireSampler(params);
+            }
+            else
+            {
+                // Parameters set on the texture object stick with it,
+                // so they only need setting once
+                ApplyTextureParams(params);
+            }
+            paramsApplied = true;
+        }
+
+        if (activeSamplers[textureUnit] != samplerId)
+        {
+            glBindSampler(textureUnit, samplerId);
+            Texture::activeSamplers[textureUnit] = samplerId;
+        }
+
+        bindsIssued++;
+    }
+
+    // Textures loading in the background start the load, or swap in the
+    // finished image through the unit they were just bound to, so no other
+    // unit is disturbed
+    if (loadOnBind)
+    {
+        LoadOnBind();
+    }
+}
+
+/*
+ * Load on bind
+ */
+void Texture::LoadOnBind()
+{
+    // Only textures that load in the background have anything to do
+}
+
+/*
+ * Reset bind counters
+ */
+void Texture::ResetBindCounters()
+{
+    bindsIssued = 0;
+    bindsElided = 0;
+}
+
+/*
+ * Measure memory used
+ */
+void Texture::MeasureMemoryUsed()
+{
+    // Every face of a cube map has the same size
+    GLenum levelTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+    GLsizeiptr faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+
+    // Levels finer than the base level may have been released, so the size
+    // of the full chain is worked out from the base level.  Only ask about
+    // levels that can exist, to avoid GL_INVALID_VALUE
+    GLint baseLevel = 0;
+    glGetTexParameteriv(target, GL_TEXTURE_BASE_LEVEL, &baseLevel);
+    GLint width = 0, height = 1, depth = 1;
+    glGetTexLevelParameteriv(levelTarget, baseLevel, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(levelTarget, baseLevel, GL_TEXTURE_HEIGHT, &height);
+    glGetTexLevelParameteriv(levelTarget, baseLevel, GL_TEXTURE_DEPTH, &depth);
+    GLint largest = width > height ? width : height;
+    largest = (largest > depth ? largest : depth) << baseLevel;
+
+    GLsizeiptr bytes = 0;
+    for (GLint level = 0; largest >> level > 0; level++)
+    {
+        // Released levels have no image
+        GLint levelWidth = 0;
+        glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_WIDTH, &levelWidth);
+        if (levelWidth == 0)
+        {
+            if (level < baseLevel)
+            {
+                continue;
+            }
+            break;
+        }
+
+        GLint compressed = GL_FALSE;
+        glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_COMPRESSED, &compressed);
+        if (compressed)
+        {
+            GLint size = 0;
+            glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            bytes += size;
+        }
+        else
+        {
+            // Add up the bits of each component the driver stores
+            static const GLenum components[] =
+            {
+                GL_TEXTURE_RED_SIZE,
+                GL_TEXTURE_GREEN_SIZE,
+                GL_TEXTURE_BLUE_SIZE,
+                GL_TEXTURE_ALPHA_SIZE,
+                GL_TEXTURE_DEPTH_SIZE,
+                GL_TEXTURE_STENCIL_SIZE
+            };
+            GLint bits = 0;
+            for (int i = 0; i < 6; i++)
+            {
+                GLint size = 0;
+                glGetTexLevelParameteriv(levelTarget, level, components[i], &size);
+                bits += size;
+            }
+
+            GLint levelHeight = 1, levelDepth = 1;
+            glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_HEIGHT, &levelHeight);
+            glGetTexLevelParameteriv(levelTarget, level, GL_TEXTURE_DEPTH, &levelDepth);
+            bytes += (GLsizeiptr)levelWidth * levelHeight * levelDepth * bits / 8;
+        }
+    }
+    bytes *= faces;
+
+    totalMemoryUsed += bytes - memoryUsed;
+    memoryUsed = bytes;
+}
+
+/*
+ * Sampler params constructor
+ */
+Texture::SamplerParams::SamplerParams()
+    : minFilter(GL_LINEAR),
+    magFilter(GL_LINEAR),
+    wrapS(GL_REPEAT),
+    wrapT(GL_REPEAT),
+    wrapR(GL_REPEAT),
+    aniso(1.0f),
+    compareMode(GL_NONE),
+    compareFunc(GL_LEQUAL)
+{
+}
+
+/*
+ * Sampler params comparison
+ */
+bool Texture::SamplerParams::operator<(const SamplerParams& other) const
+{
+    if (minFilter != other.minFilter)
+    {
+        return minFilter < other.minFilter;
+    }
+    if (magFilter != other.magFilter)
+    {
+        return magFilter < other.magFilter;
+    }
+    if (wrapS != other.wrapS)
+    {
+        return wrapS < other.wrapS;
+    }
+    if (wrapT != other.wrapT)
+    {
+        return wrapT < other.wrapT;
+    }
+    if (wrapR != other.wrapR)
+    {
+        return wrapR < other.wrapR;
+    }
+    if (aniso != other.aniso)
+    {
+        return aniso < other.aniso;
+    }
+    if (compareMode != other.compareMode)
+    {
+        return compareMode < other.compareMode;
+    }
+    return compareFunc < other.compareFunc;
+}
+
+/*
+ * Are samplers supported
+ */
+bool Texture::AreSamplersSupported()
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_sampler_objects;
+}
+
+/*
+ * Acquire sampler
+ */
+GLuint Texture::AcquireSampler(const SamplerParams& params)
+{
+    std::map<SamplerParams, SamplerEntry>::iterator it = samplers.find(params);
+    if (it != samplers.end())
+    {
+        it->second.refCount++;
+        return it->second.id;
+    }
+
+    GLuint samplerId;
+    glGenSamplers(1, &samplerId);
+    glSamplerParameteri(samplerId, GL_TEXTURE_MIN_FILTER, params.minFilter);
+    glSamplerParameteri(samplerId, GL_TEXTURE_MAG_FILTER, params.magFilter);
+    glSamplerParameteri(samplerId, GL_TEXTURE_WRAP_S, params.wrapS);
+    glSamplerParameteri(samplerId, GL_TEXTURE_WRAP_T, params.wrapT);
+    glSamplerParameteri(samplerId, GL_TEXTURE_WRAP_R, params.wrapR);
+    glSamplerParameteri(samplerId, GL_TEXTURE_COMPARE_MODE, params.compareMode);
+    glSamplerParameteri(samplerId, GL_TEXTURE_COMPARE_FUNC, params.compareFunc);
+
+    // Set aniso level if enabled
+    if (params.aniso > 1.0f)
+    {
+        glSamplerParameterf(samplerId, GL_TEXTURE_MAX_ANISOTROPY_EXT, params.aniso);
+    }
+
+    SamplerEntry entry = { samplerId, 1 };
+    samplers[params] = entry;
+    return samplerId;
+}
+
+/*
+ * Release sampler
+ */
+void Texture::ReleaseSampler(GLuint samplerId)
+{
+    if (samplerId == 0)
+    {
+        return;
+    }
+
+    for (std::map<SamplerParams, SamplerEntry>::iterator it = samplers.begin();
+         it != samplers.end();
+         it++)
+    {
+        if (it->second.id == samplerId)
+        {
+            if (--it->second.refCount == 0)
+            {
+                // Deleting the sampler unbinds it from every unit
+                glDeleteSamplers(1, &samplerId);
+                samplers.erase(it);
+                for (int i = 0; i < 32; i++)
+                {
+                    if (activeSamplers[i] == samplerId)
+                    {
+                        activeSamplers[i] = 0;
+                    }
+                }
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Apply texture parameters
+ */
+void Texture::ApplyTextureParams(const SamplerParams& params)
+{
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, params.minFilter);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, params.magFilter);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, params.wrapS);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, params.wrapT);
+    glTexParameteri(target, GL_TEXTURE_WRAP_R, params.wrapR);
+    glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, params.compareMode);
+    glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, params.compareFunc);
+
+    // Set aniso level if enabled
+    if (params.aniso > 1.0f)
+    {
+        glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, params.aniso);
+    }
 }
 
 GLsizei Texture::BytesPerPixel(GLenum format)
@@ -131,6 +482,52 @@ GLsizei Texture::BytesPerPixel(GLenum format)
     }
 }
 
+/*
+ * Bytes per component
+ */
+GLsizei Texture::BytesPerComponent(GLenum dataType)
+{
+    switch (dataType)
+    {
+    case GL_UNSIGNED_BYTE:
+        return sizeof(GLubyte);
+    case GL_HALF_FLOAT:
+        return sizeof(GLushort);
+    case GL_FLOAT:
+        return sizeof(GLfloat);
+
+    default:
+        // Bad or unsupported data type
+        assert(false);
+        return sizeof(GLfloat);
+    }
+}
+
+/*
+ * Get half float format
+ */
+GLenum Texture::GetHalfFloatFormat(GLenum format)
+{
+    switch (format)
+    {
+    case GL_RED:
+        return GL_R16F;
+    case GL_RG:
+        return GL_RG16F;
+    case GL_RGB:
+    case GL_BGR:
+        return GL_RGB16F;
+    case GL_RGBA:
+    case GL_BGRA:
+        return GL_RGBA16F;
+
+    default:
+        // Bad or unsupported format
+        assert(false);
+        return GL_RGBA16F;
+    }
+}
+
 /*
  * Load image file
  */
@@ -141,7 +538,19 @@ GLubyte* Texture::LoadFile(
     GLenum* eFormat)
 {
     int comp;
-    GLubyte * temp = stbi_load(filename, nWidth, nHeight, &comp, 0);
+    int flipPass = 0;
+
+    // TGA files are decoded natively, except for the kinds only stb_image
+    // handles
+    GLubyte * temp = NULL;
+    if (TgaDecoder::IsTgaFile(filename))
+    {
+        temp = TgaDecoder::Load(filename, nWidth, nHeight, &comp);
+    }
+    if (temp == NULL)
+    {
+        temp = stbi_load_bottom_up(filename, nWidth, nHeight, &comp, 0, &flipPass);
+    }
     if (temp == NULL)
     {
         std::cerr << "Unable to load image file " << filename << std::endl;
@@ -158,21 +567,192 @@ GLubyte* Texture::LoadFile(
     else
     {
         std::cerr << "Image is not RGB or RGBA: " << filename << std::endl;
+        stbi_image_free(temp);
         return ErrorTexture(nWidth, nHeight, eFormat);
     }
 
-    // Images are upside down
-    int width = *nWidth;
-    int height = *nHeight;
-    GLubyte * swap = (GLubyte *) malloc(width * comp);
-    for (int i = 0, j = height - 1; i < height / 2; ++i, --j)
+    // Flipping through a temporary row used to move three times the image
+    // size, and the in-place swap for other formats moves twice the size
+    unsigned long long size = (unsigned long long)*nWidth * *nHeight * comp;
+    bytesLoaded += size;
+    flipBytesSaved += (flipPass ? 1 : 3) * size;
+    return temp;
+}
+
+/*
+ * Is HDR file
+ */
+bool Texture::IsHdrFile(const char* filename)
+{
+    assert(filename);
+    return stbi_is_hdr(filename) != 0;
+}
+
+/*
+ * Load HDR file
+ */
+GLushort* Texture::LoadHdrFile(
+    const char* filename,
+    int* nWidth,
+    int* nHeight,
+    GLenum* eFormat)
+{
+    int comp;
+    GLfloat* values = stbi_loadf(filename, nWidth, nHeight, &comp, 0);
+    if (values == NULL)
     {
-        memcpy(swap, temp + i * width * comp, width * comp);
-        memcpy(temp + i * width * comp, temp + j * width * comp, width * comp);
-        memcpy(temp + j * width * comp, swap, width * comp);
+        std::cerr << "Unable to load image file " << filename << std::endl;
+        return NULL;
     }
-    free(swap);
-    return temp;
+
+    static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    *eFormat = formats[comp - 1];
+
+    // stb_image decodes top-down, so each row is converted into its
+    // bottom-up place
+    size_t rowLength = (size_t)*nWidth * comp;
+    GLushort* halves = (GLushort*)malloc(rowLength * *nHeight * sizeof(GLushort));
+    if (halves != NULL)
+    {
+        for (int row = 0; row < *nHeight; row++)
+        {
+            FloatToHalf(values + (*nHeight - 1 - row) * rowLength, halves + row * rowLength, rowLength);
+        }
+        bytesLoaded += rowLength * *nHeight * sizeof(GLushort);
+    }
+
+    stbi_image_free(values);
+    return halves;
+}
+
+/*
+ * Get bytes loaded
+ */
+unsigned long long Texture::GetBytesLoaded()
+{
+    return bytesLoaded;
+}
+
+/*
+ * Get flip bytes saved
+ */
+unsigned long long Texture::GetFlipBytesSaved()
+{
+    return flipBytesSaved;
+}
+
+/*
+ * Images of a batch and the progress of decoding them
+ */
+struct Texture::ImageBatch::State
+{
+    /*
+     * A file of the batch, and its pixels once decoded
+     */
+    struct Image
+    {
+        std::string filename;
+        GLubyte*    data;
+        int         width;
+        int         height;
+        GLenum      format;
+    };
+
+    std::vector<Image>      images;   // Set up before decoding starts, never resized
+    std::deque<int>         finished; // Decoded images not yet returned by WaitNext
+    int                     decoding; // Images still being decoded
+    std::mutex              mutex;    // Guards finished, decoding and the image results
+    std::condition_variable done;     // Signalled when an image finishes decoding
+};
+
+/*
+ * Image batch constructor
+ */
+Texture::ImageBatch::ImageBatch(const char* const* filenames, int count)
+    : state(new State())
+{
+    assert(filenames != NULL && count > 0);
+
+    state->images.resize(count);
+    state->decoding = count;
+    for (int i = 0; i < count; i++)
+    {
+        assert(filenames[i]);
+        state->images[i].filename = filenames[i];
+        state->images[i].data     = NULL;
+    }
+
+    // The workers only touch the state, which the destructor keeps alive
+    // until they are done
+    State* shared = state;
+    for (int i = 0; i < count; i++)
+    {
+        ThreadPool::GetShared().Submit([shared, i]()
+        {
+            State::Image& image = shared->images[i];
+            int    width;
+            int    height;
+            GLenum format;
+            GLubyte* data = Texture::LoadFile(image.filename.c_str(), &width, &height, &format);
+
+            std::unique_lock<std::mutex> lock(shared->mutex);
+            image.data   = data;
+            image.width  = width;
+            image.height = height;
+            image.format = format;
+            shared->finished.push_back(i);
+            shared->decoding--;
+            shared->done.notify_all();
+        });
+    }
+}
+
+/*
+ * Image batch destructor
+ */
+Texture::ImageBatch::~ImageBatch()
+{
+    {
+        // The workers still reference the state until they finish
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (state->decoding > 0)
+        {
+            state->done.wait(lock);
+        }
+    }
+
+    // Images returned by WaitNext belong to the caller and were set to NULL
+    for (size_t i = 0; i < state->images.size(); i++)
+    {
+        free(state->images[i].data);
+    }
+    delete state;
+}
+
+/*
+ * Wait for next image
+ */
+GLubyte* Texture::ImageBatch::WaitNext(int* index, int* width, int* height, GLenum* format)
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (state->finished.empty())
+    {
+        assert(state->decoding > 0);
+        state->done.wait(lock);
+    }
+
+    int i = state->finished.front();
+    state->finished.pop_front();
+
+    State::Image& image = state->images[i];
+    GLubyte* data = image.data;
+    image.data = NULL;
+
+    *index  = i;
+    *width  = image.width;
+    *height = image.height;
+    *format = image.format;
+    return data;
 }
 
 /*
@@ -1,5 +1,6 @@
 #include <cassert>
 #include <iostream>
+#include "MipmapBuilder.h"
 #include "stb_image.h"
 #include "Texture1D.h"
 
@@ -186,16 +187,31 @@ void Texture1D::InitTextureObject(const GLvoid* pixels)
          minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
          minFilter == GL_LINEAR_MIPMAP_LINEAR))
     {
-        glGenerateMipmap(GL_TEXTURE_1D);
+        // 8-bit images get their levels built on the CPU as an image one
+        // row high, as Texture2D does, anything else is left to the driver
+        if (dataType == GL_UNSIGNED_BYTE && MipmapBuilder::IsEnabled())
+        {
+            const GLubyte* faces[] = { (const GLubyte*)pixels };
+            MipmapBuilder::Chain* chain = MipmapBuilder::BuildCached(
+                faces, 1, BytesPerPixel(imageFormat), width, 1);
+            chain->Upload(GL_TEXTURE_1D, 0, internalFormat, imageFormat);
+            delete chain;
+        }
+        else
+        {
+            glGenerateMipmap(GL_TEXTURE_1D);
+        }
     }
+
+    MeasureMemoryUsed();
 }
 
 /*
- * Set texture parameters
+ * Get sampler parameters
  */
-void Texture1D::SetTextureParams()
+void Texture1D::GetSamplerParams(SamplerParams& params) const
 {
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, minFilter);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, magFilter);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, wrapS);
+    params.minFilter = minFilter;
+    params.magFilter = magFilter;
+    params.wrapS     = wrapS;
 }
@@ -0,0 +1,281 @@
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "CompressedImage.h"
+#include "MipmapBuilder.h"
+#include "Texture2DArray.h"
+
+/*
+ * Construct Texture2DArray from raw bytes
+ */
+Texture2DArray::Texture2DArray(
+    const GLubyte* const* layers,
+    int    numLayers,
+    GLenum format,
+    int    width,
+    int    height,
+    GLenum minFilter,
+    GLenum magFilter,
+    GLenum wrapS,
+    GLenum wrapT,
+    float  aniso)
+    : Texture(GL_TEXTURE_2D_ARRAY),
+    minFilter(minFilter),
+    magFilter(magFilter),
+    wrapS(wrapS),
+    wrapT(wrapT),
+    aniso(aniso),
+    width(width),
+    height(height),
+    numLayers(numLayers),
+    imageFormat(format)
+{
+    // Debug assertions
+    assert(layers != NULL && numLayers > 0);
+    assert(format == GL_RED  ||
+           format == GL_RG   ||
+           format == GL_RGB  ||
+           format == GL_BGR  ||
+           format == GL_RGBA ||
+           format == GL_BGRA);
+    assert(width > 0 && height > 0);
+    assert(minFilter == GL_NEAREST                ||
+           minFilter == GL_LINEAR                 ||
+           minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+           minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+           minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+           minFilter == GL_LINEAR_MIPMAP_LINEAR);
+    assert(magFilter == GL_NEAREST ||
+           magFilter == GL_LINEAR);
+    assert(wrapS == GL_CLAMP_TO_EDGE ||
+           wrapS == GL_REPEAT        ||
+           wrapS == GL_MIRRORED_REPEAT);
+    assert(wrapT == GL_CLAMP_TO_EDGE ||
+           wrapT == GL_REPEAT        ||
+           wrapT == GL_MIRRORED_REPEAT);
+    assert(aniso >= 1.0f);
+
+    // Figure out the internal format to use for the texture
+    switch(format)
+    {
+    case GL_BGR:
+        internalFormat = GL_RGB;
+        break;
+    case GL_BGRA:
+        internalFormat = GL_RGBA;
+        break;
+    default:
+        internalFormat = format;
+    }
+
+    InitTextureObject(layers);
+}
+
+/*
+ * Construct Texture2DArray from compressed images
+ */
+Texture2DArray::Texture2DArray(
+    const CompressedImage* const* layers,
+    int    numLayers,
+    GLenum minFilter,
+    GLenum magFilter,
+    GLenum wrapS,
+    GLenum wrapT,
+    float  aniso)
+    : Texture(GL_TEXTURE_2D_ARRAY),
+    minFilter(minFilter),
+    magFilter(magFilter),
+    wrapS(wrapS),
+    wrapT(wrapT),
+    aniso(aniso),
+    width(layers[0]->GetWidth()),
+    height(layers[0]->GetHeight()),
+    numLayers(numLayers),
+    internalFormat(layers[0]->GetFormat()),
+    imageFormat(GL_NONE)
+{
+    // Debug assertions
+    assert(numLayers > 0);
+    for (int i = 0; i < numLayers; i++)
+    {
+        assert(layers[i]->IsValid() && layers[i]->GetNumFaces() == 1);
+        assert(layers[i]->GetFormat()    == layers[0]->GetFormat() &&
+               layers[i]->GetWidth()     == width                  &&
+               layers[i]->GetHeight()    == height                 &&
+               layers[i]->GetNumLevels() == layers[0]->GetNumLevels());
+    }
+    assert(minFilter == GL_NEAREST                ||
+           minFilter == GL_LINEAR                 ||
+           minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+           minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+           minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+           minFilter == GL_LINEAR_MIPMAP_LINEAR);
+    assert(magFilter == GL_NEAREST ||
+           magFilter == GL_LINEAR);
+    assert(wrapS == GL_CLAMP_TO_EDGE ||
+           wrapS == GL_REPEAT        ||
+           wrapS == GL_MIRRORED_REPEAT);
+    assert(wrapT == GL_CLAMP_TO_EDGE ||
+           wrapT == GL_REPEAT        ||
+           wrapT == GL_MIRRORED_REPEAT);
+    assert(aniso >= 1.0f);
+
+    if (CompressedImage::IsFormatSupported(layers[0]->GetFormat()))
+    {
+        InitTextureObject(layers);
+    }
+    else
+    {
+        std::cerr << "Compressed texture format 0x" << std::hex << layers[0]->GetFormat()
+            << std::dec << " is not supported" << std::endl;
+
+        GLubyte* data  = ErrorTexture(&width, &height, &imageFormat);
+        internalFormat = imageFormat;
+        std::vector<const GLubyte*> errorLayers(numLayers, data);
+        InitTextureObject(&errorLayers[0]);
+        free(data);
+    }
+}
+
+/*
+ * Destructor
+ */
+Texture2DArray::~Texture2DArray()
+{
+    // Nothing to do here, it is all handled in the base destructor
+}
+
+/*
+ * Init texture object
+ */
+void Texture2DArray::InitTextureObject(const GLubyte* const* layers)
+{
+    bool mipmaps = minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+                   minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+                   minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+                   minFilter == GL_LINEAR_MIPMAP_LINEAR;
+
+    // Each layer's chain is built in turn, with the rows of every level
+    // spread across the thread pool
+    std::vector<MipmapBuilder::Chain*> chains;
+    if (mipmaps && MipmapBuilder::IsEnabled())
+    {
+        for (int layer = 0; layer < numLayers; layer++)
+        {
+            chains.push_back(MipmapBuilder::BuildCached(
+                &layers[layer], 1, BytesPerPixel(imageFormat), width, height));
+        }
+    }
+
+    // The storage of a level is allocated for every layer at once, then
+    // each layer is copied in, so the layers never have to be gathered
+    // into one buffer
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    int numLevels = chains.empty() ? 1 : chains[0]->GetNumLevels();
+    for (int level = 0; level < numLevels; level++)
+    {
+        int levelWidth  = width  >> level > 0 ? width  >> level : 1;
+        int levelHeight = height >> level > 0 ? height >> level : 1;
+        glTexImage3D(
+            GL_TEXTURE_2D_ARRAY,
+            level,
+            internalFormat,
+            levelWidth,
+            levelHeight,
+            numLayers,
+            0,
+            imageFormat,
+            GL_UNSIGNED_BYTE,
+            NULL);
+
+        for (int layer = 0; layer < numLayers; layer++)
+        {
+            glTexSubImage3D(
+                GL_TEXTURE_2D_ARRAY,
+                level,
+                0,
+                0,
+                layer,
+                levelWidth,
+                levelHeight,
+                1,
+                imageFormat,
+                GL_UNSIGNED_BYTE,
+                level == 0 ? layers[layer] : chains[layer]->GetLevelData(level));
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+    for (size_t i = 0; i < chains.size(); i++)
+    {
+        delete chains[i];
+    }
+
+    if (mipmaps && numLevels == 1)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+
+    MeasureMemoryUsed();
+}
+
+/*
+ * Init texture object from compressed images
+ */
+void Texture2DArray::InitTextureObject(const CompressedImage* const* layers)
+{
+    const CompressedImage& first = *layers[0];
+    for (int level = 0; level < first.GetNumLevels(); level++)
+    {
+        const CompressedImage::Level& info = first.GetLevel(level);
+        glCompressedTexImage3D(
+            GL_TEXTURE_2D_ARRAY,
+            level,
+            internalFormat,
+            info.width,
+            info.height,
+            numLayers,
+            0,
+            info.size * numLayers,
+            NULL);
+
+        for (int layer = 0; layer < numLayers; layer++)
+        {
+            glCompressedTexSubImage3D(
+                GL_TEXTURE_2D_ARRAY,
+                level,
+                0,
+                0,
+                layer,
+                info.width,
+                info.height,
+                1,
+                internalFormat,
+                info.size,
+                layers[layer]->GetLevelData(level));
+        }
+    }
+
+    // Levels past the last one in the images are never sampled, so the
+    // texture is complete even without a full chain
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.GetNumLevels() - 1);
+
+    MeasureMemoryUsed();
+}
+
+/*
+ * Get sampler parameters
+ */
+void Texture2DArray::GetSamplerParams(SamplerParams& params) const
+{
+    params.minFilter = minFilter;
+    params.magFilter = magFilter;
+    params.wrapS     = wrapS;
+    params.wrapT     = wrapT;
+    params.aniso     = aniso;
+}
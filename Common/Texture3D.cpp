@@ -1,5 +1,7 @@
 #include <cassert>
 #include <iostream>
+#include <vector>
+#include "MipmapBuilder.h"
 #include "Texture3D.h"
 
 
@@ -47,29 +49,54 @@ Texture3D::Texture3D(
            wrapR == GL_MIRRORED_REPEAT);
     assert(aniso >= 1.0f);
 
-    // Create array of image data pointers
-    GLubyte** data = new GLubyte*[depth];
-
-    // For each layer
-    for (int i = 0; i < depth; i++)
+    // Decode all of the layers at once.  The texture is created when the
+    // first layer is ready, and every layer is uploaded as soon as it is.
+    // The layers are kept to build the mip levels from
+    ImageBatch batch(filenames, depth);
+    std::vector<GLubyte*> layers(depth, (GLubyte*)NULL);
+    bool complete = true;
+    for (int n = 0; n < depth; n++)
     {
-        // Load the image from the file
-        assert(filenames[i]);
-        data[i] = Texture::LoadFile(filenames[i], &width, &height, &imageFormat);
-        internalFormat = imageFormat;
+        int      layer;
+        int      layerWidth;
+        int      layerHeight;
+        GLenum   layerFormat;
+        GLubyte* data = batch.WaitNext(&layer, &layerWidth, &layerHeight, &layerFormat);
+
+        if (n == 0)
+        {
+            width          = layerWidth;
+            height         = layerHeight;
+            imageFormat    = layerFormat;
+            internalFormat = imageFormat;
+
+            // Create empty 3D texture
+            InitTextureObject((const GLvoid*)NULL);
+        }
+
+        if (layerWidth == width && layerHeight == height && layerFormat == imageFormat)
+        {
+            UploadLayer(layer, data);
+        }
+        else
+        {
+            std::cerr << "Image " << filenames[layer] <<
+                " does not match the size and format of the other layers" << std::endl;
+            complete = false;
+        }
+        layers[layer] = data;
     }
 
-    // Initialize the texture with the image data
-    InitTextureObject((const GLvoid* const *)data);
+    // Generate mip maps after all layers loaded.  A layer left empty has no
+    // pixels to build from, so the driver fills it in
+    GenerateMipmaps(complete ? (const GLvoid* const*)&layers[0] : NULL);
+    MeasureMemoryUsed();
 
-    // Free image data
+    // Done with the image data
     for (int i = 0; i < depth; i++)
     {
-        free(data[i]);
+        free(layers[i]);
     }
-
-    // Free image data pointer array
-    delete[] data;
 }
 
 /*
@@ -446,31 +473,85 @@ void Texture3D::InitTextureObject(const GLvoid* const * pixels)
         // Load each layer individually, allows layers to not be contiguous
         for (int i = 0; i < depth; i++)
         {
-            assert(pixels[i] != NULL);
-
-            glTexSubImage3D(
-                GL_TEXTURE_3D,
-                0,
-                0,
-                0,
-                i,
-                width,
-                height,
-                1,
-                imageFormat,
-                dataType,
-                pixels[i]);
+            UploadLayer(i, pixels[i]);
         }
 
-        // Generate mip maps after all layers loaded, if necessary
-        if (minFilter == GL_NEAREST_MIPMAP_NEAREST ||
-             minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
-             minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
-             minFilter == GL_LINEAR_MIPMAP_LINEAR)
-        {
-            glGenerateMipmap(GL_TEXTURE_3D);
-        }
+        // Generate mip maps after all layers loaded
+        GenerateMipmaps(pixels);
     }
+
+    MeasureMemoryUsed();
+}
+
+/*
+ * Upload layer
+ */
+void Texture3D::UploadLayer(int layer, const GLvoid* pixels)
+{
+    assert(layer >= 0 && layer < depth);
+    assert(pixels != NULL);
+
+    glTexSubImage3D(
+        GL_TEXTURE_3D,
+        0,
+        0,
+        0,
+        layer,
+        width,
+        height,
+        1,
+        imageFormat,
+        dataType,
+        pixels);
+}
+
+/*
+ * Generate mip maps
+ */
+void Texture3D::GenerateMipmaps(const GLvoid* const * layers)
+{
+    // Generate mip maps if necessary
+    if (minFilter != GL_NEAREST_MIPMAP_NEAREST &&
+        minFilter != GL_NEAREST_MIPMAP_LINEAR  &&
+        minFilter != GL_LINEAR_MIPMAP_NEAREST  &&
+        minFilter != GL_LINEAR_MIPMAP_LINEAR)
+    {
+        return;
+    }
+
+    // 8-bit volumes get gamma-correct levels built on the CPU, anything
+    // else is left to the driver
+    if (layers == NULL || dataType != GL_UNSIGNED_BYTE || !MipmapBuilder::IsEnabled())
+    {
+        glGenerateMipmap(GL_TEXTURE_3D);
+        return;
+    }
+
+    std::vector<std::vector<GLubyte> > levels;
+    MipmapBuilder::BuildVolume((const GLubyte* const *)layers, BytesPerPixel(imageFormat),
+        width, height, depth, MipmapBuilder::IsGammaCorrect(), levels);
+
+    // Rows of odd sized levels aren't padded to 4 bytes
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int level = 1; level <= (int)levels.size(); level++)
+    {
+        glTexImage3D(
+            GL_TEXTURE_3D,
+            level,
+            internalFormat,
+            width  >> level > 0 ? width  >> level : 1,
+            height >> level > 0 ? height >> level : 1,
+            depth  >> level > 0 ? depth  >> level : 1,
+            0,
+            imageFormat,
+            dataType,
+            &levels[level - 1][0]);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
 }
 
 /*
@@ -491,31 +572,31 @@ void Texture3D::InitTextureObject(const GLvoid* pixels)
         dataType, 
         pixels);
 
-    // Generate mip maps after all layers loaded, if necessary
-    if (pixels != NULL &&
-        (minFilter == GL_NEAREST_MIPMAP_NEAREST ||
-        minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
-        minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
-        minFilter == GL_LINEAR_MIPMAP_LINEAR))
+    // Generate mip maps after all layers loaded, if necessary.  The layers
+    // follow each other
+    if (pixels != NULL)
     {
-        glGenerateMipmap(GL_TEXTURE_3D);
+        std::vector<const GLvoid*> layers(depth);
+        size_t layerBytes = (size_t)width * height * BytesPerPixel(imageFormat);
+        for (int i = 0; i < depth; i++)
+        {
+            layers[i] = (const GLubyte*)pixels + i * layerBytes;
+        }
+        GenerateMipmaps(dataType == GL_UNSIGNED_BYTE ? &layers[0] : NULL);
     }
+
+    MeasureMemoryUsed();
 }
 
 /*
- * Set texture parameters
+ * Get sampler parameters
  */
-void Texture3D::SetTextureParams()
+void Texture3D::GetSamplerParams(SamplerParams& params) const
 {
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, minFilter);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, magFilter);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, wrapS);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, wrapT);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, wrapR);
-
-    // Set aniso level if enabled
-    if (aniso > 1.0f)
-    {
-        glTexParameterf(GL_TEXTURE_3D, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
-    }
+    params.minFilter = minFilter;
+    params.magFilter = magFilter;
+    params.wrapS     = wrapS;
+    params.wrapT     = wrapT;
+    params.wrapR     = wrapR;
+    params.aniso     = aniso;
 }
@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "BlockCompressor.h"
+#include "CompressedImage.h"
+#include "Texture2DArray.h"
+#include "TextureAtlas.h"
+
+namespace
+{
+    /*
+     * Orders images tallest first, then widest first, which keeps the
+     * skyline flat while packing
+     */
+    struct TallerFirst
+    {
+        TallerFirst(const std::vector<int>& heights, const std::vector<int>& widths)
+            : heights(heights),
+            widths(widths)
+        {
+        }
+
+        bool operator()(int a, int b) const
+        {
+            if (heights[a] != heights[b])
+            {
+                return heights[a] > heights[b];
+            }
+            return widths[a] > widths[b];
+        }
+
+        const std::vector<int>& heights;
+        const std::vector<int>& widths;
+    };
+
+    /*
+     * Rounds a size up to a whole number of compressed blocks
+     */
+    int RoundUpToBlock(int size)
+    {
+        return (size + 3) & ~3;
+    }
+}
+
+/*
+ * Constructor
+ */
+TextureAtlas::TextureAtlas(GLenum format, int pageSize, int padding)
+    : format(format),
+    components(0),
+    pageSize(pageSize),
+    padding(padding),
+    pageWidth(0),
+    pageHeight(0),
+    packed(false)
+{
+    // Debug assertions
+    assert(format == GL_RED ||
+           format == GL_RG  ||
+           format == GL_RGB ||
+           format == GL_RGBA);
+    assert(pageSize > 0 && padding >= 0);
+
+    switch (format)
+    {
+    case GL_RED:
+        components = 1;
+        break;
+    case GL_RG:
+        components = 2;
+        break;
+    case GL_RGB:
+        components = 3;
+        break;
+    default:
+        components = 4;
+    }
+}
+
+/*
+ * Destructor
+ */
+TextureAtlas::~TextureAtlas()
+{
+}
+
+/*
+ * Add
+ */
+int TextureAtlas::Add(const GLubyte* pixels, int width, int height)
+{
+    assert(pixels != NULL && width > 0 && height > 0);
+
+    if (width + 2 * padding > pageSize || height + 2 * padding > pageSize)
+    {
+        std::cerr << "Image of " << width << "x" << height
+            << " does not fit in an atlas page of " << pageSize << "x" << pageSize << std::endl;
+        return -1;
+    }
+
+    Image image;
+    image.pixels.assign(pixels, pixels + (size_t)width * height * components);
+    image.width  = width;
+    image.height = height;
+    image.page   = -1;
+    image.x      = 0;
+    image.y      = 0;
+    images.push_back(image);
+
+    packed = false;
+    return (int)images.size() - 1;
+}
+
+/*
+ * Add file
+ */
+int TextureAtlas::AddFile(const char* filename)
+{
+    int width;
+    int height;
+    GLenum fileFormat;
+    GLubyte* pixels = Texture::LoadFile(filename, &width, &height, &fileFormat);
+
+    int index = -1;
+    if (fileFormat != format)
+    {
+        std::cerr << "Image " << filename << " does not match the format of the atlas" << std::endl;
+    }
+    else
+    {
+        index = Add(pixels, width, height);
+    }
+
+    free(pixels);
+    return index;
+}
+
+/*
+ * Pack
+ */
+void TextureAtlas::Pack()
+{
+    std::vector<int> order(images.size());
+    std::vector<int> heights(images.size());
+    std::vector<int> widths(images.size());
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        order[i]   = (int)i;
+        heights[i] = images[i].height;
+        widths[i]  = images[i].width;
+    }
+    std::sort(order.begin(), order.end(), TallerFirst(heights, widths));
+
+    // Each image goes into the first page with room for it, at the lowest
+    // place on that page's skyline
+    std::vector<Skyline> skylines;
+    int usedWidth  = 0;
+    int usedHeight = 0;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        Image& image = images[order[i]];
+        int width  = image.width  + 2 * padding;
+        int height = image.height + 2 * padding;
+
+        int x = 0;
+        int y = 0;
+        size_t page = 0;
+        while (page < skylines.size() && !FindPosition(skylines[page], width, height, &x, &y))
+        {
+            page++;
+        }
+        if (page == skylines.size())
+        {
+            Span empty = { 0, 0, pageSize };
+            skylines.push_back(Skyline(1, empty));
+            x = 0;
+            y = 0;
+        }
+
+        AddToSkyline(skylines[page], x, y, width, height);
+        image.page = (int)page;
+        image.x    = x + padding;
+        image.y    = y + padding;
+
+        usedWidth  = std::max(usedWidth,  x + width);
+        usedHeight = std::max(usedHeight, y + height);
+    }
+
+    // Every layer of a texture array has the same size, so all the pages
+    // are trimmed to the largest area used by any of them
+    pageWidth  = RoundUpToBlock(usedWidth);
+    pageHeight = RoundUpToBlock(usedHeight);
+
+    pages.assign(skylines.size(), std::vector<GLubyte>());
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+        pages[i].assign((size_t)pageWidth * pageHeight * components, 0);
+    }
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        CopyToPage(images[i]);
+    }
+
+    packed = true;
+}
+
+/*
+ * Create texture
+ */
+Texture2DArray* TextureAtlas::CreateTexture(
+    GLenum minFilter,
+    GLenum magFilter,
+    float  aniso,
+    GLenum compressedFormat)
+{
+    if (!packed)
+    {
+        Pack();
+    }
+    assert(!pages.empty());
+
+    if (compressedFormat != GL_NONE && !BlockCompressor::IsFormatSupported(compressedFormat))
+    {
+        std::cerr << "Cannot encode atlas pages into format 0x" << std::hex << compressedFormat
+            << std::dec << ", leaving them uncompressed" << std::endl;
+        compressedFormat = GL_NONE;
+    }
+
+    Texture2DArray* texture;
+    if (compressedFormat != GL_NONE)
+    {
+        std::vector<CompressedImage*> layers(pages.size());
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            layers[i] = BlockCompressor::CompressWithMipmaps(
+                &pages[i][0], components, pageWidth, pageHeight, compressedFormat);
+        }
+
+        texture = new Texture2DArray(
+            &layers[0], (int)layers.size(), minFilter, magFilter,
+            GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, aniso);
+
+        for (size_t i = 0; i < layers.size(); i++)
+        {
+            delete layers[i];
+        }
+    }
+    else
+    {
+        std::vector<const GLubyte*> layers(pages.size());
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            layers[i] = &pages[i][0];
+        }
+
+        texture = new Texture2DArray(
+            &layers[0], (int)layers.size(), format, pageWidth, pageHeight,
+            minFilter, magFilter, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, aniso);
+    }
+
+    return texture;
+}
+
+/*
+ * Get layer
+ */
+int TextureAtlas::GetLayer(int image) const
+{
+    assert(packed && image >= 0 && image < (int)images.size());
+    return images[image].page;
+}
+
+/*
+ * Get texture coordinate transform
+ */
+vec4 TextureAtlas::GetTexCoordTransform(int image) const
+{
+    assert(packed && image >= 0 && image < (int)images.size());
+
+    const Image& placed = images[image];
+    return vec4(
+        (float)placed.x      / pageWidth,
+        (float)placed.y      / pageHeight,
+        (float)placed.width  / pageWidth,
+        (float)placed.height / pageHeight);
+}
+
+/*
+ * Get efficiency
+ */
+float TextureAtlas::GetEfficiency() const
+{
+    if (!packed || pages.empty())
+    {
+        return 0.0f;
+    }
+
+    double imageArea = 0.0;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        imageArea += (double)images[i].width * images[i].height;
+    }
+    return (float)(imageArea / ((double)pageWidth * pageHeight * pages.size()));
+}
+
+/*
+ * Find position
+ */
+bool TextureAtlas::FindPosition(const Skyline& skyline, int width, int height, int* x, int* y) const
+{
+    bool found = false;
+    for (size_t i = 0; i < skyline.size(); i++)
+    {
+        int left = skyline[i].x;
+        if (left + width > pageSize)
+        {
+            break;
+        }
+
+        // The rectangle rests on the highest span it covers
+        int bottom = 0;
+        for (size_t j = i; j < skyline.size() && skyline[j].x < left + width; j++)
+        {
+            bottom = std::max(bottom, skyline[j].y);
+        }
+
+        if (bottom + height <= pageSize && (!found || bottom < *y))
+        {
+            *x = left;
+            *y = bottom;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Add to skyline
+ */
+void TextureAtlas::AddToSkyline(Skyline& skyline, int x, int y, int width, int height)
+{
+    Skyline raised;
+    Span top = { x, y + height, width };
+    bool added = false;
+    for (size_t i = 0; i < skyline.size(); i++)
+    {
+        const Span& span = skyline[i];
+        int right = span.x + span.width;
+
+        // Keep the parts of the span on either side of the rectangle
+        if (span.x < x)
+        {
+            Span left = { span.x, span.y, std::min(right, x) - span.x };
+            raised.push_back(left);
+        }
+        if (!added && right > x)
+        {
+            raised.push_back(top);
+            added = true;
+        }
+        if (right > x + width)
+        {
+            int start = std::max(span.x, x + width);
+            Span rest = { start, span.y, right - start };
+            raised.push_back(rest);
+        }
+    }
+
+    // Merge neighbours of equal height so searches stay short
+    skyline.clear();
+    for (size_t i = 0; i < raised.size(); i++)
+    {
+        if (!skyline.empty() && skyline.back().y == raised[i].y)
+        {
+            skyline.back().width += raised[i].width;
+        }
+        else
+        {
+            skyline.push_back(raised[i]);
+        }
+    }
+}
+
+/*
+ * Copy to page
+ */
+void TextureAtlas::CopyToPage(const Image& image)
+{
+    GLubyte* page = &pages[image.page][0];
+    size_t   rowSize = (size_t)image.width * components;
+
+    for (int row = -padding; row < image.height + padding; row++)
+    {
+        // The padding repeats the nearest edge row and column
+        int sourceRow = std::min(std::max(row, 0), image.height - 1);
+        const GLubyte* source = &image.pixels[sourceRow * rowSize];
+        GLubyte* dest = page + ((size_t)(image.y + row) * pageWidth + image.x) * components;
+
+        memcpy(dest, source, rowSize);
+        for (int column = 1; column <= padding; column++)
+        {
+            memcpy(dest - column * components, source, components);
+            memcpy(dest + rowSize + (column - 1) * components,
+                   source + rowSize - components, components);
+        }
+    }
+}
@@ -1,5 +1,8 @@
 #include <cassert>
 #include <iostream>
+#include "CompressedImage.h"
+#include "CubeMapBuilder.h"
+#include "MipmapBuilder.h"
 #include "stb_image.h"
 #include "TextureCube.h"
 
@@ -73,20 +76,190 @@ TextureCube::TextureCube(
         negZFilename
     };
 
-    // For each cube face
-    for (int i = 0; i < 6; i++)
+    // Decode all of the faces at once, and upload each as soon as it is ready
+    ImageBatch batch(filenames, 6);
+    GLubyte* data[6];  // Kept in face order for the mip maps
+    bool sameSize = true;
+    for (int n = 0; n < 6; n++)
     {
-        assert(filenames[i]);
+        int face;
+        int faceWidth;
+        int faceHeight;
+        GLenum faceFormat;
+        GLubyte* pixels = batch.WaitNext(&face, &faceWidth, &faceHeight, &faceFormat);
+        data[face] = pixels;
 
-        // Load the image from the file
-        GLubyte* data  = Texture::LoadFile(filenames[i], &width, &height, &imageFormat);
+        // A face that failed to load falls back to the error texture, which
+        // won't match the others
+        if (n > 0 && (faceWidth != width || faceHeight != height || faceFormat != imageFormat))
+        {
+            sameSize = false;
+        }
+        width          = faceWidth;
+        height         = faceHeight;
+        imageFormat    = faceFormat;
         internalFormat = imageFormat;
 
         // Fill the face texture with pixel data
-        InitTextureObject(data, faceEnums[i]);
+        InitTextureObject(pixels, faceEnums[face]);
+    }
+
+    // The faces can finish in any order, so mip maps are generated once
+    // all of them are loaded
+    GenerateMipmaps(sameSize ? data : NULL);
+
+    // Done with the image data
+    for (int face = 0; face < 6; face++)
+    {
+        free(data[face]);
+    }
+}
+
+/*
+ * Construct TextureCube from panorama
+ */
+TextureCube::TextureCube(
+    const char* panoramaFilename,
+    int    faceSize,
+    GLenum minFilter,
+    GLenum magFilter,
+    GLenum wrapS,
+    GLenum wrapT,
+    GLenum wrapR,
+    float  aniso)
+    : Texture(GL_TEXTURE_CUBE_MAP),
+    minFilter(minFilter),
+    magFilter(magFilter),
+    wrapS(wrapS),
+    wrapT(wrapT),
+    wrapR(wrapR),
+    aniso(aniso),
+    dataType(GL_UNSIGNED_BYTE)
+{
+    // Debug assertions
+    assert(panoramaFilename);
+    assert(faceSize >= 0);
+    assert(minFilter == GL_NEAREST                ||
+           minFilter == GL_LINEAR                 ||
+           minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+           minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+           minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+           minFilter == GL_LINEAR_MIPMAP_LINEAR);
+    assert(magFilter == GL_NEAREST ||
+           magFilter == GL_LINEAR);
+    assert(wrapS == GL_CLAMP_TO_EDGE ||
+           wrapS == GL_REPEAT        ||
+           wrapS == GL_MIRRORED_REPEAT);
+    assert(wrapT == GL_CLAMP_TO_EDGE ||
+           wrapT == GL_REPEAT        ||
+           wrapT == GL_MIRRORED_REPEAT);
+    assert(wrapR == GL_CLAMP_TO_EDGE ||
+           wrapR == GL_REPEAT        ||
+           wrapR == GL_MIRRORED_REPEAT);
+    assert(aniso >= 1.0f);
+
+    bool mipmaps = minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+                   minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+                   minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+                   minFilter == GL_LINEAR_MIPMAP_LINEAR;
+    CubeMapBuilder::Faces* faces = CubeMapBuilder::BuildCached(panoramaFilename, faceSize, mipmaps);
+    if (faces == NULL)
+    {
+        GLubyte* data  = ErrorTexture(&width, &height, &imageFormat);
+        internalFormat = imageFormat;
+        for (int i = 0; i < 6; i++)
+        {
+            InitTextureObject(data, faceEnums[i]);
+        }
+        free(data);
+        GenerateMipmaps();
+        return;
+    }
+
+    static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    width          = faces->GetSize(0);
+    height         = width;
+    imageFormat    = formats[faces->GetComponents() - 1];
+    dataType       = faces->GetDataType();
+    internalFormat = dataType == GL_HALF_FLOAT ? GetHalfFloatFormat(imageFormat) : imageFormat;
+    faces->Upload(internalFormat, imageFormat);
+
+    // Levels that weren't built are left to glGenerateMipmap
+    if (faces->GetNumLevels() > 1)
+    {
+        MeasureMemoryUsed();
+    }
+    else
+    {
+        GenerateMipmaps();
+    }
+    delete faces;
+}
 
-        // Done with the image data
+/*
+ * Construct TextureCube from compressed image
+ */
+TextureCube::TextureCube(
+    const CompressedImage& image,
+    GLenum minFilter,
+    GLenum magFilter,
+    GLenum wrapS,
+    GLenum wrapT,
+    GLenum wrapR,
+    float  aniso)
+    : Texture(GL_TEXTURE_CUBE_MAP),
+    minFilter(minFilter),
+    magFilter(magFilter),
+    wrapS(wrapS),
+    wrapT(wrapT),
+    wrapR(wrapR),
+    aniso(aniso),
+    width(image.GetWidth()),
+    height(image.GetHeight()),
+    internalFormat(image.GetFormat()),
+    imageFormat(GL_NONE),
+    dataType(GL_NONE)
+{
+    // Debug assertions
+    assert(image.IsValid());
+    assert(image.GetNumFaces() == 6);
+    assert(minFilter == GL_NEAREST                ||
+           minFilter == GL_LINEAR                 ||
+           minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+           minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+           minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+           minFilter == GL_LINEAR_MIPMAP_LINEAR);
+    assert(magFilter == GL_NEAREST ||
+           magFilter == GL_LINEAR);
+    assert(wrapS == GL_CLAMP_TO_EDGE ||
+           wrapS == GL_REPEAT        ||
+           wrapS == GL_MIRRORED_REPEAT);
+    assert(wrapT == GL_CLAMP_TO_EDGE ||
+           wrapT == GL_REPEAT        ||
+           wrapT == GL_MIRRORED_REPEAT);
+    assert(wrapR == GL_CLAMP_TO_EDGE ||
+           wrapR == GL_REPEAT        ||
+           wrapR == GL_MIRRORED_REPEAT);
+    assert(aniso >= 1.0f);
+
+    if (CompressedImage::IsFormatSupported(image.GetFormat()))
+    {
+        InitTextureObject(image);
+    }
+    else
+    {
+        std::cerr << "Compressed texture format 0x" << std::hex << image.GetFormat()
+            << std::dec << " is not supported" << std::endl;
+
+        GLubyte* data  = ErrorTexture(&width, &height, &imageFormat);
+        internalFormat = imageFormat;
+        dataType       = GL_UNSIGNED_BYTE;
+        for (int i = 0; i < 6; i++)
+        {
+            InitTextureObject(data, faceEnums[i]);
+        }
         free(data);
+        GenerateMipmaps();
     }
 }
 
@@ -179,6 +352,8 @@ TextureCube::TextureCube(
         // Fill the face texture with pixel data
         InitTextureObject(data[i], faceEnums[i]);
     }
+
+    GenerateMipmaps(data);
 }
 
 /*
@@ -270,6 +445,8 @@ TextureCube::TextureCube(
         // Fill the face texture with pixel data
         InitTextureObject(data[i], faceEnums[i]);
     }
+
+    GenerateMipmaps();
 }
 
 /*
@@ -327,6 +504,8 @@ TextureCube::TextureCube(
         // Create empty face texture
         InitTextureObject(NULL, faceEnums[i]);
     }
+
+    MeasureMemoryUsed();
 }
 
 /*
@@ -353,34 +532,77 @@ void TextureCube::InitTextureObject(const GLvoid* pixels, GLenum face)
         imageFormat, 
         dataType, 
         pixels);
+}
 
-    // Generate mip maps after the last face if necessary.
-    // This assumes that the negative Z face is done last
-    if (face == GL_TEXTURE_CUBE_MAP_NEGATIVE_Z &&
-        pixels != NULL &&
-        (minFilter == GL_NEAREST_MIPMAP_NEAREST ||
-         minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
-         minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
-         minFilter == GL_LINEAR_MIPMAP_LINEAR))
+/*
+ * Generate mip maps
+ */
+void TextureCube::GenerateMipmaps(const GLubyte* const* faces)
+{
+    // Generate mip maps if necessary
+    if (minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+        minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+        minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+        minFilter == GL_LINEAR_MIPMAP_LINEAR)
     {
-        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        // All six faces are filtered together, so they are spread across
+        // the thread pool
+        if (faces != NULL && dataType == GL_UNSIGNED_BYTE && MipmapBuilder::IsEnabled())
+        {
+            MipmapBuilder::Chain* chain = MipmapBuilder::BuildCached(
+                faces, 6, BytesPerPixel(imageFormat), width, height);
+            for (int face = 0; face < 6; face++)
+            {
+                chain->Upload(faceEnums[face], face, internalFormat, imageFormat);
+            }
+            delete chain;
+        }
+        else
+        {
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        }
     }
+
+    MeasureMemoryUsed();
 }
 
 /*
- * Set texture parameters
+ * Init texture object from compressed image
  */
-void TextureCube::SetTextureParams()
+void TextureCube::InitTextureObject(const CompressedImage& image)
 {
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, minFilter);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, magFilter);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, wrapS);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, wrapT);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, wrapR);
-
-    // Set aniso level if enabled
-    if (aniso > 1.0f)
+    for (int face = 0; face < 6; face++)
     {
-        glTexParameterf(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
+        for (int level = 0; level < image.GetNumLevels(); level++)
+        {
+            const CompressedImage::Level& info = image.GetLevel(level, face);
+            glCompressedTexImage2D(
+                faceEnums[face],
+                level,
+                internalFormat,
+                info.width,
+                info.height,
+                0,
+                info.size,
+                image.GetLevelData(level, face));
+        }
     }
+
+    // Levels past the last one in the image are never sampled
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, image.GetNumLevels() - 1);
+
+    MeasureMemoryUsed();
+}
+
+/*
+ * Get sampler parameters
+ */
+void TextureCube::GetSamplerParams(SamplerParams& params) const
+{
+    params.minFilter = minFilter;
+    params.magFilter = magFilter;
+    params.wrapS     = wrapS;
+    params.wrapT     = wrapT;
+    params.wrapR     = wrapR;
+    params.aniso     = aniso;
 }
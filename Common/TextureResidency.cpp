@@ -0,0 +1,441 @@
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include "CompressedImage.h"
+#include "MipmapBuilder.h"
+#include "Texture2D.h"
+#include "TextureResidency.h"
+#include "ThreadPool.h"
+
+/*
+ * Managed textures
+ */
+TextureResidency::EntryMap TextureResidency::entries;
+
+/*
+ * Bytes the textures should fit in
+ */
+GLsizeiptr TextureResidency::budget = 256 * 1024 * 1024;
+
+/*
+ * Number of Updates so far
+ */
+unsigned long TextureResidency::frame = 1;
+
+/*
+ * Streaming since the last reset
+ */
+TextureResidency::Stats TextureResidency::stats;
+
+/*
+ * Guards the decode results of loads, which are written by the workers and
+ * read by the main thread
+ */
+static std::mutex loadMutex;
+
+/*
+ * A managed texture
+ */
+struct TextureResidency::Entry
+{
+    Entry()
+        : texture(NULL),
+        maxBaseLevel(0),
+        wanted(0),
+        frameWanted(0),
+        lastUsed(0),
+        bytesPerTexel(0.0),
+        failed(false),
+        loading(false),
+        loadLevel(0),
+        loaded(false),
+        pixels(NULL),
+        width(0),
+        height(0),
+        chain(NULL),
+        image(NULL)
+    {
+    }
+
+    ~Entry()
+    {
+        free(pixels);
+        delete chain;
+        delete image;
+    }
+
+    Texture2D*    texture;       //!< Managed texture
+    std::string   filename;      //!< File to restore levels from
+    int           maxBaseLevel;  //!< Coarsest base level, whose levels are never released
+    int           wanted;        //!< Finest level needed when last drawn
+    int           frameWanted;   //!< Finest level requested since the last Update
+    unsigned long lastUsed;      //!< Frame the texture was last requested in
+    double        bytesPerTexel; //!< Video memory per texel, measured when added
+    bool          failed;        //!< Set once the file no longer matches the texture
+
+    bool          loading;       //!< Whether a load has been started
+    int           loadLevel;     //!< Finest level the load restores
+
+    // Written by the worker, guarded by loadMutex
+    bool                  loaded; //!< Set once the file is decoded
+    GLubyte*              pixels; //!< Level 0 of an uncompressed texture
+    int                   width;  //!< Size of the decoded image
+    int                   height;
+    MipmapBuilder::Chain* chain;  //!< Other levels of an uncompressed texture
+    CompressedImage*      image;  //!< Every level of a compressed texture
+};
+
+/*
+ * Add texture
+ */
+void TextureResidency::Add(Texture2D* texture, const char* filename, int minSize)
+{
+    assert(texture != NULL && filename != NULL && minSize >= 1);
+
+    if (entries.count(texture) != 0)
+    {
+        return;
+    }
+
+    std::shared_ptr<Entry> entry(new Entry());
+    entry->texture  = texture;
+    entry->filename = filename;
+
+    // Levels at or below the minimum size stay resident
+    int level = 0;
+    while (level < texture->GetNumLevels() - 1 &&
+           ((texture->GetWidth() >> level) > minSize || (texture->GetHeight() >> level) > minSize))
+    {
+        level++;
+    }
+    entry->maxBaseLevel = level;
+    entry->wanted       = texture->GetBaseLevel();
+    entry->frameWanted  = entry->maxBaseLevel;
+
+    // Every level has the same cost per texel, apart from the rounding of
+    // compressed blocks in the smallest ones
+    double texels = 0.0;
+    for (int i = texture->GetBaseLevel(); i < texture->GetNumLevels(); i++)
+    {
+        int levelWidth  = texture->GetWidth()  >> i > 0 ? texture->GetWidth()  >> i : 1;
+        int levelHeight = texture->GetHeight() >> i > 0 ? texture->GetHeight() >> i : 1;
+        texels += (double)levelWidth * levelHeight;
+    }
+    entry->bytesPerTexel = texture->GetMemoryUsed() / texels;
+
+    entries[texture] = entry;
+}
+
+/*
+ * Remove texture
+ */
+void TextureResidency::Remove(Texture2D* texture)
+{
+    // A load still running keeps its entry alive until it finishes
+    entries.erase(texture);
+}
+
+/*
+ * Request texture
+ */
+void TextureResidency::Request(Texture2D* texture, float screenSize)
+{
+    EntryMap::iterator it = entries.find(texture);
+    if (it == entries.end())
+    {
+        return;
+    }
+    Entry& entry = *it->second;
+
+    // One texel per pixel needs the level whose width matches the screen
+    int level = entry.maxBaseLevel;
+    if (screenSize > 0.0f)
+    {
+        float texelsPerPixel = texture->GetWidth() / screenSize;
+        level = texelsPerPixel > 1.0f ? (int)std::floor(std::log(texelsPerPixel) / std::log(2.0f)) : 0;
+        level = level < entry.maxBaseLevel ? level : entry.maxBaseLevel;
+    }
+
+    if (entry.lastUsed != frame || level < entry.frameWanted)
+    {
+        entry.frameWanted = level;
+    }
+    entry.lastUsed = frame;
+}
+
+/*
+ * Get screen size
+ */
+float TextureResidency::GetScreenSize(float worldSize, float distance, float fieldOfView, int viewportHeight)
+{
+    // Height of the view frustum at the distance, in world units
+    float viewHeight = 2.0f * distance * std::tan(fieldOfView * 0.5f * 3.14159265f / 180.0f);
+    if (viewHeight <= 0.0f)
+    {
+        return (float)viewportHeight;
+    }
+    return worldSize / viewHeight * viewportHeight;
+}
+
+/*
+ * Update
+ */
+void TextureResidency::Update()
+{
+    // Finish the loads the workers are done with
+    for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        Entry& entry = *it->second;
+        if (entry.loading)
+        {
+            bool loaded;
+            {
+                std::unique_lock<std::mutex> lock(loadMutex);
+                loaded = entry.loaded;
+            }
+            if (loaded)
+            {
+                FinishLoad(entry);
+            }
+        }
+    }
+
+    // The levels needed by this frame's draws
+    GLsizeiptr resident = 0;
+    for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        Entry& entry = *it->second;
+        if (entry.lastUsed == frame)
+        {
+            entry.wanted = entry.frameWanted;
+        }
+        entry.frameWanted = entry.maxBaseLevel;
+        resident += entry.texture->GetMemoryUsed();
+    }
+
+    // Restore the levels drawn textures are missing, making room for them
+    // first.  Levels in flight are counted as resident already
+    for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        const std::shared_ptr<Entry>& entry = it->second;
+        int baseLevel = entry->texture->GetBaseLevel();
+        if (entry->lastUsed != frame || entry->loading || entry->failed ||
+            entry->wanted >= baseLevel)
+        {
+            continue;
+        }
+
+        GLsizeiptr needed = 0;
+        for (int level = entry->wanted; level < baseLevel; level++)
+        {
+            needed += GetLevelSize(*entry, level);
+        }
+        if (resident + needed > budget)
+        {
+            resident -= Release(resident + needed - budget, entry.get());
+        }
+
+        StartLoad(entry, entry->wanted);
+        resident += needed;
+    }
+
+    // A lowered budget, or textures added since the last Update, may still
+    // leave too much resident
+    if (resident > budget)
+    {
+        Release(resident - budget, NULL);
+    }
+
+    stats.residentBytes = 0;
+    for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        stats.residentBytes += it->second->texture->GetMemoryUsed();
+    }
+    if (stats.residentBytes > stats.peakResidentBytes)
+    {
+        stats.peakResidentBytes = stats.residentBytes;
+    }
+
+    frame++;
+}
+
+/*
+ * Reset stats
+ */
+void TextureResidency::ResetStats()
+{
+    stats = Stats();
+}
+
+/*
+ * Get level size
+ */
+GLsizeiptr TextureResidency::GetLevelSize(const Entry& entry, int level)
+{
+    int levelWidth  = entry.texture->GetWidth()  >> level > 0 ? entry.texture->GetWidth()  >> level : 1;
+    int levelHeight = entry.texture->GetHeight() >> level > 0 ? entry.texture->GetHeight() >> level : 1;
+    return (GLsizeiptr)(levelWidth * (double)levelHeight * entry.bytesPerTexel);
+}
+
+/*
+ * Start load
+ */
+void TextureResidency::StartLoad(const std::shared_ptr<Entry>& entry, int level)
+{
+    entry->loading   = true;
+    entry->loadLevel = level;
+
+    bool compressed = entry->texture->IsCompressed();
+    bool mipmapped  = entry->texture->GetNumLevels() > 1;
+    std::shared_ptr<Entry> shared = entry;
+    ThreadPool::GetShared().Submit([shared, compressed, mipmapped]()
+    {
+        GLubyte* pixels = NULL;
+        int width  = 0;
+        int height = 0;
+        MipmapBuilder::Chain* chain = NULL;
+        CompressedImage* image = NULL;
+
+        if (compressed)
+        {
+            image = new CompressedImage(shared->filename.c_str());
+        }
+        else
+        {
+            // The chain comes from the mip cache when the texture built
+            // its levels the same way
+            GLenum format;
+            pixels = Texture::LoadFile(shared->filename.c_str(), &width, &height, &format);
+            if (mipmapped)
+            {
+                const GLubyte* faces[] = { pixels };
+                chain = MipmapBuilder::BuildCached(faces, 1, format == GL_RGB ? 3 : 4, width, height);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(loadMutex);
+        shared->pixels = pixels;
+        shared->width  = width;
+        shared->height = height;
+        shared->chain  = chain;
+        shared->image  = image;
+        shared->loaded = true;
+    });
+}
+
+/*
+ * Finish load
+ */
+void TextureResidency::FinishLoad(Entry& entry)
+{
+    Texture2D* texture = entry.texture;
+    int baseLevel = texture->GetBaseLevel();
+
+    // The file may have changed since the texture was created
+    bool matches;
+    if (entry.image != NULL)
+    {
+        matches = entry.image->IsValid() &&
+                  entry.image->GetWidth()     == texture->GetWidth()  &&
+                  entry.image->GetHeight()    == texture->GetHeight() &&
+                  entry.image->GetNumLevels() >= baseLevel;
+    }
+    else
+    {
+        matches = entry.width  == texture->GetWidth()  &&
+                  entry.height == texture->GetHeight() &&
+                  (baseLevel <= 1 || entry.chain != NULL);
+    }
+
+    if (matches)
+    {
+        GLsizeiptr before = texture->GetMemoryUsed();
+        for (int level = entry.loadLevel; level < baseLevel; level++)
+        {
+            if (entry.image != NULL)
+            {
+                texture->SetLevel(level, entry.image->GetLevelData(level),
+                    entry.image->GetLevel(level).size);
+            }
+            else
+            {
+                texture->SetLevel(level, level == 0 ? entry.pixels : entry.chain->GetLevelData(level));
+            }
+        }
+        texture->SetBaseLevel(entry.loadLevel);
+
+        stats.levelsLoaded += baseLevel - entry.loadLevel;
+        stats.bytesLoaded  += texture->GetMemoryUsed() - before;
+    }
+    else
+    {
+        std::cerr << "Unable to stream mip levels from " << entry.filename
+            << ", it no longer matches its texture" << std::endl;
+        entry.failed = true;
+        stats.loadsFailed++;
+    }
+
+    free(entry.pixels);
+    delete entry.chain;
+    delete entry.image;
+    entry.pixels  = NULL;
+    entry.chain   = NULL;
+    entry.image   = NULL;
+    entry.loaded  = false;
+    entry.loading = false;
+}
+
+/*
+ * Release levels
+ */
+GLsizeiptr TextureResidency::Release(GLsizeiptr bytes, const Entry* keep)
+{
+    GLsizeiptr freed = 0;
+    while (freed < bytes)
+    {
+        // Levels finer than needed go first, then the textures drawn least
+        // recently.  Textures drawn this frame keep the levels they need
+        Entry* victim = NULL;
+        bool victimUnneeded = false;
+        for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            Entry* entry = it->second.get();
+            int baseLevel = entry->texture->GetBaseLevel();
+            if (entry == keep || entry->loading || baseLevel >= entry->maxBaseLevel)
+            {
+                continue;
+            }
+
+            bool unneeded = baseLevel < entry->wanted;
+            if (!unneeded && entry->lastUsed == frame)
+            {
+                continue;
+            }
+
+            if (victim == NULL ||
+                (unneeded && !victimUnneeded) ||
+                (unneeded == victimUnneeded && entry->lastUsed < victim->lastUsed))
+            {
+                victim = entry;
+                victimUnneeded = unneeded;
+            }
+        }
+
+        if (victim == NULL)
+        {
+            break;
+        }
+
+        GLsizeiptr before = victim->texture->GetMemoryUsed();
+        victim->texture->SetBaseLevel(victim->texture->GetBaseLevel() + 1);
+        GLsizeiptr released = before - victim->texture->GetMemoryUsed();
+
+        freed += released;
+        stats.levelsReleased++;
+        stats.bytesReleased += released;
+    }
+
+    return freed;
+}
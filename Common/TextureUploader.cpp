@@ -0,0 +1,458 @@
+#include <cassert>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include "MipmapBuilder.h"
+#include "stb_image.h"
+#include "Texture2D.h"
+#include "TextureUploader.h"
+#include "ThreadPool.h"
+
+/*
+ * Loads in order of request
+ */
+std::vector<std::shared_ptr<TextureUploader::Upload> > TextureUploader::pending;
+
+/*
+ * Pixel buffers kept for reuse
+ */
+std::vector<TextureUploader::FreeBuffer> TextureUploader::freeBuffers;
+
+/*
+ * Bytes that may start uploading each frame
+ */
+GLsizeiptr TextureUploader::frameBudget = 4 * 1024 * 1024;
+
+/*
+ * Uploads since the last reset
+ */
+TextureUploader::Stats TextureUploader::stats;
+
+/*
+ * Number of free buffers kept.  Textures streamed together tend to have
+ * similar sizes, so a few cover most requests
+ */
+static const size_t maxFreeBuffers = 4;
+
+/*
+ * Guards the decode results of pending loads, which are written by the
+ * workers and read by the main thread
+ */
+static std::mutex decodeMutex;
+static std::condition_variable decodeDone;
+
+/*
+ * A texture being decoded or uploaded
+ */
+struct TextureUploader::Upload
+{
+    std::string filename;  //!< File being decoded
+    GLenum      minFilter; //!< Texture parameters
+    GLenum      magFilter;
+    GLenum      wrapS;
+    GLenum      wrapT;
+    float       aniso;
+    Callback    done;      //!< Receives the finished texture
+
+    int         width;     //!< Size and format the buffer was laid out for,
+    int         height;    //!< read from the file's header
+    GLenum      format;
+    int         numLevels; //!< Mip levels held in the buffer
+    FreeBuffer  buffer;    //!< Pixel buffer, or an ID of 0 if there is none
+    GLubyte*    mapped;    //!< Buffer contents while mapped
+    GLsizeiptr  size;      //!< Bytes to copy to the texture
+
+    bool        decoded;   //!< Set by the worker once the buffer is filled
+    GLubyte*    pixels;    //!< Decoded image, if it didn't match the buffer
+    int         decodedWidth;
+    int         decodedHeight;
+    GLenum      decodedFormat;
+
+    Texture2D*  texture;   //!< Texture being copied to, once started
+    GLsync      fence;     //!< Signalled when the GPU has finished the copy
+};
+
+/*
+ * Check for buffer and fence support
+ */
+bool TextureUploader::IsSupported()
+{
+    return (GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object) &&
+           (GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range) &&
+           (GLEW_VERSION_3_2 || GLEW_ARB_sync);
+}
+
+/*
+ * Load texture
+ */
+void TextureUploader::Load(
+    const char* filename,
+    GLenum minFilter,
+    GLenum magFilter,
+    GLenum wrapS,
+    GLenum wrapT,
+    float  aniso,
+    const Callback& done)
+{
+    assert(filename && done);
+    assert(IsSupported());
+
+    std::shared_ptr<Upload> upload = std::make_shared<Upload>();
+    upload->filename      = filename;
+    upload->minFilter     = minFilter;
+    upload->magFilter     = magFilter;
+    upload->wrapS         = wrapS;
+    upload->wrapT         = wrapT;
+    upload->aniso         = aniso;
+    upload->done          = done;
+    upload->width         = 0;
+    upload->height        = 0;
+    upload->format        = GL_NONE;
+    upload->numLevels     = 0;
+    upload->buffer.id     = 0;
+    upload->buffer.size   = 0;
+    upload->mapped        = NULL;
+    upload->size          = 0;
+    upload->decoded       = false;
+    upload->pixels        = NULL;
+    upload->decodedWidth  = 0;
+    upload->decodedHeight = 0;
+    upload->decodedFormat = GL_NONE;
+    upload->texture       = NULL;
+    upload->fence         = 0;
+
+    // The header gives the size of the buffer before the image is decoded.
+    // Images LoadFile doesn't accept get no buffer, and are left to fail
+    // on the worker like any other load
+    int components;
+    if (stbi_info(filename, &upload->width, &upload->height, &components) &&
+        (components == 3 || components == 4))
+    {
+        upload->format = components == 3 ? GL_RGB : GL_RGBA;
+
+        // The worker builds the mip levels into the buffer too
+        bool mipmaps = minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+                       minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+                       minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+                       minFilter == GL_LINEAR_MIPMAP_LINEAR;
+        int levelWidth  = upload->width;
+        int levelHeight = upload->height;
+        for (;;)
+        {
+            upload->numLevels++;
+            upload->size += (GLsizeiptr)levelWidth * levelHeight * components;
+            if (!mipmaps || !MipmapBuilder::IsEnabled() || (levelWidth == 1 && levelHeight == 1))
+            {
+                break;
+            }
+            levelWidth  = levelWidth  > 1 ? levelWidth  / 2 : 1;
+            levelHeight = levelHeight > 1 ? levelHeight / 2 : 1;
+        }
+
+        // The buffer is only reused once the GPU is done with it, so there
+        // is no need for the driver to synchronize the mapping
+        upload->buffer = AcquireBuffer(upload->size);
+        upload->mapped = (GLubyte*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, upload->size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (upload->mapped == NULL)
+        {
+            ReleaseBuffer(upload->buffer);
+            upload->buffer.id = 0;
+        }
+    }
+    pending.push_back(upload);
+
+    ThreadPool::GetShared().Submit([upload]()
+    {
+        int width, height;
+        GLenum format;
+        GLubyte* pixels = Texture::LoadFile(upload->filename.c_str(), &width, &height, &format);
+
+        // A file that failed to load, or decoded differently than its
+        // header said, is uploaded from the decoded pixels instead
+        if (upload->mapped != NULL &&
+            width == upload->width && height == upload->height && format == upload->format)
+        {
+            size_t levelSize = (size_t)width * height * (format == GL_RGB ? 3 : 4);
+            memcpy(upload->mapped, pixels, levelSize);
+            if (upload->numLevels > 1)
+            {
+                const GLubyte* faces[] = { pixels };
+                MipmapBuilder::Chain* chain = MipmapBuilder::BuildCached(
+                    faces, 1, format == GL_RGB ? 3 : 4, width, height);
+                assert(chain->GetNumLevels() == upload->numLevels);
+                memcpy(upload->mapped + levelSize, chain->GetLevelData(1), chain->GetDataSize());
+                delete chain;
+            }
+            free(pixels);
+            pixels = NULL;
+        }
+
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        if (pixels != NULL)
+        {
+            // Counted against the budget before the texture reports its size
+            upload->size = (GLsizeiptr)width * height * (format == GL_RGB ? 3 : 4);
+        }
+        upload->pixels        = pixels;
+        upload->decodedWidth  = width;
+        upload->decodedHeight = height;
+        upload->decodedFormat = format;
+        upload->decoded       = true;
+        decodeDone.notify_all();
+    });
+}
+
+/*
+ * Update
+ */
+size_t TextureUploader::Update()
+{
+    stats.frameBytes = 0;
+    bool budgetSpent = false;
+
+    size_t i = 0;
+    while (i < pending.size())
+    {
+        Upload& upload = *pending[i];
+
+        // Hand over textures the GPU has finished copying
+        if (upload.texture != NULL)
+        {
+            if (!IsUploadDone(upload, 0))
+            {
+                i++;
+                continue;
+            }
+
+            if (upload.buffer.id != 0)
+            {
+                ReleaseBuffer(upload.buffer);
+            }
+            stats.uploaded++;
+            stats.bytesUploaded += upload.size;
+
+            // The callback may start more loads, so the entry is removed first
+            Callback done = upload.done;
+            Texture2D* texture = upload.texture;
+            pending.erase(pending.begin() + i);
+            done(texture);
+            continue;
+        }
+
+        bool decoded;
+        {
+            std::unique_lock<std::mutex> lock(decodeMutex);
+            decoded = upload.decoded;
+        }
+
+        // Loads start in order, so a large texture isn't passed over
+        // forever by smaller ones behind it
+        if (decoded && !budgetSpent)
+        {
+            if (stats.frameBytes > 0 && stats.frameBytes + upload.size > frameBudget)
+            {
+                budgetSpent = true;
+            }
+            else
+            {
+                stats.frameBytes += StartUpload(upload);
+            }
+        }
+        if (decoded && budgetSpent)
+        {
+            stats.deferred++;
+        }
+        i++;
+    }
+
+    if (stats.frameBytes > stats.peakFrameBytes)
+    {
+        stats.peakFrameBytes = stats.frameBytes;
+    }
+    return pending.size();
+}
+
+/*
+ * Wait for all pending loads
+ */
+void TextureUploader::WaitAll()
+{
+    GLsizeiptr budget = frameBudget;
+    frameBudget = std::numeric_limits<GLsizeiptr>::max();
+
+    while (!pending.empty())
+    {
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            std::unique_lock<std::mutex> lock(decodeMutex);
+            while (!pending[i]->decoded)
+            {
+                decodeDone.wait(lock);
+            }
+        }
+
+        // Start every upload, then wait for the GPU to finish them
+        Update();
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            if (pending[i]->texture != NULL)
+            {
+                while (!IsUploadDone(*pending[i], 1000000000))
+                {
+                }
+            }
+        }
+        Update();
+    }
+
+    frameBudget = budget;
+}
+
+/*
+ * Reset stats
+ */
+void TextureUploader::ResetStats()
+{
+    stats = Stats();
+}
+
+/*
+ * Release buffers
+ */
+void TextureUploader::ReleaseBuffers()
+{
+    for (size_t i = 0; i < freeBuffers.size(); i++)
+    {
+        glDeleteBuffers(1, &freeBuffers[i].id);
+    }
+    freeBuffers.clear();
+}
+
+/*
+ * Acquire buffer
+ */
+TextureUploader::FreeBuffer TextureUploader::AcquireBuffer(GLsizeiptr size)
+{
+    // The smallest free buffer that fits, unless it would waste over half
+    size_t best = freeBuffers.size();
+    for (size_t i = 0; i < freeBuffers.size(); i++)
+    {
+        if (freeBuffers[i].size >= size && freeBuffers[i].size / 2 <= size &&
+            (best == freeBuffers.size() || freeBuffers[i].size < freeBuffers[best].size))
+        {
+            best = i;
+        }
+    }
+
+    FreeBuffer buffer;
+    if (best != freeBuffers.size())
+    {
+        buffer = freeBuffers[best];
+        freeBuffers.erase(freeBuffers.begin() + best);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+        stats.buffersReused++;
+    }
+    else
+    {
+        buffer.size = size;
+        glGenBuffers(1, &buffer.id);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        stats.buffersCreated++;
+    }
+    return buffer;
+}
+
+/*
+ * Release buffer
+ */
+void TextureUploader::ReleaseBuffer(const FreeBuffer& buffer)
+{
+    freeBuffers.push_back(buffer);
+    if (freeBuffers.size() > maxFreeBuffers)
+    {
+        glDeleteBuffers(1, &freeBuffers[0].id);
+        freeBuffers.erase(freeBuffers.begin());
+    }
+}
+
+/*
+ * Start upload
+ */
+GLsizeiptr TextureUploader::StartUpload(Upload& upload)
+{
+    assert(upload.decoded && upload.texture == NULL);
+
+    if (upload.buffer.id != 0)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer.id);
+        bool intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        upload.mapped = NULL;
+
+        if (upload.pixels == NULL && intact)
+        {
+            // The storage is allocated with no buffer bound, then filled
+            // from the buffer, which only queues the copy
+            upload.texture = new Texture2D(upload.format, upload.format, GL_UNSIGNED_BYTE,
+                upload.width, upload.height, upload.minFilter, upload.magFilter,
+                upload.wrapS, upload.wrapT, upload.aniso);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer.id);
+            upload.texture->SetLevels(NULL, upload.numLevels);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            return upload.size;
+        }
+
+        ReleaseBuffer(upload.buffer);
+        upload.buffer.id = 0;
+
+        // The contents of a buffer can be lost while mapped, such as when
+        // the display mode changes, so the image is decoded again
+        if (upload.pixels == NULL)
+        {
+            std::cerr << "Pixel buffer of " << upload.filename << " was lost" << std::endl;
+            upload.pixels = Texture::LoadFile(upload.filename.c_str(),
+                &upload.decodedWidth, &upload.decodedHeight, &upload.decodedFormat);
+        }
+    }
+
+    upload.texture = new Texture2D(upload.pixels, upload.decodedFormat,
+        upload.decodedWidth, upload.decodedHeight, upload.minFilter, upload.magFilter,
+        upload.wrapS, upload.wrapT, upload.aniso);
+    free(upload.pixels);
+    upload.pixels = NULL;
+
+    upload.size = upload.texture->GetMemoryUsed();
+    return upload.size;
+}
+
+/*
+ * Is upload done
+ */
+bool TextureUploader::IsUploadDone(Upload& upload, GLuint64 timeout)
+{
+    if (upload.fence == 0)
+    {
+        return true;
+    }
+
+    // Flushing makes sure the fence reaches the GPU before waiting on it
+    GLenum result = glClientWaitSync(upload.fence,
+        timeout != 0 ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        return false;
+    }
+
+    // A failed wait can't be retried, so the copy is assumed finished
+    glDeleteSync(upload.fence);
+    upload.fence = 0;
+    return true;
+}
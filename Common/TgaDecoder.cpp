@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include "MappedFile.h"
+#include "TgaDecoder.h"
+
+// SSSE3 is used when the compiler targets it.  MSVC has the intrinsics
+// without targeting it, so the CPU is asked at startup instead
+#if defined(__SSSE3__) || defined(__AVX__)
+#define TGA_DECODER_SSSE3
+#include <tmmintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define TGA_DECODER_SSSE3
+#define TGA_DECODER_CPUID
+#include <intrin.h>
+#include <tmmintrin.h>
+#endif
+
+namespace
+{
+    // Fields of the 18 byte header
+    enum HeaderField
+    {
+        idLength      = 0,
+        colorMapType  = 1,
+        imageType     = 2,
+        widthField    = 12,
+        heightField   = 14,
+        bitsPerPixel  = 16,
+        descriptor    = 17,
+        headerSize    = 18
+    };
+
+    // Image types handled here
+    const int trueColor    = 2;
+    const int trueColorRle = 10;
+
+    // Bits of the image descriptor giving the order of the pixels
+    const int rightToLeft = 0x10;
+    const int topToBottom = 0x20;
+
+    /*
+     * Reads a little-endian 16-bit field
+     */
+    int Read16(const GLubyte* data)
+    {
+        return data[0] | (data[1] << 8);
+    }
+
+#ifdef TGA_DECODER_SSSE3
+    /*
+     * Checks whether the CPU has SSSE3
+     */
+    bool HasSsse3()
+    {
+#ifdef TGA_DECODER_CPUID
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 9)) != 0;
+#else
+        return true;
+#endif
+    }
+
+    bool ssse3 = HasSsse3();
+#else
+    bool ssse3 = false;
+#endif
+}
+
+/*
+ * Is TGA file
+ */
+bool TgaDecoder::IsTgaFile(const char* filename)
+{
+    assert(filename);
+
+    size_t length = strlen(filename);
+    if (length < 4 || filename[length - 4] != '.')
+    {
+        return false;
+    }
+
+    const char* extension = filename + length - 3;
+    return (extension[0] == 't' || extension[0] == 'T') &&
+           (extension[1] == 'g' || extension[1] == 'G') &&
+           (extension[2] == 'a' || extension[2] == 'A');
+}
+
+/*
+ * Load
+ */
+GLubyte* TgaDecoder::Load(const char* filename, int* width, int* height, int* components)
+{
+    MappedFile file(filename);
+    if (!file.IsValid())
+    {
+        return NULL;
+    }
+    return Decode(file.GetData(), file.GetSize(), width, height, components);
+}
+
+/*
+ * Decode
+ */
+GLubyte* TgaDecoder::Decode(const GLubyte* data, size_t size, int* width, int* height, int* components)
+{
+    assert(data && width && height && components);
+
+    if (size < headerSize ||
+        data[colorMapType] != 0 ||
+        (data[imageType] != trueColor && data[imageType] != trueColorRle) ||
+        (data[bitsPerPixel] != 24 && data[bitsPerPixel] != 32) ||
+        (data[descriptor] & rightToLeft) != 0)
+    {
+        return NULL;
+    }
+
+    int imageWidth  = Read16(data + widthField);
+    int imageHeight = Read16(data + heightField);
+    int imageComponents = data[bitsPerPixel] / 8;
+    bool topDown = (data[descriptor] & topToBottom) != 0;
+    size_t offset = headerSize + data[idLength];
+    if (imageWidth == 0 || imageHeight == 0 || offset > size)
+    {
+        return NULL;
+    }
+
+    size_t rowSize = (size_t)imageWidth * imageComponents;
+    GLubyte* pixels = (GLubyte*)malloc(rowSize * imageHeight);
+    if (pixels == NULL)
+    {
+        return NULL;
+    }
+
+    const GLubyte* source = data + offset;
+    bool ok;
+    if (data[imageType] == trueColorRle)
+    {
+        ok = DecodeRle(source, data + size, imageWidth, imageHeight, imageComponents, topDown, pixels);
+    }
+    else
+    {
+        ok = size - offset >= rowSize * imageHeight;
+        for (int row = 0; ok && row < imageHeight; row++)
+        {
+            int destRow = topDown ? imageHeight - 1 - row : row;
+            Swizzle(source + row * rowSize, pixels + destRow * rowSize, imageWidth, imageComponents);
+        }
+    }
+
+    if (!ok)
+    {
+        free(pixels);
+        return NULL;
+    }
+
+    *width      = imageWidth;
+    *height     = imageHeight;
+    *components = imageComponents;
+    return pixels;
+}
+
+/*
+ * Is SIMD enabled
+ */
+bool TgaDecoder::IsSimdEnabled()
+{
+    return ssse3;
+}
+
+/*
+ * Swizzle
+ */
+void TgaDecoder::Swizzle(const GLubyte* source, GLubyte* dest, int count, int components)
+{
+    int i = 0;
+#ifdef TGA_DECODER_SSSE3
+    if (ssse3 && components == 4)
+    {
+        // 4 pixels at a time
+        const __m128i order = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i*)(source + i * 4));
+            _mm_storeu_si128((__m128i*)(dest + i * 4), _mm_shuffle_epi8(block, order));
+        }
+    }
+    else if (ssse3)
+    {
+        // 5 pixels at a time.  The 16th byte belongs to the next pixel and is
+        // written again by the next step, so a sixth pixel must follow
+        const __m128i order = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+        for (; i + 6 <= count; i += 5)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i*)(source + i * 3));
+            _mm_storeu_si128((__m128i*)(dest + i * 3), _mm_shuffle_epi8(block, order));
+        }
+    }
+#endif
+
+    source += i * components;
+    dest   += i * components;
+    for (; i < count; i++)
+    {
+        dest[0] = source[2];
+        dest[1] = source[1];
+        dest[2] = source[0];
+        if (components == 4)
+        {
+            dest[3] = source[3];
+        }
+        source += components;
+        dest   += components;
+    }
+}
+
+/*
+ * Fill
+ */
+void TgaDecoder::Fill(const GLubyte* pixel, GLubyte* dest, int count, int components)
+{
+    // 16 copies of the pixel make a block whose size is a multiple of 16
+    // bytes for either pixel size, which is then copied as a whole
+    const int blockPixels = 16;
+    GLubyte block[blockPixels * 4];
+    int filled = std::min(count, blockPixels);
+    for (int i = 0; i < filled; i++)
+    {
+        block[i * components + 0] = pixel[2];
+        block[i * components + 1] = pixel[1];
+        block[i * components + 2] = pixel[0];
+        if (components == 4)
+        {
+            block[i * components + 3] = pixel[3];
+        }
+    }
+
+    size_t blockSize = (size_t)blockPixels * components;
+    for (; count >= blockPixels; count -= blockPixels)
+    {
+        memcpy(dest, block, blockSize);
+        dest += blockSize;
+    }
+    memcpy(dest, block, (size_t)count * components);
+}
+
+/*
+ * Decode RLE
+ */
+bool TgaDecoder::DecodeRle(
+    const GLubyte* data,
+    const GLubyte* end,
+    int width,
+    int height,
+    int components,
+    bool topDown,
+    GLubyte* pixels)
+{
+    // Packets may run across the end of a row, so they are split at row ends
+    size_t rowSize = (size_t)width * components;
+    int row = 0;
+    int column = 0;
+    while (row < height)
+    {
+        if (data >= end)
+        {
+            return false;
+        }
+
+        int header = *data++;
+        int count = (header & 0x7F) + 1;
+        bool repeated = (header & 0x80) != 0;
+        size_t packetSize = repeated ? components : (size_t)count * components;
+        if ((size_t)(end - data) < packetSize)
+        {
+            return false;
+        }
+
+        while (count > 0 && row < height)
+        {
+            int span = std::min(count, width - column);
+            int destRow = topDown ? height - 1 - row : row;
+            GLubyte* dest = pixels + destRow * rowSize + (size_t)column * components;
+            if (repeated)
+            {
+                Fill(data, dest, span, components);
+            }
+            else
+            {
+                Swizzle(data, dest, span, components);
+                data += (size_t)span * components;
+            }
+
+            count  -= span;
+            column += span;
+            if (column == width)
+            {
+                column = 0;
+                row++;
+            }
+        }
+
+        if (repeated)
+        {
+            data += components;
+        }
+    }
+
+    return true;
+}
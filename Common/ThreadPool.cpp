@@ -0,0 +1,127 @@
+#include <cassert>
+#include "ThreadPool.h"
+
+/*
+ * Thread pool constructor
+ */
+ThreadPool::ThreadPool(unsigned int numThreads)
+    : threads(),
+    tasks(),
+    running(0),
+    stopping(false)
+{
+    if (numThreads == 0)
+    {
+        // hardware_concurrency may not know, in which case it returns 0
+        numThreads = std::thread::hardware_concurrency();
+        if (numThreads == 0)
+        {
+            numThreads = 2;
+        }
+    }
+
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        threads.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+    }
+}
+
+/*
+ * Destructor
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
+
+/*
+ * Submit
+ */
+void ThreadPool::Submit(const Task& task)
+{
+    assert(task);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        assert(!stopping);
+        tasks.push_back(task);
+    }
+    wake.notify_one();
+}
+
+/*
+ * Wait all
+ */
+void ThreadPool::WaitAll()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!tasks.empty() || running != 0)
+    {
+        idle.wait(lock);
+    }
+}
+
+/*
+ * Is worker thread
+ */
+bool ThreadPool::IsWorkerThread() const
+{
+    std::thread::id id = std::this_thread::get_id();
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        if (threads[i].get_id() == id)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Get shared pool
+ */
+ThreadPool& ThreadPool::GetShared()
+{
+    static ThreadPool shared;
+    return shared;
+}
+
+/*
+ * Worker loop
+ */
+void ThreadPool::WorkerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        while (tasks.empty() && !stopping)
+        {
+            wake.wait(lock);
+        }
+
+        // Queued tasks are still run when stopping
+        if (tasks.empty())
+        {
+            return;
+        }
+
+        Task task = tasks.front();
+        tasks.pop_front();
+        running++;
+
+        lock.unlock();
+        task();
+        lock.lock();
+
+        running--;
+        idle.notify_all();
+    }
+}
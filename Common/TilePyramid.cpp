@@ -0,0 +1,485 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include "MipmapBuilder.h"
+#include "TilePyramid.h"
+
+namespace
+{
+    const char  vtexIdentifier[4] = { 'V', 'T', 'E', 'X' };
+    const GLuint vtexVersion = 1;
+
+    // Fields of the header after the identifier
+    enum HeaderField
+    {
+        version,
+        imageWidth,
+        imageHeight,
+        tileWidth,
+        tileBorder,
+        numComponents,
+        levelCount,
+        headerFields
+    };
+
+    /*
+     * Gets the number of levels needed for the grid of level 0 to cover an
+     * image, halving down to a single tile
+     */
+    int CountLevels(int width, int height, int tileSize)
+    {
+        int tiles = (std::max(width, height) + tileSize - 1) / tileSize;
+        int levels = 1;
+        while ((1 << (levels - 1)) < tiles)
+        {
+            levels++;
+        }
+        return levels;
+    }
+
+    /*
+     * Gets the width or height of a level of the image
+     */
+    int LevelSize(int size, int level)
+    {
+        return size >> level > 0 ? size >> level : 1;
+    }
+
+    /*
+     * Moves to a file offset, which may be past 2 GB
+     */
+    bool Seek(FILE* file, unsigned long long offset)
+    {
+#ifdef _MSC_VER
+        return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+        return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+
+    /*
+     * Gets the size of a file in bytes, leaving the position where it was
+     */
+    unsigned long long FileSize(FILE* file)
+    {
+#ifdef _MSC_VER
+        __int64 position = _ftelli64(file);
+        _fseeki64(file, 0, SEEK_END);
+        __int64 size = _ftelli64(file);
+        _fseeki64(file, position, SEEK_SET);
+#else
+        off_t position = ftello(file);
+        fseeko(file, 0, SEEK_END);
+        off_t size = ftello(file);
+        fseeko(file, position, SEEK_SET);
+#endif
+        return size > 0 ? (unsigned long long)size : 0;
+    }
+}
+
+/*
+ * Rows of one level held while a pyramid is built
+ */
+struct TilePyramid::BuildLevel
+{
+    int width;       // Width of the level in pixels
+    int height;      // Height of the level in pixels
+    int tilesX;      // Columns of tiles covering the level
+    int tilesY;      // Rows of tiles covering the level
+    int grid;        // Tiles across each side of the level's grid
+    int firstTile;   // Index of the level's first tile
+    int firstRow;    // Row of the level held at the start of rows
+    int numRows;     // Rows of the level added so far
+    int nextTileRow; // Next row of tiles to write
+
+    std::vector<GLubyte> rows; // Rows from firstRow up to numRows
+};
+
+/*
+ * State shared by the levels while a pyramid is built
+ */
+struct TilePyramid::BuildState
+{
+    FILE* file;         // File being written
+    int   components;   // Components in each pixel
+    int   tileSize;     // Size of a tile without its border
+    int   border;       // Border on each side of a tile
+    bool  gammaCorrect; // Whether levels are averaged in linear light
+
+    std::vector<unsigned long long> offsets; // File offset of each tile
+    std::vector<BuildLevel>         levels;  // Rows held for each level
+    std::vector<GLubyte>            tile;    // Tile being written
+};
+
+/*
+ * Constructor
+ */
+TilePyramid::TilePyramid(const char* filename)
+    : file(NULL),
+    width(0),
+    height(0),
+    components(0),
+    tileSize(0),
+    border(0),
+    numLevels(0)
+{
+    assert(filename);
+
+    FILE* opened = fopen(filename, "rb");
+    if (opened == NULL)
+    {
+        std::cerr << "Unable to open tile pyramid " << filename << std::endl;
+        return;
+    }
+
+    char identifier[4];
+    GLuint header[headerFields];
+    if (fread(identifier, sizeof(identifier), 1, opened) != 1 ||
+        memcmp(identifier, vtexIdentifier, sizeof(identifier)) != 0 ||
+        fread(header, sizeof(header), 1, opened) != 1)
+    {
+        std::cerr << "Not a tile pyramid: " << filename << std::endl;
+        fclose(opened);
+        return;
+    }
+
+    if (header[version]       != vtexVersion ||
+        header[imageWidth]    == 0 || header[imageWidth]  > 0x1000000 ||
+        header[imageHeight]   == 0 || header[imageHeight] > 0x1000000 ||
+        header[tileWidth]     == 0 || header[tileWidth]   > 4096 ||
+        header[tileBorder]    >= header[tileWidth] ||
+        header[numComponents] == 0 || header[numComponents] > 4 ||
+        header[levelCount] != (GLuint)CountLevels(header[imageWidth], header[imageHeight], header[tileWidth]))
+    {
+        std::cerr << "Unsupported or corrupt tile pyramid: " << filename << std::endl;
+        fclose(opened);
+        return;
+    }
+
+    // A corrupt header could ask for more offsets than the file holds, or
+    // more tiles than fit in it, before any of them are read
+    unsigned long long fileSize = FileSize(opened);
+    unsigned long long padded = header[tileWidth] + 2ULL * header[tileBorder];
+    unsigned long long tileBytes = padded * padded * header[numComponents];
+    unsigned long long numTiles = 0;
+    unsigned long long numStored = 0;
+    for (GLuint level = 0; level < header[levelCount]; level++)
+    {
+        unsigned long long grid = (1ULL << (header[levelCount] - 1)) >> level;
+        numTiles += grid * grid;
+        numStored += (unsigned long long)((LevelSize(header[imageWidth],  level) + header[tileWidth] - 1) / header[tileWidth]) *
+                     ((LevelSize(header[imageHeight], level) + header[tileWidth] - 1) / header[tileWidth]);
+    }
+    if (numTiles >= 0x7fffffff ||
+        (numTiles + 1) * sizeof(unsigned long long) > fileSize ||
+        numStored > fileSize / tileBytes)
+    {
+        std::cerr << "Tile pyramid is truncated: " << filename << std::endl;
+        fclose(opened);
+        return;
+    }
+
+    width      = header[imageWidth];
+    height     = header[imageHeight];
+    tileSize   = header[tileWidth];
+    border     = header[tileBorder];
+    components = header[numComponents];
+    numLevels  = header[levelCount];
+
+    levelStart.resize(numLevels + 1);
+    levelStart[0] = 0;
+    for (int level = 0; level < numLevels; level++)
+    {
+        levelStart[level + 1] = levelStart[level] + GetGridSize(level) * GetGridSize(level);
+    }
+
+    offsets.resize(GetNumTiles() + 1);
+    if (fread(&offsets[0], sizeof(offsets[0]), offsets.size(), opened) != offsets.size())
+    {
+        std::cerr << "Tile pyramid is truncated: " << filename << std::endl;
+        fclose(opened);
+        return;
+    }
+
+    file = opened;
+}
+
+/*
+ * Destructor
+ */
+TilePyramid::~TilePyramid()
+{
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+}
+
+/*
+ * Has tile
+ */
+bool TilePyramid::HasTile(int level, int x, int y) const
+{
+    assert(IsValid());
+    assert(level >= 0 && level < numLevels);
+    assert(x >= 0 && x < GetGridSize(level) && y >= 0 && y < GetGridSize(level));
+
+    int index = GetTileIndex(level, x, y);
+    return offsets[index + 1] > offsets[index];
+}
+
+/*
+ * Read tile
+ */
+bool TilePyramid::ReadTile(int level, int x, int y, GLubyte* pixels)
+{
+    assert(pixels);
+
+    if (!HasTile(level, x, y))
+    {
+        return false;
+    }
+
+    int index = GetTileIndex(level, x, y);
+    std::lock_guard<std::mutex> lock(fileMutex);
+    return offsets[index + 1] - offsets[index] == GetTileBytes() &&
+        Seek(file, offsets[index]) &&
+        fread(pixels, GetTileBytes(), 1, file) == 1;
+}
+
+/*
+ * Build
+ */
+bool TilePyramid::Build(
+    const GLubyte* pixels,
+    int components,
+    int width,
+    int height,
+    int tileSize,
+    int border,
+    const char* filename)
+{
+    assert(pixels && filename);
+    assert(components >= 1 && components <= 4);
+    assert(width > 0 && height > 0);
+    assert(tileSize > 0 && border >= 0 && border < tileSize);
+
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        std::cerr << "Unable to open " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    int numLevels = CountLevels(width, height, tileSize);
+    GLuint header[headerFields] =
+    {
+        vtexVersion,
+        (GLuint)width,
+        (GLuint)height,
+        (GLuint)tileSize,
+        (GLuint)border,
+        (GLuint)components,
+        (GLuint)numLevels
+    };
+
+    // Tiles are laid out in index order, so their offsets are known up front
+    // and each level can seek to its tiles as it completes them
+    int padded = tileSize + 2 * border;
+    unsigned long long tileBytes = (unsigned long long)padded * padded * components;
+    std::vector<unsigned long long> offsets;
+    unsigned long long offset = sizeof(vtexIdentifier) + sizeof(header);
+    for (int level = 0; level < numLevels; level++)
+    {
+        int grid = (1 << (numLevels - 1)) >> level;
+        offset += (unsigned long long)grid * grid * sizeof(offset);
+    }
+    offset += sizeof(offset);
+    for (int level = 0; level < numLevels; level++)
+    {
+        int grid = (1 << (numLevels - 1)) >> level;
+        int tilesX = (LevelSize(width,  level) + tileSize - 1) / tileSize;
+        int tilesY = (LevelSize(height, level) + tileSize - 1) / tileSize;
+        for (int y = 0; y < grid; y++)
+        {
+            for (int x = 0; x < grid; x++)
+            {
+                offsets.push_back(offset);
+                if (x < tilesX && y < tilesY)
+                {
+                    offset += tileBytes;
+                }
+            }
+        }
+    }
+    offsets.push_back(offset);
+
+    bool ok = fwrite(vtexIdentifier, sizeof(vtexIdentifier), 1, file) == 1 &&
+        fwrite(header, sizeof(header), 1, file) == 1 &&
+        fwrite(&offsets[0], sizeof(offsets[0]), offsets.size(), file) == offsets.size();
+
+    BuildState state;
+    state.file         = file;
+    state.components   = components;
+    state.tileSize     = tileSize;
+    state.border       = border;
+    state.gammaCorrect = MipmapBuilder::IsGammaCorrect();
+    state.offsets.swap(offsets);
+    state.tile.resize((size_t)tileBytes);
+    state.levels.resize(numLevels);
+    int firstTile = 0;
+    for (int level = 0; level < numLevels; level++)
+    {
+        BuildLevel& rows = state.levels[level];
+        rows.width       = LevelSize(width,  level);
+        rows.height      = LevelSize(height, level);
+        rows.tilesX      = (rows.width  + tileSize - 1) / tileSize;
+        rows.tilesY      = (rows.height + tileSize - 1) / tileSize;
+        rows.grid        = (1 << (numLevels - 1)) >> level;
+        rows.firstTile   = firstTile;
+        rows.firstRow    = 0;
+        rows.numRows     = 0;
+        rows.nextTileRow = 0;
+        firstTile += rows.grid * rows.grid;
+    }
+
+    // The image is fed in a row at a time, and every level below it is
+    // built and written as its rows arrive
+    size_t rowBytes = (size_t)width * components;
+    for (int y = 0; ok && y < height; y++)
+    {
+        const GLubyte* row = pixels + y * rowBytes;
+        state.levels[0].rows.insert(state.levels[0].rows.end(), row, row + rowBytes);
+        ok = AddRow(state, 0);
+    }
+
+    fclose(file);
+    if (!ok)
+    {
+        std::cerr << "Unable to write " << filename << std::endl;
+    }
+    return ok;
+}
+
+/*
+ * Add row
+ */
+bool TilePyramid::AddRow(BuildState& state, int level)
+{
+    BuildLevel& rows = state.levels[level];
+    size_t rowBytes = (size_t)rows.width * state.components;
+    int added = rows.numRows++;
+
+    // Each row of the next level averages a pair of rows of this one, and an
+    // odd last row is dropped.  A level one row high pairs the row with itself
+    if (level + 1 < (int)state.levels.size())
+    {
+        BuildLevel& next = state.levels[level + 1];
+        if (next.numRows < next.height && rows.numRows >= std::min(2 * next.numRows + 2, rows.height))
+        {
+            int upper = added;
+            int lower = std::max(added - 1, rows.firstRow);
+            next.rows.resize(next.rows.size() + (size_t)next.width * state.components);
+            MipmapBuilder::HalveRow(
+                &rows.rows[(lower - rows.firstRow) * rowBytes],
+                &rows.rows[(upper - rows.firstRow) * rowBytes],
+                state.components,
+                rows.width,
+                state.gammaCorrect,
+                &next.rows[next.rows.size() - (size_t)next.width * state.components]);
+            if (!AddRow(state, level + 1))
+            {
+                return false;
+            }
+        }
+    }
+
+    // A row of tiles is complete once the rows of its top border arrived,
+    // which at the top of the level may complete more than one
+    int tileSize = state.tileSize;
+    int border   = state.border;
+    while (rows.nextTileRow < rows.tilesY &&
+        rows.numRows >= std::min((rows.nextTileRow + 1) * tileSize + border, rows.height))
+    {
+        int y = rows.nextTileRow++;
+        if (!Seek(state.file, state.offsets[rows.firstTile + y * rows.grid]))
+        {
+            return false;
+        }
+        for (int x = 0; x < rows.tilesX; x++)
+        {
+            CopyTile(&rows.rows[0], rows.firstRow, state.components, rows.width, rows.height,
+                tileSize, border, x, y, &state.tile[0]);
+            if (fwrite(&state.tile[0], state.tile.size(), 1, state.file) != 1)
+            {
+                return false;
+            }
+        }
+
+        // Only the bottom border of the next row of tiles is still needed,
+        // and the first row of a pair the next level hasn't averaged yet
+        int keep = std::min(std::max((y + 1) * tileSize - border, 0), rows.numRows);
+        if (level + 1 < (int)state.levels.size())
+        {
+            keep = std::min(keep, 2 * state.levels[level + 1].numRows);
+        }
+        if (keep > rows.firstRow)
+        {
+            rows.rows.erase(rows.rows.begin(), rows.rows.begin() + (keep - rows.firstRow) * rowBytes);
+            rows.firstRow = keep;
+        }
+    }
+    return true;
+}
+
+/*
+ * Copy tile
+ */
+void TilePyramid::CopyTile(
+    const GLubyte* rows,
+    int firstRow,
+    int components,
+    int width,
+    int height,
+    int tileSize,
+    int border,
+    int x,
+    int y,
+    GLubyte* tile)
+{
+    int padded = tileSize + 2 * border;
+    int left   = x * tileSize - border;
+    int bottom = y * tileSize - border;
+
+    // Columns past the edges of the level repeat the edge pixel, as do rows
+    std::vector<int> columns(padded);
+    for (int i = 0; i < padded; i++)
+    {
+        columns[i] = std::min(std::max(left + i, 0), width - 1) * components;
+    }
+
+    for (int row = 0; row < padded; row++)
+    {
+        int sourceRow = std::min(std::max(bottom + row, 0), height - 1);
+        assert(sourceRow >= firstRow);
+        const GLubyte* source = rows + (size_t)(sourceRow - firstRow) * width * components;
+        GLubyte* dest = tile + (size_t)row * padded * components;
+
+        // Inside the level, a run of the row can be copied at once
+        int start = std::max(-left, 0);
+        int end   = std::min(width - left, padded);
+        for (int i = 0; i < start; i++)
+        {
+            memcpy(dest + i * components, source + columns[i], components);
+        }
+        if (end > start)
+        {
+            memcpy(dest + start * components, source + columns[start], (size_t)(end - start) * components);
+        }
+        for (int i = std::max(end, start); i < padded; i++)
+        {
+            memcpy(dest + i * components, source + columns[i], components);
+        }
+    }
+}
@@ -0,0 +1,409 @@
+#include <cassert>
+#include <cstring>
+#include "UniformBuffer.h"
+
+/*
+ * Uniform buffer constructor
+ */
+UniformBuffer::UniformBuffer(GLsizeiptr size, GLenum usage)
+    : bufferId(0),
+    size(size)
+{
+    assert(size > 0);
+
+    // Create the buffer and allocate its storage
+    glGenBuffers(1, &bufferId);
+    glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+    glBufferData(GL_UNIFORM_BUFFER, size, NULL, usage);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/*
+ * Destructor
+ */
+UniformBuffer::~UniformBuffer()
+{
+    glDeleteBuffers(1, &bufferId);
+}
+
+/*
+ * Set data
+ */
+void UniformBuffer::SetData(const GLvoid* data, GLsizeiptr size, GLintptr offset)
+{
+    assert(data != NULL);
+    assert(offset >= 0 && offset + size <= this->size);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/*
+ * Bind
+ */
+void UniformBuffer::Bind(GLuint binding) const
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, bufferId);
+}
+
+/*
+ * Bind range
+ */
+void UniformBuffer::BindRange(GLuint binding, GLintptr offset, GLsizeiptr size) const
+{
+    assert(offset >= 0 && offset + size <= this->size);
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, bufferId, offset, size);
+}
+
+/*
+ * Map range
+ */
+GLvoid* UniformBuffer::MapRange(GLintptr offset, GLsizeiptr size, GLbitfield access)
+{
+    assert(offset >= 0 && offset + size <= this->size);
+    assert((access & GL_MAP_WRITE_BIT) != 0);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+    return glMapBufferRange(GL_UNIFORM_BUFFER, offset, size, access);
+}
+
+/*
+ * Unmap
+ */
+void UniformBuffer::Unmap()
+{
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/*
+ * Std140 layout constructor
+ */
+Std140Layout::Std140Layout()
+    : data(),
+    used(0)
+{
+}
+
+/*
+ * Add float
+ */
+GLintptr Std140Layout::Add(float value)
+{
+    GLintptr offset = Reserve(4, 4);
+    Set(offset, value);
+    return offset;
+}
+
+/*
+ * Add int
+ */
+GLintptr Std140Layout::Add(int value)
+{
+    GLintptr offset = Reserve(4, 4);
+    Set(offset, value);
+    return offset;
+}
+
+/*
+ * Add vec2
+ */
+GLintptr Std140Layout::Add(const vec2& value)
+{
+    GLintptr offset = Reserve(8, 8);
+    Set(offset, value);
+    return offset;
+}
+
+/*
+ * Add vec3
+ */
+GLintptr Std140Layout::Add(const vec3& value)
+{
+    // vec3's are aligned like vec4's, but a following scalar can use the
+    // fourth component
+    GLintptr offset = Reserve(16, 12);
+    Set(offset, value);
+    return offset;
+}
+
+/*
+ * Add vec4
+ */
+GLintptr Std140Layout::Add(const vec4& value)
+{
+    GLintptr offset = Reserve(16, 16);
+    Set(offset, value);
+    return offset;
+}
+
+/*
+ * Add mat2
+ */
+GLintptr Std140Layout::Add(const mat2& value)
+{
+    // Matrices are arrays of column vectors, and array elements are
+    // always padded out to a vec4
+    GLintptr offset = Reserve(16, 2 * 16);
+    Set(offset, value);
+    return offset;
+}
+
+/*
+ * Add mat3
+ */
+GLintptr Std140Layout::Add(const mat3& value)
+{
+    GLintptr offset = Reserve(16, 3 * 16);
+    Set(offset, value);
+    return offset;
+}
+
+/*
+ * Add mat4
+ */
+GLintptr Std140Layout::Add(const mat4& value)
+{
+    GLintptr offset = Reserve(16, 4 * 16);
+    Set(offset, value);
+    return offset;
+}
+
+/*
+ * Set float
+ */
+void Std140Layout::Set(GLintptr offset, float value)
+{
+    Write(offset, &value, 1);
+}
+
+/*
+ * Set int
+ */
+void Std140Layout::Set(GLintptr offset, int value)
+{
+    assert(offset >= 0 && offset + 4 <= (GLintptr)data.size());
+    memcpy(&data[offset], &value, sizeof(GLint));
+}
+
+/*
+ * Set vec2
+ */
+void Std140Layout::Set(GLintptr offset, const vec2& value)
+{
+    Write(offset, value, 2);
+}
+
+/*
+ * Set vec3
+ */
+void Std140Layout::Set(GLintptr offset, const vec3& value)
+{
+    Write(offset, value, 3);
+}
+
+/*
+ * Set vec4
+ */
+void Std140Layout::Set(GLintptr offset, const vec4& value)
+{
+    Write(offset, value, 4);
+}
+
+/*
+ * Set mat2
+ */
+void Std140Layout::Set(GLintptr offset, const mat2& value)
+{
+    // Columns of the GLSL matrix are the rows of the mat2
+    for (int column = 0; column < 2; column++)
+    {
+        GLfloat values[] = { value[0][column], value[1][column] };
+        Write(offset + column * 16, values, 2);
+    }
+}
+
+/*
+ * Set mat3
+ */
+void Std140Layout::Set(GLintptr offset, const mat3& value)
+{
+    for (int column = 0; column < 3; column++)
+    {
+        GLfloat values[] = { value[0][column], value[1][column], value[2][column] };
+        Write(offset + column * 16, values, 3);
+    }
+}
+
+/*
+ * Set mat4
+ */
+void Std140Layout::Set(GLintptr offset, const mat4& value)
+{
+    for (int column = 0; column < 4; column++)
+    {
+        GLfloat values[] =
+        {
+            value[0][column],
+            value[1][column],
+            value[2][column],
+            value[3][column]
+        };
+        Write(offset + column * 16, values, 4);
+    }
+}
+
+/*
+ * Clear
+ */
+void Std140Layout::Clear()
+{
+    data.clear();
+    used = 0;
+}
+
+/*
+ * Get size
+ */
+GLsizeiptr Std140Layout::GetSize() const
+{
+    return (GLsizeiptr)data.size();
+}
+
+/*
+ * Reserve
+ */
+GLintptr Std140Layout::Reserve(GLintptr alignment, GLsizeiptr size)
+{
+    GLintptr offset = (used + alignment - 1) & ~(alignment - 1);
+    used = offset + size;
+
+    // Keep the storage padded to a multiple of 16 bytes, so the data can
+    // be copied as a complete block.  The padding is free for the next member
+    data.resize((used + 15) & ~(GLsizeiptr)15, 0);
+    return offset;
+}
+
+/*
+ * Write
+ */
+void Std140Layout::Write(GLintptr offset, const GLfloat* values, int count)
+{
+    assert(offset >= 0 && offset + count * 4 <= (GLintptr)data.size());
+    memcpy(&data[offset], values, count * sizeof(GLfloat));
+}
+
+/*
+ * Uniform ring buffer constructor
+ */
+UniformRingBuffer::UniformRingBuffer(GLsizeiptr size)
+    : buffer(new UniformBuffer(size, GL_STREAM_DRAW)),
+    staging(),
+    alignment(256),
+    head(0),
+    frameBase(0)
+{
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+}
+
+/*
+ * Destructor
+ */
+UniformRingBuffer::~UniformRingBuffer()
+{
+    delete buffer;
+}
+
+/*
+ * Begin
+ */
+void UniformRingBuffer::Begin()
+{
+    staging.clear();
+}
+
+/*
+ * Push
+ */
+GLintptr UniformRingBuffer::Push(const GLvoid* data, GLsizeiptr size)
+{
+    assert(data != NULL && size > 0);
+
+    GLintptr offset = (GLintptr)staging.size();
+    GLsizeiptr padded = (size + alignment - 1) & ~(GLsizeiptr)(alignment - 1);
+    staging.resize(offset + padded, 0);
+    memcpy(&staging[offset], data, size);
+    return offset;
+}
+
+/*
+ * Push std140 block
+ */
+GLintptr UniformRingBuffer::Push(const Std140Layout& block)
+{
+    return Push(block.GetData(), block.GetSize());
+}
+
+/*
+ * Upload
+ */
+void UniformRingBuffer::Upload()
+{
+    GLsizeiptr frameSize = (GLsizeiptr)staging.size();
+    if (frameSize == 0)
+    {
+        return;
+    }
+
+    // A frame larger than the whole ring needs a bigger buffer
+    if (frameSize > buffer->GetSize())
+    {
+        GLsizeiptr size = buffer->GetSize();
+        while (size < frameSize)
+        {
+            size *= 2;
+        }
+        delete buffer;
+        buffer = new UniformBuffer(size, GL_STREAM_DRAW);
+        head = 0;
+    }
+
+    // Regions ahead of the head aren't used by any frame still in flight,
+    // so they can be written without synchronizing.  When wrapping, orphan
+    // the storage so the driver hands back fresh memory instead of stalling
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    if (head + frameSize > buffer->GetSize())
+    {
+        head = 0;
+        access |= GL_MAP_INVALIDATE_BUFFER_BIT;
+    }
+    else
+    {
+        access |= GL_MAP_INVALIDATE_RANGE_BIT;
+    }
+
+    frameBase = head;
+    GLvoid* mapped = buffer->MapRange(frameBase, frameSize, access);
+    if (mapped != NULL)
+    {
+        memcpy(mapped, &staging[0], frameSize);
+        buffer->Unmap();
+    }
+    else
+    {
+        buffer->SetData(&staging[0], frameSize, frameBase);
+    }
+
+    head = frameBase + frameSize;
+}
+
+/*
+ * Bind range
+ */
+void UniformRingBuffer::BindRange(GLuint binding, GLintptr offset, GLsizeiptr size) const
+{
+    assert(offset >= 0 && offset + size <= (GLintptr)staging.size());
+    buffer->BindRange(binding, frameBase + offset, size);
+}
@@ -1,4 +1,7 @@
 #include <cassert>
+#include <vector>
+#include "HalfFloat.h"
+#include "ProgramPipeline.h"
 #include "VertexArray.h"
 
 int VertexArray::activeVertexArrayId = 0;
@@ -19,6 +22,65 @@ bool LexicographicalOrder(const char* str1, const char* str2)
     return cmp < 0;
 }
 
+/**
+ * \brief Converts a float in [-1,1] to a 10-bit signed normalized integer
+ *
+ * \param[in] value - Value to convert, clamped to [-1,1]
+ * \return The 10-bit two's complement value in the low bits of the result
+ */
+static inline GLuint PackSnorm10(float value)
+{
+    value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+    int scaled = (int)floor(value * 511.0f + 0.5f);
+    return (GLuint)scaled & 0x3ff;
+}
+
+/**
+ * \brief Converts a float in [-1,1] to a 2-bit signed normalized integer
+ *
+ * \param[in] value - Value to convert, clamped to [-1,1]
+ * \return The 2-bit two's complement value in the low bits of the result
+ */
+static inline GLuint PackSnorm2(float value)
+{
+    value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+    int scaled = (int)floor(value + 0.5f);
+    return (GLuint)scaled & 0x3;
+}
+
+/**
+ * \brief Converts a float in [0,1] to a normalized unsigned byte
+ *
+ * \param[in] value - Value to convert, clamped to [0,1]
+ * \return The normalized byte
+ */
+static inline GLubyte PackUnorm8(float value)
+{
+    value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+    return (GLubyte)(value * 255.0f + 0.5f);
+}
+
+/**
+ * \brief Finds the largest value in an array of indices
+ *
+ * \param[in] indices - Array of indices
+ * \param[in] length  - Number of indices
+ * \return The largest index, or 0 if the array is empty
+ */
+template<class T>
+static T MaxIndex(const T* indices, int length)
+{
+    T maxIndex = 0;
+    for (int i = 0; i < length; i++)
+    {
+        if (indices[i] > maxIndex)
+        {
+            maxIndex = indices[i];
+        }
+    }
+    return maxIndex;
+}
+
 /*
  * Default constructor
  */
@@ -26,6 +88,8 @@ VertexArray::VertexArray()
     : numVertices(0), 
     numIndices(0),
     indicesId(0), 
+    indicesType(GL_UNSIGNED_INT),
+    indicesSize(0),
     id(vertexArrayIdCounter++),
     attributes(),//LexicographicalOrder)
     vertexArrayIds()
@@ -74,7 +138,26 @@ VertexArray::~VertexArray()
 void VertexArray::Bind(const Shader& shader)
 {
     assert(shader.IsBound());
+    BindVAO(shader);
+}
+
+/*
+ * Bind for program pipeline
+ */
+void VertexArray::Bind(const ProgramPipeline& pipeline)
+{
+    assert(pipeline.IsBound() && pipeline.GetVertexStage() != NULL);
+
+    // Attributes belong to the vertex stage, so its VAO works whatever the
+    // other stages are
+    BindVAO(*pipeline.GetVertexStage());
+}
 
+/*
+ * Bind VAO
+ */
+void VertexArray::BindVAO(const Shader& shader)
+{
     // Check if we have a current VAO for this shader
     if (vertexArrayIds.count(shader.GetProgramId()) == 0 ||
         vertexArrayIds[shader.GetProgramId()].stale)
@@ -108,8 +191,14 @@ bool VertexArray::IsBound() const
 /*
  * Add Attribute vec2
  */
-void VertexArray::AddAttribute(const char* name, const vec2* data, int length)
+void VertexArray::AddAttribute(const char* name, const vec2* data, int length, Packing packing)
 {
+    if (packing != PACK_NONE)
+    {
+        AddPackedAttribute(name, &(data[0].x), 2, sizeof(vec2), length, packing);
+        return;
+    }
+
     AddAttributeCommon(
         name, 
         (float*)&(data[0].x), // Point to the first component of the first vector
@@ -122,8 +211,14 @@ void VertexArray::AddAttribute(const char* name, const vec2* data, int length)
 /*
  * Add Attribute vec3
  */
-void VertexArray::AddAttribute(const char* name, const vec3* data, int length)
+void VertexArray::AddAttribute(const char* name, const vec3* data, int length, Packing packing)
 {
+    if (packing != PACK_NONE)
+    {
+        AddPackedAttribute(name, &(data[0].x), 3, sizeof(vec3), length, packing);
+        return;
+    }
+
     AddAttributeCommon(
         name, 
         (float*)&(data[0].x), // Point to the first component of the first vector
@@ -136,8 +231,14 @@ void VertexArray::AddAttribute(const char* name, const vec3* data, int length)
 /*
  * Add Attribute vec4
  */
-void VertexArray::AddAttribute(const char* name, const vec4* data, int length)
+void VertexArray::AddAttribute(const char* name, const vec4* data, int length, Packing packing)
 {
+    if (packing != PACK_NONE)
+    {
+        AddPackedAttribute(name, &(data[0].x), 4, sizeof(vec4), length, packing);
+        return;
+    }
+
     AddAttributeCommon(
         name, 
         (float*)&(data[0].x), // Point to the first component of the first vector
@@ -270,6 +371,136 @@ void VertexArray::AddAttributeCommon(
     int         length,
     GLsizei     stride,
     GLenum      type)
+{
+    AddAttributeBuffer(
+        name,
+        data,
+        numComponents * length * sizeof(T),
+        numComponents,
+        length,
+        stride,
+        type,
+        GL_FALSE);
+}
+
+/*
+ * Add packed attribute
+ */
+void VertexArray::AddPackedAttribute(
+    const char*  name,
+    const float* data,
+    int          numComponents,
+    size_t       vectorSize,
+    int          length,
+    Packing      packing)
+{
+    assert(numComponents >= 2 && numComponents <= 4);
+    assert(length > 0);
+
+    // Walk the vectors by their real size in case they carry padding
+    const GLubyte* bytes = (const GLubyte*)data;
+
+    // vec3's are padded out to 4 components to keep each vertex 4-byte aligned
+    int packedComponents = numComponents == 3 ? 4 : numComponents;
+
+    switch (packing)
+    {
+    case PACK_INT_2_10_10_10:
+        {
+            // The format always has 4 components, so vec2's can't use it
+            assert(numComponents >= 3);
+
+            std::vector<GLuint> packed(length);
+            for (int i = 0; i < length; i++)
+            {
+                const float* v = (const float*)(bytes + i * vectorSize);
+                float w = numComponents == 4 ? v[3] : 0.0f;
+                packed[i] = PackSnorm10(v[0])         |
+                            (PackSnorm10(v[1]) << 10) |
+                            (PackSnorm10(v[2]) << 20) |
+                            (PackSnorm2(w)     << 30);
+            }
+
+            AddAttributeBuffer(
+                name,
+                &packed[0],
+                packed.size() * sizeof(GLuint),
+                4,
+                length,
+                0,
+                GL_INT_2_10_10_10_REV,
+                GL_TRUE);
+        }
+        break;
+
+    case PACK_HALF_FLOAT:
+        {
+            std::vector<GLushort> packed(length * packedComponents);
+            for (int i = 0; i < length; i++)
+            {
+                const float* v = (const float*)(bytes + i * vectorSize);
+                for (int c = 0; c < packedComponents; c++)
+                {
+                    packed[i * packedComponents + c] =
+                        FloatToHalf(c < numComponents ? v[c] : 1.0f);
+                }
+            }
+
+            AddAttributeBuffer(
+                name,
+                &packed[0],
+                packed.size() * sizeof(GLushort),
+                packedComponents,
+                length,
+                0,
+                GL_HALF_FLOAT,
+                GL_FALSE);
+        }
+        break;
+
+    case PACK_UNORM_BYTE:
+        {
+            std::vector<GLubyte> packed(length * packedComponents);
+            for (int i = 0; i < length; i++)
+            {
+                const float* v = (const float*)(bytes + i * vectorSize);
+                for (int c = 0; c < packedComponents; c++)
+                {
+                    packed[i * packedComponents + c] =
+                        PackUnorm8(c < numComponents ? v[c] : 1.0f);
+                }
+            }
+
+            AddAttributeBuffer(
+                name,
+                &packed[0],
+                packed.size() * sizeof(GLubyte),
+                packedComponents,
+                length,
+                0,
+                GL_UNSIGNED_BYTE,
+                GL_TRUE);
+        }
+        break;
+
+    default:
+        // PACK_NONE is handled by the regular float path
+        assert(false);
+    }
+}
+
+/*
+ * Add attribute buffer
+ */
+void VertexArray::AddAttributeBuffer(
+    const char*   name,
+    const GLvoid* data,
+    GLsizeiptr    size,
+    int           numComponents,
+    int           length,
+    GLsizei       stride,
+    GLenum        type,
+    GLboolean     normalized)
 {
     // We cannot be currently bound for drawing while making changes to the
     // data in our VertexArray
@@ -296,7 +527,8 @@ void VertexArray::AddAttributeCommon(
 
         if (attribute.type != type ||
             attribute.numComponents != numComponents ||
-            attribute.stride != stride)
+            attribute.stride != stride ||
+            attribute.normalized != normalized)
         {
             // The attribute data is being replaced with data of a different
             // format, invalidating previously created VAOs
@@ -317,7 +549,7 @@ void VertexArray::AddAttributeCommon(
     // This will destroy any existing data in the buffer
     glBindBuffer(GL_ARRAY_BUFFER, attribute.bufferId);
     glBufferData(GL_ARRAY_BUFFER,
-        numComponents * length * sizeof(T),
+        size,
         data,
         GL_STATIC_DRAW);
     
@@ -325,6 +557,8 @@ void VertexArray::AddAttributeCommon(
     attribute.type = type;
     attribute.numComponents = numComponents;
     attribute.stride = stride;
+    attribute.normalized = normalized;
+    attribute.size = size;
 
     // Save the attribute to our map
     attributes[str] = attribute;
@@ -386,7 +620,7 @@ void VertexArray::GenerateVAO(const Shader& shader)
             (GLuint)location,
             attribute.numComponents,
             attribute.type,
-            GL_FALSE,
+            attribute.normalized,
             attribute.stride,
             0);
     }
@@ -422,7 +656,22 @@ void VertexArray::MarkVAOsAsStale()
  */
 void VertexArray::AddIndices(const unsigned int* indices, int length)
 {
-    AddIndicesCommon(indices, length, GL_UNSIGNED_INT);
+    // Store the indices in the smallest type that can hold all of them
+    unsigned int maxIndex = MaxIndex(indices, length);
+    if (length > 0 && maxIndex <= 0xff)
+    {
+        std::vector<unsigned char> narrowed(indices, indices + length);
+        AddIndicesCommon(&narrowed[0], length, GL_UNSIGNED_BYTE);
+    }
+    else if (length > 0 && maxIndex <= 0xffff)
+    {
+        std::vector<unsigned short> narrowed(indices, indices + length);
+        AddIndicesCommon(&narrowed[0], length, GL_UNSIGNED_SHORT);
+    }
+    else
+    {
+        AddIndicesCommon(indices, length, GL_UNSIGNED_INT);
+    }
 }
 
 /*
@@ -430,7 +679,17 @@ void VertexArray::AddIndices(const unsigned int* indices, int length)
  */
 void VertexArray::AddIndices(const unsigned short* indices, int length)
 {
-    AddIndicesCommon(indices, length, GL_UNSIGNED_SHORT);
+    // Store the indices in the smallest type that can hold all of them
+    unsigned short maxIndex = MaxIndex(indices, length);
+    if (length > 0 && maxIndex <= 0xff)
+    {
+        std::vector<unsigned char> narrowed(indices, indices + length);
+        AddIndicesCommon(&narrowed[0], length, GL_UNSIGNED_BYTE);
+    }
+    else
+    {
+        AddIndicesCommon(indices, length, GL_UNSIGNED_SHORT);
+    }
 }
 
 /*
@@ -478,6 +737,7 @@ void VertexArray::AddIndicesCommon(const T* indices, int length, GLenum type)
     // Save the number and type of the indices for reference later
     numIndices  = length;
     indicesType = type;
+    indicesSize = length * sizeof(T);
 }
 
 /*
@@ -499,3 +759,136 @@ void VertexArray::Draw(GLenum mode) const
     }
 }
 
+/*
+ * Draw range
+ */
+void VertexArray::DrawRange(GLenum mode, int first, int count, int baseVertex) const
+{
+    // We must be bound
+    assert(IsBound());
+    assert(first >= 0 && count >= 0);
+
+    if (HasIndices())
+    {
+        assert(first + count <= NumIndices());
+
+        // The indices pointer is a byte offset into the bound index buffer
+        GLvoid* offset = BUFFER_OFFSET(first * IndexSize());
+        if (baseVertex != 0)
+        {
+            glDrawElementsBaseVertex(mode, count, IndicesType(), offset, baseVertex);
+        }
+        else
+        {
+            glDrawElements(mode, count, IndicesType(), offset);
+        }
+    }
+    else
+    {
+        assert(baseVertex + first + count <= NumVertices());
+        glDrawArrays(mode, baseVertex + first, count);
+    }
+}
+
+/*
+ * Draw ranges
+ */
+void VertexArray::DrawRanges(GLenum mode, const Range* ranges, int numRanges) const
+{
+    // We must be bound
+    assert(IsBound());
+    assert(ranges != NULL || numRanges == 0);
+
+    if (numRanges <= 0)
+    {
+        return;
+    }
+
+    // The multi-draw calls take separate arrays of each property
+    rangeCounts.resize(numRanges);
+    rangeFirsts.resize(numRanges);
+    if (HasIndices())
+    {
+        rangeOffsets.resize(numRanges);
+    }
+
+    GLsizeiptr indexSize = HasIndices() ? IndexSize() : 0;
+    for (int i = 0; i < numRanges; i++)
+    {
+        rangeCounts[i] = ranges[i].count;
+        if (HasIndices())
+        {
+            rangeOffsets[i] = BUFFER_OFFSET(ranges[i].first * indexSize);
+            rangeFirsts[i]  = ranges[i].baseVertex;
+        }
+        else
+        {
+            rangeFirsts[i]  = ranges[i].baseVertex + ranges[i].first;
+        }
+    }
+
+    if (HasIndices())
+    {
+        glMultiDrawElementsBaseVertex(
+            mode,
+            &rangeCounts[0],
+            IndicesType(),
+            &rangeOffsets[0],
+            numRanges,
+            &rangeFirsts[0]);
+    }
+    else
+    {
+        glMultiDrawArrays(mode, &rangeFirsts[0], &rangeCounts[0], numRanges);
+    }
+}
+
+/*
+ * Draw instanced
+ */
+void VertexArray::DrawInstanced(GLenum mode, int instanceCount) const
+{
+    // We must be bound
+    assert(IsBound());
+    assert(instanceCount >= 0);
+
+    if (HasIndices())
+    {
+        glDrawElementsInstanced(mode, NumIndices(), IndicesType(), NULL, instanceCount);
+    }
+    else
+    {
+        glDrawArraysInstanced(mode, 0, NumVertices(), instanceCount);
+    }
+}
+
+/*
+ * Index size
+ */
+GLsizeiptr VertexArray::IndexSize() const
+{
+    switch (indicesType)
+    {
+    case GL_UNSIGNED_BYTE:
+        return sizeof(GLubyte);
+    case GL_UNSIGNED_SHORT:
+        return sizeof(GLushort);
+    default:
+        return sizeof(GLuint);
+    }
+}
+
+/*
+ * Num bytes
+ */
+GLsizeiptr VertexArray::NumBytes() const
+{
+    GLsizeiptr total = indicesSize;
+    for (AttributeMap::const_iterator it = attributes.begin();
+         it != attributes.end();
+         it++)
+    {
+        total += it->second.size;
+    }
+    return total;
+}
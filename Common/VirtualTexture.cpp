@@ -0,0 +1,509 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include "Texture2D.h"
+#include "ThreadPool.h"
+#include "TilePyramid.h"
+#include "VirtualTexture.h"
+
+/*
+ * Guards the results of loads, which are written by the workers and read
+ * by the main thread
+ */
+static std::mutex loadMutex;
+
+/*
+ * A tile being read
+ */
+struct VirtualTexture::Load
+{
+    Load(int level, int x, int y, size_t bytes)
+        : level(level),
+        x(x),
+        y(y),
+        pixels(bytes),
+        done(false),
+        ok(false)
+    {
+    }
+
+    int level; //!< Level of the tile
+    int x;     //!< Column of the tile in its level
+    int y;     //!< Row of the tile in its level
+    std::vector<GLubyte> pixels; //!< Pixels of the tile with its border
+
+    // Written by the worker, guarded by loadMutex
+    bool done; //!< Set once the read finished
+    bool ok;   //!< Whether the tile could be read
+};
+
+/*
+ * Constructor
+ */
+VirtualTexture::VirtualTexture(const char* filename, int pagesAcross, int maxPendingLoads)
+    : pyramid(new TilePyramid(filename)),
+    pagesAcross(pagesAcross),
+    maxPendingLoads(maxPendingLoads),
+    cache(NULL),
+    indirection(NULL),
+    frame(1)
+{
+    // Page coordinates are stored in 8 bits each
+    assert(pagesAcross >= 1 && pagesAcross <= 256);
+    assert(maxPendingLoads >= 1);
+
+    if (!pyramid->IsValid())
+    {
+        return;
+    }
+
+    // The last level is read now and never leaves the cache, so there is
+    // always something to draw
+    int root = pyramid->GetNumLevels() - 1;
+    std::vector<GLubyte> rootPixels(pyramid->GetTileBytes());
+    if (!pyramid->ReadTile(root, 0, 0, &rootPixels[0]))
+    {
+        std::cerr << "Unable to read the last level of " << filename << std::endl;
+        return;
+    }
+
+    static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    static const GLenum internalFormats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+    int components = pyramid->GetComponents();
+    int cacheSize  = pagesAcross * pyramid->GetPaddedTileSize();
+    cache = new Texture2D(
+        internalFormats[components - 1], formats[components - 1], GL_UNSIGNED_BYTE,
+        cacheSize, cacheSize, GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+
+    // Every level of the indirection texture starts out pointing at the
+    // last level, in page 0
+    int grid = pyramid->GetGridSize(0);
+    indirection = new Texture2D(
+        GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, grid, grid,
+        GL_NEAREST_MIPMAP_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+
+    tilePages.assign(pyramid->GetNumTiles(), notResident);
+    Page freePage = { -1, 0, 0, 0, 0 };
+    pages.assign(pagesAcross * pagesAcross, freePage);
+    entries.resize(pyramid->GetNumLevels());
+    dirty.resize(pyramid->GetNumLevels());
+    std::vector<GLubyte> levels;
+    for (int level = 0; level <= root; level++)
+    {
+        int size = pyramid->GetGridSize(level);
+        entries[level].assign((size_t)size * size * 4, 0);
+        Rect clean = { size, size, 0, 0 };
+        dirty[level] = clean;
+        for (size_t i = 0; i < entries[level].size(); i += 4)
+        {
+            entries[level][i + 2] = (GLubyte)root;
+            entries[level][i + 3] = 255;
+        }
+        levels.insert(levels.end(), entries[level].begin(), entries[level].end());
+    }
+    indirection->SetLevels(&levels[0], root + 1);
+
+    Page rootPage = { pyramid->GetTileIndex(root, 0, 0), root, 0, 0, 0 };
+    pages[0] = rootPage;
+    tilePages[rootPage.tile] = 0;
+    cache->SetSubImage(
+        0, 0, 0, pyramid->GetPaddedTileSize(), pyramid->GetPaddedTileSize(), &rootPixels[0]);
+    stats.tilesLoaded++;
+    stats.bytesRead += rootPixels.size();
+}
+
+/*
+ * Destructor
+ */
+VirtualTexture::~VirtualTexture()
+{
+    // Loads still running hold their own references to the pyramid
+    delete cache;
+    delete indirection;
+}
+
+/*
+ * Get width
+ */
+int VirtualTexture::GetWidth() const
+{
+    return pyramid->GetWidth();
+}
+
+/*
+ * Get height
+ */
+int VirtualTexture::GetHeight() const
+{
+    return pyramid->GetHeight();
+}
+
+/*
+ * Get number of levels
+ */
+int VirtualTexture::GetNumLevels() const
+{
+    return pyramid->GetNumLevels();
+}
+
+/*
+ * Get level
+ */
+int VirtualTexture::GetLevel(float pixelsPerScreenPixel) const
+{
+    if (pixelsPerScreenPixel <= 1.0f)
+    {
+        return 0;
+    }
+    int level = (int)floor(log(pixelsPerScreenPixel) / log(2.0f));
+    return std::min(level, pyramid->GetNumLevels() - 1);
+}
+
+/*
+ * Request region
+ */
+void VirtualTexture::RequestRegion(float u0, float v0, float u1, float v1, int level)
+{
+    assert(IsValid());
+    assert(level >= 0 && level < pyramid->GetNumLevels());
+
+    // Only the tiles covering the image are requested, however far past
+    // it the region reaches
+    int levelWidth  = std::max(pyramid->GetWidth()  >> level, 1);
+    int levelHeight = std::max(pyramid->GetHeight() >> level, 1);
+    int tileSize = pyramid->GetTileSize();
+    int lastX = (levelWidth  - 1) / tileSize;
+    int lastY = (levelHeight - 1) / tileSize;
+
+    int x0 = std::max((int)floor(std::min(u0, u1) * levelWidth  / tileSize), 0);
+    int y0 = std::max((int)floor(std::min(v0, v1) * levelHeight / tileSize), 0);
+    int x1 = std::min((int)floor(std::max(u0, u1) * levelWidth  / tileSize), lastX);
+    int y1 = std::min((int)floor(std::max(v0, v1) * levelHeight / tileSize), lastY);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            Touch(level, x, y);
+        }
+    }
+}
+
+/*
+ * Update
+ */
+void VirtualTexture::Update()
+{
+    assert(IsValid());
+
+    // Tiles that finished reading go into the cache
+    for (size_t i = 0; i < loads.size(); )
+    {
+        bool done;
+        {
+            std::unique_lock<std::mutex> lock(loadMutex);
+            done = loads[i]->done;
+        }
+
+        if (done)
+        {
+            FinishLoad(*loads[i]);
+            loads.erase(loads.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    // Reading more tiles than there are pages not drawn this frame would
+    // only drop them once read
+    int root = pyramid->GetNumLevels() - 1;
+    int available = -(int)loads.size();
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+        if (pages[i].tile < 0 || (pages[i].level != root && pages[i].lastUsed < frame))
+        {
+            available++;
+        }
+    }
+
+    // The requested tiles are read coarsest first, so the tiles others fall
+    // back to arrive before them, as far as the limits allow.  The rest are
+    // asked for again next frame if still needed
+    std::stable_sort(requested.begin(), requested.end(), IsCoarser);
+    for (size_t i = 0; i < requested.size(); i++)
+    {
+        const Request& request = requested[i];
+        if ((int)loads.size() < maxPendingLoads && available > 0)
+        {
+            StartLoad(request.level, request.x, request.y);
+            available--;
+        }
+        else
+        {
+            tilePages[pyramid->GetTileIndex(request.level, request.x, request.y)] = notResident;
+        }
+    }
+    requested.clear();
+
+    UploadEntries();
+    frame++;
+}
+
+/*
+ * Bind
+ */
+void VirtualTexture::Bind(int cacheUnit, int indirectionUnit)
+{
+    assert(IsValid());
+
+    cache->Bind(cacheUnit);
+    indirection->Bind(indirectionUnit);
+}
+
+/*
+ * Get texture coordinate scale
+ */
+vec2 VirtualTexture::GetTexCoordScale() const
+{
+    float gridPixels = (float)pyramid->GetGridSize(0) * pyramid->GetTileSize();
+    return vec2(pyramid->GetWidth() / gridPixels, pyramid->GetHeight() / gridPixels);
+}
+
+/*
+ * Get shader parameters
+ */
+vec4 VirtualTexture::GetShaderParams() const
+{
+    return vec4(
+        (float)pyramid->GetGridSize(0) * pyramid->GetTileSize(),
+        (float)pyramid->GetTileSize(),
+        (float)pyramid->GetBorder(),
+        (float)pagesAcross * pyramid->GetPaddedTileSize());
+}
+
+/*
+ * Get number of resident tiles
+ */
+int VirtualTexture::GetNumResidentTiles() const
+{
+    int resident = 0;
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+        if (pages[i].tile >= 0)
+        {
+            resident++;
+        }
+    }
+    return resident;
+}
+
+/*
+ * Get memory used
+ */
+GLsizeiptr VirtualTexture::GetMemoryUsed() const
+{
+    if (!IsValid())
+    {
+        return 0;
+    }
+    return cache->GetMemoryUsed() + indirection->GetMemoryUsed() +
+        (GLsizeiptr)(loads.size() * pyramid->GetTileBytes());
+}
+
+/*
+ * Touch
+ */
+void VirtualTexture::Touch(int level, int x, int y)
+{
+    for (; level < pyramid->GetNumLevels(); level++, x >>= 1, y >>= 1)
+    {
+        int tile = pyramid->GetTileIndex(level, x, y);
+        int page = tilePages[tile];
+        if (page >= 0)
+        {
+            pages[page].lastUsed = frame;
+        }
+        else if (page == notResident && pyramid->HasTile(level, x, y))
+        {
+            Request request = { level, x, y };
+            tilePages[tile] = wanted;
+            requested.push_back(request);
+        }
+    }
+}
+
+/*
+ * Is coarser
+ */
+bool VirtualTexture::IsCoarser(const Request& a, const Request& b)
+{
+    return a.level > b.level;
+}
+
+/*
+ * Start load
+ */
+void VirtualTexture::StartLoad(int level, int x, int y)
+{
+    tilePages[pyramid->GetTileIndex(level, x, y)] = loading;
+
+    std::shared_ptr<Load> load(new Load(level, x, y, pyramid->GetTileBytes()));
+    loads.push_back(load);
+
+    std::shared_ptr<TilePyramid> file = pyramid;
+    ThreadPool::GetShared().Submit([load, file]()
+    {
+        bool ok = file->ReadTile(load->level, load->x, load->y, &load->pixels[0]);
+
+        std::unique_lock<std::mutex> lock(loadMutex);
+        load->ok   = ok;
+        load->done = true;
+    });
+}
+
+/*
+ * Finish load
+ */
+void VirtualTexture::FinishLoad(const Load& load)
+{
+    int tile = pyramid->GetTileIndex(load.level, load.x, load.y);
+    if (!load.ok)
+    {
+        std::cerr << "Unable to read tile " << load.x << "," << load.y
+            << " of level " << load.level << std::endl;
+        tilePages[tile] = notResident;
+        return;
+    }
+
+    // A free page is used first, then the one requested least recently.
+    // Pages used this frame are still being drawn, and the last level
+    // never leaves
+    int root = pyramid->GetNumLevels() - 1;
+    int page = -1;
+    for (int i = 0; i < (int)pages.size(); i++)
+    {
+        if (pages[i].tile < 0)
+        {
+            page = i;
+            break;
+        }
+        if (pages[i].level != root && pages[i].lastUsed < frame &&
+            (page < 0 || pages[i].lastUsed < pages[page].lastUsed))
+        {
+            page = i;
+        }
+    }
+    if (page < 0)
+    {
+        tilePages[tile] = notResident;
+        stats.tilesDropped++;
+        return;
+    }
+
+    Page& slot = pages[page];
+    if (slot.tile >= 0)
+    {
+        tilePages[slot.tile] = notResident;
+        UpdateEntries(slot.level, slot.x, slot.y);
+        stats.tilesEvicted++;
+    }
+
+    slot.tile     = tile;
+    slot.level    = load.level;
+    slot.x        = load.x;
+    slot.y        = load.y;
+    slot.lastUsed = frame;
+    tilePages[tile] = page;
+
+    int padded = pyramid->GetPaddedTileSize();
+    cache->SetSubImage(
+        0, (page % pagesAcross) * padded, (page / pagesAcross) * padded,
+        padded, padded, &load.pixels[0]);
+    UpdateEntries(load.level, load.x, load.y);
+
+    stats.tilesLoaded++;
+    stats.bytesRead += load.pixels.size();
+}
+
+/*
+ * Update entries
+ */
+void VirtualTexture::UpdateEntries(int level, int x, int y)
+{
+    // Each level under the tile takes the tile's own page where it is
+    // resident, or the texel of the level above, which was already updated
+    int root = pyramid->GetNumLevels() - 1;
+    for (int current = level; current >= 0; current--)
+    {
+        int shift = level - current;
+        int size  = pyramid->GetGridSize(current);
+        Rect area = { x << shift, y << shift, (x + 1) << shift, (y + 1) << shift };
+
+        for (int row = area.y0; row < area.y1; row++)
+        {
+            for (int column = area.x0; column < area.x1; column++)
+            {
+                GLubyte* entry = &entries[current][((size_t)row * size + column) * 4];
+                int page = tilePages[pyramid->GetTileIndex(current, column, row)];
+                if (page >= 0)
+                {
+                    entry[0] = (GLubyte)(page % pagesAcross);
+                    entry[1] = (GLubyte)(page / pagesAcross);
+                    entry[2] = (GLubyte)current;
+                }
+                else if (current < root)
+                {
+                    int parentSize = pyramid->GetGridSize(current + 1);
+                    const GLubyte* parent =
+                        &entries[current + 1][((size_t)(row >> 1) * parentSize + (column >> 1)) * 4];
+                    entry[0] = parent[0];
+                    entry[1] = parent[1];
+                    entry[2] = parent[2];
+                }
+            }
+        }
+
+        Rect& changed = dirty[current];
+        changed.x0 = std::min(changed.x0, area.x0);
+        changed.y0 = std::min(changed.y0, area.y0);
+        changed.x1 = std::max(changed.x1, area.x1);
+        changed.y1 = std::max(changed.y1, area.y1);
+    }
+}
+
+/*
+ * Upload entries
+ */
+void VirtualTexture::UploadEntries()
+{
+    std::vector<GLubyte> rows;
+    for (int level = 0; level < (int)dirty.size(); level++)
+    {
+        Rect& changed = dirty[level];
+        if (changed.x0 >= changed.x1 || changed.y0 >= changed.y1)
+        {
+            continue;
+        }
+
+        // The changed rows are gathered so only the changed rectangle is sent
+        int size  = pyramid->GetGridSize(level);
+        int width = changed.x1 - changed.x0;
+        rows.resize((size_t)width * (changed.y1 - changed.y0) * 4);
+        for (int row = changed.y0; row < changed.y1; row++)
+        {
+            std::copy(
+                entries[level].begin() + ((size_t)row * size + changed.x0) * 4,
+                entries[level].begin() + ((size_t)row * size + changed.x1) * 4,
+                rows.begin() + (size_t)(row - changed.y0) * width * 4);
+        }
+        indirection->SetSubImage(
+            level, changed.x0, changed.y0, width, changed.y1 - changed.y0, &rows[0]);
+
+        Rect clean = { size, size, 0, 0 };
+        changed = clean;
+    }
+}
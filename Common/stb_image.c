@@ -226,6 +226,12 @@ extern stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, in
 extern stbi_uc *stbi_load            (char const *filename,     int *x, int *y, int *comp, int req_comp);
 extern stbi_uc *stbi_load_from_file  (FILE *f,                  int *x, int *y, int *comp, int req_comp);
 // for stbi_load_from_file, file pointer is left pointing immediately after image
+
+// same as stbi_load, but returns the rows bottom-up (the first row is the
+// bottom of the image), which is the order OpenGL expects.  JPEG, BMP and
+// TGA decoders write each row straight to its final place; other formats
+// are flipped in place afterwards, in which case *flip_pass is set to 1
+extern stbi_uc *stbi_load_bottom_up  (char const *filename,     int *x, int *y, int *comp, int req_comp, int *flip_pass);
 #endif
 
 typedef struct
@@ -404,6 +410,9 @@ typedef struct
 
    uint8 *img_buffer, *img_buffer_end;
    uint8 *img_buffer_original;
+
+   int flip_vertically;   // caller wants the rows bottom-up
+   int flipped;           // set by decoders that wrote the rows bottom-up
 } stbi;
 
 
@@ -416,6 +425,7 @@ static void start_mem(stbi *s, uint8 const *buffer, int len)
    s->read_from_callbacks = 0;
    s->img_buffer = s->img_buffer_original = (uint8 *) buffer;
    s->img_buffer_end = (uint8 *) buffer+len;
+   s->flip_vertically = s->flipped = 0;
 }
 
 // initialize a callback-based context
@@ -426,6 +436,7 @@ static void start_callbacks(stbi *s, stbi_io_callbacks *c, void *user)
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->img_buffer_original = s->buffer_start;
+   s->flip_vertically = s->flipped = 0;
    refill_buffer(s);
 }
 
@@ -570,6 +581,33 @@ unsigned char *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_c
    start_file(&s,f);
    return stbi_load_main(&s,x,y,comp,req_comp);
 }
+
+unsigned char *stbi_load_bottom_up(char const *filename, int *x, int *y, int *comp, int req_comp, int *flip_pass)
+{
+   FILE *f = fopen(filename, "rb");
+   unsigned char *result;
+   stbi s;
+   *flip_pass = 0;
+   if (!f) return epuc("can't fopen", "Unable to open file");
+   start_file(&s,f);
+   s.flip_vertically = 1;
+   result = stbi_load_main(&s,x,y,comp,req_comp);
+   fclose(f);
+   if (result && !s.flipped) {
+      // decoder wrote top-down, so swap the rows in place
+      int i,j, stride = *x * (req_comp ? req_comp : *comp);
+      stbi_uc t;
+      for (j=0; j < *y >> 1; ++j) {
+         stbi_uc *p1 = result +       j     * stride;
+         stbi_uc *p2 = result + (*y - 1 - j) * stride;
+         for (i=0; i < stride; ++i) {
+            t = p1[i], p1[i] = p2[i], p2[i] = t;
+         }
+      }
+      *flip_pass = 1;
+   }
+   return result;
+}
 #endif //!STBI_NO_STDIO
 
 unsigned char *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
@@ -1764,7 +1802,7 @@ static void YCbCr_to_RGB_row(uint8 *out, const uint8 *y, const uint8 *pcb, const
       out[0] = (uint8)r;
       out[1] = (uint8)g;
       out[2] = (uint8)b;
-      out[3] = 255;
+      if (step == 4) out[3] = 255;  // rows may be written bottom-up, so don't spill into the next row
       out += step;
    }
 }
@@ -1860,7 +1898,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
 
       // now go ahead and resample
       for (j=0; j < z->s->img_y; ++j) {
-         uint8 *out = output + n * z->s->img_x * j;
+         uint8 *out = output + n * z->s->img_x * (z->s->flip_vertically ? z->s->img_y - 1 - j : j);
          for (k=0; k < decode_n; ++k) {
             stbi_resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -1886,7 +1924,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
             } else
                for (i=0; i < z->s->img_x; ++i) {
                   out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
+                  if (n == 4) out[3] = 255;
                   out += n;
                }
          } else {
@@ -1898,6 +1936,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
          }
       }
       cleanup_jpeg(z);
+      z->s->flipped = z->s->flip_vertically;
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
       if (comp) *comp  = z->s->img_n; // report original components, not output
@@ -2974,6 +3013,11 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    if (bpp == 1) return epuc("monochrome", "BMP type not supported: 1-bit");
    flip_vertically = ((int) s->img_y) > 0;
    s->img_y = abs((int) s->img_y);
+   if (s->flip_vertically) {
+      // rows are stored bottom-up unless the height is negative
+      flip_vertically = !flip_vertically;
+      s->flipped = 1;
+   }
    if (hsz == 12) {
       if (bpp < 24)
          psize = (offset - 14 - 24) / 3;
@@ -3054,6 +3098,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       else { free(out); return epuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       for (j=0; j < (int) s->img_y; ++j) {
+         z = (flip_vertically ? (int) s->img_y-1-j : j) * s->img_x * target;
          for (i=0; i < (int) s->img_x; i += 2) {
             int v=get8(s),v2=0;
             if (bpp == 4) {
@@ -3097,6 +3142,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          ashift = high_bit(ma)-7; acount = bitcount(mr);
       }
       for (j=0; j < (int) s->img_y; ++j) {
+         z = (flip_vertically ? (int) s->img_y-1-j : j) * s->img_x * target;
          if (easy) {
             for (i=0; i < (int) s->img_x; ++i) {
                int a;
@@ -3121,17 +3167,6 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          skip(s, pad);
       }
    }
-   if (flip_vertically) {
-      stbi_uc t;
-      for (j=0; j < (int) s->img_y>>1; ++j) {
-         stbi_uc *p1 = out +      j     *s->img_x*target;
-         stbi_uc *p2 = out + (s->img_y-1-j)*s->img_x*target;
-         for (i=0; i < (int) s->img_x*target; ++i) {
-            t = p1[i], p1[i] = p2[i], p2[i] = t;
-         }
-      }
-   }
-
    if (req_comp && req_comp != target) {
       out = convert_format(out, target, req_comp, s->img_x, s->img_y);
       if (out == NULL) return out; // convert_format frees input on failure
@@ -3239,6 +3274,9 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    int tga_inverted = get8u(s);
    //   image data
    unsigned char *tga_data;
+   unsigned char *tga_out;
+   int tga_row = 0;
+   int tga_col = 0;
    unsigned char *tga_palette = NULL;
    int i, j;
    unsigned char raw_data[4];
@@ -3255,6 +3293,12 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
    }
    /* int tga_alpha_bits = tga_inverted & 15; */
    tga_inverted = 1 - ((tga_inverted >> 5) & 1);
+   if ( s->flip_vertically )
+   {
+      //   caller wants the rows bottom-up, which is how most TGAs are stored
+      tga_inverted = !tga_inverted;
+      s->flipped = 1;
+   }
 
    //   error check
    if ( //(tga_indexed) ||
@@ -3388,52 +3432,42 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          //   clear the reading flag for the next pixel
          read_next_pixel = 0;
       } // end of reading a pixel
+      //   rows are written straight to their final place
+      tga_out = tga_data + ((tga_inverted ? tga_height - 1 - tga_row : tga_row) * tga_width + tga_col) * req_comp;
+      if ( ++tga_col == tga_width )
+      {
+         tga_col = 0;
+         ++tga_row;
+      }
       //   convert to final format
       switch (req_comp)
       {
       case 1:
          //   RGBA => Luminance
-         tga_data[i*req_comp+0] = compute_y(trans_data[0],trans_data[1],trans_data[2]);
+         tga_out[0] = compute_y(trans_data[0],trans_data[1],trans_data[2]);
          break;
       case 2:
          //   RGBA => Luminance,Alpha
-         tga_data[i*req_comp+0] = compute_y(trans_data[0],trans_data[1],trans_data[2]);
-         tga_data[i*req_comp+1] = trans_data[3];
+         tga_out[0] = compute_y(trans_data[0],trans_data[1],trans_data[2]);
+         tga_out[1] = trans_data[3];
          break;
       case 3:
          //   RGBA => RGB
-         tga_data[i*req_comp+0] = trans_data[0];
-         tga_data[i*req_comp+1] = trans_data[1];
-         tga_data[i*req_comp+2] = trans_data[2];
+         tga_out[0] = trans_data[0];
+         tga_out[1] = trans_data[1];
+         tga_out[2] = trans_data[2];
          break;
       case 4:
          //   RGBA => RGBA
-         tga_data[i*req_comp+0] = trans_data[0];
-         tga_data[i*req_comp+1] = trans_data[1];
-         tga_data[i*req_comp+2] = trans_data[2];
-         tga_data[i*req_comp+3] = trans_data[3];
+         tga_out[0] = trans_data[0];
+         tga_out[1] = trans_data[1];
+         tga_out[2] = trans_data[2];
+         tga_out[3] = trans_data[3];
          break;
       }
       //   in case we're in RLE mode, keep counting down
       --RLE_count;
    }
-   //   do I need to invert the image?
-   if ( tga_inverted )
-   {
-      for (j = 0; j*2 < tga_height; ++j)
-      {
-         int index1 = j * tga_width * req_comp;
-         int index2 = (tga_height - 1 - j) * tga_width * req_comp;
-         for (i = tga_width * req_comp; i > 0; --i)
-         {
-            unsigned char temp = tga_data[index1];
-            tga_data[index1] = tga_data[index2];
-            tga_data[index2] = temp;
-            ++index1;
-            ++index2;
-         }
-      }
-   }
    //   clear my palette, if I had one
    if ( tga_palette != NULL )
    {
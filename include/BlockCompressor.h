@@ -0,0 +1,123 @@
+#ifndef BLOCK_COMPRESSOR_H
+#define BLOCK_COMPRESSOR_H
+
+#include <GL/glew.h>
+
+class CompressedImage;
+
+/**
+ * \brief Encodes images into GPU block-compressed formats on the CPU
+ *
+ * Supports BC1 (DXT1) for opaque color, BC3 (DXT5) for color with alpha,
+ * BC4 (RGTC1) for single channel images and BC5 (RGTC2) for two channel
+ * images such as normal maps.  The sRGB variants of BC1 and BC3 use the same
+ * encoding.
+ *
+ * Color endpoints are fit along the principal axis of each block's colors,
+ * then refined once with a least squares fit to the chosen indices.  This is
+ * meant for converting textures offline or at load time, not for encoding
+ * every frame.
+ *
+ * Rows of blocks are spread across the shared thread pool, so none of the
+ * functions may be called from a task running on that pool.
+ */
+class BlockCompressor
+{
+public:
+
+    /**
+     * \brief Compresses an image
+     *
+     * \param[in]  pixels     - Rows of pixels, starting at the bottom of the image
+     * \param[in]  components - Number of bytes in each pixel, 1 to 4.  Missing
+     *                          color channels read as 0 and missing alpha as 255
+     * \param[in]  width      - Width of the image in pixels
+     * \param[in]  height     - Height of the image in pixels
+     * \param[in]  format     - Compressed format to encode into
+     * \param[out] blocks     - Receives the compressed blocks, which must have
+     *                          room for CompressedImage::ImageSize bytes
+     */
+    static void Compress(
+        const GLubyte* pixels,
+        int components,
+        int width,
+        int height,
+        GLenum format,
+        GLubyte* blocks);
+
+    /**
+     * \brief Compresses an image along with a full chain of mip levels
+     *
+     * The levels are built by MipmapBuilder with its current filter and
+     * gamma settings.
+     *
+     * \param[in] pixels     - Rows of pixels, starting at the bottom of the image
+     * \param[in] components - Number of bytes in each pixel, 1 to 4
+     * \param[in] width      - Width of the image in pixels
+     * \param[in] height     - Height of the image in pixels
+     * \param[in] format     - Compressed format to encode into
+     *
+     * \return The compressed image, which must be deleted by the caller
+     */
+    static CompressedImage* CompressWithMipmaps(
+        const GLubyte* pixels,
+        int components,
+        int width,
+        int height,
+        GLenum format);
+
+    /**
+     * \brief Checks whether a format can be encoded
+     *
+     * \param[in] format - Compressed format
+     */
+    static bool IsFormatSupported(GLenum format);
+
+private:
+
+    /**
+     * \brief Encodes a 4x4 block of color as BC1
+     *
+     * \param[in]  rgba  - 16 pixels of 4 bytes each, in rows
+     * \param[out] block - Receives 8 bytes
+     */
+    static void EncodeColorBlock(const GLubyte rgba[16][4], GLubyte* block);
+
+    /**
+     * \brief Encodes one channel of a 4x4 block as a BC4 block, which is
+     *        also the alpha half of BC3 and each half of BC5
+     *
+     * \param[in]  rgba    - 16 pixels of 4 bytes each, in rows
+     * \param[in]  channel - Which byte of each pixel to encode
+     * \param[out] block   - Receives 8 bytes
+     */
+    static void EncodeChannelBlock(const GLubyte rgba[16][4], int channel, GLubyte* block);
+
+    /**
+     * \brief Compresses a range of rows of blocks
+     *
+     * \param[in]  pixels     - Rows of pixels of the whole image
+     * \param[in]  components - Number of bytes in each pixel
+     * \param[in]  width      - Width of the image in pixels
+     * \param[in]  height     - Height of the image in pixels
+     * \param[in]  format     - Compressed format to encode into
+     * \param[in]  firstRow   - First row of blocks to encode
+     * \param[in]  lastRow    - One past the last row of blocks to encode
+     * \param[out] blocks     - Compressed blocks of the whole image
+     */
+    static void CompressRows(
+        const GLubyte* pixels,
+        int components,
+        int width,
+        int height,
+        GLenum format,
+        int firstRow,
+        int lastRow,
+        GLubyte* blocks);
+
+    BlockCompressor();                                  //!< Only has static functions
+    BlockCompressor(const BlockCompressor&);            //!< No copy constructor
+    BlockCompressor& operator=(const BlockCompressor&); //!< No assignment operator
+};
+
+#endif
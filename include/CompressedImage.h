@@ -0,0 +1,216 @@
+#ifndef COMPRESSED_IMAGE_H
+#define COMPRESSED_IMAGE_H
+
+#include <GL/glew.h>
+#include <cstdio>
+#include <vector>
+
+/**
+ * \brief Block-compressed image data with all of its mip levels, as read
+ *        from or written to a KTX or DDS container
+ *
+ * The data is kept in the format the GPU samples from, so it can be passed
+ * straight to glCompressedTexImage2D without being decoded.  Each 4x4 block
+ * of pixels takes 8 bytes (BC1, BC4, ETC2 RGB) or 16 bytes (BC2, BC3, BC5,
+ * BC7, ETC2 RGBA), compared to 48 or 64 bytes uncompressed.
+ *
+ * Rows of blocks are expected in OpenGL's order, starting at the bottom of
+ * the image.  Files written by the texture_compressor tool are stored that
+ * way; files from other tools are usually top-down, and appear flipped
+ * unless their texture coordinates are flipped to match.
+ *
+ * Cube maps hold 6 faces in the order +X, -X, +Y, -Y, +Z, -Z.
+ */
+class CompressedImage
+{
+public:
+
+    /**
+     * \brief Location and size of one mip level of one face
+     */
+    struct Level
+    {
+        int     width;  //!< Width of the level in pixels
+        int     height; //!< Height of the level in pixels
+        GLsizei size;   //!< Size of the compressed data in bytes
+        size_t  offset; //!< Byte offset of the data within the image
+    };
+
+    /**
+     * \brief Reads an image from a KTX or DDS file
+     *
+     * The container is picked from the start of the file, not its name.
+     * If the file can't be read, the error is reported and the image is
+     * left empty, which can be checked with IsValid.
+     *
+     * \param[in] filename - Name and path of the file to load
+     */
+    CompressedImage(const char* filename);
+
+    /**
+     * \brief Creates an image with its data allocated, to be filled through
+     *        GetLevelData
+     *
+     * \param[in] format    - Compressed internal format, such as
+     *                        GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+     * \param[in] width     - Width of the top mip level in pixels
+     * \param[in] height    - Height of the top mip level in pixels
+     * \param[in] numLevels - Number of mip levels, 0 for a full chain down
+     *                        to 1x1
+     * \param[in] numFaces  - 1 for a 2D image, 6 for a cube map
+     */
+    CompressedImage(GLenum format, int width, int height, int numLevels = 0, int numFaces = 1);
+
+    /**
+     * \brief CompressedImage destructor
+     */
+    ~CompressedImage();
+
+    /**
+     * \brief Writes the image to a KTX file
+     *
+     * \param[in] filename - Name and path of the file to write
+     *
+     * \return Whether the file was written
+     */
+    bool SaveKTX(const char* filename) const;
+
+    /**
+     * \brief Gets whether the image was loaded successfully
+     */
+    inline bool IsValid() const { return !levels.empty(); }
+
+    /**
+     * \brief Gets the compressed internal format of the image
+     */
+    inline GLenum GetFormat() const { return format; }
+
+    /**
+     * \brief Gets the width of the top mip level in pixels
+     */
+    inline int GetWidth() const { return width; }
+
+    /**
+     * \brief Gets the height of the top mip level in pixels
+     */
+    inline int GetHeight() const { return height; }
+
+    /**
+     * \brief Gets the number of mip levels stored for each face
+     */
+    inline int GetNumLevels() const { return numLevels; }
+
+    /**
+     * \brief Gets the number of faces, 1 for a 2D image or 6 for a cube map
+     */
+    inline int GetNumFaces() const { return numFaces; }
+
+    /**
+     * \brief Gets the size of all of the compressed data in bytes
+     */
+    inline size_t GetDataSize() const { return data.size(); }
+
+    /**
+     * \brief Gets the size and location of a mip level
+     *
+     * \param[in] level - Mip level, 0 being the largest
+     * \param[in] face  - Face of a cube map, or 0
+     */
+    const Level& GetLevel(int level, int face = 0) const;
+
+    /**
+     * \brief Gets the compressed data of a mip level
+     *
+     * \param[in] level - Mip level, 0 being the largest
+     * \param[in] face  - Face of a cube map, or 0
+     */
+    const GLubyte* GetLevelData(int level, int face = 0) const;
+
+    /**
+     * \brief Gets the compressed data of a mip level for writing
+     *
+     * \param[in] level - Mip level, 0 being the largest
+     * \param[in] face  - Face of a cube map, or 0
+     */
+    GLubyte* GetLevelData(int level, int face = 0);
+
+    /**
+     * \brief Gets the number of bytes in each 4x4 block of a compressed format
+     *
+     * \param[in] format - Compressed internal format
+     *
+     * \return 8 or 16, or 0 if the format isn't a known block format
+     */
+    static GLsizei BlockSize(GLenum format);
+
+    /**
+     * \brief Gets the size of a compressed image in bytes
+     *
+     * \param[in] format - Compressed internal format
+     * \param[in] width  - Width of the image in pixels
+     * \param[in] height - Height of the image in pixels
+     */
+    static GLsizei ImageSize(GLenum format, int width, int height);
+
+    /**
+     * \brief Checks whether the current OpenGL context can sample a format
+     *
+     * BC1-BC3 need EXT_texture_compression_s3tc, BC4 and BC5 need OpenGL 3.0,
+     * BC7 needs OpenGL 4.2 and ETC2 needs OpenGL 4.3 (or the matching ARB
+     * extensions).
+     *
+     * \param[in] format - Compressed internal format
+     */
+    static bool IsFormatSupported(GLenum format);
+
+    /**
+     * \brief Checks whether a file starts like a KTX or DDS file, which the
+     *        filename constructor can read
+     *
+     * \param[in] filename - Name and path of the file
+     */
+    static bool IsCompressedFile(const char* filename);
+
+private:
+
+    GLenum               format;    //!< Compressed internal format
+    int                  width;     //!< Width of the top mip level in pixels
+    int                  height;    //!< Height of the top mip level in pixels
+    int                  numLevels; //!< Mip levels stored for each face
+    int                  numFaces;  //!< 1, or 6 for a cube map
+    std::vector<Level>   levels;    //!< Every level of the first face, then the next face
+    std::vector<GLubyte> data;      //!< Compressed data of every level
+
+    /**
+     * \brief Lays out the levels of the image and allocates its data
+     *
+     * \return Whether the format is a known block format, the size is at
+     *         most 65536 and there are no more levels than a full chain
+     */
+    bool AllocateLevels();
+
+    /**
+     * \brief Reads a KTX file after its identifier
+     *
+     * \param[in] file     - File to read from
+     * \param[in] filename - Name of the file, for error messages
+     *
+     * \return Whether the file was read successfully
+     */
+    bool ReadKTX(FILE* file, const char* filename);
+
+    /**
+     * \brief Reads a DDS file after its magic number
+     *
+     * \param[in] file     - File to read from
+     * \param[in] filename - Name of the file, for error messages
+     *
+     * \return Whether the file was read successfully
+     */
+    bool ReadDDS(FILE* file, const char* filename);
+
+    CompressedImage(const CompressedImage&);            //!< No copy constructor
+    CompressedImage& operator=(const CompressedImage&); //!< No assignment operator
+};
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef CUBE_MAP_BUILDER_H
+#define CUBE_MAP_BUILDER_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * \brief Resamples equirectangular panoramas into the six faces of a cube
+ *        map on the CPU
+ *
+ * Environment captures usually arrive as a single panorama, with longitude
+ * across the image and latitude up it.  Each face pixel looks up the
+ * panorama along its direction with bilinear filtering, blending the four
+ * texels with SSE where available, and the rows of all six faces are
+ * spread across the shared thread pool.  8-bit panoramas get their mip
+ * levels from MipmapBuilder, with its current settings.  High dynamic range
+ * panoramas are box filtered in floating point and stored as half floats.
+ *
+ * Finished cube maps are cached in MipmapBuilder's cache directory, keyed
+ * by the panorama's path, size and modification time, so later runs read
+ * the faces back without decoding the panorama at all.
+ */
+class CubeMapBuilder
+{
+public:
+
+    /**
+     * \brief Every mip level of the six faces of a cube map
+     *
+     * Faces are in the order of the GL_TEXTURE_CUBE_MAP_POSITIVE_X to
+     * NEGATIVE_Z targets.  Rows are tightly packed and start at the t = 0
+     * edge, the order glTexImage2D reads cube map faces in.
+     */
+    class Faces
+    {
+    public:
+
+        /**
+         * \brief Creates faces with the data of every level allocated
+         *
+         * \param[in] dataType   - GL_UNSIGNED_BYTE or GL_HALF_FLOAT
+         * \param[in] components - Number of components in each pixel, 1 to 4
+         * \param[in] size       - Width and height of level 0 in pixels
+         * \param[in] numLevels  - Number of levels, starting at level 0
+         */
+        Faces(GLenum dataType, int components, int size, int numLevels);
+
+        /**
+         * \brief Gets the type of each component, GL_UNSIGNED_BYTE or
+         *        GL_HALF_FLOAT
+         */
+        inline GLenum GetDataType() const { return dataType; }
+
+        /**
+         * \brief Gets the number of components in each pixel
+         */
+        inline int GetComponents() const { return components; }
+
+        /**
+         * \brief Gets the number of levels, 1 if mip maps weren't built
+         */
+        inline int GetNumLevels() const { return (int)offsets.size(); }
+
+        /**
+         * \brief Gets the width and height of a level in pixels
+         *
+         * \param[in] level - Mip level
+         */
+        inline int GetSize(int level) const { return size >> level > 0 ? size >> level : 1; }
+
+        /**
+         * \brief Gets the size of every level of every face in bytes
+         */
+        inline size_t GetDataSize() const { return data.size(); }
+
+        /**
+         * \brief Gets the pixels of a level of a face
+         *
+         * \param[in] level - Mip level
+         * \param[in] face  - Face, 0 to 5
+         */
+        const GLubyte* GetLevelData(int level, int face) const;
+
+        /**
+         * \brief Gets the pixels of a level of a face for writing
+         *
+         * \param[in] level - Mip level
+         * \param[in] face  - Face, 0 to 5
+         */
+        GLubyte* GetLevelData(int level, int face);
+
+        /**
+         * \brief Uploads every level of every face to the cube map bound to
+         *        the active texture unit
+         *
+         * \param[in] internalFormat - Internal format of the texture
+         * \param[in] format         - Format of the pixels, such as GL_RGB
+         */
+        void Upload(GLint internalFormat, GLenum format) const;
+
+    private:
+        GLenum               dataType;   //!< Type of each component
+        int                  components; //!< Components in each pixel
+        int                  size;       //!< Width and height of level 0
+        size_t               faceSize;   //!< Bytes of all levels of a face
+        std::vector<size_t>  offsets;    //!< Byte offset of each level within a face
+        std::vector<GLubyte> data;       //!< Levels of each face in turn
+
+        friend class CubeMapBuilder;
+
+        Faces(const Faces&);            //!< No copy constructor
+        Faces& operator=(const Faces&); //!< No assignment operator
+    };
+
+    /**
+     * \brief Statistics about the cube maps built
+     */
+    struct Stats
+    {
+    public:
+
+        /**
+         * \brief Creates empty statistics
+         */
+        Stats()
+            : built(0),
+            cacheHits(0),
+            buildMilliseconds(0.0),
+            loadMilliseconds(0.0)
+        {
+        }
+
+        unsigned int built;             //!< Cube maps resampled from a panorama
+        unsigned int cacheHits;         //!< Cube maps read from the cache
+        double       buildMilliseconds; //!< Time spent decoding, resampling and saving
+        double       loadMilliseconds;  //!< Time spent reading the cache
+    };
+
+    /**
+     * \brief Resamples a panorama into the faces of a cube map
+     *
+     * \param[in] pixels     - Pixels of the panorama, starting at the bottom
+     *                         row
+     * \param[in] dataType   - GL_UNSIGNED_BYTE, or GL_FLOAT for a high
+     *                         dynamic range panorama, which is stored as
+     *                         GL_HALF_FLOAT
+     * \param[in] components - Number of components in each pixel, 1 to 4
+     * \param[in] width      - Width of the panorama in pixels
+     * \param[in] height     - Height of the panorama in pixels
+     * \param[in] faceSize   - Width and height of each face in pixels
+     * \param[in] mipmaps    - Whether to build every mip level.  8-bit faces
+     *                         only get them when MipmapBuilder is enabled
+     *
+     * \return The faces, which must be deleted by the caller
+     */
+    static Faces* Build(
+        const GLvoid* pixels,
+        GLenum dataType,
+        int components,
+        int width,
+        int height,
+        int faceSize,
+        bool mipmaps);
+
+    /**
+     * \brief Loads a panorama and resamples it into the faces of a cube map,
+     *        reading them from the cache if they were built before
+     *
+     * \param[in] filename - Name and path of the panorama.  Radiance .hdr
+     *                       files give half float faces, anything else
+     *                       stb_image reads gives 8-bit faces
+     * \param[in] faceSize - Width and height of each face in pixels, or 0
+     *                       for the size GetFaceSize picks
+     * \param[in] mipmaps  - Whether to build every mip level
+     *
+     * \return The faces, which must be deleted by the caller, or NULL if
+     *         the panorama couldn't be loaded
+     */
+    static Faces* BuildCached(const char* filename, int faceSize, bool mipmaps);
+
+    /**
+     * \brief Gets the face size matching the resolution of a panorama: the
+     *        largest power of two no wider than a quarter of it, since
+     *        four faces span its width
+     *
+     * \param[in] panoramaWidth - Width of the panorama in pixels
+     */
+    static int GetFaceSize(int panoramaWidth);
+
+    /**
+     * \brief Gets statistics about the cube maps built since the last reset
+     */
+    static inline const Stats& GetStats() { return stats; }
+
+    /**
+     * \brief Resets the statistics
+     */
+    static void ResetStats();
+
+private:
+
+    static Stats stats; //!< Cube maps built since the last reset
+
+    /**
+     * \brief Resamples a band of rows of a face, 4 floats per pixel
+     *
+     * \param[in]  bottomRow  - First pixel of the bottom row of the panorama
+     * \param[in]  rowStride  - Elements from one row of the panorama to the
+     *                          row above it, negative for top-down images
+     * \param[in]  components - Number of components in each pixel
+     * \param[in]  width      - Width of the panorama in pixels
+     * \param[in]  height     - Height of the panorama in pixels
+     * \param[in]  face       - Face to resample, 0 to 5
+     * \param[in]  size       - Width and height of the face in pixels
+     * \param[in]  firstRow   - First row of the face to compute
+     * \param[in]  lastRow    - One past the last row to compute
+     * \param[out] result     - Receives the rows, starting with firstRow
+     */
+    template<class T>
+    static void SampleRows(
+        const T* bottomRow,
+        ptrdiff_t rowStride,
+        int components,
+        int width,
+        int height,
+        int face,
+        int size,
+        int firstRow,
+        int lastRow,
+        float* result);
+
+    /**
+     * \brief Resamples a panorama stored in either row order
+     *
+     * Parameters are as for Build, except that the rows are given by the
+     * bottom row and the stride between rows.
+     */
+    static Faces* BuildFaces(
+        const GLvoid* bottomRow,
+        ptrdiff_t rowStride,
+        GLenum dataType,
+        int components,
+        int width,
+        int height,
+        int faceSize,
+        bool mipmaps);
+
+    /**
+     * \brief Hashes the panorama's path, size and modification time and the
+     *        settings to name a cached cube map
+     *
+     * \return Whether the panorama's file exists
+     */
+    static bool GetCacheKey(const char* filename, int faceSize, bool mipmaps, unsigned long long* key);
+
+    /**
+     * \brief Reads cached faces, returning NULL unless they match the key
+     */
+    static Faces* LoadFaces(const std::string& filename, unsigned long long key);
+
+    /**
+     * \brief Writes faces to the cache
+     */
+    static void SaveFaces(const std::string& filename, unsigned long long key, const Faces& faces);
+
+    CubeMapBuilder();                                 //!< Only has static functions
+    CubeMapBuilder(const CubeMapBuilder&);            //!< No copy constructor
+    CubeMapBuilder& operator=(const CubeMapBuilder&); //!< No assignment operator
+};
+
+#endif
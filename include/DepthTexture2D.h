@@ -93,11 +93,11 @@ public:
 protected:
 
     /**
-     * \brief Sets the texture parameters such as min/mag filter and wrap modes
+     * \brief Gets the texture parameters such as min/mag filter and wrap modes
      *
-     * Sets the texture parameters
+     * \param[out] params - Parameters of the texture
      */
-    virtual void SetTextureParams();
+    virtual void GetSamplerParams(SamplerParams& params) const;
 
 private:
     GLenum compareFunc; //!< Comparison function used
@@ -0,0 +1,126 @@
+#ifndef HALF_FLOAT_H
+#define HALF_FLOAT_H
+
+#include <GL/glew.h>
+#include <cstddef>
+
+/**
+ * \brief Converts a 32-bit float to a 16-bit IEEE half float
+ *
+ * Values too large for a half float become infinity, values too small
+ * become denormals or zero.  Rounds to the nearest representable value,
+ * with ties going to even.
+ *
+ * \param[in] value - Value to convert
+ *
+ * \return Bits of the half float, suitable for use with GL_HALF_FLOAT
+ */
+inline GLushort FloatToHalf(float value)
+{
+    union
+    {
+        float  f;
+        GLuint u;
+    } bits;
+    bits.f = value;
+
+    GLuint sign     = (bits.u >> 16) & 0x8000;
+    GLuint rawExp   = (bits.u >> 23) & 0xff;
+    GLuint mantissa = bits.u & 0x007fffff;
+    int    exponent = (int)rawExp - 127 + 15;
+
+    // Infinity and NaN keep their class
+    if (rawExp == 0xff)
+    {
+        return (GLushort)(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+    }
+
+    // Too large, clamp to infinity
+    if (exponent >= 31)
+    {
+        return (GLushort)(sign | 0x7c00);
+    }
+
+    // Too small for a normal half, produce a denormal or zero
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+        {
+            return (GLushort)sign;
+        }
+
+        mantissa |= 0x00800000;
+        int    shift     = 14 - exponent;
+        GLuint half      = mantissa >> shift;
+        GLuint remainder = mantissa & ((1u << shift) - 1);
+        GLuint halfway   = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+        {
+            half++;
+        }
+        return (GLushort)(sign | half);
+    }
+
+    // Normal number.  A carry out of the mantissa while rounding correctly
+    // bumps the exponent, and rounds up to infinity at the top of the range
+    GLuint half      = sign | ((GLuint)exponent << 10) | (mantissa >> 13);
+    GLuint remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    {
+        half++;
+    }
+    return (GLushort)half;
+}
+
+/**
+ * \brief Converts an array of 32-bit floats to 16-bit IEEE half floats
+ *
+ * Gives exactly the results of FloatToHalf on each value, converting four
+ * values at a time with SSE2 where the compiler targets it.  Denormal
+ * results rely on the default round-to-nearest mode of the FPU.
+ *
+ * \param[in]  values - Values to convert
+ * \param[out] halves - Bits of the half floats
+ * \param[in]  count  - Number of values
+ */
+void FloatToHalf(const float* values, GLushort* halves, size_t count);
+
+/**
+ * \brief Converts a 16-bit IEEE half float to a 32-bit float
+ *
+ * \param[in] half - Bits of the half float
+ *
+ * \return The value as a float
+ */
+inline float HalfToFloat(GLushort half)
+{
+    GLuint sign     = ((GLuint)half & 0x8000) << 16;
+    GLuint exponent = ((GLuint)half >> 10) & 0x1f;
+    GLuint mantissa = (GLuint)half & 0x3ff;
+
+    union
+    {
+        float  f;
+        GLuint u;
+    } bits;
+
+    if (exponent == 0x1f)
+    {
+        // Infinity or NaN
+        bits.u = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (exponent == 0)
+    {
+        // Zero or denormal, which is a normal number as a float
+        bits.f = (float)mantissa * (1.0f / 16777216.0f);
+        bits.u |= sign;
+    }
+    else
+    {
+        bits.u = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    return bits.f;
+}
+
+#endif
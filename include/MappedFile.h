@@ -0,0 +1,56 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+/**
+ * \brief Maps a whole file into memory for reading
+ *
+ * Decoders can then parse the file in place: pages are read by the
+ * operating system as they are first touched, with no copy into a buffer
+ * of our own.
+ */
+class MappedFile
+{
+public:
+
+    /**
+     * \brief Maps a file
+     *
+     * \param[in] filename - Name and path of the file to map
+     */
+    MappedFile(const char* filename);
+
+    /**
+     * \brief Unmaps the file
+     */
+    ~MappedFile();
+
+    /**
+     * \brief Checks whether the file could be mapped.  Empty files can't
+     */
+    inline bool IsValid() const { return data != NULL; }
+
+    /**
+     * \brief Gets the contents of the file
+     */
+    inline const unsigned char* GetData() const { return data; }
+
+    /**
+     * \brief Gets the size of the file in bytes
+     */
+    inline size_t GetSize() const { return size; }
+
+private:
+    const unsigned char* data; //!< Mapped contents, or NULL
+    size_t size;               //!< Size of the file in bytes
+#ifdef _WIN32
+    void* file;    //!< Handle of the open file
+    void* mapping; //!< Handle of the file mapping
+#endif
+
+    MappedFile(const MappedFile&);            //!< No copy constructor
+    MappedFile& operator=(const MappedFile&); //!< No assignment operator
+};
+
+#endif
@@ -0,0 +1,462 @@
+#ifndef MIPMAP_BUILDER_H
+#define MIPMAP_BUILDER_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+/**
+ * \brief Builds chains of mip levels on the CPU, so textures upload
+ *        prebuilt levels instead of relying on glGenerateMipmap
+ *
+ * glGenerateMipmap's filter and cost are up to the driver, and software
+ * drivers build the levels single-threaded during the upload.  Here each
+ * level is resampled from the one above it in linear light, with SSE used
+ * for the filtering where available, and the rows of every face of a level
+ * are spread across the shared thread pool.
+ *
+ * Every level is resampled with weights computed for its exact size, so
+ * odd and non-power-of-two sizes are filtered correctly instead of
+ * dropping a row or column, and Resize can scale an image to any size.
+ *
+ * Finished chains can be cached on disk, keyed by a hash of the source
+ * pixels and the filter settings, so later runs only read the levels back.
+ *
+ * Build, BuildCached and Resize may also be called from a task running on
+ * the shared thread pool, in which case all of the work is done on that
+ * task's thread.  The settings must only be changed on the main thread.
+ */
+class MipmapBuilder
+{
+public:
+
+    /**
+     * \brief Filter used to resample each level
+     */
+    enum Filter
+    {
+        FILTER_BOX,   //!< Averages the pixels each output pixel covers
+        FILTER_KAISER //!< Kaiser-windowed sinc, sharper than a box with
+                      //!< less aliasing, but reads 6 times as many pixels
+    };
+
+    /**
+     * \brief Generated mip levels of an image, below the source image itself
+     *
+     * Levels are numbered as in OpenGL, so level 0 is the source image,
+     * which isn't stored.  Rows are tightly packed, so they must be uploaded
+     * with GL_UNPACK_ALIGNMENT set to 1.
+     */
+    class Chain
+    {
+    public:
+
+        /**
+         * \brief Creates a chain with the data of every level allocated
+         *
+         * \param[in] components - Number of bytes in each pixel, 1 to 4
+         * \param[in] width      - Width of the source image in pixels
+         * \param[in] height     - Height of the source image in pixels
+         * \param[in] numFaces   - 1 for a 2D image, 6 for a cube map
+         */
+        Chain(int components, int width, int height, int numFaces = 1);
+
+        /**
+         * \brief Gets the number of bytes in each pixel
+         */
+        inline int GetComponents() const { return components; }
+
+        /**
+         * \brief Gets the number of levels including the source image, down
+         *        to 1x1
+         */
+        inline int GetNumLevels() const { return (int)levels.size(); }
+
+        /**
+         * \brief Gets the number of faces, 1 for a 2D image or 6 for a cube map
+         */
+        inline int GetNumFaces() const { return numFaces; }
+
+        /**
+         * \brief Gets the width of a level in pixels
+         *
+         * \param[in] level - Mip level, 0 being the source image
+         */
+        inline int GetWidth(int level) const { return levels[level].width; }
+
+        /**
+         * \brief Gets the height of a level in pixels
+         *
+         * \param[in] level - Mip level, 0 being the source image
+         */
+        inline int GetHeight(int level) const { return levels[level].height; }
+
+        /**
+         * \brief Gets the size of the generated levels in bytes
+         */
+        inline size_t GetDataSize() const { return data.size(); }
+
+        /**
+         * \brief Gets the pixels of a generated level
+         *
+         * \param[in] level - Mip level, 1 or more
+         * \param[in] face  - Face of a cube map, or 0
+         */
+        const GLubyte* GetLevelData(int level, int face = 0) const;
+
+        /**
+         * \brief Gets the pixels of a generated level for writing
+         *
+         * \param[in] level - Mip level, 1 or more
+         * \param[in] face  - Face of a cube map, or 0
+         */
+        GLubyte* GetLevelData(int level, int face = 0);
+
+        /**
+         * \brief Uploads the generated levels of a face to the texture bound
+         *        to the active texture unit
+         *
+         * \param[in] target         - GL_TEXTURE_2D or a cube map face, or
+         *                             GL_TEXTURE_1D for a chain built from an
+         *                             image one row high
+         * \param[in] face           - Face of the chain to upload
+         * \param[in] internalFormat - Internal format of the texture
+         * \param[in] format         - Format of the pixels, such as GL_RGB
+         */
+        void Upload(GLenum target, int face, GLint internalFormat, GLenum format) const;
+
+    private:
+
+        /**
+         * \brief Size and location of a level
+         */
+        struct Level
+        {
+            int    width;  //!< Width in pixels
+            int    height; //!< Height in pixels
+            size_t offset; //!< Byte offset of the level within a face
+        };
+
+        int                  components; //!< Bytes in each pixel
+        int                  numFaces;   //!< 1, or 6 for a cube map
+        size_t               faceSize;   //!< Bytes of generated levels per face
+        std::vector<Level>   levels;     //!< Every level, including the source
+        std::vector<GLubyte> data;       //!< Generated levels of each face in turn
+
+        friend class MipmapBuilder;
+
+        Chain(const Chain&);            //!< No copy constructor
+        Chain& operator=(const Chain&); //!< No assignment operator
+    };
+
+    /**
+     * \brief Statistics about the chains built
+     */
+    struct Stats
+    {
+    public:
+
+        /**
+         * \brief Creates empty statistics
+         */
+        Stats()
+            : built(0),
+            cacheHits(0),
+            buildMilliseconds(0.0),
+            loadMilliseconds(0.0)
+        {
+        }
+
+        unsigned int built;             //!< Chains filtered from their source
+        unsigned int cacheHits;         //!< Chains read from the cache
+        double       buildMilliseconds; //!< Time spent filtering and saving
+        double       loadMilliseconds;  //!< Time spent hashing and reading the cache
+    };
+
+    /**
+     * \brief Builds the mip levels of an image
+     *
+     * \param[in] faces        - Pixels of each face, starting at the bottom row
+     * \param[in] numFaces     - 1 for a 2D image, 6 for a cube map
+     * \param[in] components   - Number of bytes in each pixel, 1 to 4
+     * \param[in] width        - Width of the image in pixels
+     * \param[in] height       - Height of the image in pixels
+     * \param[in] filter       - Filter to resample each level with
+     * \param[in] gammaCorrect - Whether the color channels are sRGB encoded,
+     *                           and are filtered after converting them to
+     *                           linear light.  Only applies to images with 3
+     *                           or 4 components; alpha and the channels of 1
+     *                           and 2 component images are always linear
+     *
+     * \return The generated levels, which must be deleted by the caller
+     */
+    static Chain* Build(
+        const GLubyte* const* faces,
+        int numFaces,
+        int components,
+        int width,
+        int height,
+        Filter filter,
+        bool gammaCorrect);
+
+    /**
+     * \brief Builds the mip levels of an image with the current settings,
+     *        reading them from the cache directory if they were built before
+     *
+     * \param[in] faces      - Pixels of each face, starting at the bottom row
+     * \param[in] numFaces   - 1 for a 2D image, 6 for a cube map
+     * \param[in] components - Number of bytes in each pixel, 1 to 4
+     * \param[in] width      - Width of the image in pixels
+     * \param[in] height     - Height of the image in pixels
+     *
+     * \return The generated levels, which must be deleted by the caller
+     */
+    static Chain* BuildCached(
+        const GLubyte* const* faces,
+        int numFaces,
+        int components,
+        int width,
+        int height);
+
+    /**
+     * \brief Builds the mip levels of a volume, such as a 3D texture, with a
+     *        2x2x2 box filter
+     *
+     * Each level averages blocks of 2x2x2 voxels of the one above in linear
+     * light, and the slices of each level are spread across the shared
+     * thread pool.  As in OpenGL, each level is max(size >> level, 1) on
+     * every side, so an odd last row, column or slice is dropped and a side
+     * of 1 is averaged with itself.  Volumes aren't cached, and the filter
+     * setting isn't used.
+     *
+     * \param[in]  slices       - Pixels of each slice, starting at the bottom row
+     * \param[in]  components   - Number of bytes in each pixel, 1 to 4
+     * \param[in]  width        - Width of the volume in pixels
+     * \param[in]  height       - Height of the volume in pixels
+     * \param[in]  depth        - Number of slices
+     * \param[in]  gammaCorrect - Whether the color channels are sRGB encoded
+     * \param[out] levels       - Receives levels 1 and up, each holding its
+     *                             slices in turn with tightly packed rows
+     */
+    static void BuildVolume(
+        const GLubyte* const* slices,
+        int components,
+        int width,
+        int height,
+        int depth,
+        bool gammaCorrect,
+        std::vector<std::vector<GLubyte> >& levels);
+
+    /**
+     * \brief Resamples an image to a different size, such as the next power
+     *        of two
+     *
+     * \param[in]  pixels       - Pixels of the image, starting at the bottom row
+     * \param[in]  components   - Number of bytes in each pixel, 1 to 4
+     * \param[in]  width        - Width of the image in pixels
+     * \param[in]  height       - Height of the image in pixels
+     * \param[in]  newWidth     - Width to resample to
+     * \param[in]  newHeight    - Height to resample to
+     * \param[in]  filter       - Filter to resample with
+     * \param[in]  gammaCorrect - Whether the color channels are sRGB encoded
+     * \param[out] result       - Receives newWidth * newHeight pixels
+     */
+    static void Resize(
+        const GLubyte* pixels,
+        int components,
+        int width,
+        int height,
+        int newWidth,
+        int newHeight,
+        Filter filter,
+        bool gammaCorrect,
+        GLubyte* result);
+
+    /**
+     * \brief Averages a pair of rows into one row of half the width with a
+     *        2x2 box filter
+     *
+     * Lets an image too large to resample at once be halved a row at a
+     * time.  The result is max(width / 2, 1) pixels wide, so an odd last
+     * column is dropped, as is an odd last row when the caller pairs rows.
+     *
+     * \param[in]  lower        - Lower row of the pair
+     * \param[in]  upper        - Upper row of the pair, which may be the
+     *                             same as lower
+     * \param[in]  components   - Number of bytes in each pixel, 1 to 4
+     * \param[in]  width        - Width of the rows in pixels
+     * \param[in]  gammaCorrect - Whether the color channels are sRGB encoded
+     * \param[out] result       - Receives the halved row
+     */
+    static void HalveRow(
+        const GLubyte* lower,
+        const GLubyte* upper,
+        int components,
+        int width,
+        bool gammaCorrect,
+        GLubyte* result);
+
+    /**
+     * \brief Sets whether textures build their mip maps with BuildCached
+     *        instead of glGenerateMipmap.  Enabled by default
+     */
+    static inline void SetEnabled(bool enable) { enabled = enable; }
+
+    /**
+     * \brief Checks whether textures build their mip maps on the CPU
+     */
+    static inline bool IsEnabled() { return enabled; }
+
+    /**
+     * \brief Sets the filter used by BuildCached.  FILTER_KAISER by default
+     */
+    static inline void SetFilter(Filter newFilter) { filter = newFilter; }
+
+    /**
+     * \brief Gets the filter used by BuildCached
+     */
+    static inline Filter GetFilter() { return filter; }
+
+    /**
+     * \brief Sets whether BuildCached treats color as sRGB encoded.
+     *        Enabled by default, since that is how images are stored
+     */
+    static inline void SetGammaCorrect(bool enable) { gammaCorrect = enable; }
+
+    /**
+     * \brief Checks whether BuildCached treats color as sRGB encoded
+     */
+    static inline bool IsGammaCorrect() { return gammaCorrect; }
+
+    /**
+     * \brief Sets the directory BuildCached saves chains to, creating it if
+     *        needed.  An empty string (the default) disables the cache
+     *
+     * \param[in] directory - Path of the cache directory
+     */
+    static void SetCacheDirectory(const char* directory);
+
+    /**
+     * \brief Gets the directory chains are cached in, ending with a path
+     *        separator, or an empty string if caching is disabled
+     */
+    static inline const std::string& GetCacheDirectory() { return cacheDirectory; }
+
+    /**
+     * \brief Gets statistics about the chains built since the last reset
+     */
+    static inline const Stats& GetStats() { return stats; }
+
+    /**
+     * \brief Resets the statistics
+     */
+    static void ResetStats();
+
+private:
+
+    /**
+     * \brief Weights of the source pixels that make up each output pixel
+     *        along one axis
+     */
+    struct Weights
+    {
+        std::vector<int>   first;   //!< First source pixel of each output pixel
+        std::vector<int>   count;   //!< Number of source pixels of each output pixel
+        std::vector<int>   offset;  //!< Index of each output pixel's first weight
+        std::vector<float> weights; //!< Weights of every output pixel in turn
+    };
+
+    static bool        enabled;        //!< Whether textures use BuildCached
+    static Filter      filter;         //!< Filter used by BuildCached
+    static bool        gammaCorrect;   //!< Whether BuildCached converts to linear
+    static std::string cacheDirectory; //!< Where chains are cached, or empty
+    static Stats       stats;          //!< Chains built since the last reset
+
+    /**
+     * \brief Computes the weights for resampling along one axis
+     *
+     * Source pixels past the edges are clamped to the edge.
+     *
+     * \param[in]  sourceSize - Number of source pixels
+     * \param[in]  size       - Number of output pixels
+     * \param[in]  filter     - Filter to resample with
+     * \param[out] weights    - Receives the weights
+     */
+    static void ComputeWeights(int sourceSize, int size, Filter filter, Weights& weights);
+
+    /**
+     * \brief Resamples a band of rows of an image held as 4 floats per pixel
+     *
+     * \param[in]  source       - Source pixels
+     * \param[in]  sourceWidth  - Width of the source in pixels
+     * \param[in]  columns      - Horizontal weights
+     * \param[in]  rows         - Vertical weights
+     * \param[in]  width        - Width of the result in pixels
+     * \param[in]  firstRow     - First row of the result to compute
+     * \param[in]  lastRow      - One past the last row to compute
+     * \param[out] result       - Receives the rows, 4 floats per pixel
+     */
+    static void ResampleRows(
+        const float* source,
+        int sourceWidth,
+        const Weights& columns,
+        const Weights& rows,
+        int width,
+        int firstRow,
+        int lastRow,
+        float* result);
+
+    /**
+     * \brief Converts pixels to 4 floats each, in linear light if requested
+     */
+    static void ToFloat(
+        const GLubyte* pixels,
+        int components,
+        int count,
+        bool gammaCorrect,
+        float* result);
+
+    /**
+     * \brief Converts pixels from 4 floats each back to bytes
+     */
+    static void ToBytes(
+        const float* pixels,
+        int components,
+        int count,
+        bool gammaCorrect,
+        GLubyte* result);
+
+    /**
+     * \brief Hashes the source pixels and settings to name a cached chain
+     */
+    static unsigned long long GetCacheKey(
+        const GLubyte* const* faces,
+        int numFaces,
+        int components,
+        int width,
+        int height);
+
+    /**
+     * \brief Reads a cached chain
+     *
+     * \return The chain, or NULL if it isn't cached or doesn't match
+     */
+    static Chain* LoadChain(
+        const std::string& filename,
+        unsigned long long key,
+        int numFaces,
+        int components,
+        int width,
+        int height);
+
+    /**
+     * \brief Writes a chain to the cache
+     */
+    static void SaveChain(const std::string& filename, unsigned long long key, const Chain& chain);
+
+    MipmapBuilder();                                //!< Only has static functions
+    MipmapBuilder(const MipmapBuilder&);            //!< No copy constructor
+    MipmapBuilder& operator=(const MipmapBuilder&); //!< No assignment operator
+};
+
+#endif
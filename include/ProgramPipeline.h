@@ -0,0 +1,105 @@
+#ifndef PROGRAM_PIPELINE_H
+#define PROGRAM_PIPELINE_H
+
+#include <GL/glew.h>
+#include "Shader.h"
+
+/**
+ * \brief Class representing an OpenGL program pipeline object
+ *
+ * A program pipeline combines separable shader stages, each created with
+ * the single stage Shader constructor, into the set of shaders used for
+ * drawing.  Stages are linked once on their own, so pairing V vertex
+ * stages with F fragment stages costs V + F links rather than V * F.
+ *
+ * Changing a stage only swaps which program the pipeline uses for it, no
+ * relinking is involved and vertex arrays stay valid as long as the vertex
+ * stage is the same.  This makes it cheap to switch fragment stages between
+ * draws.
+ *
+ * Requires OpenGL 4.1 or ARB_separate_shader_objects.
+ */
+class ProgramPipeline
+{
+public:
+
+    /**
+     * \brief Creates an empty pipeline
+     */
+    ProgramPipeline();
+
+    /**
+     * \brief ProgramPipeline destructor
+     */
+    ~ProgramPipeline();
+
+    /**
+     * \brief Uses a separable shader for its stage in this pipeline
+     *
+     * Does nothing if the stage already uses this shader.  The shader must
+     * outlive its use in the pipeline.
+     *
+     * \param[in] stage - A separable shader created with the single stage
+     *                    Shader constructor
+     */
+    void SetStage(const Shader* stage);
+
+    /**
+     * \brief Binds the pipeline, causing its stages to be used for drawing
+     *
+     * Any bound shader program is unbound first, since a program bound with
+     * Shader::Bind takes precedence over the bound pipeline.
+     */
+    void Bind();
+
+    /**
+     * \brief Unbinds any bound pipeline
+     */
+    static void Unbind();
+
+    /**
+     * \brief Checks whether the pipeline is currently bound
+     */
+    bool IsBound() const;
+
+    /**
+     * \brief Gets the vertex stage, which the vertex array is paired with
+     *
+     * \return The vertex stage, or NULL if none was set
+     */
+    inline const Shader* GetVertexStage() const { return vertexStage; }
+
+    /**
+     * \brief Gets the fragment stage
+     *
+     * \return The fragment stage, or NULL if none was set
+     */
+    inline const Shader* GetFragmentStage() const { return fragStage; }
+
+    /**
+     * \brief Gets the OpenGL ID of the pipeline
+     */
+    inline GLuint GetId() const { return pipelineId; }
+
+    /**
+     * \brief Checks whether the driver supports program pipelines
+     */
+    static bool IsSupported();
+
+private:
+
+    GLuint        pipelineId;  //!< OpenGL ID of the pipeline
+    const Shader* vertexStage; //!< Shader used for the vertex stage
+    const Shader* fragStage;   //!< Shader used for the fragment stage
+    const Shader* geoStage;    //!< Shader used for the geometry stage
+
+    /**
+     * \brief The currently bound pipeline
+     */
+    static GLuint activePipelineId;
+
+    ProgramPipeline(const ProgramPipeline&);            //!< No copy constructor
+    ProgramPipeline& operator=(const ProgramPipeline&); //!< No assignment operator
+};
+
+#endif
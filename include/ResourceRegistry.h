@@ -0,0 +1,465 @@
+#ifndef RESOURCE_REGISTRY_H
+#define RESOURCE_REGISTRY_H
+
+#include <GL/glew.h>
+#include <cassert>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Shader.h"
+
+class ObjFile;
+class Texture;
+class Texture2D;
+class TextureCube;
+
+/**
+ * \brief Shares textures, models and shaders that are loaded more than once
+ *
+ * Resources are keyed by the canonical path of their files plus the
+ * parameters they were created with, so asking for the same file with the
+ * same settings returns the instance that is already loaded instead of
+ * decoding and uploading it again.  Handles are reference counted, and the
+ * resource is deleted, releasing its OpenGL objects, when the last handle
+ * to it is dropped.
+ *
+ * Handles may only be created, copied and dropped on the thread that owns
+ * the OpenGL context.  Textures can be loaded asynchronously, in which case
+ * the image is decoded on the shared thread pool and the texture is created
+ * by Update once it has been decoded.  Where pixel buffers are supported,
+ * the image is decoded into one and streamed by TextureUploader, within its
+ * per-frame budget.
+ */
+class ResourceRegistry
+{
+public:
+
+    /**
+     * \brief Progress of loading a resource
+     */
+    enum LoadState
+    {
+        LOADING, //!< Still being decoded, Get returns NULL
+        READY,   //!< Loaded and ready to use
+        FAILED   //!< The file couldn't be found.  The resource still exists,
+                 //!< holding whatever its class falls back to on errors
+    };
+
+    /**
+     * \brief A resource's loading state, shared by every handle to it
+     */
+    class Slot
+    {
+    public:
+
+        /**
+         * \brief Slot destructor
+         */
+        virtual ~Slot();
+
+        LoadState    state;      //!< Progress of loading the resource
+        GLsizeiptr   memoryUsed; //!< Bytes used by the resource, once loaded
+        unsigned int hits;       //!< Requests answered with the resource since
+                                 //!< the last ResetStats
+
+        /**
+         * \brief Measures the bytes used by the resource now, which change
+         *        when a lazy texture swaps in its image or mip levels are
+         *        streamed
+         */
+        virtual GLsizeiptr MeasureMemory() const = 0;
+
+    protected:
+
+        /**
+         * \brief Creates a slot for a resource that is still loading
+         */
+        Slot();
+
+    private:
+
+        Slot(const Slot&);            //!< No copy constructor
+        Slot& operator=(const Slot&); //!< No assignment operator
+    };
+
+    /**
+     * \brief Slot holding a resource of a particular type
+     */
+    template<class T>
+    class TypedSlot : public Slot
+    {
+    public:
+
+        /**
+         * \brief Creates a slot for a resource that is still loading
+         */
+        TypedSlot()
+            : Slot(),
+            resource(NULL)
+        {
+        }
+
+        /**
+         * \brief Deletes the resource
+         */
+        ~TypedSlot()
+        {
+            delete resource;
+        }
+
+        /**
+         * \brief Measures the bytes used by the resource, 0 while loading
+         */
+        virtual GLsizeiptr MeasureMemory() const
+        {
+            return resource != NULL ? GetResourceMemory(resource) : 0;
+        }
+
+        T* resource; //!< The resource, or NULL while loading
+    };
+
+    /**
+     * \brief Reference-counted handle to a shared resource
+     *
+     * Copying a handle shares the resource.  An empty handle, or one whose
+     * resource is still loading, returns NULL from Get.
+     */
+    template<class T>
+    class Handle
+    {
+    public:
+
+        /**
+         * \brief Creates an empty handle
+         */
+        Handle()
+        {
+        }
+
+        /**
+         * \brief Gets the resource
+         *
+         * \return The resource, or NULL if it is still loading or the
+         *         handle is empty
+         */
+        inline T* Get() const
+        {
+            return slot ? slot->resource : NULL;
+        }
+
+        /**
+         * \brief Accesses the resource, which must be loaded
+         */
+        inline T* operator->() const
+        {
+            assert(Get() != NULL);
+            return slot->resource;
+        }
+
+        /**
+         * \brief Gets a reference to the resource, which must be loaded
+         */
+        inline T& operator*() const
+        {
+            assert(Get() != NULL);
+            return *slot->resource;
+        }
+
+        /**
+         * \brief Gets the progress of loading the resource
+         */
+        inline LoadState GetState() const
+        {
+            return slot ? slot->state : FAILED;
+        }
+
+        /**
+         * \brief Gets whether the resource can be used
+         */
+        inline bool IsReady() const
+        {
+            return Get() != NULL;
+        }
+
+        /**
+         * \brief Drops the handle, deleting the resource if it was the last one
+         */
+        inline void Reset()
+        {
+            slot.reset();
+        }
+
+    private:
+
+        friend class ResourceRegistry;
+
+        std::shared_ptr<TypedSlot<T> > slot; //!< The shared resource
+    };
+
+    /**
+     * \brief Gets a texture loaded from an image file
+     *
+     * The parameters are the same as those of the matching Texture2D
+     * constructor, and are part of the key, so the same file with
+     * different settings is a separate texture.
+     *
+     * \param[in] filename  - Name and path of the file to load
+     * \param[in] minFilter - Minification filter
+     * \param[in] magFilter - Magnification filter
+     * \param[in] wrapS     - Wrap mode for s coordinates
+     * \param[in] wrapT     - Wrap mode for t coordinates
+     * \param[in] aniso     - Maximum samples for anisotropic filtering
+     * \param[in] async     - Whether to decode the image on the shared thread
+     *                        pool.  The handle stays LOADING until Update
+     *                        creates the texture, or finishes uploading it
+     *                        through TextureUploader
+     */
+    static Handle<Texture2D> LoadTexture2D(
+        const char* filename,
+        GLenum minFilter = GL_LINEAR,
+        GLenum magFilter = GL_LINEAR,
+        GLenum wrapS     = GL_REPEAT,
+        GLenum wrapT     = GL_REPEAT,
+        float  aniso     = 1.0f,
+        bool   async     = false);
+
+    /**
+     * \brief Gets a cube texture loaded from six image files
+     *
+     * The faces are decoded in parallel, as with the TextureCube constructor.
+     */
+    static Handle<TextureCube> LoadTextureCube(
+        const char* posXFilename,
+        const char* negXFilename,
+        const char* posYFilename,
+        const char* negYFilename,
+        const char* posZFilename,
+        const char* negZFilename,
+        GLenum minFilter = GL_LINEAR,
+        GLenum magFilter = GL_LINEAR,
+        GLenum wrapS     = GL_CLAMP_TO_EDGE,
+        GLenum wrapT     = GL_CLAMP_TO_EDGE,
+        GLenum wrapR     = GL_CLAMP_TO_EDGE,
+        float  aniso     = 1.0f);
+
+    /**
+     * \brief Gets a model read from an obj file
+     *
+     * \param[in] filename - Name and path of the file to read
+     */
+    static Handle<ObjFile> LoadObjFile(const char* filename);
+
+    /**
+     * \brief Gets a shader program built from the given source files
+     *
+     * \param[in] vertexShaderPath - Location of the vertex shader source file
+     * \param[in] fragShaderPath   - Location of the fragment shader source file
+     * \param[in] geoShaderPath    - Optionally, location of the geometry
+     *                               shader source file
+     */
+    static Handle<Shader> LoadShader(
+        const char* vertexShaderPath,
+        const char* fragShaderPath,
+        const char* geoShaderPath = NULL);
+
+    /**
+     * \brief Gets a separable program holding a single shader stage
+     *
+     * \param[in] stage      - Stage of the shader, such as GL_VERTEX_SHADER
+     * \param[in] shaderPath - Location of the shader source file
+     * \param[in] defines    - Defines to compile the shader with
+     */
+    static Handle<Shader> LoadShader(
+        GLenum stage,
+        const char* shaderPath,
+        const Shader::Defines& defines = Shader::Defines());
+
+    /**
+     * \brief Gets a resource created by a custom loader
+     *
+     * For resources the typed loaders don't cover, such as textures read
+     * through a cache.  The loader is only called if no resource with the
+     * key is loaded.
+     *
+     * \param[in] key    - Identifies the resource, usually built from
+     *                     GetCanonicalPath and the creation parameters
+     * \param[in] create - Creates the resource
+     */
+    template<class T>
+    static Handle<T> Load(const std::string& key, const std::function<T*()>& create)
+    {
+        Handle<T> handle;
+        if (Find(key, handle))
+        {
+            return handle;
+        }
+        handle.slot = Insert<T>(key);
+        handle.slot->resource = create();
+        handle.slot->state = READY;
+        handle.slot->memoryUsed = GetResourceMemory(handle.slot->resource);
+        return handle;
+    }
+
+    /**
+     * \brief Creates the textures whose images have finished decoding
+     *
+     * Call regularly, such as once per frame, while asynchronous loads are
+     * pending.  Must be called on the thread that owns the OpenGL context.
+     * Also updates TextureUploader, so it needn't be updated separately,
+     * and remeasures the resources so GetMemorySaved follows their sizes.
+     *
+     * \return Number of loads still pending
+     */
+    static size_t Update();
+
+    /**
+     * \brief Waits for every pending asynchronous load and creates its texture
+     */
+    static void WaitAll();
+
+    /**
+     * \brief Gets the canonical form of a path, so different spellings of
+     *        the same file share a key
+     *
+     * \param[in] path - Path to a file
+     *
+     * \return The absolute path with links resolved, or an empty string if
+     *         the file doesn't exist
+     */
+    static std::string GetCanonicalPath(const char* path);
+
+    /**
+     * \brief Gets the number of resources currently loaded
+     */
+    static size_t GetNumResources();
+
+    /**
+     * \brief Gets the number of requests that created a new resource
+     */
+    static inline unsigned int GetMisses() { return misses; }
+
+    /**
+     * \brief Gets the number of requests answered with a resource that was
+     *        already loaded
+     */
+    static inline unsigned int GetHits() { return hits; }
+
+    /**
+     * \brief Gets the bytes that would have been used by duplicate copies
+     *        of the resources returned by hits
+     *
+     * Counts the video memory of textures and the vertex data of models.
+     * Shaders are shared too, but the size of a program isn't known.
+     */
+    static inline GLsizeiptr GetMemorySaved() { return memorySaved; }
+
+    /**
+     * \brief Resets the hit, miss and memory saved counters
+     */
+    static void ResetStats();
+
+private:
+
+    struct PendingTexture;
+
+    static std::map<std::string, std::weak_ptr<Slot> > slots; //!< Loaded resources by key
+    static std::vector<std::shared_ptr<PendingTexture> > pending; //!< Textures still decoding
+
+    static unsigned int hits;        //!< Requests answered by a loaded resource
+    static unsigned int misses;      //!< Requests that created a resource
+    static GLsizeiptr   memorySaved; //!< Bytes of duplicates avoided by hits
+
+    /**
+     * \brief Looks up a loaded resource, counting a hit if found
+     *
+     * Entries whose last handle was dropped are left in the map until they
+     * are looked up or purged by Update, so the map never has to outlive
+     * the handles.
+     *
+     * \param[in]  key    - Key of the resource
+     * \param[out] handle - Receives the resource if found
+     *
+     * \return Whether the resource was found
+     */
+    template<class T>
+    static bool Find(const std::string& key, Handle<T>& handle)
+    {
+        std::map<std::string, std::weak_ptr<Slot> >::iterator it = slots.find(key);
+        if (it == slots.end())
+        {
+            return false;
+        }
+        handle.slot = std::static_pointer_cast<TypedSlot<T> >(it->second.lock());
+        if (!handle.slot)
+        {
+            slots.erase(it);
+            return false;
+        }
+        hits++;
+        handle.slot->hits++;
+        memorySaved += handle.slot->memoryUsed;
+        return true;
+    }
+
+    /**
+     * \brief Adds an empty slot for a resource that is about to be loaded,
+     *        counting a miss
+     *
+     * \param[in] key - Key of the resource
+     */
+    template<class T>
+    static std::shared_ptr<TypedSlot<T> > Insert(const std::string& key)
+    {
+        std::shared_ptr<TypedSlot<T> > slot = std::make_shared<TypedSlot<T> >();
+        slots[key] = slot;
+        misses++;
+        return slot;
+    }
+
+    /**
+     * \brief Builds the key of a resource from its files and parameters
+     *
+     * \param[in] type       - Kind of resource, so different kinds loaded
+     *                         from the same file don't collide
+     * \param[in] paths      - Files the resource is loaded from
+     * \param[in] count      - Number of files
+     * \param[in] parameters - Creation parameters
+     * \param[out] found     - Set to false if any of the files doesn't exist
+     */
+    static std::string MakeKey(
+        const char* type,
+        const char* const* paths,
+        int count,
+        const std::string& parameters,
+        bool* found);
+
+    /**
+     * \brief Creates the texture of a finished asynchronous load
+     *
+     * \param[in] load - The finished load
+     */
+    static void FinishTexture(PendingTexture& load);
+
+    /**
+     * \brief Gets the video memory used by a texture
+     */
+    static GLsizeiptr GetResourceMemory(const Texture* texture);
+
+    /**
+     * \brief Gets the memory used by the vertex data of a model
+     */
+    static GLsizeiptr GetResourceMemory(const ObjFile* model);
+
+    /**
+     * \brief Gets the memory used by a resource of unknown size, which is 0
+     */
+    static inline GLsizeiptr GetResourceMemory(const void*) { return 0; }
+
+    ResourceRegistry();                                   //!< Only has static functions
+    ResourceRegistry(const ResourceRegistry&);            //!< No copy constructor
+    ResourceRegistry& operator=(const ResourceRegistry&); //!< No assignment operator
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <GL/glew.h>
 #include <map>
 #include <string>
+#include <vector>
 #include <Angel.h>
 
 // Forward declaration to prevent circular include loop
@@ -70,7 +71,169 @@ public:
         GLint   location; //!< Location for this parameter
     };
 
-    typedef ParamInfo UniformInfo;   //!< Structure of uniform variable info
+    /**
+     * \brief Structure of the information associated with uniform variables
+     */
+    struct UniformInfo : public ParamInfo
+    {
+    public:
+
+        /**
+         * \brief Creates an empty uniform info object
+         */
+        UniformInfo()
+            : ParamInfo(), shadowOffset(-1), shadowSize(0)
+        {
+        }
+
+        /**
+         * \brief Creates a new uniform info object
+         *
+         * \param[in] size         - Array length of the uniform, if it is an array
+         * \param[in] type         - Type of the uniform
+         * \param[in] location     - Location of the uniform
+         * \param[in] shadowOffset - Offset of the uniform's slot in the shadow
+         *                           copy of the uniform values, or -1 for none
+         * \param[in] shadowSize   - Size in bytes of the uniform's value
+         */
+        UniformInfo(
+            GLint size,
+            GLenum type,
+            GLint location,
+            GLint shadowOffset = -1,
+            GLsizei shadowSize = 0)
+            : ParamInfo(size, type, location),
+            shadowOffset(shadowOffset),
+            shadowSize(shadowSize)
+        {
+        }
+
+        GLint   shadowOffset; //!< Slot in the shadow values, or -1 if not shadowed
+        GLsizei shadowSize;   //!< Size in bytes of the shadowed value
+    };
+
+    /**
+     * \brief Preprocessor defines injected into every stage of a shader
+     *
+     * Each entry is what would follow #define in the source: a name,
+     * optionally followed by a space and a value, such as "USE_HALF_VECTOR"
+     * or "NUM_LIGHTS 4".
+     */
+    typedef std::vector<std::string> Defines;
+
+    /**
+     * \brief Statistics of the program binary cache
+     */
+    struct ProgramCacheStats
+    {
+    public:
+
+        /**
+         * \brief Creates empty statistics
+         */
+        ProgramCacheStats()
+            : hits(0),
+            misses(0),
+            stagesCompiled(0),
+            stagesShared(0),
+            compileMilliseconds(0.0),
+            loadMilliseconds(0.0)
+        {
+        }
+
+        unsigned int hits;                //!< Programs loaded from a cached binary
+        unsigned int misses;              //!< Programs compiled and linked from source
+        unsigned int stagesCompiled;      //!< Shader stages compiled from source
+        unsigned int stagesShared;        //!< Shader stages reused from another program
+        double       compileMilliseconds; //!< Time spent compiling and linking from source,
+                                          //!< including waiting for asynchronous builds
+        double       loadMilliseconds;    //!< Time spent loading cached binaries
+    };
+
+    /**
+     * \brief Resolved reference to a uniform variable
+     *
+     * A handle is looked up once with GetUniformHandle and can then be passed
+     * to SetUniform in place of the uniform's name, which skips the name
+     * lookup on every call.  A handle is only valid for the shader that
+     * created it.
+     */
+    struct UniformHandle
+    {
+    public:
+
+        /**
+         * \brief Creates a handle that refers to no uniform
+         */
+        UniformHandle()
+            : location(-1), type(0), shadowOffset(-1), shadowSize(0)
+        {
+        }
+
+        /**
+         * \brief Creates a uniform handle
+         *
+         * \param[in] location     - Location of the uniform
+         * \param[in] type         - Type of the uniform, or 0 if unknown
+         * \param[in] shadowOffset - Slot of the uniform in the shader's shadow
+         *                           values, or -1 if it is not shadowed
+         * \param[in] shadowSize   - Size in bytes of the shadowed value
+         */
+        UniformHandle(
+            GLint location,
+            GLenum type,
+            GLint shadowOffset = -1,
+            GLsizei shadowSize = 0)
+            : location(location),
+            type(type),
+            shadowOffset(shadowOffset),
+            shadowSize(shadowSize)
+        {
+        }
+
+        /**
+         * \brief Checks whether the handle refers to an active uniform
+         */
+        inline bool IsValid() const { return location != -1; }
+
+        GLint   location;     //!< Location of the uniform, -1 if it does not exist
+        GLenum  type;         //!< Type of the uniform, or 0 if unknown
+        GLint   shadowOffset; //!< Slot in the shadow values, or -1 if not shadowed
+        GLsizei shadowSize;   //!< Size in bytes of the shadowed value
+    };
+
+    /**
+     * \brief Structure of the information associated with uniform blocks
+     */
+    struct UniformBlockInfo
+    {
+    public:
+
+        /**
+         * \brief Creates an empty uniform block info object
+         */
+        UniformBlockInfo()
+            : index(GL_INVALID_INDEX), dataSize(0), binding(0)
+        {
+        }
+
+        /**
+         * \brief Creates a new uniform block info object
+         *
+         * \param[in] index    - Index of the block in the shader program
+         * \param[in] dataSize - Size of the buffer needed to back the block
+         * \param[in] binding  - Binding point the block reads its buffer from
+         */
+        UniformBlockInfo(GLuint index, GLint dataSize, GLuint binding)
+            : index(index), dataSize(dataSize), binding(binding)
+        {
+        }
+
+        GLuint index;    //!< Index of the block in the shader program
+        GLint  dataSize; //!< Size in bytes of the buffer needed to back the block
+        GLuint binding;  //!< Binding point the block reads its buffer from
+    };
+
     typedef ParamInfo AttributeInfo; //!< Structure of attribute variable info
     typedef std::map<
         std::string, 
@@ -80,6 +243,10 @@ public:
         std::string, 
         AttributeInfo> 
         AttributeMap;                //!< Map of attributes
+    typedef std::map<
+        std::string,
+        UniformBlockInfo>
+        UniformBlockMap;             //!< Map of uniform blocks
 
     /**
      * \brief Creates a shader program from the given source files
@@ -93,15 +260,65 @@ public:
      * A shader that fails to compile will have a programID of 0, all others
      * will have a non-zero ID.
      *
+     * If a program cache directory is set, the linked program binary is
+     * loaded from the cache when the sources and graphics driver match a
+     * previous run, which skips compiling and linking entirely.  Otherwise
+     * the program is built from source and its binary saved to the cache.
+     *
+     * Sources are run through a small preprocessor before compiling, which
+     * expands #include "file" directives.  Included paths are relative to
+     * the including file.
+     *
+     * If SetAsyncCompile is enabled, the constructor returns as soon as the
+     * stages have been submitted to the driver, and the build is finished
+     * when the shader is first used.
+     *
+     * \param[in] vertexShaderPath - Location of the vertex shader source file
+     * \param[in] fragShaderPath   - Location of the fragment shader source file
+     * \param[in] geoShaderPath    - Optionally, location of the geometry shader source file.
+     *                               Ignored if set to NULL
+     */
+    Shader(const char* vertexShaderPath,
+           const char* fragShaderPath,
+           const char* geoShaderPath = NULL);
+
+    /**
+     * \brief Creates a shader program specialized by preprocessor defines
+     *
+     * The defines are inserted right after the #version line of every
+     * stage, so features can be switched with #ifdef at compile time instead
+     * of branching on uniforms.  Each combination of defines is a separate
+     * program.  ShaderPermutations creates and caches them on demand.
+     *
      * \param[in] vertexShaderPath - Location of the vertex shader source file
      * \param[in] fragShaderPath   - Location of the fragment shader source file
+     * \param[in] defines          - Defines to compile the shaders with
      * \param[in] geoShaderPath    - Optionally, location of the geometry shader source file.
      *                               Ignored if set to NULL
      */
     Shader(const char* vertexShaderPath,
            const char* fragShaderPath,
+           const Defines& defines,
            const char* geoShaderPath = NULL);
 
+    /**
+     * \brief Creates a separable program holding a single shader stage
+     *
+     * Separable stages aren't bound on their own.  Instead they are combined
+     * with other stages in a ProgramPipeline, so one vertex stage can be
+     * paired with any number of fragment stages without linking every
+     * combination.  Requires OpenGL 4.1 or ARB_separate_shader_objects.
+     *
+     * Uniforms of a separable stage are set with glProgramUniform*, so
+     * SetUniform works without binding anything.
+     *
+     * \param[in] stage      - One of GL_VERTEX_SHADER, GL_FRAGMENT_SHADER,
+     *                         or GL_GEOMETRY_SHADER
+     * \param[in] shaderPath - Location of the shader source file
+     * \param[in] defines    - Defines to compile the shader with
+     */
+    Shader(GLenum stage, const char* shaderPath, const Defines& defines = Defines());
+
     /**
      * \brief Shader destructor
      */
@@ -151,43 +368,76 @@ public:
     GLint GetUniformLocation(const char* name) const;
     GLint GetUniformLocation(const std::string& name) const;
 
+    /**
+     * \brief Gets a handle to a uniform variable for use with SetUniform
+     *
+     * Resolve handles once, for example after creating the shader, and use
+     * them in the draw loop instead of names.
+     *
+     * \param[in] name - Name of the variable, exactly as written in the shader file
+     *
+     * \return Handle to the uniform.  The handle is not valid if the shader
+     *         doesn't have a uniform variable by that name
+     */
+    UniformHandle GetUniformHandle(const char* name) const;
+    UniformHandle GetUniformHandle(const std::string& name) const;
+
     /**
      * \brief Sets the value of a uniform variable
      *
-     * The shader must be currently bound, or this will fail
+     * The shader must be currently bound, or this will fail.  Separable
+     * stages are the exception, their uniforms can be set at any time.
      *
-     * \param[in] name - Name of the uniform, exactly as written in the shader file
-     * \param[in] v#   - Components of a 1-4D float uniform
+     * The shader keeps a copy of the last value set for each active uniform.
+     * Setting a uniform to the value it already has is skipped without
+     * calling OpenGL.  This applies to all SetUniform overloads.
+     *
+     * \param[in] name   - Name of the uniform, exactly as written in the shader file
+     * \param[in] handle - Handle of the uniform from GetUniformHandle
+     * \param[in] v#     - Components of a 1-4D float uniform
      */
     void SetUniform(const char* name, float v0);
     void SetUniform(const char* name, float v0, float v1);
     void SetUniform(const char* name, float v0, float v1, float v2);
     void SetUniform(const char* name, float v0, float v1, float v2, float v3);
+    void SetUniform(const UniformHandle& handle, float v0);
+    void SetUniform(const UniformHandle& handle, float v0, float v1);
+    void SetUniform(const UniformHandle& handle, float v0, float v1, float v2);
+    void SetUniform(const UniformHandle& handle, float v0, float v1, float v2, float v3);
 
     /**
      * \brief Sets the value of a uniform variable
      *
      * The shader must be currently bound, or this will fail
      *
-     * \param[in] name - Name of the uniform, exactly as written in the shader file
-     * \param[in] v#   - Components of a 1-4D int uniform
+     * \param[in] name   - Name of the uniform, exactly as written in the shader file
+     * \param[in] handle - Handle of the uniform from GetUniformHandle
+     * \param[in] v#     - Components of a 1-4D int uniform
      */
     void SetUniform(const char* name, int v0);
     void SetUniform(const char* name, int v0, int v1);
     void SetUniform(const char* name, int v0, int v1, int v2);
     void SetUniform(const char* name, int v0, int v1, int v2, int v3);
+    void SetUniform(const UniformHandle& handle, int v0);
+    void SetUniform(const UniformHandle& handle, int v0, int v1);
+    void SetUniform(const UniformHandle& handle, int v0, int v1, int v2);
+    void SetUniform(const UniformHandle& handle, int v0, int v1, int v2, int v3);
 
     /**
      * \brief Sets the value of a uniform variable
      *
      * The shader must be currently bound, or this will fail
      *
-     * \param[in] name - Name of the uniform, exactly as written in the shader file
-     * \param[in] vec# - Vector containing the value of the uniform
+     * \param[in] name   - Name of the uniform, exactly as written in the shader file
+     * \param[in] handle - Handle of the uniform from GetUniformHandle
+     * \param[in] vec#   - Vector containing the value of the uniform
      */
     void SetUniform(const char* name, const vec2& vec2);
     void SetUniform(const char* name, const vec3& vec3);
     void SetUniform(const char* name, const vec4& vec4);
+    void SetUniform(const UniformHandle& handle, const vec2& vec2);
+    void SetUniform(const UniformHandle& handle, const vec3& vec3);
+    void SetUniform(const UniformHandle& handle, const vec4& vec4);
 
     /**
      * \brief Sets the value of a uniform variable
@@ -195,18 +445,204 @@ public:
      * The shader must be currently bound, or this will fail
      *
      * \param[in] name   - Name of the uniform, exactly as written in the shader file
+     * \param[in] handle - Handle of the uniform from GetUniformHandle
      * \param[in] matrix - Matrix value for the uniform
      */
     void SetUniform(const char* name, const mat2& matrix);
     void SetUniform(const char* name, const mat3& matrix);
     void SetUniform(const char* name, const mat4& matrix);
+    void SetUniform(const UniformHandle& handle, const mat2& matrix);
+    void SetUniform(const UniformHandle& handle, const mat3& matrix);
+    void SetUniform(const UniformHandle& handle, const mat4& matrix);
+
+    /**
+     * \brief Assigns a uniform block name to a shared binding point
+     *
+     * Every shader created afterwards that declares a uniform block with
+     * this name reads it from the given binding point.  A UniformBuffer bound
+     * to that point then supplies the block to all of those shaders at once,
+     * such as per-frame camera and lighting data.
+     *
+     * \param[in] blockName - Name of the uniform block, exactly as written in
+     *                        the shader file
+     * \param[in] binding   - Binding point, less than GL_MAX_UNIFORM_BUFFER_BINDINGS
+     */
+    static void SetUniformBlockBinding(const char* blockName, GLuint binding);
+
+    /**
+     * \brief Assigns one of this shader's uniform blocks to a binding point
+     *
+     * \param[in] blockName - Name of the uniform block, exactly as written in
+     *                        the shader file
+     * \param[in] binding   - Binding point, less than GL_MAX_UNIFORM_BUFFER_BINDINGS
+     */
+    void BindUniformBlock(const char* blockName, GLuint binding);
+
+    /**
+     * \brief Gets the size of the buffer needed to back a uniform block
+     *
+     * \param[in] blockName - Name of the uniform block, exactly as written in
+     *                        the shader file
+     *
+     * \return Size of the block in bytes
+     * \return 0 if the shader doesn't have a uniform block by that name
+     */
+    GLint GetUniformBlockSize(const char* blockName) const;
+
+    /**
+     * \brief Gets the binding point a uniform block reads from
+     *
+     * \param[in] blockName - Name of the uniform block, exactly as written in
+     *                        the shader file
+     *
+     * \return Binding point of the block
+     * \return -1 if the shader doesn't have a uniform block by that name
+     */
+    GLint GetUniformBlockBinding(const char* blockName) const;
+
+    /**
+     * \brief Gets the byte offset of a member within its uniform block
+     *
+     * Useful to check that data filled on the CPU, for example with a
+     * Std140Layout, matches the layout the compiler chose.
+     *
+     * \param[in] name - Name of the block member, exactly as written in the
+     *                   shader file
+     *
+     * \return Offset of the member from the start of its block
+     * \return -1 if the member isn't active or isn't in a uniform block
+     */
+    GLint GetUniformBlockOffset(const char* name) const;
+
+    /**
+     * \brief Forgets the last values set for all uniforms
+     *
+     * Must be called after changing uniforms with glUniform* directly,
+     * otherwise a following SetUniform with the old value would be skipped.
+     */
+    void InvalidateUniformValues();
+
+    /**
+     * \brief Gets the number of uniform uploads sent to OpenGL
+     *
+     * Counts the SetUniform calls, across all shaders, that called glUniform*
+     * since the last call to ResetUniformCounters.
+     */
+    static inline unsigned int GetUniformUploadsIssued() { return uploadsIssued; }
+
+    /**
+     * \brief Gets the number of uniform uploads skipped
+     *
+     * Counts the SetUniform calls, across all shaders, that were skipped
+     * because the uniform already had the value since the last call to
+     * ResetUniformCounters.
+     */
+    static inline unsigned int GetUniformUploadsSkipped() { return uploadsSkipped; }
+
+    /**
+     * \brief Resets the uniform upload counters, typically once per frame
+     */
+    static void ResetUniformCounters();
+
+    /**
+     * \brief Enables caching of linked program binaries on disk
+     *
+     * Shaders created afterwards save their program binaries to the directory,
+     * and load them instead of compiling on later runs.  Binaries are keyed
+     * by a hash of the shader sources and the driver vendor, renderer and
+     * version strings, so editing a shader or updating the driver falls back
+     * to compiling from source.  Has no effect if the driver doesn't support
+     * ARB_get_program_binary.
+     *
+     * \param[in] directory - Directory to store binaries in, which is
+     *                        created if needed.  NULL or "" disables the cache
+     */
+    static void SetProgramCacheDirectory(const char* directory);
+
+    /**
+     * \brief Gets the program cache hits, misses and build times
+     *
+     * Counts all shaders created since the last call to ResetProgramCacheStats.
+     */
+    static inline const ProgramCacheStats& GetProgramCacheStats() { return cacheStats; }
+
+    /**
+     * \brief Resets the program cache statistics
+     */
+    static void ResetProgramCacheStats();
+
+    /**
+     * \brief Enables building shaders without waiting for the driver
+     *
+     * While enabled, constructing a Shader only submits its stages for
+     * compiling and linking and returns before the driver has finished, so
+     * all programs can be submitted up front.  With
+     * KHR_parallel_shader_compile the driver builds them on several threads
+     * at once.  Errors are reported and the variables are looked up when the
+     * shader is first used, which blocks if the build hasn't finished yet.
+     * Use IsReady to poll without blocking.
+     *
+     * \param[in] enable - Whether shaders created afterwards build asynchronously
+     */
+    static void SetAsyncCompile(bool enable);
+
+    /**
+     * \brief Checks whether new shaders build asynchronously
+     */
+    static inline bool IsAsyncCompile() { return asyncCompile; }
+
+    /**
+     * \brief Checks whether the driver supports KHR_parallel_shader_compile
+     *
+     * Without it, asynchronous builds still defer the status checks, but
+     * the driver may compile each program as it is submitted.
+     */
+    static bool IsParallelCompileSupported();
+
+    /**
+     * \brief Checks whether the program has finished building, without blocking
+     *
+     * Finishes the build once the driver reports it complete.  If the driver
+     * can't report completion, the build is finished immediately.
+     *
+     * \return Whether the program is built and can be used without waiting
+     */
+    bool IsReady();
+
+    /**
+     * \brief Waits for an asynchronous build to finish
+     *
+     * Called by every method that needs the linked program, so it is only
+     * needed to control when the wait happens.
+     */
+    inline void WaitUntilBuilt() const
+    {
+        if (pending != NULL)
+        {
+            // Finishing the build doesn't change what the shader represents
+            const_cast<Shader*>(this)->FinishBuild();
+        }
+    }
 
     /**
      * \brief Gets the OpenGL ID of the shader program
      *
      * \return The OpenGL ID of the shader program
      */
-    inline GLuint GetProgramId() const { return programId; }
+    inline GLuint GetProgramId() const { WaitUntilBuilt(); return programId; }
+
+    /**
+     * \brief Checks whether this is a separable stage for a ProgramPipeline
+     */
+    inline bool IsSeparable() const { return separable; }
+
+    /**
+     * \brief Gets the stages the program contains
+     *
+     * \return Combination of GL_VERTEX_SHADER_BIT, GL_FRAGMENT_SHADER_BIT
+     *         and GL_GEOMETRY_SHADER_BIT
+     */
+    inline GLbitfield GetStageBits() const { return stageBits; }
 
     /**
      * \brief Gets the OpenGL ID of the vertex shader
@@ -243,6 +679,7 @@ public:
      */
     inline AttributeMap::const_iterator GetAttributeIterator() const
     {
+        WaitUntilBuilt();
         return attributes.cbegin();
     }
 
@@ -269,6 +706,7 @@ public:
      */
     inline UniformMap::const_iterator GetUniformIterator() const
     {
+        WaitUntilBuilt();
         return uniforms.cbegin();
     }
 
@@ -282,6 +720,30 @@ public:
         return uniforms.cend();
     }
 
+    /**
+     * \brief Gets an iterator over all the uniform blocks in the shader
+     *
+     * The key is the name of the block as written in the shader source and
+     * the value holds its index, size and binding point.
+     *
+     * \return Uniform block iterator
+     */
+    inline UniformBlockMap::const_iterator GetUniformBlockIterator() const
+    {
+        WaitUntilBuilt();
+        return uniformBlocks.cbegin();
+    }
+
+    /**
+     * \brief Gets an iterator at the end of the uniform blocks
+     *
+     * \return Uniform block iterator end
+     */
+    inline UniformBlockMap::const_iterator GetUniformBlockIteratorEnd() const
+    {
+        return uniformBlocks.cend();
+    }
+
 private:
 
     /**
@@ -294,6 +756,26 @@ private:
      */
     GLuint programId;
 
+    /**
+     * \brief Whether the program is a separable stage for a program pipeline
+     */
+    bool separable;
+
+    /**
+     * \brief Stages in the program, as program pipeline stage bits
+     */
+    GLbitfield stageBits;
+
+    /**
+     * \brief State of a build that was submitted but not yet checked
+     */
+    struct PendingBuild;
+
+    /**
+     * \brief Build waiting to be finished, NULL once the program is built
+     */
+    PendingBuild* pending;
+
     /**
      * \brief Information about the uniforms mapped by the variable name
      */
@@ -304,43 +786,314 @@ private:
      */
     mutable AttributeMap attributes;
 
+    /**
+     * \brief Information about the uniform blocks mapped by the block name
+     */
+    UniformBlockMap uniformBlocks;
+
+    /**
+     * \brief Binding points assigned to uniform block names for all shaders
+     */
+    static std::map<std::string, GLuint> sharedBlockBindings;
+
+    /**
+     * \brief Directory program binaries are cached in, empty if disabled
+     */
+    static std::string cacheDirectory;
+
+    /**
+     * \brief Program cache hits, misses and build times
+     */
+    static ProgramCacheStats cacheStats;
+
+    /**
+     * \brief Whether new shaders are built asynchronously
+     */
+    static bool asyncCompile;
+
+    /**
+     * \brief Identifies a compiled shader stage
+     */
+    struct StageKey
+    {
+        GLenum             stage;      //!< Type of the shader, such as GL_VERTEX_SHADER
+        std::string        path;       //!< Path of the source file
+        unsigned long long sourceHash; //!< Hash of the source code
+        std::string        defines;    //!< Preprocessor defines the stage was built with
+
+        bool operator<(const StageKey& other) const;
+    };
+
+    /**
+     * \brief A compiled shader stage shared between programs
+     */
+    struct StageEntry
+    {
+        GLuint id;       //!< OpenGL ID of the shader
+        int    refCount; //!< Number of programs using the shader
+    };
+
+    /**
+     * \brief Compiled shader stages of all live programs
+     */
+    static std::map<StageKey, StageEntry> compiledStages;
+
+    /**
+     * \brief Last values set for the active uniforms
+     *
+     * Each shadowed uniform has a slot starting with a 4 byte flag
+     * saying whether the slot holds a value, followed by the value.
+     */
+    std::vector<GLubyte> shadowValues;
+
     /**
      * \brief The currently bound shader
      */
     static GLuint activeProgramId;
 
+    /**
+     * \brief Number of uniform uploads issued since the last reset
+     */
+    static unsigned int uploadsIssued;
+
+    /**
+     * \brief Number of uniform uploads skipped since the last reset
+     */
+    static unsigned int uploadsSkipped;
+
+    /**
+     * \brief Checks a new uniform value against its shadow copy
+     *
+     * Updates the shadow copy and the upload counters.
+     *
+     * \param[in] handle - Uniform being set
+     * \param[in] value  - New value of the uniform
+     * \param[in] size   - Size of the value in bytes
+     *
+     * \return Whether the value needs to be uploaded to OpenGL
+     */
+    bool UniformChanged(const UniformHandle& handle, const void* value, GLsizei size);
+
+    /**
+     * \brief Gets the size in bytes of a single value of a uniform type
+     *
+     * \param[in] type - Type of the uniform, such as GL_FLOAT_VEC3
+     *
+     * \return Size of the value as set through SetUniform, or 0 if the type
+     *         can't be set through SetUniform
+     */
+    static GLsizei UniformTypeSize(GLenum type);
+
+    /**
+     * \brief Compiles and links the program, or loads it from the cache
+     *
+     * Shared by the constructors.
+     */
+    void Build(const char* vertexShaderPath,
+               const char* fragShaderPath,
+               const char* geoShaderPath,
+               const Defines& defines);
+
+    /**
+     * \brief Compiles and links the given stages into the program
+     *
+     * \param[in] stages    - Type of each stage, such as GL_VERTEX_SHADER
+     * \param[in] paths     - Source file of each stage
+     * \param[in] numStages - Number of stages, at most 3
+     * \param[in] defines   - Defines to compile the stages with
+     */
+    void Build(const GLenum* stages,
+               const char* const* paths,
+               int numStages,
+               const Defines& defines);
+
+    /**
+     * \brief Checks the results of the submitted build
+     *
+     * Reports compile and link errors, saves the binary to the cache and
+     * looks up the variables.  Blocks until the driver has finished.
+     */
+    void FinishBuild();
+
     /**
      * \brief Retrives data about the variables in the shader
      */
     void GetShaderInfo();
 
     /**
-     * \brief Helper function to compile a shader source file
+     * \brief Reads a shader source file into memory
      *
-     * A detailed log will be printed to stderr if the shader fails compilation
+     * \param[in]  srcPath - Path to shader source file
+     * \param[out] source  - Contents of the file
+     *
+     * \return Whether the file could be read
+     */
+    static bool LoadSource(const char* srcPath, std::string& source);
+
+    /**
+     * \brief Loads a shader source file and runs it through the preprocessor
+     *
+     * Expands #include directives and inserts the defines after the
+     * #version line, which must stay the first directive.  #line directives
+     * keep compiler errors pointing at the right line.  Each included file is
+     * numbered as its own source string, and a comment before its contents
+     * names the file.
+     *
+     * \param[in]  srcPath - Path to shader source file
+     * \param[in]  defines - Defines to insert, see Defines
+     * \param[out] source  - Preprocessed source code
+     *
+     * \return Whether the file and everything it includes could be read
+     */
+    static bool PreprocessSource(const char* srcPath, const Defines& defines, std::string& source);
+
+    /**
+     * \brief Appends a source file to the output, expanding its #includes
+     *
+     * \param[in]     srcPath - Path to the file
+     * \param[in,out] output  - Preprocessed source code so far
+     * \param[in,out] files   - Files expanded so far, the index of each file
+     *                          is its source string number
+     * \param[in]     depth   - Include nesting depth, used to catch include cycles
+     * \param[in,out] lineBias - Added to line numbers in #line directives.
+     *                          Set from the #version line, since before GLSL
+     *                          3.30 #line named the number of its own line
+     *                          rather than the next one
+     *
+     * \return Whether the file and everything it includes could be read
+     */
+    static bool ExpandIncludes(
+        const std::string& srcPath,
+        std::string& output,
+        std::vector<std::string>& files,
+        int depth,
+        int& lineBias);
+
+    /**
+     * \brief Helper function to compile shader source code
+     *
+     * Only submits the source to the driver.  The result is checked later
+     * with CheckShader, so the driver can compile in the background.
      *
      * \param[in] shaderType - One of GL_VERTEX_SHADER, GL_FRAGMENT_SHADER,
      *                         or GL_GEOMETRY_SHADER
-     * \param[in] srcPath    - Path to shader source file
+     * \param[in] source     - Source code of the shader
      *
      * \return The OpenGL ID of the shader
-     * \return 0 if the shader failed compilation
      */
-    static GLuint CompileShader(GLenum shaderType, const char* srcPath);
+    static GLuint CompileShader(GLenum shaderType, const std::string& source);
+
+    /**
+     * \brief Checks whether a shader compiled successfully
+     *
+     * A detailed log will be printed to stderr if the shader failed compilation
+     *
+     * \param[in] shaderId - OpenGL ID of the shader
+     * \param[in] srcPath  - Path to shader source file, used in error messages
+     *
+     * \return Whether the shader compiled
+     */
+    static bool CheckShader(GLuint shaderId, const char* srcPath);
+
+    /**
+     * \brief Gets a compiled shader stage, compiling it only if no other
+     *        program already uses an identical stage
+     *
+     * Each successful call must be matched by a call to ReleaseShader.
+     *
+     * \param[in] shaderType - One of GL_VERTEX_SHADER, GL_FRAGMENT_SHADER,
+     *                         or GL_GEOMETRY_SHADER
+     * \param[in] srcPath    - Path to shader source file
+     * \param[in] source     - Preprocessed source code of the shader
+     * \param[in] defines    - Defines the source was preprocessed with
+     *
+     * \return The OpenGL ID of the shader, which may still be compiling
+     */
+    static GLuint AcquireShader(
+        GLenum shaderType,
+        const char* srcPath,
+        const std::string& source,
+        const Defines& defines);
+
+    /**
+     * \brief Releases a shader stage from AcquireShader, deleting it once
+     *        no program uses it
+     *
+     * \param[in] shaderId - OpenGL ID of the shader, ignored if 0
+     */
+    static void ReleaseShader(GLuint shaderId);
 
     /**
      * \brief Links a previously compiled shaders into a shader program
      *
-     * A detailed log will be printed to stderr if the program fails linking
+     * Like CompileShader, only submits the link.  The result is checked
+     * with CheckProgram.
+     *
+     * \param[in] shaderIds   - OpenGL IDs of the shaders
+     * \param[in] numShaders  - Number of shaders
+     * \param[in] separable   - Whether to link a separable program
+     * \param[in] retrievable - Whether the program binary will be read back
+     *
+     * \return The OpenGL ID of the shader program
+     */
+    static GLuint LinkProgram(
+        const GLuint* shaderIds,
+        int numShaders,
+        bool separable,
+        bool retrievable);
+
+    /**
+     * \brief Checks whether a program linked successfully
+     *
+     * A detailed log will be printed to stderr if the program failed linking
      *
-     * \param[in] vertexId - OpenGL ID of the vertex shader
-     * \param[in] fragId   - OpenGL ID of the fragment shader
-     * \param[in] geoId    - Optionally, OpenGL ID of the geometry shader
+     * \param[in] programId - OpenGL ID of the shader program
+     *
+     * \return Whether the program linked
+     */
+    static bool CheckProgram(GLuint programId);
+
+    /**
+     * \brief Computes the cache key of a program built from the given sources
+     *
+     * \param[in]  stages     - Stage of each source, such as GL_VERTEX_SHADER
+     * \param[in]  sources    - Source code of each stage
+     * \param[in]  numSources - Number of stages
+     * \param[in]  separable  - Whether the program is separable
+     * \param[out] key        - Hash of the sources and driver strings
+     *
+     * \return Whether the driver supports retrieving program binaries
+     */
+    static bool GetProgramCacheKey(
+        const GLenum* stages,
+        const std::string* sources,
+        int numSources,
+        bool separable,
+        unsigned long long& key);
+
+    /**
+     * \brief Gets the path of the cache file for a key
+     */
+    static std::string GetProgramCacheFile(unsigned long long key);
+
+    /**
+     * \brief Creates a program from a cached program binary
+     *
+     * \param[in] key       - Cache key of the program
+     * \param[in] separable - Whether the program is separable
      *
      * \return The OpenGL ID of the shader program
-     * \return 0 if the program failed linking
+     * \return 0 if the file doesn't exist, is stale or was rejected by the driver
+     */
+    static GLuint LoadProgramBinary(unsigned long long key, bool separable);
+
+    /**
+     * \brief Saves the binary of a linked program to the cache
+     *
+     * \param[in] programId - OpenGL ID of the shader program
+     * \param[in] key       - Cache key of the program
      */
-    static GLuint LinkProgram(GLuint vertexId, GLuint fragId, GLuint geoId = 0);
+    static void SaveProgramBinary(GLuint programId, unsigned long long key);
 
     Shader(const Shader&);            //!< No copy constructor
     Shader& operator=(const Shader&); //!< No assignment operator
@@ -0,0 +1,118 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include "Shader.h"
+
+/**
+ * \brief Cache of the variants of a shader built with different defines
+ *
+ * Shaders can use #ifdef to select features at compile time rather than
+ * branching on uniforms in every fragment.  Each combination of defines is
+ * then its own program.  This class compiles each combination the first
+ * time it is asked for and keeps it for later requests.
+ *
+ * Variants that will probably be needed later can be queued with Prefetch,
+ * then compiled a few at a time with CompilePending, such as once per frame
+ * from the idle callback, so they are ready before they are first drawn.
+ *
+ * The order of the defines doesn't matter, { "A", "B" } and { "B", "A" }
+ * give the same program.
+ */
+class ShaderPermutations
+{
+public:
+
+    /**
+     * \brief Creates an empty cache for the given source files
+     *
+     * \param[in] vertexShaderPath - Location of the vertex shader source file
+     * \param[in] fragShaderPath   - Location of the fragment shader source file
+     * \param[in] geoShaderPath    - Optionally, location of the geometry shader source file.
+     *                               Ignored if set to NULL
+     */
+    ShaderPermutations(const char* vertexShaderPath,
+                       const char* fragShaderPath,
+                       const char* geoShaderPath = NULL);
+
+    /**
+     * \brief Creates an empty cache of separable shaders for a single stage
+     *
+     * The shaders are meant to be combined in a ProgramPipeline, see the
+     * single stage Shader constructor.
+     *
+     * \param[in] stage      - One of GL_VERTEX_SHADER, GL_FRAGMENT_SHADER,
+     *                         or GL_GEOMETRY_SHADER
+     * \param[in] shaderPath - Location of the shader source file
+     */
+    ShaderPermutations(GLenum stage, const char* shaderPath);
+
+    /**
+     * \brief Destroys the cache and every shader in it
+     */
+    ~ShaderPermutations();
+
+    /**
+     * \brief Gets the shader compiled with a set of defines
+     *
+     * Compiles the shader if this combination hasn't been used before.
+     *
+     * \param[in] defines - Defines to compile the shaders with
+     *
+     * \return The shader, owned by the cache
+     */
+    Shader* Get(const Shader::Defines& defines);
+
+    /**
+     * \brief Queues a combination of defines to be compiled by CompilePending
+     *
+     * \param[in] defines - Defines to compile the shaders with
+     */
+    void Prefetch(const Shader::Defines& defines);
+
+    /**
+     * \brief Compiles some of the combinations queued with Prefetch
+     *
+     * Also finishes any asynchronous builds the driver has completed, see
+     * Shader::SetAsyncCompile, so they are ready before they are first used.
+     *
+     * \param[in] maxShaders - Maximum number of shaders to compile
+     *
+     * \return Number of combinations still waiting to be compiled or to
+     *         finish building
+     */
+    size_t CompilePending(size_t maxShaders = 1);
+
+    /**
+     * \brief Gets the number of combinations compiled so far
+     */
+    inline size_t GetNumCompiled() const { return shaders.size(); }
+
+private:
+
+    GLenum      stage;      //!< Stage of separable shaders, or 0 for complete programs
+    std::string vertexPath; //!< Path of the vertex shader source file, or of the
+                            //!< only stage of separable shaders
+    std::string fragPath;   //!< Path of the fragment shader source file
+    std::string geoPath;    //!< Path of the geometry shader source file, or empty
+
+    std::map<std::string, Shader*> shaders; //!< Compiled shaders by define key
+    std::deque<Shader::Defines>    pending; //!< Combinations queued by Prefetch
+
+    /**
+     * \brief Sorts defines into a canonical order
+     *
+     * \param[in]  defines - Defines in any order
+     * \param[out] sorted  - The same defines, sorted
+     *
+     * \return Key identifying the combination
+     */
+    static std::string MakeKey(const Shader::Defines& defines, Shader::Defines& sorted);
+
+    ShaderPermutations(const ShaderPermutations&);            //!< No copy constructor
+    ShaderPermutations& operator=(const ShaderPermutations&); //!< No assignment operator
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define TEXTURE_H
 
 #include <GL/glew.h>
+#include <map>
 
 /**
  * \brief Abstract base class for texture types
@@ -12,6 +13,33 @@ class Texture
 {
 public:
 
+    /**
+     * \brief Filtering, wrap and depth comparison settings of a texture
+     *
+     * Textures with identical settings share a single sampler object.
+     */
+    struct SamplerParams
+    {
+    public:
+
+        /**
+         * \brief Creates settings with bilinear filtering and repeat wrapping
+         */
+        SamplerParams();
+
+        GLenum minFilter;   //!< Filter to use when shrinking the texture
+        GLenum magFilter;   //!< Filter to use when expanding the texture
+        GLenum wrapS;       //!< Wrap mode for S coordinates
+        GLenum wrapT;       //!< Wrap mode for T coordinates
+        GLenum wrapR;       //!< Wrap mode for R coordinates
+        float  aniso;       //!< Maximum samples for anisotropic filtering
+        GLenum compareMode; //!< GL_COMPARE_REF_TO_TEXTURE for depth comparison,
+                            //!< otherwise GL_NONE
+        GLenum compareFunc; //!< Depth comparison function
+
+        bool operator<(const SamplerParams& other) const;
+    };
+
     /**
      * \brief Texture destructor
      */
@@ -34,6 +62,15 @@ public:
      * texture to bind to the unit.  The exact number of texture units in the
      * system may vary, but it is guaranteed to be at least 16.
      *
+     * Binding a texture to the unit it is already bound to only makes that
+     * unit active, so glTex* calls that follow still reach this texture.
+     * The filter and wrap modes are held in a sampler object bound alongside
+     * the texture, so they aren't set again on every bind.
+     *
+     * A texture that loads its image in the background, such as a lazily
+     * loaded Texture2D, may start the load or swap in the finished image
+     * first.
+     *
      * \param[in] textureUnit - Texture unit number to bind to.  Values range
      *                          from 0 (inclusive) to max_texture_units (exclusive),
      *                          where the maximum is system dependant, but is
@@ -41,6 +78,117 @@ public:
      */
     void Bind(int textureUnit);
 
+    /**
+     * \brief Gets the number of binds that changed OpenGL state since the last reset
+     */
+    static inline unsigned int GetBindsIssued() { return bindsIssued; }
+
+    /**
+     * \brief Gets the number of binds skipped since the last reset
+     *
+     * A bind is skipped when the texture and its sampler are already bound
+     * to the unit.
+     */
+    static inline unsigned int GetBindsElided() { return bindsElided; }
+
+    /**
+     * \brief Resets the bind counters, typically at the start of each frame
+     */
+    static void ResetBindCounters();
+
+    /**
+     * \brief Gets the number of distinct sampler objects in use
+     */
+    static inline size_t GetNumSamplers() { return samplers.size(); }
+
+    /**
+     * \brief Gets the number of image bytes decoded by LoadFile so far
+     */
+    static unsigned long long GetBytesLoaded();
+
+    /**
+     * \brief Gets the number of bytes of memory traffic LoadFile has avoided
+     *        by decoding images straight into OpenGL's bottom-up row order
+     *
+     * Flipping an image after decoding swapped each pair of rows with three
+     * copies through a temporary row, moving three times the image size
+     * through memory.  Formats the decoder can't write bottom-up still need
+     * an in-place swap, which moves twice the image size.  This is a lower bound,
+     * since it doesn't count the flip stb_image used to do itself on
+     * images stored bottom-up.
+     */
+    static unsigned long long GetFlipBytesSaved();
+
+    /**
+     * \brief Gets the video memory used by the texture's images in bytes
+     *
+     * Measured from the sizes OpenGL reports for every mip level, so it
+     * reflects compression but not any padding the driver adds.
+     */
+    inline GLsizeiptr GetMemoryUsed() const { return memoryUsed; }
+
+    /**
+     * \brief Gets the video memory used by all textures in bytes
+     */
+    static inline GLsizeiptr GetTotalMemoryUsed() { return totalMemoryUsed; }
+
+    /**
+     * \brief Wrapper to handle loading images with the stb_image library
+     *
+     * The rows are returned bottom-up, as glTexImage expects.  JPEG, BMP and
+     * TGA images are decoded straight into that order, so the returned
+     * buffer is the only copy of the pixels that is ever written.
+     *
+     * Safe to call from any thread.
+     *
+     * \param[in]  filename    - Name and path of the image file to load
+     * \param[out] nWidth      - Returns the width of the loaded image
+     * \param[out] nHeight     - Returns the height of the loaded image
+     * \param[out] eFormat     - Returns the format of the loaded image
+     *
+     * \return Array of color bytes in the image allocated with malloc,
+     *         must be free'd by the caller
+     *
+     * \author Steve Kautz
+     */
+    static GLubyte* LoadFile(
+        const char* filename, 
+        int* nWidth, 
+        int* nHeight,
+        GLenum* eFormat);
+
+    /**
+     * \brief Checks whether a file holds a high dynamic range image, such as
+     *        a Radiance .hdr file, that LoadHdrFile should be used for
+     *
+     * \param[in] filename - Name and path of the image file
+     */
+    static bool IsHdrFile(const char* filename);
+
+    /**
+     * \brief Loads a high dynamic range image as half floats
+     *
+     * The floats stb_image decodes are converted to half floats four at a
+     * time while the rows are written bottom-up, so the image keeps its
+     * range in half the memory and the flip costs no extra pass.  Upload
+     * with GL_HALF_FLOAT into the format from GetHalfFloatFormat.
+     *
+     * Safe to call from any thread.
+     *
+     * \param[in]  filename - Name and path of the image file to load
+     * \param[out] nWidth   - Returns the width of the loaded image
+     * \param[out] nHeight  - Returns the height of the loaded image
+     * \param[out] eFormat  - Returns the format of the loaded image
+     *
+     * \return Array of half floats allocated with malloc, must be free'd by
+     *         the caller, or NULL if the file couldn't be loaded
+     */
+    static GLushort* LoadHdrFile(
+        const char* filename,
+        int* nWidth,
+        int* nHeight,
+        GLenum* eFormat);
+
     /**
      * \brief Gets the ID of the texture
      *
@@ -90,30 +238,88 @@ protected:
     //virtual void InitTextureObject()=0;
 
     /**
-     * \brief Sets the texture parameters such as min/mag filter and wrap modes
+     * \brief Gets the texture parameters such as min/mag filter and wrap modes
      *
-     * Sets the texture parameters
+     * Called when the texture is first bound, to pick its sampler object.
+     *
+     * \param[out] params - Parameters of the texture
      */
-    virtual void SetTextureParams()=0;
+    virtual void GetSamplerParams(SamplerParams& params) const=0;
 
     /**
-     * \brief Wrapper to handle loading images with the stb_image library
+     * \brief Updates the memory used by the texture from the sizes of its
+     *        mip levels
      *
-     * \param[in]  filename    - Name and path of the image file to load
-     * \param[out] nWidth      - Returns the width of the loaded image
-     * \param[out] nHeight     - Returns the height of the loaded image
-     * \param[out] eFormat     - Returns the format of the loaded image
+     * Must be called with the texture bound to the active texture unit, once
+     * its images and mip maps have been created.
+     */
+    void MeasureMemoryUsed();
+
+    /**
+     * \brief Sets whether Bind calls LoadOnBind before binding the texture
      *
-     * \return Array of color bytes in the image allocated with malloc,
-     *         must be free'd by the caller
+     * \param[in] enabled - Whether the texture is still loading
+     */
+    inline void SetLoadOnBind(bool enabled) { loadOnBind = enabled; }
+
+    /**
+     * \brief Called by Bind while SetLoadOnBind is enabled, so a texture
+     *        whose image is loaded in the background can start the load or
+     *        swap in the finished image
      *
-     * \author Steve Kautz
+     * The texture is bound to the active texture unit when this is called,
+     * so the image can be uploaded without binding it anywhere else.
      */
-    static GLubyte* LoadFile(
-        const char* filename, 
-        int* nWidth, 
-        int* nHeight,
-        GLenum* eFormat);
+    virtual void LoadOnBind();
+
+    /**
+     * \brief Decodes several image files at once on the shared thread pool
+     *
+     * Each file is loaded as with LoadFile on a worker thread.  WaitNext
+     * returns the images in the order they finish decoding, so the caller
+     * can upload each one to OpenGL while the rest are still decoding.
+     */
+    class ImageBatch
+    {
+    public:
+
+        /**
+         * \brief Starts decoding the files
+         *
+         * \param[in] filenames - Names and paths of the files to load
+         * \param[in] count     - Number of files
+         */
+        ImageBatch(const char* const* filenames, int count);
+
+        /**
+         * \brief Waits for any decodes still running and frees the images
+         *        that weren't returned by WaitNext
+         */
+        ~ImageBatch();
+
+        /**
+         * \brief Waits for the next image to finish decoding
+         *
+         * Must be called at most once per file.
+         *
+         * \param[out] index  - Returns the position of the file in the batch
+         * \param[out] width  - Returns the width of the image
+         * \param[out] height - Returns the height of the image
+         * \param[out] format - Returns the format of the image
+         *
+         * \return Array of color bytes allocated with malloc, must be free'd
+         *         by the caller
+         */
+        GLubyte* WaitNext(int* index, int* width, int* height, GLenum* format);
+
+    private:
+
+        struct State;
+        State* state; //!< Images and decode progress, shared with the workers
+
+        ImageBatch(const ImageBatch&);            //!< No copy constructor
+        ImageBatch& operator=(const ImageBatch&); //!< No assignment operator
+    };
 
     /**
      * \brief Generates a texture to be used when one cannot be loaded
@@ -135,6 +341,21 @@ protected:
      */
     static GLsizei BytesPerPixel(GLenum format);
 
+    /**
+     * \brief Gets the number of bytes in one component of a given data type
+     *
+     * \param[in] dataType - GL_UNSIGNED_BYTE, GL_HALF_FLOAT or GL_FLOAT
+     */
+    static GLsizei BytesPerComponent(GLenum dataType);
+
+    /**
+     * \brief Gets the half float internal format holding images of a given
+     *        format, such as GL_RGB16F for GL_RGB or GL_BGR
+     *
+     * \param[in] format - Format of the source image
+     */
+    static GLenum GetHalfFloatFormat(GLenum format);
+
 private:
 
     GLenum target;        //!< The target of glBindTexture commands
@@ -142,8 +363,68 @@ private:
     //GLuint imageBufferId; //!< ID of the buffer used to hold the image data
     int    textureUnit;   //!< The texture unit the texture was last bound to
     //bool   imageStale;    //!< Flag whether the texture image data needs updating
+    GLuint samplerId;     //!< The sampler object holding the texture parameters,
+                          //!< or 0 if sampler objects aren't supported
+    bool   paramsApplied; //!< Whether the parameters have been looked up yet
+    bool   loadOnBind;    //!< Whether Bind calls LoadOnBind first
+    GLsizeiptr memoryUsed; //!< Video memory used by the images in bytes
 
     static GLuint activeTextures[]; //!< The ID of the texture bound to each unit
+    static GLuint activeSamplers[]; //!< The ID of the sampler bound to each unit
+    static int    activeUnit;       //!< The unit selected with glActiveTexture
+
+    static unsigned int bindsIssued; //!< Binds that changed state since the last reset
+    static unsigned int bindsElided; //!< Binds skipped since the last reset
+
+    static GLsizeiptr totalMemoryUsed; //!< Video memory used by all textures
+
+    /**
+     * \brief A sampler object shared between textures
+     */
+    struct SamplerEntry
+    {
+        GLuint id;       //!< OpenGL ID of the sampler
+        int    refCount; //!< Number of textures using the sampler
+    };
+
+    static std::map<SamplerParams, SamplerEntry> samplers; //!< Samplers by parameters
+
+    /**
+     * \brief Checks whether sampler objects are supported
+     *
+     * Requires OpenGL 3.3 or ARB_sampler_objects
+     */
+    static bool AreSamplersSupported();
+
+    /**
+     * \brief Gets a sampler object with the given parameters, creating it
+     *        only if no other texture already uses the same parameters
+     *
+     * Each call must be matched by a call to ReleaseSampler.
+     *
+     * \param[in] params - Parameters of the sampler
+     *
+     * \return The OpenGL ID of the sampler
+     */
+    static GLuint AcquireSampler(const SamplerParams& params);
+
+    /**
+     * \brief Releases a sampler from AcquireSampler, deleting it once no
+     *        texture uses it
+     *
+     * \param[in] samplerId - OpenGL ID of the sampler, ignored if 0
+     */
+    static void ReleaseSampler(GLuint samplerId);
+
+    /**
+     * \brief Sets the parameters on the texture object itself
+     *
+     * Used when sampler objects aren't supported.  The texture must be bound
+     * to the active texture unit.
+     *
+     * \param[in] params - Parameters to set
+     */
+    void ApplyTextureParams(const SamplerParams& params);
 
     static const GLenum textureUnits[]; //!< Lookup table of texture enums
 
@@ -1,8 +1,12 @@
 #ifndef TEXTURE_2D_H
 #define TEXTURE_2D_H
 
+#include <functional>
+#include <memory>
 #include "Texture.h"
 
+class CompressedImage;
+
 /**
  * \brief Class to manage a 2-dimensional texture
  *
@@ -15,6 +19,17 @@ public:
     /** 
      * \brief Creates a texture by loading an image
      *
+     * High dynamic range images, such as Radiance .hdr files, are stored as
+     * half floats in GL_RGB16F or GL_RGBA16F so they keep their range.  KTX
+     * and DDS files are uploaded as the compressed levels they hold.
+     *
+     * A lazy texture only records the path and holds a 1x1 grey placeholder,
+     * so creating it costs nothing.  The image is decoded on the shared
+     * thread pool, along with its mip levels, the first time the texture is
+     * bound or when Prefetch is called, and replaces the placeholder on the
+     * first bind after it is ready.  Until then the size and level queries
+     * describe the placeholder.
+     *
      * \param[in] filename - Name and path of the file to load
      * \param[in] minFilter - Minification filter to use when the texture
      *                        is drawn on small surfaces.  Valid values are:
@@ -43,6 +58,8 @@ public:
      *                        using a filter mode involving mipmaps to enable
      *                        anisotropic filtering.  Valid values range from
      *                        1 to GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT (usually 16)
+     * \param[in] lazy      - Whether to load the image in the background
+     *                        once the texture is needed
      */
     Texture2D(
         const char* filename,
@@ -50,6 +67,81 @@ public:
         GLenum magFilter = GL_LINEAR,
         GLenum wrapS     = GL_REPEAT,
         GLenum wrapT     = GL_REPEAT,
+        float  aniso     = 1.0f,
+        bool   lazy      = false);
+
+    /**
+     * \brief Creates a lazy texture whose compressed image is made by a
+     *        function, such as one that reads a cached copy of an image and
+     *        compresses the image when there is none
+     *
+     * As with a lazy texture loaded from a file, the texture holds a 1x1
+     * grey placeholder until the function has run on the shared thread
+     * pool, started by the first bind or by Prefetch.
+     *
+     * \param[in] loader    - Function returning a new image, which the
+     *                        texture deletes, or NULL if it failed
+     * \param[in] minFilter - Minification filter, as for the other
+     *                        constructors.  Only the mip levels stored in the
+     *                        image are sampled
+     * \param[in] magFilter - Magnification filter, as for the other constructors
+     * \param[in] wrapS     - Wrap mode for s coordinates, as for the other constructors
+     * \param[in] wrapT     - Wrap mode for t coordinates, as for the other constructors
+     * \param[in] aniso     - Maximum samples for anisotropic filtering
+     */
+    Texture2D(
+        const std::function<CompressedImage*()>& loader,
+        GLenum minFilter = GL_LINEAR,
+        GLenum magFilter = GL_LINEAR,
+        GLenum wrapS     = GL_REPEAT,
+        GLenum wrapT     = GL_REPEAT,
+        float  aniso     = 1.0f);
+
+    /** 
+     * \brief Creates a texture from block-compressed data, such as an image
+     *        loaded from a KTX or DDS file
+     *
+     * Every mip level in the image is uploaded as is, so the texture takes a
+     * quarter to an eighth of the memory of an uncompressed one.  Mip maps
+     * can't be generated for compressed textures, so when the image has a
+     * single level only that level is used.  If the format isn't supported
+     * by the OpenGL context, an error texture is used instead.
+     *
+     * \param[in] image     - Compressed image with 1 face
+     * \param[in] minFilter - Minification filter to use when the texture
+     *                        is drawn on small surfaces.  Valid values are:
+     *                        GL_NEAREST
+     *                        GL_LINEAR (default, aka bilinear filtering)
+     *                        GL_NEAREST_MIPMAP_NEAREST
+     *                        GL_LINEAR_MIPMAP_NEAREST
+     *                        GL_NEAREST_MIPMAP_LINEAR
+     *                        GL_LINEAR_MIPMAP_LINEAR (aka trilinear filtering)
+     * \param[in] magFilter - Magnification filter to use when the texture
+     *                        is drawn on large surfaces.  Valid values are:
+     *                        GL_NEAREST
+     *                        GL_LINEAR (default)
+     * \param[in] wrapS     - Wrap mode to use when accessing texture coordinates
+     *                        with s values outside of [0,1].  Valid values are:
+     *                        GL_CLAMP_TO_EDGE
+     *                        GL_REPEAT (default)
+     *                        GL_MIRRORED_REPEAT
+     * \param[in] wrapT     - Wrap mode to use when accessing texture coordinates
+     *                        with t values outside of [0,1].  Valid values are:
+     *                        GL_CLAMP_TO_EDGE
+     *                        GL_REPEAT (default)
+     *                        GL_MIRRORED_REPEAT
+     * \param[in] aniso     - Maximum number of samples used for anisotropic
+     *                        filtering.  Set to a value greater than 1 while
+     *                        using a filter mode involving mipmaps to enable
+     *                        anisotropic filtering.  Valid values range from
+     *                        1 to GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT (usually 16)
+     */
+    Texture2D(
+        const CompressedImage& image,
+        GLenum minFilter = GL_LINEAR,
+        GLenum magFilter = GL_LINEAR,
+        GLenum wrapS     = GL_REPEAT,
+        GLenum wrapT     = GL_REPEAT,
         float  aniso     = 1.0f);
 
     /** 
@@ -106,6 +198,15 @@ public:
         GLenum wrapS     = GL_REPEAT,
         GLenum wrapT     = GL_REPEAT,
         float  aniso     = 1.0f);
+
+    /** 
+     * \brief Creates a texture from an array of floats
+     *
+     * Takes the same parameters as the constructor from bytes.  The values
+     * are converted to half floats and stored in a 16-bit float format such
+     * as GL_RGBA16F, so they aren't clamped to [0, 1] and take half the
+     * memory of 32-bit floats.
+     */
     Texture2D(
         const GLfloat* data,
         GLenum format, 
@@ -173,6 +274,101 @@ public:
      */
     ~Texture2D();
 
+    /**
+     * \brief Starts decoding the image of a lazy texture ahead of its first
+     *        bind, such as when it is about to come into view
+     *
+     * Does nothing if the decode has already started or the texture isn't
+     * lazy.
+     */
+    void Prefetch();
+
+    /**
+     * \brief Checks whether the texture holds its image, rather than the
+     *        placeholder of a lazy texture
+     */
+    inline bool IsLoaded() const { return !lazyLoad; }
+
+    /**
+     * \brief Replaces the images of the first mip levels
+     *
+     * The levels are stored one after another with tightly packed rows, in
+     * the texture's source format and data type, the same layout as level 0
+     * followed by a MipmapBuilder::Chain.  If the min filter uses mip maps
+     * and only level 0 is given, glGenerateMipmap makes the rest.
+     *
+     * With a buffer bound to GL_PIXEL_UNPACK_BUFFER, pixels is a byte offset
+     * into the buffer, and the copy is queued on the GPU instead of the
+     * driver reading client memory before returning.
+     *
+     * \param[in] pixels    - Pixels of the levels
+     * \param[in] numLevels - Number of levels given, starting at level 0
+     */
+    void SetLevels(const GLvoid* pixels, int numLevels);
+
+    /**
+     * \brief Replaces the image of a single mip level, such as one streamed
+     *        back in after SetBaseLevel released it
+     *
+     * \param[in] level          - Level to replace
+     * \param[in] pixels         - Pixels of the level in the texture's source
+     *                             format and data type, or compressed blocks
+     *                             for a compressed texture
+     * \param[in] compressedSize - Size of the compressed blocks in bytes.
+     *                             Ignored for uncompressed textures
+     */
+    void SetLevel(int level, const GLvoid* pixels, GLsizei compressedSize = 0);
+
+    /**
+     * \brief Replaces a rectangle of one mip level, keeping the rest of the
+     *        level's image
+     *
+     * \param[in] level  - Level to update
+     * \param[in] x      - Left of the rectangle in pixels
+     * \param[in] y      - Bottom of the rectangle in pixels
+     * \param[in] width  - Width of the rectangle in pixels
+     * \param[in] height - Height of the rectangle in pixels
+     * \param[in] pixels - Pixels of the rectangle with tightly packed rows,
+     *                     in the texture's source format and data type
+     */
+    void SetSubImage(int level, int x, int y, int width, int height, const GLvoid* pixels);
+
+    /**
+     * \brief Sets the finest mip level that is sampled
+     *
+     * The images of finer levels are released, freeing their video memory.
+     * Before lowering the base level, every level from the new base up to
+     * the old one must be given an image again with SetLevel.
+     *
+     * \param[in] level - New base level, less than GetNumLevels
+     */
+    void SetBaseLevel(int level);
+
+    /**
+     * \brief Gets the finest mip level that is sampled
+     */
+    inline int GetBaseLevel() const { return baseLevel; }
+
+    /**
+     * \brief Gets the number of mip levels, including released ones
+     */
+    inline int GetNumLevels() const { return numLevels; }
+
+    /**
+     * \brief Gets the width of level 0 in pixels
+     */
+    inline int GetWidth() const { return width; }
+
+    /**
+     * \brief Gets the height of level 0 in pixels
+     */
+    inline int GetHeight() const { return height; }
+
+    /**
+     * \brief Checks whether the texture holds block-compressed images
+     */
+    inline bool IsCompressed() const { return imageFormat == GL_NONE; }
+
 protected:
 
     /**
@@ -186,11 +382,32 @@ protected:
     void InitTextureObject(const GLvoid* pixels);
 
     /**
-     * \brief Sets the texture parameters such as min/mag filter and wrap modes
+     * \brief Initializes the texture with every mip level of a compressed image
      *
-     * Sets the texture parameters
+     * \param[in] image - Compressed image to initialize the texture with
      */
-    virtual void SetTextureParams();
+    void InitTextureObject(const CompressedImage& image);
+
+    /**
+     * \brief Gets the texture parameters such as min/mag filter and wrap modes
+     *
+     * \param[out] params - Parameters of the texture
+     */
+    virtual void GetSamplerParams(SamplerParams& params) const;
+
+    /**
+     * \brief Swaps in the image of a lazy texture once it is decoded,
+     *        starting the decode if nothing has yet
+     */
+    virtual void LoadOnBind();
+
+    /**
+     * \brief Gets the number of levels in a full mip chain, down to 1x1
+     *
+     * \param[in] width  - Width of level 0 in pixels
+     * \param[in] height - Height of level 0 in pixels
+     */
+    static int CountLevels(int width, int height);
 
 private:
     GLenum minFilter; //!< Filter to use when shrinking the texture
@@ -204,6 +421,36 @@ private:
     GLint  internalFormat; //!< Image format used when rendering
     GLenum imageFormat;    //!< Source image format
     GLenum dataType;       //!< Type of data in the image buffer
+    int    numLevels;      //!< Mip levels of the texture, including released ones
+    int    baseLevel;      //!< Finest level with an image
+
+    struct LazyLoad;
+    std::shared_ptr<LazyLoad> lazyLoad; //!< Image being decoded for a lazy texture,
+                                        //!< shared with the worker decoding it
+
+    /**
+     * \brief Replaces the placeholder of a lazy texture with its decoded
+     *        image, through the active unit the texture is bound to
+     */
+    void FinishLazyLoad();
+
+    /**
+     * \brief Fills the texture with a 1x1 grey texel until the image of a
+     *        lazy texture is loaded
+     *
+     * \param[in] load - Image to load once the texture is needed
+     */
+    void InitPlaceholder(const std::shared_ptr<LazyLoad>& load);
+
+    /**
+     * \brief Initializes the texture from a compressed image, or with the
+     *        error texture if there is no image, or it is empty, a cube map
+     *        or in a format the context can't sample
+     *
+     * \param[in] image - Compressed image to initialize the texture with,
+     *                    or NULL if it couldn't be loaded
+     */
+    void LoadCompressedImage(const CompressedImage* image);
 
     Texture2D(const Texture2D&);            //!< No copy constructor
     Texture2D& operator=(const Texture2D&); //!< No assignment operator
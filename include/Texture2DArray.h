@@ -0,0 +1,139 @@
+#ifndef TEXTURE_2D_ARRAY_H
+#define TEXTURE_2D_ARRAY_H
+
+#include "Texture.h"
+
+class CompressedImage;
+
+/**
+ * \brief Class to manage an array of 2-dimensional textures of the same size
+ *        and format
+ *
+ * Shaders pick a layer with the third texture coordinate, so objects that
+ * only differ by their texture can share one binding, and one instanced
+ * draw with a layer index per instance.  Unlike a 3D texture, layers are
+ * never filtered into each other.
+ */
+class Texture2DArray : public Texture
+{
+public:
+
+    /**
+     * \brief Creates a texture array from raw bytes
+     *
+     * \param[in] layers    - Pixel data of each layer, starting at the bottom row
+     * \param[in] numLayers - Number of layers
+     * \param[in] format    - Format of the pixel data, such as GL_RGB
+     * \param[in] width     - Width of each layer in pixels
+     * \param[in] height    - Height of each layer in pixels
+     * \param[in] minFilter - Minification filter, as for Texture2D.  Mip
+     *                        levels are built by MipmapBuilder when enabled
+     * \param[in] magFilter - Magnification filter, as for Texture2D
+     * \param[in] wrapS     - Wrap mode for s coordinates, as for Texture2D
+     * \param[in] wrapT     - Wrap mode for t coordinates, as for Texture2D
+     * \param[in] aniso     - Maximum samples for anisotropic filtering
+     */
+    Texture2DArray(
+        const GLubyte* const* layers,
+        int    numLayers,
+        GLenum format,
+        int    width,
+        int    height,
+        GLenum minFilter = GL_LINEAR,
+        GLenum magFilter = GL_LINEAR,
+        GLenum wrapS     = GL_REPEAT,
+        GLenum wrapT     = GL_REPEAT,
+        float  aniso     = 1.0f);
+
+    /**
+     * \brief Creates a texture array from block-compressed images
+     *
+     * Every image must have the same format, size and number of mip levels.
+     * If the format isn't supported by the driver, every layer holds the
+     * error texture instead.
+     *
+     * \param[in] layers    - Compressed image of each layer
+     * \param[in] numLayers - Number of layers
+     * \param[in] minFilter - Minification filter, as for Texture2D.  Only the
+     *                        mip levels stored in the images are sampled
+     * \param[in] magFilter - Magnification filter, as for Texture2D
+     * \param[in] wrapS     - Wrap mode for s coordinates, as for Texture2D
+     * \param[in] wrapT     - Wrap mode for t coordinates, as for Texture2D
+     * \param[in] aniso     - Maximum samples for anisotropic filtering
+     */
+    Texture2DArray(
+        const CompressedImage* const* layers,
+        int    numLayers,
+        GLenum minFilter = GL_LINEAR,
+        GLenum magFilter = GL_LINEAR,
+        GLenum wrapS     = GL_REPEAT,
+        GLenum wrapT     = GL_REPEAT,
+        float  aniso     = 1.0f);
+
+    /**
+     * \brief Texture2DArray destructor
+     */
+    ~Texture2DArray();
+
+    /**
+     * \brief Gets the number of layers
+     */
+    inline int GetNumLayers() const { return numLayers; }
+
+    /**
+     * \brief Gets the width of each layer in pixels
+     */
+    inline int GetWidth() const { return width; }
+
+    /**
+     * \brief Gets the height of each layer in pixels
+     */
+    inline int GetHeight() const { return height; }
+
+    /**
+     * \brief Checks whether the texture holds block-compressed images
+     */
+    inline bool IsCompressed() const { return imageFormat == GL_NONE; }
+
+protected:
+
+    /**
+     * \brief Fills every layer from raw bytes, and builds their mip levels
+     *        if the min filter uses them
+     *
+     * \param[in] layers - Pixel data of each layer
+     */
+    void InitTextureObject(const GLubyte* const* layers);
+
+    /**
+     * \brief Fills every layer and mip level from compressed images
+     *
+     * \param[in] layers - Compressed image of each layer
+     */
+    void InitTextureObject(const CompressedImage* const* layers);
+
+    /**
+     * \brief Gets the texture parameters such as min/mag filter and wrap modes
+     *
+     * \param[out] params - Parameters of the texture
+     */
+    virtual void GetSamplerParams(SamplerParams& params) const;
+
+private:
+    GLenum minFilter; //!< Filter to use when shrinking the texture
+    GLenum magFilter; //!< Filter to use when expanding the texture
+    GLenum wrapS;     //!< Wrap mode for S coordinates
+    GLenum wrapT;     //!< Wrap mode for T coordinates
+    float  aniso;     //!< Maximum samples for anisotropic filtering
+
+    int    width;          //!< Width of each layer in pixels
+    int    height;         //!< Height of each layer in pixels
+    int    numLayers;      //!< Number of layers
+    GLint  internalFormat; //!< Image format used when rendering
+    GLenum imageFormat;    //!< Source image format
+
+    Texture2DArray(const Texture2DArray&);            //!< No copy constructor
+    Texture2DArray& operator=(const Texture2DArray&); //!< No assignment operator
+};
+
+#endif
@@ -307,11 +307,31 @@ protected:
     void InitTextureObject(const GLvoid* pixels);
 
     /**
-     * \brief Sets the texture parameters such as min/mag filter and wrap modes
+     * \brief Fills one layer of the texture, which must already be created
      *
-     * Sets the texture parameters
+     * \param[in] layer  - Depth of the layer to fill
+     * \param[in] pixels - Pixel data of the layer
      */
-    virtual void SetTextureParams();
+    void UploadLayer(int layer, const GLvoid* pixels);
+
+    /**
+     * \brief Generates mip maps from the layers, if the min filter uses them
+     *
+     * Must be called once all of the layers are filled.  8-bit layers are
+     * filtered with MipmapBuilder::BuildVolume when it is enabled, anything
+     * else with glGenerateMipmap.
+     *
+     * \param[in] layers - Pixel data of each layer, or NULL to leave the
+     *                     levels to glGenerateMipmap
+     */
+    void GenerateMipmaps(const GLvoid* const * layers);
+
+    /**
+     * \brief Gets the texture parameters such as min/mag filter and wrap modes
+     *
+     * \param[out] params - Parameters of the texture
+     */
+    virtual void GetSamplerParams(SamplerParams& params) const;
 
 private:
     GLenum minFilter; //!< Filter to use when shrinking the texture
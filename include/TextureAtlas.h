@@ -0,0 +1,201 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <GL/glew.h>
+#include <vector>
+#include "Angel.h"
+
+class Texture2DArray;
+
+/**
+ * \brief Packs images of the same format into the layers of a texture array
+ *
+ * Objects that only differ by their texture can then be drawn together with
+ * one binding: each object samples its own rectangle of its own layer,
+ * through the texture coordinate transform and layer of its image.
+ *
+ * Images are packed with a skyline bottom-left packer, tallest first, into
+ * square pages.  A page that fills up starts another layer.  Every layer is
+ * then trimmed to the largest area used by any page, so a few images don't
+ * pay for a whole page.  Each image is surrounded by copies of its edge
+ * pixels, so bilinear filtering and the first few mip levels don't bleed
+ * neighbouring images into it.
+ */
+class TextureAtlas
+{
+public:
+
+    /**
+     * \brief Creates an empty atlas
+     *
+     * \param[in] format   - Format of every image: GL_RED, GL_RG, GL_RGB or GL_RGBA
+     * \param[in] pageSize - Width and height of a page in pixels
+     * \param[in] padding  - Pixels of repeated edge around each image
+     */
+    TextureAtlas(GLenum format, int pageSize = 2048, int padding = 2);
+
+    /**
+     * \brief TextureAtlas destructor
+     */
+    ~TextureAtlas();
+
+    /**
+     * \brief Adds a copy of an image to the atlas
+     *
+     * \param[in] pixels - Pixels of the image, starting at the bottom row
+     * \param[in] width  - Width of the image in pixels
+     * \param[in] height - Height of the image in pixels
+     *
+     * \return Index of the image, or -1 if it doesn't fit in a page
+     */
+    int Add(const GLubyte* pixels, int width, int height);
+
+    /**
+     * \brief Loads an image file and adds it to the atlas
+     *
+     * \param[in] filename - Name and path of the file to load
+     *
+     * \return Index of the image, or -1 if it couldn't be loaded, has a
+     *         different format or doesn't fit in a page
+     */
+    int AddFile(const char* filename);
+
+    /**
+     * \brief Places every image added so far and builds the pages
+     *
+     * Called by CreateTexture if needed.  Adding an image afterwards
+     * requires packing again.
+     */
+    void Pack();
+
+    /**
+     * \brief Creates a texture array with a layer for each page
+     *
+     * The texture clamps to its edges, since images at the border of a page
+     * have no neighbour to wrap around to.
+     *
+     * \param[in] minFilter        - Minification filter, as for Texture2D
+     * \param[in] magFilter        - Magnification filter, as for Texture2D
+     * \param[in] aniso            - Maximum samples for anisotropic filtering
+     * \param[in] compressedFormat - Block-compressed format to encode the pages
+     *                               into with BlockCompressor, or GL_NONE
+     *
+     * \return The texture, which must be deleted by the caller
+     */
+    Texture2DArray* CreateTexture(
+        GLenum minFilter = GL_LINEAR,
+        GLenum magFilter = GL_LINEAR,
+        float  aniso     = 1.0f,
+        GLenum compressedFormat = GL_NONE);
+
+    /**
+     * \brief Gets the number of images added
+     */
+    inline int GetNumImages() const { return (int)images.size(); }
+
+    /**
+     * \brief Gets the number of pages, which is the number of texture layers
+     */
+    inline int GetNumPages() const { return (int)pages.size(); }
+
+    /**
+     * \brief Gets the width of every page after trimming
+     */
+    inline int GetPageWidth() const { return pageWidth; }
+
+    /**
+     * \brief Gets the height of every page after trimming
+     */
+    inline int GetPageHeight() const { return pageHeight; }
+
+    /**
+     * \brief Gets the texture layer holding an image
+     *
+     * \param[in] image - Index returned by Add
+     */
+    int GetLayer(int image) const;
+
+    /**
+     * \brief Gets the transform from an image's texture coordinates to the
+     *        coordinates of its rectangle in the layer
+     *
+     * \param[in] image - Index returned by Add
+     *
+     * \return Offset in x and y, then scale in z and w, so that
+     *         atlas = offset + scale * uv
+     */
+    vec4 GetTexCoordTransform(int image) const;
+
+    /**
+     * \brief Gets the fraction of the pages covered by images, not counting
+     *        their padding
+     */
+    float GetEfficiency() const;
+
+private:
+
+    /**
+     * \brief An image and where it was placed
+     */
+    struct Image
+    {
+        std::vector<GLubyte> pixels; //!< Copy of the pixels
+        int width;  //!< Width in pixels
+        int height; //!< Height in pixels
+        int page;   //!< Page the image was placed in, or -1
+        int x;      //!< Left of the image in the page
+        int y;      //!< Bottom of the image in the page
+    };
+
+    /**
+     * \brief A horizontal segment of the top of the used area of a page
+     */
+    struct Span
+    {
+        int x;     //!< Left of the segment
+        int y;     //!< Height of the used area below the segment
+        int width; //!< Width of the segment
+    };
+
+    typedef std::vector<Span> Skyline;
+
+    GLenum format;     //!< Format of every image
+    int    components; //!< Bytes in each pixel
+    int    pageSize;   //!< Size of an untrimmed page
+    int    padding;    //!< Pixels of repeated edge around each image
+    int    pageWidth;  //!< Width of every page after trimming
+    int    pageHeight; //!< Height of every page after trimming
+    bool   packed;     //!< Whether the pages match the images
+
+    std::vector<Image> images; //!< Images in the order they were added
+    std::vector<std::vector<GLubyte> > pages; //!< Pixels of each page
+
+    /**
+     * \brief Finds the lowest place for a rectangle on a skyline, leftmost
+     *        on a tie
+     *
+     * \param[in]  skyline - Top of the used area of the page
+     * \param[in]  width   - Width of the rectangle
+     * \param[in]  height  - Height of the rectangle
+     * \param[out] x       - Left of the place found
+     * \param[out] y       - Bottom of the place found
+     *
+     * \return Whether the rectangle fits anywhere
+     */
+    bool FindPosition(const Skyline& skyline, int width, int height, int* x, int* y) const;
+
+    /**
+     * \brief Raises a skyline over a rectangle that was placed on it
+     */
+    static void AddToSkyline(Skyline& skyline, int x, int y, int width, int height);
+
+    /**
+     * \brief Copies an image and its padding into its page
+     */
+    void CopyToPage(const Image& image);
+
+    TextureAtlas(const TextureAtlas&);            //!< No copy constructor
+    TextureAtlas& operator=(const TextureAtlas&); //!< No assignment operator
+};
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "Texture.h"
 
+class CompressedImage;
+
 /**
  * \brief Class to manage a cube texture with 6 faces
  *
@@ -69,6 +71,113 @@ public:
         GLenum wrapR     = GL_CLAMP_TO_EDGE,
         float  aniso     = 1.0f);
 
+    /** 
+     * \brief Creates a cube texture from an equirectangular panorama
+     *
+     * The six faces are resampled from the panorama by CubeMapBuilder, along
+     * with every mip level if the min filter uses them, and cached so later
+     * runs upload the prebuilt faces without decoding the panorama.  High
+     * dynamic range panoramas give half float faces.  If the panorama can't
+     * be loaded, error textures are used instead.
+     *
+     * \param[in] panoramaFilename - Name and path of the panorama to load
+     * \param[in] faceSize  - Width and height of each face in pixels, or 0
+     *                        (default) to match the panorama's resolution
+     * \param[in] minFilter - Minification filter to use when the texture
+     *                        is drawn on small surfaces.  Valid values are:
+     *                        GL_NEAREST
+     *                        GL_LINEAR (default, aka bilinear filtering)
+     *                        GL_NEAREST_MIPMAP_NEAREST
+     *                        GL_LINEAR_MIPMAP_NEAREST
+     *                        GL_NEAREST_MIPMAP_LINEAR
+     *                        GL_LINEAR_MIPMAP_LINEAR (aka trilinear filtering)
+     * \param[in] magFilter - Magnification filter to use when the texture
+     *                        is drawn on large surfaces.  Valid values are:
+     *                        GL_NEAREST
+     *                        GL_LINEAR (default)
+     * \param[in] wrapS     - Wrap mode to use when accessing texture coordinates
+     *                        with s values outside of [0,1].  Valid values are:
+     *                        GL_CLAMP_TO_EDGE (default)
+     *                        GL_REPEAT
+     *                        GL_MIRRORED_REPEAT
+     * \param[in] wrapT     - Wrap mode to use when accessing texture coordinates
+     *                        with t values outside of [0,1].  Valid values are:
+     *                        GL_CLAMP_TO_EDGE (default)
+     *                        GL_REPEAT
+     *                        GL_MIRRORED_REPEAT
+     * \param[in] wrapR     - Wrap mode to use when accessing texture coordinates
+     *                        with r values outside of [0,1].  Valid values are:
+     *                        GL_CLAMP_TO_EDGE (default)
+     *                        GL_REPEAT
+     *                        GL_MIRRORED_REPEAT
+     * \param[in] aniso     - Maximum number of samples used for anisotropic
+     *                        filtering.  Set to a value greater than 1 while
+     *                        using a filter mode involving mipmaps to enable
+     *                        anisotropic filtering.  Valid values range from
+     *                        1 to GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT (usually 16)
+     */
+    TextureCube(
+        const char* panoramaFilename,
+        int    faceSize  = 0,
+        GLenum minFilter = GL_LINEAR,
+        GLenum magFilter = GL_LINEAR,
+        GLenum wrapS     = GL_CLAMP_TO_EDGE,
+        GLenum wrapT     = GL_CLAMP_TO_EDGE,
+        GLenum wrapR     = GL_CLAMP_TO_EDGE,
+        float  aniso     = 1.0f);
+
+    /** 
+     * \brief Creates a cube texture from block-compressed data, such as an
+     *        image loaded from a KTX or DDS file
+     *
+     * Every mip level of every face is uploaded as is.  Mip maps can't be
+     * generated for compressed textures, so when the image has a single
+     * level only that level is used.  If the format isn't supported by the
+     * OpenGL context, error textures are used instead.
+     *
+     * \param[in] image     - Compressed image with 6 faces
+     * \param[in] minFilter - Minification filter to use when the texture
+     *                        is drawn on small surfaces.  Valid values are:
+     *                        GL_NEAREST
+     *                        GL_LINEAR (default, aka bilinear filtering)
+     *                        GL_NEAREST_MIPMAP_NEAREST
+     *                        GL_LINEAR_MIPMAP_NEAREST
+     *                        GL_NEAREST_MIPMAP_LINEAR
+     *                        GL_LINEAR_MIPMAP_LINEAR (aka trilinear filtering)
+     * \param[in] magFilter - Magnification filter to use when the texture
+     *                        is drawn on large surfaces.  Valid values are:
+     *                        GL_NEAREST
+     *                        GL_LINEAR (default)
+     * \param[in] wrapS     - Wrap mode to use when accessing texture coordinates
+     *                        with s values outside of [0,1].  Valid values are:
+     *                        GL_CLAMP_TO_EDGE (default)
+     *                        GL_REPEAT
+     *                        GL_MIRRORED_REPEAT
+     * \param[in] wrapT     - Wrap mode to use when accessing texture coordinates
+     *                        with t values outside of [0,1].  Valid values are:
+     *                        GL_CLAMP_TO_EDGE (default)
+     *                        GL_REPEAT
+     *                        GL_MIRRORED_REPEAT
+     * \param[in] wrapR     - Wrap mode to use when accessing texture coordinates
+     *                        with r values outside of [0,1].  Valid values are:
+     *                        GL_CLAMP_TO_EDGE (default)
+     *                        GL_REPEAT
+     *                        GL_MIRRORED_REPEAT
+     * \param[in] aniso     - Maximum number of samples used for anisotropic
+     *                        filtering.  Set to a value greater than 1 while
+     *                        using a filter mode involving mipmaps to enable
+     *                        anisotropic filtering.  Valid values range from
+     *                        1 to GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT (usually 16)
+     */
+    TextureCube(
+        const CompressedImage& image,
+        GLenum minFilter = GL_LINEAR,
+        GLenum magFilter = GL_LINEAR,
+        GLenum wrapS     = GL_CLAMP_TO_EDGE,
+        GLenum wrapT     = GL_CLAMP_TO_EDGE,
+        GLenum wrapR     = GL_CLAMP_TO_EDGE,
+        float  aniso     = 1.0f);
+
     /** 
      * \brief Creates a cube texture from 6 arrays of pixel data
      *
@@ -229,11 +338,29 @@ protected:
     void InitTextureObject(const GLvoid* pixels, GLenum face);
 
     /**
-     * \brief Sets the texture parameters such as min/mag filter and wrap modes
+     * \brief Initializes every face with every mip level of a compressed image
+     *
+     * \param[in] image - Compressed image to initialize the texture with
+     */
+    void InitTextureObject(const CompressedImage& image);
+
+    /**
+     * \brief Generates mip maps from the faces, if the min filter uses them
+     *
+     * Must be called once all of the faces are filled.
+     *
+     * \param[in] faces - Pixels of the six faces in order, to build the
+     *                    levels with MipmapBuilder, or NULL to leave them to
+     *                    glGenerateMipmap
+     */
+    void GenerateMipmaps(const GLubyte* const* faces = NULL);
+
+    /**
+     * \brief Gets the texture parameters such as min/mag filter and wrap modes
      *
-     * Sets the texture parameters
+     * \param[out] params - Parameters of the texture
      */
-    virtual void SetTextureParams();
+    virtual void GetSamplerParams(SamplerParams& params) const;
 
 private:
     GLenum minFilter; //!< Filter to use when shrinking the texture
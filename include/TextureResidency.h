@@ -0,0 +1,187 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <GL/glew.h>
+#include <map>
+#include <memory>
+#include <string>
+
+class Texture2D;
+
+/**
+ * \brief Keeps the video memory of textures under a budget by streaming
+ *        their mip levels in and out
+ *
+ * Each frame, the objects drawn with a managed texture report how large
+ * the texture appears on screen, which decides the finest mip level worth
+ * keeping.  Update then streams missing levels back in, decoding the
+ * texture's file on the shared thread pool, and makes room for them by
+ * releasing the finest levels of other textures.  Levels nobody needs go
+ * first, then those of the textures drawn least recently.  Textures drawn
+ * this frame keep the levels they need, and every texture keeps its small
+ * levels, so something can always be drawn.
+ *
+ * Levels are released with GL_TEXTURE_BASE_LEVEL, so the texture object
+ * and its bindings stay the same.  Only Texture2D is managed; texture
+ * arrays, such as the pages of a TextureAtlas, stay fully resident.
+ *
+ * Every function must be called on the thread that owns the OpenGL context.
+ */
+class TextureResidency
+{
+public:
+
+    /**
+     * \brief Statistics about the streaming
+     */
+    struct Stats
+    {
+    public:
+
+        /**
+         * \brief Creates empty statistics
+         */
+        Stats()
+            : levelsLoaded(0),
+            levelsReleased(0),
+            bytesLoaded(0),
+            bytesReleased(0),
+            residentBytes(0),
+            peakResidentBytes(0),
+            loadsFailed(0)
+        {
+        }
+
+        unsigned int       levelsLoaded;      //!< Mip levels streamed in
+        unsigned int       levelsReleased;    //!< Mip levels streamed out
+        unsigned long long bytesLoaded;       //!< Bytes streamed in
+        unsigned long long bytesReleased;     //!< Bytes streamed out
+        GLsizeiptr         residentBytes;     //!< Bytes used by managed textures
+        GLsizeiptr         peakResidentBytes; //!< Most bytes used after an Update
+        unsigned int       loadsFailed;       //!< Files that no longer matched
+                                              //!< their texture
+    };
+
+    /**
+     * \brief Starts managing a texture.  Does nothing if it is already managed
+     *
+     * The texture must stay alive until Remove is called.
+     *
+     * \param[in] texture  - Texture to manage
+     * \param[in] filename - File to read released levels back from.  Either
+     *                       the image the texture was created from, or a
+     *                       KTX or DDS file for a compressed texture
+     * \param[in] minSize  - Levels of this width and height or smaller are
+     *                       never released
+     */
+    static void Add(Texture2D* texture, const char* filename, int minSize = 64);
+
+    /**
+     * \brief Stops managing a texture, leaving its levels as they are
+     */
+    static void Remove(Texture2D* texture);
+
+    /**
+     * \brief Reports that a texture is drawn this frame
+     *
+     * Call for every object drawn with the texture.  The finest level
+     * needed by any of them is kept.
+     *
+     * \param[in] texture    - Managed texture
+     * \param[in] screenSize - Pixels on screen covered by the full width of
+     *                         the texture, for example from GetScreenSize
+     */
+    static void Request(Texture2D* texture, float screenSize);
+
+    /**
+     * \brief Estimates how many pixels a length in the world covers on screen
+     *
+     * \param[in] worldSize      - Length facing the camera, in world units
+     * \param[in] distance       - Distance from the camera, in world units
+     * \param[in] fieldOfView    - Vertical field of view in degrees
+     * \param[in] viewportHeight - Height of the viewport in pixels
+     */
+    static float GetScreenSize(float worldSize, float distance, float fieldOfView, int viewportHeight);
+
+    /**
+     * \brief Finishes loaded levels, then starts loading and releasing levels
+     *        for the requests made since the last Update
+     *
+     * Call once per frame, after the frame's requests.  Levels are changed
+     * through texture unit 0, which Texture2D selects even when the texture
+     * is already bound there, so units bound for drawing aren't modified.
+     */
+    static void Update();
+
+    /**
+     * \brief Sets the most video memory the managed textures should use.
+     *        256 MB by default
+     *
+     * The budget can be exceeded when the levels needed by the textures drawn
+     * this frame don't fit.
+     */
+    static inline void SetBudget(GLsizeiptr bytes) { budget = bytes; }
+
+    /**
+     * \brief Gets the most video memory the managed textures should use
+     */
+    static inline GLsizeiptr GetBudget() { return budget; }
+
+    /**
+     * \brief Gets the number of managed textures
+     */
+    static inline size_t GetNumTextures() { return entries.size(); }
+
+    /**
+     * \brief Gets statistics about the streaming since the last reset
+     */
+    static inline const Stats& GetStats() { return stats; }
+
+    /**
+     * \brief Resets the statistics
+     */
+    static void ResetStats();
+
+private:
+
+    struct Entry;
+    typedef std::map<Texture2D*, std::shared_ptr<Entry> > EntryMap;
+
+    static EntryMap      entries; //!< Managed textures
+    static GLsizeiptr    budget;  //!< Bytes the textures should fit in
+    static unsigned long frame;   //!< Number of Updates so far
+    static Stats         stats;   //!< Streaming since the last reset
+
+    /**
+     * \brief Estimates the video memory of one level of a texture
+     */
+    static GLsizeiptr GetLevelSize(const Entry& entry, int level);
+
+    /**
+     * \brief Starts decoding a texture's file to restore its levels from
+     *        the given one up to its base level
+     */
+    static void StartLoad(const std::shared_ptr<Entry>& entry, int level);
+
+    /**
+     * \brief Uploads the levels of a finished load
+     */
+    static void FinishLoad(Entry& entry);
+
+    /**
+     * \brief Releases the finest levels of other textures until enough
+     *        memory is freed or nothing more may be released
+     *
+     * \param[in] bytes - Memory to free
+     * \param[in] keep  - Texture that must not be touched, or NULL
+     *
+     * \return Memory freed
+     */
+    static GLsizeiptr Release(GLsizeiptr bytes, const Entry* keep);
+
+    TextureResidency();                                   //!< Only has static functions
+    TextureResidency(const TextureResidency&);            //!< No copy constructor
+    TextureResidency& operator=(const TextureResidency&); //!< No assignment operator
+};
+
+#endif
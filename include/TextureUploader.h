@@ -0,0 +1,200 @@
+#ifndef TEXTURE_UPLOADER_H
+#define TEXTURE_UPLOADER_H
+
+#include <GL/glew.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Texture2D;
+
+/**
+ * \brief Streams textures to the GPU through pixel buffer objects
+ *
+ * Creating a Texture2D from client memory makes the driver copy every pixel
+ * before glTexImage2D returns, which stalls the frame for large images.
+ * Here the image is decoded on the shared thread pool straight into a
+ * mapped pixel buffer, along with its mip levels, and the main thread only
+ * queues the copy from the buffer to the texture.  A fence marks when the
+ * GPU has finished the copy, at which point the texture is handed over and
+ * the buffer is kept for the next upload.
+ *
+ * At most a budget of bytes starts uploading each frame, so streaming many
+ * textures at once spreads them over several frames instead of causing a
+ * spike.  A texture larger than the whole budget still uploads, alone.
+ *
+ * Every function must be called on the thread that owns the OpenGL context.
+ */
+class TextureUploader
+{
+public:
+
+    /**
+     * \brief Called with a finished texture, which the callee owns
+     */
+    typedef std::function<void(Texture2D*)> Callback;
+
+    /**
+     * \brief Statistics about the uploads
+     */
+    struct Stats
+    {
+    public:
+
+        /**
+         * \brief Creates empty statistics
+         */
+        Stats()
+            : uploaded(0),
+            bytesUploaded(0),
+            frameBytes(0),
+            peakFrameBytes(0),
+            deferred(0),
+            buffersCreated(0),
+            buffersReused(0)
+        {
+        }
+
+        unsigned int       uploaded;       //!< Textures handed over
+        unsigned long long bytesUploaded;  //!< Bytes copied, including mip levels
+        GLsizeiptr         frameBytes;     //!< Bytes started by the last Update
+        GLsizeiptr         peakFrameBytes; //!< Most bytes started by one Update
+        unsigned int       deferred;       //!< Decoded textures held back a frame
+                                           //!< by the budget
+        unsigned int       buffersCreated; //!< Pixel buffers allocated
+        unsigned int       buffersReused;  //!< Uploads that reused a free buffer
+    };
+
+    /**
+     * \brief Checks whether pixel buffers, buffer mapping and fences are
+     *        available.  Load may only be used if they are
+     */
+    static bool IsSupported();
+
+    /**
+     * \brief Starts loading a texture from an image file
+     *
+     * The parameters are the same as those of the matching Texture2D
+     * constructor.  Files that can't be read are still decoded on the pool,
+     * and end up as the error texture uploaded without a buffer.
+     *
+     * \param[in] filename  - Name and path of the file to load
+     * \param[in] minFilter - Minification filter
+     * \param[in] magFilter - Magnification filter
+     * \param[in] wrapS     - Wrap mode for s coordinates
+     * \param[in] wrapT     - Wrap mode for t coordinates
+     * \param[in] aniso     - Maximum samples for anisotropic filtering
+     * \param[in] done      - Called by Update once the texture is ready
+     */
+    static void Load(
+        const char* filename,
+        GLenum minFilter,
+        GLenum magFilter,
+        GLenum wrapS,
+        GLenum wrapT,
+        float  aniso,
+        const Callback& done);
+
+    /**
+     * \brief Starts the uploads of decoded textures that fit in this
+     *        frame's budget, and hands over the ones the GPU has finished
+     *
+     * Call once per frame while loads are pending.
+     *
+     * \return Number of loads still pending
+     */
+    static size_t Update();
+
+    /**
+     * \brief Finishes every pending load, ignoring the budget
+     */
+    static void WaitAll();
+
+    /**
+     * \brief Gets the number of loads still pending
+     */
+    static inline size_t GetNumPending() { return pending.size(); }
+
+    /**
+     * \brief Sets the number of bytes that may start uploading each frame.
+     *        4 MB by default
+     */
+    static inline void SetFrameBudget(GLsizeiptr bytes) { frameBudget = bytes; }
+
+    /**
+     * \brief Gets the number of bytes that may start uploading each frame
+     */
+    static inline GLsizeiptr GetFrameBudget() { return frameBudget; }
+
+    /**
+     * \brief Gets statistics about the uploads since the last reset
+     */
+    static inline const Stats& GetStats() { return stats; }
+
+    /**
+     * \brief Resets the statistics
+     */
+    static void ResetStats();
+
+    /**
+     * \brief Deletes the pixel buffers kept for reuse
+     */
+    static void ReleaseBuffers();
+
+private:
+
+    struct Upload;
+
+    /**
+     * \brief A pixel buffer that isn't in use
+     */
+    struct FreeBuffer
+    {
+        GLuint     id;   //!< OpenGL ID of the buffer
+        GLsizeiptr size; //!< Size of the buffer in bytes
+    };
+
+    static std::vector<std::shared_ptr<Upload> > pending; //!< Loads in order of request
+    static std::vector<FreeBuffer> freeBuffers; //!< Buffers kept for reuse
+    static GLsizeiptr frameBudget; //!< Bytes that may start each frame
+    static Stats      stats;       //!< Uploads since the last reset
+
+    /**
+     * \brief Gets a buffer of at least the given size, reusing a free one
+     *        if one is big enough and not much bigger
+     *
+     * \param[in] size - Size needed in bytes
+     *
+     * \return A buffer, which is bound to GL_PIXEL_UNPACK_BUFFER
+     */
+    static FreeBuffer AcquireBuffer(GLsizeiptr size);
+
+    /**
+     * \brief Keeps a buffer for reuse, deleting it if enough are kept
+     */
+    static void ReleaseBuffer(const FreeBuffer& buffer);
+
+    /**
+     * \brief Starts copying a decoded image to its texture
+     *
+     * \param[in] upload - The decoded load
+     *
+     * \return Number of bytes copied
+     */
+    static GLsizeiptr StartUpload(Upload& upload);
+
+    /**
+     * \brief Checks whether the GPU has finished an upload
+     *
+     * \param[in] upload  - A load whose copy was started
+     * \param[in] timeout - Nanoseconds to wait, or 0 to only check
+     */
+    static bool IsUploadDone(Upload& upload, GLuint64 timeout);
+
+    TextureUploader();                                  //!< Only has static functions
+    TextureUploader(const TextureUploader&);            //!< No copy constructor
+    TextureUploader& operator=(const TextureUploader&); //!< No assignment operator
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef TGA_DECODER_H
+#define TGA_DECODER_H
+
+#include <GL/glew.h>
+#include <cstddef>
+
+/**
+ * \brief Decodes true-color TGA files straight into the layout OpenGL
+ *        expects
+ *
+ * The file is mapped rather than read, and each row is written to its
+ * final place according to the image's origin bit, so a file stored
+ * bottom-up, as most are, needs no flip.  Blue-green-red pixels are
+ * swizzled to red-green-blue 16 bytes at a time with SSSE3 when the CPU
+ * has it, and run-length packets are expanded by copying a block of
+ * repeated pixels instead of one pixel at a time.
+ *
+ * Only uncompressed and run-length encoded 24 and 32-bit images are
+ * handled, which is what image editors write.  Color-mapped, grayscale,
+ * 16-bit and right-to-left images are left to stb_image.
+ */
+class TgaDecoder
+{
+public:
+
+    /**
+     * \brief Checks whether a filename has a .tga extension
+     */
+    static bool IsTgaFile(const char* filename);
+
+    /**
+     * \brief Decodes a TGA file
+     *
+     * \param[in]  filename   - Name and path of the file to load
+     * \param[out] width      - Width of the image in pixels
+     * \param[out] height     - Height of the image in pixels
+     * \param[out] components - 3 for RGB, 4 for RGBA
+     *
+     * \return Pixels starting at the bottom row, to be released with free,
+     *         or NULL if the file couldn't be read or isn't a kind handled
+     *         here
+     */
+    static GLubyte* Load(const char* filename, int* width, int* height, int* components);
+
+    /**
+     * \brief Decodes a TGA file already in memory
+     *
+     * \param[in]  data       - Contents of the file
+     * \param[in]  size       - Size of the file in bytes
+     * \param[out] width      - Width of the image in pixels
+     * \param[out] height     - Height of the image in pixels
+     * \param[out] components - 3 for RGB, 4 for RGBA
+     *
+     * \return Pixels as for Load
+     */
+    static GLubyte* Decode(const GLubyte* data, size_t size, int* width, int* height, int* components);
+
+    /**
+     * \brief Checks whether the SSSE3 paths are used
+     */
+    static bool IsSimdEnabled();
+
+private:
+
+    /**
+     * \brief Copies pixels, swapping their blue and red components
+     */
+    static void Swizzle(const GLubyte* source, GLubyte* dest, int count, int components);
+
+    /**
+     * \brief Writes copies of one pixel, swapping its blue and red components
+     */
+    static void Fill(const GLubyte* pixel, GLubyte* dest, int count, int components);
+
+    /**
+     * \brief Expands run-length packets into rows
+     *
+     * \return Whether the packets covered the image without running past
+     *         the end of the data
+     */
+    static bool DecodeRle(
+        const GLubyte* data,
+        const GLubyte* end,
+        int width,
+        int height,
+        int components,
+        bool topDown,
+        GLubyte* pixels);
+
+    TgaDecoder();                             //!< Only has static functions
+    TgaDecoder(const TgaDecoder&);            //!< No copy constructor
+    TgaDecoder& operator=(const TgaDecoder&); //!< No assignment operator
+};
+
+#endif
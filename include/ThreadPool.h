@@ -0,0 +1,137 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief Fixed set of worker threads that run queued tasks
+ *
+ * Used to move CPU work such as image decoding off the thread that owns
+ * the OpenGL context.  Tasks must not make OpenGL calls, since the context
+ * is only current on the main thread.  Results are usually handed back to
+ * the main thread, which does the OpenGL work.
+ */
+class ThreadPool
+{
+public:
+
+    /**
+     * \brief A unit of work run on one of the worker threads
+     */
+    typedef std::function<void()> Task;
+
+    /**
+     * \brief Starts the worker threads
+     *
+     * \param[in] numThreads - Number of worker threads.  0 (default) uses
+     *                         one per hardware thread
+     */
+    explicit ThreadPool(unsigned int numThreads = 0);
+
+    /**
+     * \brief Finishes all queued tasks, then stops the worker threads
+     */
+    ~ThreadPool();
+
+    /**
+     * \brief Queues a task to run on the next free worker thread
+     *
+     * \param[in] task - Task to run
+     */
+    void Submit(const Task& task);
+
+    /**
+     * \brief Waits until every submitted task has finished
+     */
+    void WaitAll();
+
+    /**
+     * \brief Gets the number of worker threads
+     */
+    inline unsigned int GetNumThreads() const { return (unsigned int)threads.size(); }
+
+    /**
+     * \brief Checks whether the calling thread is one of the workers
+     *
+     * A task that waits for other tasks it submitted can deadlock once
+     * every worker is waiting, so such work is run inline instead.
+     */
+    bool IsWorkerThread() const;
+
+    /**
+     * \brief Runs a function for each of a range of indices on the pool and
+     *        waits for all of them
+     *
+     * When called from one of the workers, every index is run on that
+     * worker, since a task waiting on tasks queued behind it could wait
+     * forever once every worker is waiting.
+     *
+     * \param[in] count - Number of indices
+     * \param[in] job   - Function to run with each index
+     */
+    template<class Job>
+    void RunParallel(int count, const Job& job)
+    {
+        if (IsWorkerThread())
+        {
+            for (int i = 0; i < count; i++)
+            {
+                job(i);
+            }
+            return;
+        }
+
+        std::mutex doneMutex;
+        std::condition_variable done;
+        int remaining = count;
+        for (int i = 0; i < count; i++)
+        {
+            Submit([i, &job, &doneMutex, &done, &remaining]()
+            {
+                job(i);
+
+                std::unique_lock<std::mutex> lock(doneMutex);
+                remaining--;
+                done.notify_all();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(doneMutex);
+        while (remaining != 0)
+        {
+            done.wait(lock);
+        }
+    }
+
+    /**
+     * \brief Gets a pool shared by the loaders, created on first use
+     *
+     * Must first be called from the main thread.
+     */
+    static ThreadPool& GetShared();
+
+private:
+
+    std::vector<std::thread> threads;   //!< Worker threads
+    std::deque<Task>         tasks;     //!< Tasks waiting for a worker
+    std::mutex               mutex;     //!< Guards everything below
+    std::condition_variable  wake;      //!< Signalled when a task is queued or on shutdown
+    std::condition_variable  idle;      //!< Signalled when a task finishes
+    unsigned int             running;   //!< Tasks currently being run
+    bool                     stopping;  //!< Set when the pool is being destroyed
+
+    /**
+     * \brief Loop run by each worker thread
+     */
+    void WorkerLoop();
+
+    ThreadPool(const ThreadPool&);            //!< No copy constructor
+    ThreadPool& operator=(const ThreadPool&); //!< No assignment operator
+};
+
+#endif
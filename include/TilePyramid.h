@@ -0,0 +1,214 @@
+#ifndef TILE_PYRAMID_H
+#define TILE_PYRAMID_H
+
+#include <GL/glew.h>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+/**
+ * \brief A file holding an image and its mip levels cut into square tiles,
+ *        so any tile of any level can be read without decoding the rest
+ *
+ * Images too large to fit in memory, let alone video memory, are converted
+ * once by Build, then drawn through a VirtualTexture that reads only the
+ * tiles in view.
+ *
+ * The tiles are laid out on a square grid whose side is a power of two, so
+ * each level has half as many tiles across as the one before and the last
+ * level is a single tile.  Level 0 covers the image at full resolution,
+ * starting at the bottom left of the grid; tiles wholly past the image are
+ * not stored.  Each tile is surrounded by a border of neighbouring pixels
+ * (or repeated edge pixels at the sides of the image), so tiles placed
+ * anywhere in a cache texture can still be filtered bilinearly.  Rows are
+ * stored bottom-up, the way OpenGL expects them.
+ *
+ * A .vtex file starts with a header of 32-bit values:
+ *   "VTEX", version, width, height, tile size, border, components, levels
+ * followed by the 64-bit file offset of every tile, level by level and row
+ * by row, plus one past the end.  A tile that isn't stored has the same
+ * offset as the next one.
+ */
+class TilePyramid
+{
+public:
+
+    /**
+     * \brief Opens a tile pyramid file for reading
+     *
+     * \param[in] filename - Name and path of the .vtex file
+     */
+    TilePyramid(const char* filename);
+
+    /**
+     * \brief TilePyramid destructor
+     */
+    ~TilePyramid();
+
+    /**
+     * \brief Checks whether the file was opened and its header is valid
+     */
+    inline bool IsValid() const { return file != NULL; }
+
+    /**
+     * \brief Gets the width of the image in pixels
+     */
+    inline int GetWidth() const { return width; }
+
+    /**
+     * \brief Gets the height of the image in pixels
+     */
+    inline int GetHeight() const { return height; }
+
+    /**
+     * \brief Gets the number of components in each pixel, from 1 to 4
+     */
+    inline int GetComponents() const { return components; }
+
+    /**
+     * \brief Gets the width and height of a tile in pixels, without its border
+     */
+    inline int GetTileSize() const { return tileSize; }
+
+    /**
+     * \brief Gets the pixels of border on each side of a tile
+     */
+    inline int GetBorder() const { return border; }
+
+    /**
+     * \brief Gets the width and height of a stored tile, with its border
+     */
+    inline int GetPaddedTileSize() const { return tileSize + 2 * border; }
+
+    /**
+     * \brief Gets the size of a stored tile in bytes
+     */
+    inline size_t GetTileBytes() const
+    {
+        return (size_t)GetPaddedTileSize() * GetPaddedTileSize() * components;
+    }
+
+    /**
+     * \brief Gets the number of levels, the last of which is a single tile
+     */
+    inline int GetNumLevels() const { return numLevels; }
+
+    /**
+     * \brief Gets the tiles across each side of the grid of a level
+     */
+    inline int GetGridSize(int level) const { return (1 << (numLevels - 1)) >> level; }
+
+    /**
+     * \brief Gets the index of a tile among every tile of every level
+     */
+    inline int GetTileIndex(int level, int x, int y) const
+    {
+        return levelStart[level] + y * GetGridSize(level) + x;
+    }
+
+    /**
+     * \brief Gets the number of tiles of every level, stored or not
+     */
+    inline int GetNumTiles() const { return levelStart[numLevels]; }
+
+    /**
+     * \brief Checks whether a tile covers any of the image and was stored
+     */
+    bool HasTile(int level, int x, int y) const;
+
+    /**
+     * \brief Reads one tile with its border
+     *
+     * May be called from several threads at once; the reads take turns.
+     *
+     * \param[in]  level  - Level of the tile
+     * \param[in]  x      - Column of the tile in the level's grid
+     * \param[in]  y      - Row of the tile, counting up from the bottom
+     * \param[out] pixels - Receives GetTileBytes bytes
+     *
+     * \return Whether the tile was stored and could be read
+     */
+    bool ReadTile(int level, int x, int y, GLubyte* pixels);
+
+    /**
+     * \brief Cuts an image and its mip levels into tiles and writes them
+     *        to a file
+     *
+     * Each level is built a row at a time from pairs of rows of the level
+     * before, with MipmapBuilder::HalveRow, and its tiles are written as
+     * soon as it has the rows they cover.  A level only keeps the rows of
+     * one row of tiles and their borders, so besides the image itself the
+     * memory needed grows with the width of the image and the tile size,
+     * not with the size of the image.
+     *
+     * \param[in] pixels     - Pixels of the image, starting at the bottom row
+     * \param[in] components - Number of components in each pixel
+     * \param[in] width      - Width of the image in pixels
+     * \param[in] height     - Height of the image in pixels
+     * \param[in] tileSize   - Width and height of a tile without its border
+     * \param[in] border     - Pixels of border on each side of a tile
+     * \param[in] filename   - Name and path of the .vtex file to write
+     *
+     * \return Whether the file was written
+     */
+    static bool Build(
+        const GLubyte* pixels,
+        int components,
+        int width,
+        int height,
+        int tileSize,
+        int border,
+        const char* filename);
+
+private:
+    FILE*      file;       //!< Open file, or NULL
+    std::mutex fileMutex;  //!< Guards the file position between reads
+    int        width;      //!< Width of the image in pixels
+    int        height;     //!< Height of the image in pixels
+    int        components; //!< Components in each pixel
+    int        tileSize;   //!< Size of a tile without its border
+    int        border;     //!< Border on each side of a tile
+    int        numLevels;  //!< Number of levels
+
+    std::vector<int> levelStart; //!< Index of the first tile of each level,
+                                 //!< and the number of tiles at the end
+    std::vector<unsigned long long> offsets; //!< File offset of each tile,
+                                             //!< and the end of the last
+
+    struct BuildLevel;
+    struct BuildState;
+
+    /**
+     * \brief Passes the row just added to a level being built on to the
+     *        next level, and writes the rows of tiles it completes
+     *
+     * \return Whether the tiles were written
+     */
+    static bool AddRow(BuildState& state, int level);
+
+    /**
+     * \brief Copies a tile and its border out of a level, repeating the
+     *        level's edge pixels where the border falls outside it
+     *
+     * \param[in] rows     - Rows of the level held, starting at firstRow,
+     *                       which must include the rows of the tile and
+     *                       its border
+     * \param[in] firstRow - Row of the level held at the start of rows
+     */
+    static void CopyTile(
+        const GLubyte* rows,
+        int firstRow,
+        int components,
+        int width,
+        int height,
+        int tileSize,
+        int border,
+        int x,
+        int y,
+        GLubyte* tile);
+
+    TilePyramid(const TilePyramid&);            //!< No copy constructor
+    TilePyramid& operator=(const TilePyramid&); //!< No assignment operator
+};
+
+#endif
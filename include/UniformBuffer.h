@@ -0,0 +1,293 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <GL/glew.h>
+#include <vector>
+#include <Angel.h>
+
+/**
+ * \brief Class for managing an OpenGL uniform buffer object (UBO)
+ *
+ * A uniform buffer holds the values of a uniform block declared in GLSL.
+ * Binding the buffer to a binding point makes its values visible to every
+ * shader program whose block is assigned to that binding point, so data
+ * shared between programs (such as the camera and lights) only needs to
+ * be written once per frame.
+ *
+ * The contents must follow the layout of the block in the shader.  Blocks
+ * declared with layout(std140) can be filled using Std140Layout.
+ */
+class UniformBuffer
+{
+public:
+
+    /**
+     * \brief Creates a uniform buffer with storage allocated
+     *
+     * \param[in] size  - Size of the buffer in bytes
+     * \param[in] usage - Expected usage pattern of the buffer, such as
+     *                    GL_DYNAMIC_DRAW (default) or GL_STATIC_DRAW
+     */
+    UniformBuffer(GLsizeiptr size, GLenum usage = GL_DYNAMIC_DRAW);
+
+    /**
+     * \brief UniformBuffer destructor
+     */
+    ~UniformBuffer();
+
+    /**
+     * \brief Replaces part of the contents of the buffer
+     *
+     * \param[in] data   - New contents
+     * \param[in] size   - Number of bytes to copy
+     * \param[in] offset - Byte offset into the buffer to copy to
+     */
+    void SetData(const GLvoid* data, GLsizeiptr size, GLintptr offset = 0);
+
+    /**
+     * \brief Binds the whole buffer to a uniform block binding point
+     *
+     * \param[in] binding - Binding point, less than GL_MAX_UNIFORM_BUFFER_BINDINGS
+     */
+    void Bind(GLuint binding) const;
+
+    /**
+     * \brief Binds part of the buffer to a uniform block binding point
+     *
+     * \param[in] binding - Binding point, less than GL_MAX_UNIFORM_BUFFER_BINDINGS
+     * \param[in] offset  - Start of the range in bytes.  Must be a multiple
+     *                      of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+     * \param[in] size    - Size of the range in bytes
+     */
+    void BindRange(GLuint binding, GLintptr offset, GLsizeiptr size) const;
+
+    /**
+     * \brief Maps part of the buffer into client memory for writing
+     *
+     * \param[in] offset - Byte offset of the range to map
+     * \param[in] size   - Size of the range in bytes
+     * \param[in] access - Access flags passed to glMapBufferRange, which
+     *                     must include GL_MAP_WRITE_BIT
+     *
+     * \return Pointer to the mapped range, or NULL if it could not be mapped
+     */
+    GLvoid* MapRange(GLintptr offset, GLsizeiptr size, GLbitfield access);
+
+    /**
+     * \brief Unmaps the range mapped by MapRange
+     */
+    void Unmap();
+
+    /**
+     * \brief Gets the OpenGL ID of the buffer
+     */
+    inline GLuint GetID() const { return bufferId; }
+
+    /**
+     * \brief Gets the size of the buffer in bytes
+     */
+    inline GLsizeiptr GetSize() const { return size; }
+
+private:
+
+    GLuint     bufferId; //!< OpenGL ID of the buffer
+    GLsizeiptr size;     //!< Size of the buffer in bytes
+
+    UniformBuffer(const UniformBuffer&);            //!< No copy constructor
+    UniformBuffer& operator=(const UniformBuffer&); //!< No assignment operator
+};
+
+/**
+ * \brief Builds the contents of a std140 uniform block in memory
+ *
+ * Values are appended in the order the members are declared in the block,
+ * and are padded and aligned following the std140 rules, so the result
+ * can be copied directly into a UniformBuffer.  Matrices are converted from
+ * the row-major mat classes to the column-major order GLSL expects, the
+ * same way SetUniform transposes them.
+ *
+ * Each Add returns the byte offset of the value, which can later be
+ * passed to Set to change the value without rebuilding the block.
+ */
+class Std140Layout
+{
+public:
+
+    /**
+     * \brief Creates an empty layout
+     */
+    Std140Layout();
+
+    /**
+     * \brief Appends a member to the block
+     *
+     * \param[in] value - Value of the member
+     *
+     * \return Byte offset of the member within the block
+     */
+    GLintptr Add(float value);
+    GLintptr Add(int value);
+    GLintptr Add(const vec2& value);
+    GLintptr Add(const vec3& value);
+    GLintptr Add(const vec4& value);
+    GLintptr Add(const mat2& value);
+    GLintptr Add(const mat3& value);
+    GLintptr Add(const mat4& value);
+
+    /**
+     * \brief Changes the value of a previously added member
+     *
+     * \param[in] offset - Offset returned when the member was added
+     * \param[in] value  - New value, of the same type as the member
+     */
+    void Set(GLintptr offset, float value);
+    void Set(GLintptr offset, int value);
+    void Set(GLintptr offset, const vec2& value);
+    void Set(GLintptr offset, const vec3& value);
+    void Set(GLintptr offset, const vec4& value);
+    void Set(GLintptr offset, const mat2& value);
+    void Set(GLintptr offset, const mat3& value);
+    void Set(GLintptr offset, const mat4& value);
+
+    /**
+     * \brief Removes all members
+     */
+    void Clear();
+
+    /**
+     * \brief Gets the block data
+     */
+    inline const GLubyte* GetData() const { return data.empty() ? NULL : &data[0]; }
+
+    /**
+     * \brief Gets the size of the block in bytes
+     *
+     * The size is rounded up to a multiple of 16 bytes, matching the
+     * GL_UNIFORM_BLOCK_DATA_SIZE reported for the block
+     */
+    GLsizeiptr GetSize() const;
+
+private:
+
+    std::vector<GLubyte> data; //!< Contents of the block, padded to 16 bytes
+    GLsizeiptr           used; //!< Bytes used by the members, without padding
+
+    /**
+     * \brief Pads the block so that the next member starts aligned
+     *
+     * \param[in] alignment - Base alignment of the next member in bytes
+     * \param[in] size      - Size of the next member in bytes
+     *
+     * \return Offset of the next member
+     */
+    GLintptr Reserve(GLintptr alignment, GLsizeiptr size);
+
+    /**
+     * \brief Copies floats into the block
+     *
+     * \param[in] offset - Byte offset to copy to
+     * \param[in] values - Values to copy
+     * \param[in] count  - Number of values to copy
+     */
+    void Write(GLintptr offset, const GLfloat* values, int count);
+};
+
+/**
+ * \brief Streams per-draw uniform block data through one large buffer
+ *
+ * Rather than setting the uniforms of each object with separate glUniform
+ * calls, the values for every draw in a frame are pushed into a CPU-side
+ * staging area, then copied to the GPU in a single contiguous write by
+ * Upload.  Each draw then selects its own slice of the buffer with
+ * BindRange, which costs one glBindBufferRange call.
+ *
+ * Slices are placed at multiples of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+ * Frames are written one after another around the ring, so the GPU can
+ * still be reading the previous frame's data while the next one is
+ * uploaded.  When a frame no longer fits at the end of the buffer it wraps
+ * to the start and the old storage is orphaned instead of waited on.
+ * The buffer grows if a single frame is larger than the whole ring.
+ *
+ * Typical use each frame is Begin, Push for every draw, Upload, then
+ * BindRange before each draw with the offsets returned by Push.
+ */
+class UniformRingBuffer
+{
+public:
+
+    /**
+     * \brief Creates a ring buffer
+     *
+     * \param[in] size - Initial size of the buffer in bytes
+     */
+    UniformRingBuffer(GLsizeiptr size);
+
+    /**
+     * \brief UniformRingBuffer destructor
+     */
+    ~UniformRingBuffer();
+
+    /**
+     * \brief Starts recording a new frame, discarding the previous frame's data
+     */
+    void Begin();
+
+    /**
+     * \brief Appends the data of one draw to the current frame
+     *
+     * \param[in] data - Contents of the uniform block for the draw
+     * \param[in] size - Size of the data in bytes
+     *
+     * \return Offset to pass to BindRange.  The offset is only valid until
+     *         the next call to Begin
+     */
+    GLintptr Push(const GLvoid* data, GLsizeiptr size);
+
+    /**
+     * \brief Appends the contents of a std140 block to the current frame
+     *
+     * \param[in] block - Block to copy
+     *
+     * \return Offset to pass to BindRange
+     */
+    GLintptr Push(const Std140Layout& block);
+
+    /**
+     * \brief Copies all data pushed since Begin to the GPU in one write
+     */
+    void Upload();
+
+    /**
+     * \brief Binds the data of one draw to a uniform block binding point
+     *
+     * Must be called after Upload.
+     *
+     * \param[in] binding - Binding point of the block
+     * \param[in] offset  - Offset returned by Push
+     * \param[in] size    - Size of the block in bytes
+     */
+    void BindRange(GLuint binding, GLintptr offset, GLsizeiptr size) const;
+
+    /**
+     * \brief Gets the number of bytes pushed since Begin, including padding
+     */
+    inline GLsizeiptr GetFrameSize() const { return (GLsizeiptr)staging.size(); }
+
+    /**
+     * \brief Gets the alignment of each draw's data in bytes
+     */
+    inline GLint GetAlignment() const { return alignment; }
+
+private:
+
+    UniformBuffer*       buffer;    //!< GPU storage for the ring
+    std::vector<GLubyte> staging;   //!< Data pushed during the current frame
+    GLint                alignment; //!< GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    GLintptr             head;      //!< Where the next frame will be written
+    GLintptr             frameBase; //!< Where the current frame was written
+
+    UniformRingBuffer(const UniformRingBuffer&);            //!< No copy constructor
+    UniformRingBuffer& operator=(const UniformRingBuffer&); //!< No assignment operator
+};
+
+#endif
@@ -4,9 +4,13 @@
 #include <GL/glew.h>
 #include <map>
 #include <string>
+#include <vector>
 #include <Angel.h>
 #include "Shader.h"
 
+// Forward declaration, only referenced by Bind
+class ProgramPipeline;
+
 /**
  * \brief Class for managing OpenGL vertex array objects (VAOs)
  *
@@ -22,6 +26,55 @@ class VertexArray
 {
 public:
 
+    /**
+     * \brief Storage formats that float vertex data can be packed into
+     *
+     * Packing happens once when the data is uploaded.  The vertex fetch
+     * hardware expands packed data back to floats, so attributes declared
+     * as vec2/vec3/vec4 in the shader do not need to change.
+     */
+    enum Packing
+    {
+        PACK_NONE,           //!< 32-bit floats, unchanged (default)
+        PACK_INT_2_10_10_10, //!< Signed normalized 10 bits per component,
+                             //!< for unit length normals and tangents
+        PACK_HALF_FLOAT,     //!< 16-bit floats, for texture coordinates
+        PACK_UNORM_BYTE      //!< Normalized unsigned bytes, for colors
+                             //!< with components in [0,1]
+    };
+
+    /**
+     * \brief A contiguous part of the vertex array, such as a submesh
+     */
+    struct Range
+    {
+    public:
+
+        int first;      //!< First index (or vertex, if there are no indices) to draw
+        int count;      //!< Number of indices (or vertices) to draw
+        int baseVertex; //!< Value added to each index before fetching vertices
+
+        /**
+         * \brief Creates an empty range
+         */
+        Range()
+            : first(0), count(0), baseVertex(0)
+        {
+        }
+
+        /**
+         * \brief Creates a range
+         *
+         * \param[in] first      - First index (or vertex) to draw
+         * \param[in] count      - Number of indices (or vertices) to draw
+         * \param[in] baseVertex - Value added to each index
+         */
+        Range(int first, int count, int baseVertex = 0)
+            : first(first), count(count), baseVertex(baseVertex)
+        {
+        }
+    };
+
     /**
      * \brief Creates an empty vertex array
      */
@@ -46,6 +99,18 @@ public:
      */
     void Bind(const Shader& shader);
 
+    /**
+     * \brief Binds a vertex array for drawing with a program pipeline
+     *
+     * The attributes are matched to the pipeline's vertex stage, and the VAO
+     * is kept per vertex stage.  Pipelines sharing a vertex stage, or a
+     * pipeline whose fragment stage changes, reuse the same VAO.
+     *
+     * \param[in] pipeline - Pipeline to bind to.  Must be currently bound
+     *                       and have a vertex stage
+     */
+    void Bind(const ProgramPipeline& pipeline);
+
     /**
      * \brief Unbinds the vertex array, causing it to no longer be active
      */
@@ -66,14 +131,19 @@ public:
      * this function.  All attributes in the same vertex array must have
      * the same number of elements.
      *
-     * \param[in] name   - Name of the attribute exactly as it appears
-     *                     in the shader source
-     * \param[in] data   - Data for the attribute
-     * \param[in] length - Number of elements in the data array
+     * Packed vec3 data is padded to four components to keep every vertex
+     * 4-byte aligned.  The padding is 0 for PACK_INT_2_10_10_10 and 1 for
+     * the other packings.  PACK_INT_2_10_10_10 cannot be used with vec2's.
+     *
+     * \param[in] name    - Name of the attribute exactly as it appears
+     *                      in the shader source
+     * \param[in] data    - Data for the attribute
+     * \param[in] length  - Number of elements in the data array
+     * \param[in] packing - Format to store the data in on the GPU
      */
-    void AddAttribute(const char* name, const vec2* data, int length);
-    void AddAttribute(const char* name, const vec3* data, int length);
-    void AddAttribute(const char* name, const vec4* data, int length);
+    void AddAttribute(const char* name, const vec2* data, int length, Packing packing = PACK_NONE);
+    void AddAttribute(const char* name, const vec3* data, int length, Packing packing = PACK_NONE);
+    void AddAttribute(const char* name, const vec4* data, int length, Packing packing = PACK_NONE);
 
     /**
      * \brief Adds an attribute to the vertex array
@@ -108,6 +178,10 @@ public:
      * If the vertex array already has indices attached, this will overwrite them.
      * The indices are copied by this call, so it is okay to delete the indices
      * array after calling this function.
+     *
+     * The indices are stored using the smallest of GL_UNSIGNED_BYTE,
+     * GL_UNSIGNED_SHORT and GL_UNSIGNED_INT that can hold the largest index,
+     * so IndicesType() may be narrower than the type passed in.
      */
     void AddIndices(const unsigned int*   indices, int length);
     void AddIndices(const unsigned short* indices, int length);
@@ -134,6 +208,47 @@ public:
      */
     void Draw(GLenum mode) const;
 
+    /**
+     * \brief Draws part of the vertex data using the currently bound shader
+     *
+     * Draws a subrange of the vertex array, such as one material group,
+     * LOD level or cluster of a model.  With indices, first and count
+     * select indices and baseVertex is added to every index read, so several
+     * meshes can share one set of buffers while keeping their own zero-based
+     * indices.  Without indices, vertices first + baseVertex up to
+     * first + baseVertex + count are drawn.
+     *
+     * \param[in] mode       - Type of primitive to use while drawing, as in Draw
+     * \param[in] first      - First index (or vertex) to draw
+     * \param[in] count      - Number of indices (or vertices) to draw
+     * \param[in] baseVertex - Value added to each index before fetching vertices
+     */
+    void DrawRange(GLenum mode, int first, int count, int baseVertex = 0) const;
+
+    /**
+     * \brief Draws several parts of the vertex data in a single call
+     *
+     * Equivalent to calling DrawRange for every range, but submitted to
+     * the driver with one glMultiDrawElementsBaseVertex (or glMultiDrawArrays)
+     * call.
+     *
+     * \param[in] mode      - Type of primitive to use while drawing, as in Draw
+     * \param[in] ranges    - Array of ranges to draw
+     * \param[in] numRanges - Number of elements in the ranges array
+     */
+    void DrawRanges(GLenum mode, const Range* ranges, int numRanges) const;
+
+    /**
+     * \brief Draws several instances of the vertex data in a single call
+     *
+     * The shader tells the instances apart with gl_InstanceID, for example
+     * to pick each one's transform and texture layer from a uniform block.
+     *
+     * \param[in] mode          - Type of primitive to use while drawing, as in Draw
+     * \param[in] instanceCount - Number of instances to draw
+     */
+    void DrawInstanced(GLenum mode, int instanceCount) const;
+
     /**
      * \brief Gets the number of vertices for the vertex array
      *
@@ -164,6 +279,13 @@ public:
      */
     inline GLenum IndicesType() const { return indicesType; }
 
+    /**
+     * \brief Gets the GPU memory used by the attribute and index buffers
+     *
+     * \return Total size in bytes of all buffers owned by the vertex array
+     */
+    GLsizeiptr NumBytes() const;
+
 private:
 
     /**
@@ -187,8 +309,10 @@ private:
          *                 GL_UNSIGNED_SHORT,
          *                 GL_INT,
          *                 GL_UNSIGNED_INT,
+         *                 GL_HALF_FLOAT,
          *                 GL_FLOAT,
-         *                 GL_DOUBLE
+         *                 GL_DOUBLE,
+         *                 GL_INT_2_10_10_10_REV
          */
         GLenum type;
 
@@ -204,11 +328,21 @@ private:
          */
         GLsizei stride;
 
+        /**
+         * \brief Whether integer data is mapped to [0,1] or [-1,1] when read
+         */
+        GLboolean normalized;
+
+        /**
+         * \brief Size of the attribute's buffer in bytes
+         */
+        GLsizeiptr size;
+
         /**
          * \brief Default constructor
          */
         Attribute()
-            : bufferId(0)
+            : bufferId(0), normalized(GL_FALSE), size(0)
         {
         }
     };
@@ -272,7 +406,19 @@ private:
      * \brief Type of data in the indices buffer
      */
     GLenum indicesType;
+
+    /**
+     * \brief Size of the indices buffer in bytes
+     */
+    GLsizeiptr indicesSize;
     
+    /**
+     * \brief Scratch arrays for DrawRanges, kept to avoid allocating per draw
+     */
+    mutable std::vector<GLsizei> rangeCounts;
+    mutable std::vector<GLint>   rangeFirsts;
+    mutable std::vector<GLvoid*> rangeOffsets;
+
     /**
      * \brief Type for maps of attributes
      */
@@ -298,6 +444,11 @@ private:
      */
     static int vertexArrayIdCounter;
 
+    /**
+     * \brief Gets the size in bytes of a single index
+     */
+    GLsizeiptr IndexSize() const;
+
     /**
      * \brief Creates a VAO object for pairing with a shader
      *
@@ -305,6 +456,13 @@ private:
      */
     void GenerateVAO(const Shader& shader);
 
+    /**
+     * \brief Binds the VAO paired with a shader, creating it if needed
+     *
+     * \param[in] shader - Shader, or vertex stage of a pipeline, to pair with
+     */
+    void BindVAO(const Shader& shader);
+
     /**
      * \brief Marks all previously created VAOs as stale
      */
@@ -336,6 +494,46 @@ private:
         GLsizei stride,
         GLenum type);
 
+    /**
+     * \brief Uploads attribute data that is already in its final format
+     *
+     * \param[in] name          - Name of the attribute
+     * \param[in] data          - Data for the attribute
+     * \param[in] size          - Size of the data in bytes
+     * \param[in] numComponents - Number of components per element
+     * \param[in] length        - Number of complete elements in the data
+     * \param[in] stride        - Byte offset between consecutive elements
+     * \param[in] type          - Data type of the components
+     * \param[in] normalized    - Whether integer data is normalized when read
+     */
+    void AddAttributeBuffer(
+        const char*   name,
+        const GLvoid* data,
+        GLsizeiptr    size,
+        int           numComponents,
+        int           length,
+        GLsizei       stride,
+        GLenum        type,
+        GLboolean     normalized);
+
+    /**
+     * \brief Packs float vectors according to a packing mode and uploads them
+     *
+     * \param[in] name          - Name of the attribute
+     * \param[in] data          - First component of the first vector
+     * \param[in] numComponents - Number of components per vector (2, 3 or 4)
+     * \param[in] vectorSize    - Size in bytes of one vector in the data
+     * \param[in] length        - Number of vectors in the data
+     * \param[in] packing       - Format to store the data in
+     */
+    void AddPackedAttribute(
+        const char*  name,
+        const float* data,
+        int          numComponents,
+        size_t       vectorSize,
+        int          length,
+        Packing      packing);
+
     /**
      * \brief Common method for adding indices
      *
@@ -0,0 +1,278 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <GL/glew.h>
+#include <memory>
+#include <vector>
+#include "Angel.h"
+
+class Texture2D;
+class TilePyramid;
+
+/**
+ * \brief Draws an image far larger than video memory by paging the tiles
+ *        of a TilePyramid file into a fixed-size cache texture
+ *
+ * Each frame, the parts of the image in view are requested at the level of
+ * detail they are drawn at.  Update reads missing tiles on the shared
+ * thread pool and copies finished ones into free pages of the cache,
+ * reusing the pages of the tiles requested least recently when it is full.
+ *
+ * Shaders find a tile through the indirection texture, which has a texel
+ * per tile of each level, and a mip level per level of the pyramid.  Each
+ * texel holds the page of the finest resident tile covering it (in red and
+ * green, counting pages from the bottom left of the cache) and the level of
+ * that tile (in blue).  Tiles that haven't arrived yet are drawn from their
+ * nearest resident ancestor, and the single tile of the last level is kept
+ * resident, so every part of the image can always be drawn.
+ *
+ * Video memory is the cache and the indirection texture, which takes 4
+ * bytes per tile.  Memory in flight is bounded by the number of pending
+ * loads, so neither depends on the size of the image beyond its number of
+ * tiles.
+ *
+ * Every function must be called on the thread that owns the OpenGL context.
+ */
+class VirtualTexture
+{
+public:
+
+    /**
+     * \brief Statistics about the paging
+     */
+    struct Stats
+    {
+    public:
+
+        /**
+         * \brief Creates empty statistics
+         */
+        Stats()
+            : tilesLoaded(0),
+            tilesEvicted(0),
+            tilesDropped(0),
+            bytesRead(0)
+        {
+        }
+
+        unsigned int       tilesLoaded;  //!< Tiles copied into the cache
+        unsigned int       tilesEvicted; //!< Tiles whose page was reused
+        unsigned int       tilesDropped; //!< Tiles read while every page
+                                         //!< was in use this frame
+        unsigned long long bytesRead;    //!< Bytes read from the file
+    };
+
+    /**
+     * \brief Opens a tile pyramid and creates its cache
+     *
+     * \param[in] filename        - Name and path of the .vtex file
+     * \param[in] pagesAcross     - Pages along each side of the cache texture
+     * \param[in] maxPendingLoads - Most tiles being read at once
+     */
+    VirtualTexture(const char* filename, int pagesAcross = 16, int maxPendingLoads = 16);
+
+    /**
+     * \brief VirtualTexture destructor
+     */
+    ~VirtualTexture();
+
+    /**
+     * \brief Checks whether the file was opened and its last tile read
+     */
+    inline bool IsValid() const { return cache != NULL; }
+
+    /**
+     * \brief Gets the width of the image in pixels
+     */
+    int GetWidth() const;
+
+    /**
+     * \brief Gets the height of the image in pixels
+     */
+    int GetHeight() const;
+
+    /**
+     * \brief Gets the number of levels of detail
+     */
+    int GetNumLevels() const;
+
+    /**
+     * \brief Gets the level of detail at which one image pixel covers about
+     *        one screen pixel
+     *
+     * \param[in] pixelsPerScreenPixel - Image pixels across one screen pixel
+     */
+    int GetLevel(float pixelsPerScreenPixel) const;
+
+    /**
+     * \brief Requests the tiles covering part of the image for this frame
+     *
+     * \param[in] u0    - Left of the part, from 0 to 1 across the image
+     * \param[in] v0    - Bottom of the part, from 0 to 1 up the image
+     * \param[in] u1    - Right of the part
+     * \param[in] v1    - Top of the part
+     * \param[in] level - Level of detail the part is drawn at
+     */
+    void RequestRegion(float u0, float v0, float u1, float v1, int level);
+
+    /**
+     * \brief Copies read tiles into the cache, then starts reading the tiles
+     *        requested since the last Update
+     *
+     * Call once per frame, after the frame's requests.  The uploads go
+     * through texture unit 0 and may leave either texture bound there, so
+     * call Bind after Update and before drawing.
+     */
+    void Update();
+
+    /**
+     * \brief Binds the cache and the indirection texture
+     *
+     * \param[in] cacheUnit       - Texture unit for the cache
+     * \param[in] indirectionUnit - Texture unit for the indirection texture
+     */
+    void Bind(int cacheUnit, int indirectionUnit);
+
+    /**
+     * \brief Gets the scale from texture coordinates across the image to
+     *        coordinates across the tile grid, which is square and may
+     *        extend past the image
+     */
+    vec2 GetTexCoordScale() const;
+
+    /**
+     * \brief Gets the values shaders need to sample the cache
+     *
+     * \return Pixels across the tile grid of level 0, pixels across a tile,
+     *         pixels of border around a tile, and pixels across the cache
+     */
+    vec4 GetShaderParams() const;
+
+    /**
+     * \brief Gets the number of tiles in the cache
+     */
+    int GetNumResidentTiles() const;
+
+    /**
+     * \brief Gets the number of tiles being read
+     */
+    inline int GetNumPendingLoads() const { return (int)loads.size(); }
+
+    /**
+     * \brief Gets the video memory of the cache and indirection texture, plus
+     *        the memory of the tiles being read
+     */
+    GLsizeiptr GetMemoryUsed() const;
+
+    /**
+     * \brief Gets statistics about the paging since the last reset
+     */
+    inline const Stats& GetStats() const { return stats; }
+
+    /**
+     * \brief Resets the statistics
+     */
+    inline void ResetStats() { stats = Stats(); }
+
+private:
+
+    /**
+     * \brief A page of the cache and the tile it holds
+     */
+    struct Page
+    {
+        int           tile;     //!< Index of the tile, or -1 if free
+        int           level;    //!< Level of the tile
+        int           x;        //!< Column of the tile in its level
+        int           y;        //!< Row of the tile in its level
+        unsigned long lastUsed; //!< Frame the tile was last requested in
+    };
+
+    /**
+     * \brief Part of a level of the indirection texture to upload
+     */
+    struct Rect
+    {
+        int x0; //!< First column
+        int y0; //!< First row
+        int x1; //!< One past the last column
+        int y1; //!< One past the last row
+    };
+
+    /**
+     * \brief A tile asked for since the last Update
+     */
+    struct Request
+    {
+        int level; //!< Level of the tile
+        int x;     //!< Column of the tile in its level
+        int y;     //!< Row of the tile in its level
+    };
+
+    struct Load;
+
+    /**
+     * \brief States of a tile that isn't in a page
+     */
+    enum TileState
+    {
+        notResident = -1, //!< Nobody asked for the tile
+        loading     = -2, //!< The tile is being read
+        wanted      = -3  //!< The tile was requested this frame
+    };
+
+    std::shared_ptr<TilePyramid> pyramid; //!< File the tiles are read from
+    int pagesAcross;     //!< Pages along each side of the cache
+    int maxPendingLoads; //!< Most tiles being read at once
+
+    Texture2D* cache;       //!< Pages of tiles
+    Texture2D* indirection; //!< Page and level of the tile to sample
+
+    std::vector<int>     tilePages; //!< Page of each tile, or one of the states
+    std::vector<Page>    pages;     //!< Tile held by each page
+    std::vector<Request> requested; //!< Tiles wanted since the last Update
+    std::vector<Rect>    dirty;     //!< Texels of each level to upload
+    std::vector<std::shared_ptr<Load> > loads;  //!< Tiles being read
+    std::vector<std::vector<GLubyte> > entries; //!< Indirection texels of each level
+
+    unsigned long frame; //!< Number of Updates so far
+    Stats         stats; //!< Paging since the last reset
+
+    /**
+     * \brief Marks a tile and its ancestors as used this frame, and asks
+     *        for those that aren't resident
+     */
+    void Touch(int level, int x, int y);
+
+    /**
+     * \brief Orders requests coarsest first
+     */
+    static bool IsCoarser(const Request& a, const Request& b);
+
+    /**
+     * \brief Starts reading a tile on the shared thread pool
+     */
+    void StartLoad(int level, int x, int y);
+
+    /**
+     * \brief Copies a read tile into a page, if one is free or unused this
+     *        frame
+     */
+    void FinishLoad(const Load& load);
+
+    /**
+     * \brief Points the indirection texels under a tile at the finest
+     *        resident tile covering each of them
+     */
+    void UpdateEntries(int level, int x, int y);
+
+    /**
+     * \brief Uploads the indirection texels that changed
+     */
+    void UploadEntries();
+
+    VirtualTexture(const VirtualTexture&);            //!< No copy constructor
+    VirtualTexture& operator=(const VirtualTexture&); //!< No assignment operator
+};
+
+#endif
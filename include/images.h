@@ -7,7 +7,8 @@
 GLubyte * loadFile(char * filename, int * nWidth, int * nHeight, int * nComponents, GLenum * eFormat)
 {
   int comp;
-  GLubyte * temp = stbi_load(filename, nWidth, nHeight, &comp, 0);
+  int flipPass;
+  GLubyte * temp = stbi_load_bottom_up(filename, nWidth, nHeight, &comp, 0, &flipPass);
   if (temp == NULL)
   {
     std::cout << "Unable to load image file " << filename << std::endl;
@@ -29,17 +30,7 @@ GLubyte * loadFile(char * filename, int * nWidth, int * nHeight, int * nComponen
     exit(1);
   }
 
-  // Images are upside down
-  int width = *nWidth;
-  int height = *nHeight;
-  GLubyte * swap = (GLubyte *) malloc(width * comp);
-  for (int i = 0, j = height - 1; i < height / 2; ++i, --j)
-  {
-    memcpy(swap, temp + i * width * comp, width * comp);
-    memcpy(temp + i * width * comp, temp + j * width * comp, width * comp);
-    memcpy(temp + j * width * comp, swap, width * comp);
-  }
-  free(swap);
+  // Rows are already bottom-up, as OpenGL expects
   return temp;
 }
 
@@ -226,6 +226,12 @@ extern stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, in
 extern stbi_uc *stbi_load            (char const *filename,     int *x, int *y, int *comp, int req_comp);
 extern stbi_uc *stbi_load_from_file  (FILE *f,                  int *x, int *y, int *comp, int req_comp);
 // for stbi_load_from_file, file pointer is left pointing immediately after image
+
+// same as stbi_load, but returns the rows bottom-up (the first row is the
+// bottom of the image), which is the order OpenGL expects.  JPEG, BMP and
+// TGA decoders write each row straight to its final place; other formats
+// are flipped in place afterwards, in which case *flip_pass is set to 1
+extern stbi_uc *stbi_load_bottom_up  (char const *filename,     int *x, int *y, int *comp, int req_comp, int *flip_pass);
 #endif
 
 typedef struct
@@ -1,7 +1,54 @@
+#include <atomic>
 #include <cassert>
 #include <iostream>
+#include <string>
+#include <vector>
+#include "CompressedImage.h"
+#include "HalfFloat.h"
+#include "MipmapBuilder.h"
 #include "stb_image.h"
 #include "Texture2D.h"
+#include "ThreadPool.h"
+
+/*
+ * The image of a lazy texture, decoded on the thread pool
+ */
+struct Texture2D::LazyLoad
+{
+    LazyLoad(const char* filename)
+        : filename(filename),
+        started(false),
+        pixels(NULL),
+        width(0),
+        height(0),
+        format(GL_NONE),
+        dataType(GL_UNSIGNED_BYTE),
+        chain(NULL),
+        image(NULL),
+        decoded(false)
+    {
+    }
+
+    ~LazyLoad()
+    {
+        free(pixels);
+        delete chain;
+        delete image;
+    }
+
+    std::string           filename; // File to decode
+    bool                  started;  // Whether the decode was submitted, only used on the main thread
+    GLvoid*               pixels;   // Level 0, allocated with malloc
+    int                   width;    // Width of the image in pixels
+    int                   height;   // Height of the image in pixels
+    GLenum                format;   // Format of the image
+    GLenum                dataType; // GL_UNSIGNED_BYTE, or GL_HALF_FLOAT for HDR images
+    MipmapBuilder::Chain* chain;    // Levels built alongside the decode, or NULL
+    CompressedImage*      image;    // Image read from a KTX or DDS file instead, or NULL
+
+    std::function<CompressedImage*()> loader; // Makes the image instead of the file, if set
+    std::atomic<bool>     decoded;  // Set by the worker once the fields above are written
+};
 
 /*
  * Construct Texture2D from file name
@@ -12,14 +59,17 @@ Texture2D::Texture2D(
     GLenum magFilter,
     GLenum wrapS,
     GLenum wrapT,
-    float  aniso)
+    float  aniso,
+    bool   lazy)
     : Texture(GL_TEXTURE_2D),
     minFilter(minFilter),
     magFilter(magFilter),
     wrapS(wrapS),
     wrapT(wrapT),
     aniso(aniso),
-    dataType(GL_UNSIGNED_BYTE)
+    dataType(GL_UNSIGNED_BYTE),
+    numLevels(1),
+    baseLevel(0)
 {
     // Debug assertions
     assert(filename);
@@ -39,9 +89,35 @@ Texture2D::Texture2D(
            wrapT == GL_MIRRORED_REPEAT);
     assert(aniso >= 1.0f);
 
-    // Load the image from the file
-    GLubyte* data  = Texture::LoadFile(filename, &width, &height, &imageFormat);
-    internalFormat = imageFormat;
+    if (lazy)
+    {
+        InitPlaceholder(std::make_shared<LazyLoad>(filename));
+        return;
+    }
+
+    // KTX and DDS files keep the compressed levels they hold
+    if (CompressedImage::IsCompressedFile(filename))
+    {
+        CompressedImage image(filename);
+        LoadCompressedImage(&image);
+        return;
+    }
+
+    // Load the image from the file.  High dynamic range images keep their
+    // range as half floats
+    GLvoid* data = NULL;
+    if (Texture::IsHdrFile(filename))
+    {
+        data           = Texture::LoadHdrFile(filename, &width, &height, &imageFormat);
+        internalFormat = GetHalfFloatFormat(imageFormat);
+        dataType       = GL_HALF_FLOAT;
+    }
+    if (data == NULL)
+    {
+        data           = Texture::LoadFile(filename, &width, &height, &imageFormat);
+        internalFormat = imageFormat;
+        dataType       = GL_UNSIGNED_BYTE;
+    }
 
     // Fill the texture with pixel data
     InitTextureObject(data);
@@ -50,6 +126,95 @@ Texture2D::Texture2D(
     free(data);
 }
 
+/*
+ * Construct Texture2D from compressed image
+ */
+Texture2D::Texture2D(
+    const CompressedImage& image,
+    GLenum minFilter,
+    GLenum magFilter,
+    GLenum wrapS,
+    GLenum wrapT,
+    float  aniso)
+    : Texture(GL_TEXTURE_2D),
+    minFilter(minFilter),
+    magFilter(magFilter),
+    wrapS(wrapS),
+    wrapT(wrapT),
+    aniso(aniso),
+    width(image.GetWidth()),
+    height(image.GetHeight()),
+    internalFormat(image.GetFormat()),
+    imageFormat(GL_NONE),
+    dataType(GL_NONE),
+    numLevels(1),
+    baseLevel(0)
+{
+    // Debug assertions
+    assert(image.IsValid());
+    assert(image.GetNumFaces() == 1);
+    assert(minFilter == GL_NEAREST                ||
+           minFilter == GL_LINEAR                 ||
+           minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+           minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+           minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+           minFilter == GL_LINEAR_MIPMAP_LINEAR);
+    assert(magFilter == GL_NEAREST ||
+           magFilter == GL_LINEAR);
+    assert(wrapS == GL_CLAMP_TO_EDGE ||
+           wrapS == GL_REPEAT        ||
+           wrapS == GL_MIRRORED_REPEAT);
+    assert(wrapT == GL_CLAMP_TO_EDGE ||
+           wrapT == GL_REPEAT        ||
+           wrapT == GL_MIRRORED_REPEAT);
+    assert(aniso >= 1.0f);
+
+    LoadCompressedImage(&image);
+}
+
+/*
+ * Construct lazy Texture2D from compressed image loader
+ */
+Texture2D::Texture2D(
+    const std::function<CompressedImage*()>& loader,
+    GLenum minFilter,
+    GLenum magFilter,
+    GLenum wrapS,
+    GLenum wrapT,
+    float  aniso)
+    : Texture(GL_TEXTURE_2D),
+    minFilter(minFilter),
+    magFilter(magFilter),
+    wrapS(wrapS),
+    wrapT(wrapT),
+    aniso(aniso),
+    dataType(GL_UNSIGNED_BYTE),
+    numLevels(1),
+    baseLevel(0)
+{
+    // Debug assertions
+    assert(loader);
+    assert(minFilter == GL_NEAREST                ||
+           minFilter == GL_LINEAR                 ||
+           minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+           minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+           minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+           minFilter == GL_LINEAR_MIPMAP_LINEAR);
+    assert(magFilter == GL_NEAREST ||
+           magFilter == GL_LINEAR);
+    assert(wrapS == GL_CLAMP_TO_EDGE ||
+           wrapS == GL_REPEAT        ||
+           wrapS == GL_MIRRORED_REPEAT);
+    assert(wrapT == GL_CLAMP_TO_EDGE ||
+           wrapT == GL_REPEAT        ||
+           wrapT == GL_MIRRORED_REPEAT);
+    assert(aniso >= 1.0f);
+
+    std::shared_ptr<LazyLoad> load = std::make_shared<LazyLoad>("");
+    load->loader = loader;
+    InitPlaceholder(load);
+}
+
 /*
  * Construct Texture2D from raw bytes
  */
@@ -72,7 +237,9 @@ Texture2D::Texture2D(
     wrapS(wrapS),
     wrapT(wrapT),
     aniso(aniso),
-    dataType(GL_UNSIGNED_BYTE)
+    dataType(GL_UNSIGNED_BYTE),
+    numLevels(1),
+    baseLevel(0)
 {
     // Debug assertions
     assert(format == GL_RED  ||
@@ -137,7 +304,9 @@ Texture2D::Texture2D(
     wrapS(wrapS),
     wrapT(wrapT),
     aniso(aniso),
-    dataType(GL_FLOAT)
+    dataType(GL_HALF_FLOAT),
+    numLevels(1),
+    baseLevel(0)
 {
     // Debug assertions
     assert(format == GL_RED  ||
@@ -163,21 +332,14 @@ Texture2D::Texture2D(
            wrapT == GL_MIRRORED_REPEAT);
     assert(aniso >= 1.0f);
 
-    // Figure out the internal format to use for the texture
-    switch(format)
-    {
-    case GL_BGR:
-        internalFormat = GL_RGB;
-        break;
-    case GL_BGRA:
-        internalFormat = GL_RGBA;
-        break;
-    default:
-        internalFormat = format;
-    }
+    // Stored as half floats, which keep the range of the values in half the
+    // memory of 32-bit floats
+    internalFormat = GetHalfFloatFormat(format);
+    std::vector<GLushort> halves((size_t)width * height * BytesPerPixel(format));
+    FloatToHalf(data, &halves[0], halves.size());
 
     // Fill the texture with pixel data
-    InitTextureObject(data);
+    InitTextureObject(&halves[0]);
 }
 
 /*
@@ -204,7 +366,9 @@ Texture2D::Texture2D(
     magFilter(magFilter),
     wrapS(wrapS),
     wrapT(wrapT),
-    aniso(aniso)
+    aniso(aniso),
+    numLevels(1),
+    baseLevel(0)
 {
     // Debug assertions
     assert(width > 0 && height > 0);
@@ -236,6 +400,288 @@ Texture2D::~Texture2D()
     // Nothing to do here, it is all handled in the base destructor
 }
 
+/*
+ * Prefetch
+ */
+void Texture2D::Prefetch()
+{
+    if (!lazyLoad || lazyLoad->started)
+    {
+        return;
+    }
+    lazyLoad->started = true;
+
+    // The worker only touches the shared state, so the texture may be
+    // deleted before it finishes
+    std::shared_ptr<LazyLoad> load = lazyLoad;
+    bool mipmaps = minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+                   minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+                   minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+                   minFilter == GL_LINEAR_MIPMAP_LINEAR;
+    ThreadPool::GetShared().Submit([load, mipmaps]()
+    {
+        if (load->loader)
+        {
+            load->image = load->loader();
+            load->decoded = true;
+            return;
+        }
+
+        // KTX and DDS files already hold their levels
+        const char* filename = load->filename.c_str();
+        if (CompressedImage::IsCompressedFile(filename))
+        {
+            load->image = new CompressedImage(filename);
+            load->decoded = true;
+            return;
+        }
+
+        if (Texture::IsHdrFile(filename))
+        {
+            load->pixels   = Texture::LoadHdrFile(filename, &load->width, &load->height, &load->format);
+            load->dataType = GL_HALF_FLOAT;
+        }
+        if (load->pixels == NULL)
+        {
+            load->pixels   = Texture::LoadFile(filename, &load->width, &load->height, &load->format);
+            load->dataType = GL_UNSIGNED_BYTE;
+        }
+
+        // 8-bit levels are built here as well, so the main thread only
+        // uploads them
+        if (mipmaps && load->dataType == GL_UNSIGNED_BYTE && MipmapBuilder::IsEnabled())
+        {
+            const GLubyte* faces[] = { (const GLubyte*)load->pixels };
+            load->chain = MipmapBuilder::BuildCached(
+                faces, 1, BytesPerPixel(load->format), load->width, load->height);
+        }
+
+        load->decoded = true;
+    });
+}
+
+/*
+ * Load on bind
+ */
+void Texture2D::LoadOnBind()
+{
+    // The first bind starts the decode if a prefetch hasn't already
+    Prefetch();
+    if (lazyLoad->decoded)
+    {
+        SetLoadOnBind(false);
+        FinishLazyLoad();
+    }
+}
+
+/*
+ * Finish lazy load
+ */
+void Texture2D::FinishLazyLoad()
+{
+    std::shared_ptr<LazyLoad> load = lazyLoad;
+    lazyLoad.reset();
+
+    // Called from Bind with the texture on the active unit.  The image
+    // replaces the placeholder in the same texture object, so its ID stays
+    // valid
+    if (load->image != NULL || load->loader)
+    {
+        LoadCompressedImage(load->image);
+        return;
+    }
+
+    width          = load->width;
+    height         = load->height;
+    imageFormat    = load->format;
+    dataType       = load->dataType;
+    internalFormat = dataType == GL_HALF_FLOAT ? GetHalfFloatFormat(imageFormat) : imageFormat;
+
+    if (load->chain == NULL)
+    {
+        InitTextureObject(load->pixels);
+        return;
+    }
+
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        internalFormat,
+        width,
+        height,
+        0,
+        imageFormat,
+        dataType,
+        load->pixels);
+    load->chain->Upload(GL_TEXTURE_2D, 0, internalFormat, imageFormat);
+    numLevels = CountLevels(width, height);
+
+    MeasureMemoryUsed();
+}
+
+/*
+ * Set levels
+ */
+void Texture2D::SetLevels(const GLvoid* pixels, int numLevels)
+{
+    assert(numLevels >= 1);
+    assert(IsLoaded());
+
+    Bind(0);
+
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // Offsets into a bound buffer are passed as pointers too
+    const GLubyte* level = (const GLubyte*)pixels;
+    GLsizei pixelSize = BytesPerPixel(imageFormat) * BytesPerComponent(dataType);
+    for (int i = 0; i < numLevels; i++)
+    {
+        int levelWidth  = width  >> i > 0 ? width  >> i : 1;
+        int levelHeight = height >> i > 0 ? height >> i : 1;
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            i,
+            internalFormat,
+            levelWidth,
+            levelHeight,
+            0,
+            imageFormat,
+            dataType,
+            level);
+        level += (size_t)levelWidth * levelHeight * pixelSize;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    this->numLevels = numLevels;
+
+    // Every level is present again
+    if (baseLevel != 0)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        baseLevel = 0;
+    }
+
+    if (numLevels == 1 &&
+        (minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+         minFilter == GL_NEAREST_MIPMAP_LINEAR  ||
+         minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
+         minFilter == GL_LINEAR_MIPMAP_LINEAR))
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+        this->numLevels = CountLevels(width, height);
+    }
+
+    MeasureMemoryUsed();
+}
+
+/*
+ * Set level
+ */
+void Texture2D::SetLevel(int level, const GLvoid* pixels, GLsizei compressedSize)
+{
+    assert(IsLoaded());
+    assert(level >= 0 && level < numLevels);
+
+    Bind(0);
+
+    int levelWidth  = width  >> level > 0 ? width  >> level : 1;
+    int levelHeight = height >> level > 0 ? height >> level : 1;
+    if (IsCompressed())
+    {
+        glCompressedTexImage2D(
+            GL_TEXTURE_2D,
+            level,
+            internalFormat,
+            levelWidth,
+            levelHeight,
+            0,
+            compressedSize,
+            pixels);
+    }
+    else
+    {
+        GLint alignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            level,
+            internalFormat,
+            levelWidth,
+            levelHeight,
+            0,
+            imageFormat,
+            dataType,
+            pixels);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    }
+
+    MeasureMemoryUsed();
+}
+
+/*
+ * Set sub image
+ */
+void Texture2D::SetSubImage(int level, int x, int y, int width, int height, const GLvoid* pixels)
+{
+    assert(IsLoaded());
+    assert(level >= 0 && level < numLevels && !IsCompressed());
+
+    Bind(0);
+
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glTexSubImage2D(
+        GL_TEXTURE_2D,
+        level,
+        x,
+        y,
+        width,
+        height,
+        imageFormat,
+        dataType,
+        pixels);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+}
+
+/*
+ * Set base level
+ */
+void Texture2D::SetBaseLevel(int level)
+{
+    assert(IsLoaded());
+    assert(level >= 0 && level < numLevels);
+
+    Bind(0);
+
+    // The base level is moved before releasing anything, so the texture
+    // stays complete throughout
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+
+    // An empty image frees the storage of a level
+    for (int i = baseLevel; i < level; i++)
+    {
+        if (IsCompressed())
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat, 0, 0, 0, 0, NULL);
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, i, internalFormat, 0, 0, 0, imageFormat, dataType, NULL);
+        }
+    }
+    baseLevel = level;
+
+    MeasureMemoryUsed();
+}
+
 /*
  * Init texture object
  */
@@ -260,23 +706,131 @@ void Texture2D::InitTextureObject(const GLvoid* pixels)
          minFilter == GL_LINEAR_MIPMAP_NEAREST  ||
          minFilter == GL_LINEAR_MIPMAP_LINEAR))
     {
-        glGenerateMipmap(GL_TEXTURE_2D);
+        numLevels = CountLevels(width, height);
+
+        // 8-bit images get gamma-correct levels built on the CPU, anything
+        // else is left to the driver
+        if (dataType == GL_UNSIGNED_BYTE && MipmapBuilder::IsEnabled())
+        {
+            const GLubyte* faces[] = { (const GLubyte*)pixels };
+            MipmapBuilder::Chain* chain = MipmapBuilder::BuildCached(
+                faces, 1, BytesPerPixel(imageFormat), width, height);
+            chain->Upload(GL_TEXTURE_2D, 0, internalFormat, imageFormat);
+            delete chain;
+        }
+        else
+        {
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
     }
+
+    MeasureMemoryUsed();
 }
 
 /*
- * Set texture parameters
+ * Init texture object from compressed image
  */
-void Texture2D::SetTextureParams()
+void Texture2D::InitTextureObject(const CompressedImage& image)
 {
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+    for (int level = 0; level < image.GetNumLevels(); level++)
+    {
+        const CompressedImage::Level& info = image.GetLevel(level);
+        glCompressedTexImage2D(
+            GL_TEXTURE_2D,
+            level,
+            internalFormat,
+            info.width,
+            info.height,
+            0,
+            info.size,
+            image.GetLevelData(level));
+    }
 
-    // Set aniso level if enabled
-    if (aniso > 1.0f)
+    // Levels past the last one in the image are never sampled, so the
+    // texture is complete even without a full chain
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.GetNumLevels() - 1);
+    numLevels = image.GetNumLevels();
+
+    MeasureMemoryUsed();
+}
+
+/*
+ * Load compressed image
+ */
+void Texture2D::LoadCompressedImage(const CompressedImage* image)
+{
+    if (image != NULL && image->IsValid() && image->GetNumFaces() == 1 &&
+        CompressedImage::IsFormatSupported(image->GetFormat()))
+    {
+        width          = image->GetWidth();
+        height         = image->GetHeight();
+        internalFormat = image->GetFormat();
+        imageFormat    = GL_NONE;
+        dataType       = GL_NONE;
+        InitTextureObject(*image);
+        return;
+    }
+
+    // Images that couldn't be read were already reported
+    if (image != NULL && image->IsValid() && image->GetNumFaces() == 6)
     {
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
+        std::cerr << "A cube map can't be loaded as a 2D texture" << std::endl;
     }
+    else if (image != NULL && image->IsValid())
+    {
+        std::cerr << "Compressed texture format 0x" << std::hex << image->GetFormat()
+            << std::dec << " is not supported" << std::endl;
+    }
+
+    GLubyte* data  = ErrorTexture(&width, &height, &imageFormat);
+    internalFormat = imageFormat;
+    dataType       = GL_UNSIGNED_BYTE;
+    InitTextureObject(data);
+    free(data);
+}
+
+/*
+ * Init placeholder
+ */
+void Texture2D::InitPlaceholder(const std::shared_ptr<LazyLoad>& load)
+{
+    // A single grey texel is complete for any filter, so nothing is loaded
+    // until the texture is needed
+    static const GLubyte placeholder[] = { 128, 128, 128, 255 };
+    width          = 1;
+    height         = 1;
+    imageFormat    = GL_RGBA;
+    internalFormat = imageFormat;
+    dataType       = GL_UNSIGNED_BYTE;
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, imageFormat, dataType, placeholder);
+    MeasureMemoryUsed();
+
+    lazyLoad = load;
+    SetLoadOnBind(true);
+}
+
+/*
+ * Count levels
+ */
+int Texture2D::CountLevels(int width, int height)
+{
+    int largest = width > height ? width : height;
+    int levels = 1;
+    while (largest >> levels > 0)
+    {
+        levels++;
+    }
+    return levels;
+}
+
+/*
+ * Get sampler parameters
+ */
+void Texture2D::GetSamplerParams(SamplerParams& params) const
+{
+    params.minFilter = minFilter;
+    params.magFilter = magFilter;
+    params.wrapS     = wrapS;
+    params.wrapT     = wrapT;
+    params.aniso     = aniso;
 }
@@ -0,0 +1,8 @@
+// Per-draw object data, one slice of the draw ring buffer per object
+layout(std140) uniform DrawData
+{
+  mat4 model;
+  mat3 normalMatrix;
+  mat3 materialProperties;
+  float shininess;
+};
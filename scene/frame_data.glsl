@@ -0,0 +1,8 @@
+// Per-frame camera and lighting data, shared by all shader programs
+layout(std140) uniform FrameData
+{
+  mat4 view;
+  mat4 projection;
+  vec4 lightPosition;
+  mat3 lightProperties;
+};
@@ -1,9 +1,7 @@
 #version 150
 
-uniform mat3 materialProperties;
-uniform mat3 lightProperties;
-uniform float shininess;
-uniform bool useHalfVector;
+#include "draw_data.glsl"
+#include "frame_data.glsl"
 
 in vec3 fN;
 in vec3 fL;
@@ -51,15 +49,12 @@ void main()
   vec4 is = vec4(0.0, 0.0, 0.0, 1.0);  
   if (dot(L, N) >= 0.0) 
   {
-    float specularFactor;
-    if (useHalfVector)
-    {
-      specularFactor = pow(max(dot(N, h), 0.0), shininess);    
-    }
-    else
-    {
-      specularFactor = pow(max(dot(R, V), 0.0), shininess);
-    }
+    // Selected when the shader is compiled, define USE_HALF_VECTOR for N dot h
+#ifdef USE_HALF_VECTOR
+    float specularFactor = pow(max(dot(N, h), 0.0), shininess);
+#else
+    float specularFactor = pow(max(dot(R, V), 0.0), shininess);
+#endif
     is = specularFactor * specularColor;
   }
   
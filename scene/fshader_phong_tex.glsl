@@ -1,10 +1,10 @@
 #version 150
 
-uniform mat3 materialProperties;
-uniform mat3 lightProperties;
-uniform float shininess;
 uniform sampler2D texture;
 
+#include "draw_data.glsl"
+#include "frame_data.glsl"
+
 in vec3 fN;
 in vec3 fL;
 in vec3 fV;
@@ -0,0 +1,15 @@
+// Per-instance object data for instanced draws, indexed by gl_InstanceID
+#define MAX_INSTANCES 16
+
+struct Instance
+{
+  mat4 model;
+  mat3 normalMatrix;
+  vec4 texCoordTransform; // offset in xy, scale in zw
+  float layer;
+};
+
+layout(std140) uniform InstanceData
+{
+  Instance instances[MAX_INSTANCES];
+};
@@ -1,3 +1,4 @@
+#include <cassert>
 #include <Angel.h>
 #include <sphere.h>
 #include <images.h>
@@ -8,23 +9,198 @@
 #include <ObjFile.h>
 #include <TextureCube.h>
 #include <Texture2D.h>
+#include <Texture2DArray.h>
+#include <TextureAtlas.h>
+#include <ProgramPipeline.h>
+#include <ShaderPermutations.h>
+#include <UniformBuffer.h>
+#include <BlockCompressor.h>
+#include <CompressedImage.h>
+#include <ResourceRegistry.h>
+#include <MipmapBuilder.h>
+#include <TextureUploader.h>
+#include <TextureResidency.h>
+#include <TgaDecoder.h>
+#include <stb_image.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
 
 VertexArray* skyboxVao;
 VertexArray* asteroidVao;
 VertexArray* planetVao;
 VertexArray* starcruiserVao;
 
-Texture2D* planetTexture;
-Texture2D* moonTexture;
+// Textures and shaders come from the resource registry, which shares
+// anything requested more than once and frees it with the last handle
+ResourceRegistry::Handle<Texture2D> planetTexture;
+ResourceRegistry::Handle<Texture2D> moonTexture;
 
-Shader* skyboxShader;
-Shader* lightShader;
-Shader* texShader;
+// The planet and moon images packed into one texture array, and where each
+// image ended up in it
+TextureAtlas* sphereAtlas;
+Texture2DArray* sphereTexture;
+int planetImage;
+int moonImage;
+
+ResourceRegistry::Handle<Shader> skyboxShader;
+
+// The phong shaders are separable stages combined in one pipeline, so the
+// vertex stage is linked once and shared by both fragment stages
+ResourceRegistry::Handle<Shader> phongVertexShader;
+Shader* lightShader; // fragment stage
+ResourceRegistry::Handle<Shader> texShader; // fragment stage
+ProgramPipeline* phongPipeline;
+
+// Stages for drawing every textured sphere at once, with each instance
+// picking its transform and texture layer by gl_InstanceID
+ResourceRegistry::Handle<Shader> instancedVertexShader; // vertex stage
+ResourceRegistry::Handle<Shader> texArrayShader; // fragment stage
 
 Camera* camera;
 CameraControl* cameraControl;
 
-TextureCube* skyboxTexture;
+ResourceRegistry::Handle<TextureCube> skyboxTexture;
+
+// Binding point of the FrameData uniform block in every shader
+const GLuint frameDataBinding = 0;
+
+// Camera and lighting data shared by all shaders, written once per frame
+UniformBuffer* frameData;
+Std140Layout frameDataLayout;
+
+// Offsets of the FrameData members within the block
+struct FrameDataOffsets
+{
+	GLintptr view;
+	GLintptr projection;
+	GLintptr lightPosition;
+	GLintptr lightProperties;
+} frameDataOffsets;
+
+// Binding point of the DrawData uniform block in the phong shaders
+const GLuint drawDataBinding = 1;
+
+// Per-object data for every draw in a frame, uploaded in one write
+UniformRingBuffer* drawData;
+Std140Layout drawDataLayout;
+GLsizeiptr drawDataSize;
+
+// Offsets of the DrawData members within the block
+struct DrawDataOffsets
+{
+	GLintptr model;
+	GLintptr normalMatrix;
+	GLintptr materialProperties;
+	GLintptr shininess;
+} drawDataOffsets;
+
+// Binding point of the InstanceData uniform block in the instanced shader
+const GLuint instanceDataBinding = 2;
+
+// Most instances in one instanced draw, MAX_INSTANCES in instance_data.glsl
+const int maxInstances = 16;
+
+// Transforms and atlas rectangles of the spheres, pushed to drawData as
+// one block per instanced draw
+Std140Layout instanceDataLayout;
+GLsizeiptr instanceDataSize;
+
+// Offsets of the members of the first Instance, and the distance between
+// instances
+struct InstanceDataOffsets
+{
+	GLintptr model;
+	GLintptr normalMatrix;
+	GLintptr texCoordTransform;
+	GLintptr layer;
+	GLintptr stride;
+} instanceDataOffsets;
+
+// A draw recorded for the current frame, with its slice of drawData
+struct DrawCall
+{
+	Shader* vertexShader;
+	Shader* shader; // fragment stage
+	VertexArray* vao;
+	Texture* texture; // NULL for untextured objects
+	Shader::UniformHandle textureUniform;
+	GLintptr drawData;
+	int instanceCount; // 0 for a single object
+	GLintptr instanceData;
+};
+std::vector<DrawCall> drawCalls;
+
+// Number of objects in this frame's draws, which is more than the number of
+// draws when objects are batched
+size_t numObjectsDrawn;
+
+// A sphere waiting to be drawn with the others in one instanced draw
+struct SphereInstance
+{
+	mat4 model;
+	int image; // in sphereAtlas
+};
+std::vector<SphereInstance> sphereInstances;
+
+// Uniform handles for the skybox shader, resolved once in initShaders
+struct SkyboxUniforms
+{
+	Shader::UniformHandle textureCube;
+	Shader::UniformHandle model;
+} skyboxUniforms;
+
+// Uniform handles for the textured phong shader, resolved once in initShaders
+struct PhongUniforms
+{
+	Shader::UniformHandle texture;
+} texUniforms, texArrayUniforms;
+
+// Variants of the untextured phong fragment stage.  lightShader is one of these
+ShaderPermutations* lightPermutations;
+
+// Whether lightShader uses the half vector for specular highlights
+bool useHalfVector = false;
+
+// Whether to submit all shaders before waiting for any of them.  Turn off
+// to compare startup time with building each shader in turn
+bool asyncShaderBuild = true;
+
+// Whether the first frame has been drawn, for timing startup
+bool firstFrameDrawn = false;
+
+// Whether to load the planet and moon textures block-compressed.  Turn off
+// to compare video memory use with uncompressed textures, which are then
+// decoded in the background while the first frames are drawn
+bool compressTextures = true;
+
+// Whether to pack the planet and moon textures into one texture array and
+// draw both spheres with a single instanced draw.  The residency manager
+// only streams the levels of separate textures, so the array stays fully
+// resident; turn off to draw the spheres separately and watch their levels
+// stream in and out
+bool batchSpheres = true;
+
+// Whether the planet and moon textures start out as a placeholder and have
+// their images decoded in the background once they are needed, so startup
+// doesn't wait on them.  Compressed textures are read from their cached
+// .ktx files, or compressed on the first run, in the background as well.
+// Not used when they are batched.  Turn off to compare with loading each
+// image before the texture can be drawn
+bool lazyTextures = true;
+
+// Gets the defines for the current lighting options
+Shader::Defines getLightDefines(bool halfVector)
+{
+	Shader::Defines defines;
+	if (halfVector)
+	{
+		defines.push_back("USE_HALF_VECTOR");
+	}
+	return defines;
+}
 
 GLfloat alphaAsteroid;
 GLfloat alphaPlanet;
@@ -72,19 +248,241 @@ mat3 light = mat3(
   vec3(1.0, 1.0, 1.0),
   vec3(1.0, 1.0, 1.0));
 
+// Gets a BC1 copy of an image.  The copy is made the first time and kept
+// next to the image as a .ktx file; delete it to rebuild it.  Returns NULL
+// if the image can't be decoded.  May run on the thread pool
+CompressedImage* loadCompressedImage(const std::string& filename)
+{
+	const GLenum format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	std::string cacheName = filename.substr(0, filename.rfind('.')) + ".ktx";
+	if (std::ifstream(cacheName.c_str()))
+	{
+		CompressedImage* image = new CompressedImage(cacheName.c_str());
+		if (image->IsValid() && image->GetNumFaces() == 1)
+		{
+			return image;
+		}
+		delete image;
+	}
+
+	int width, height, components, flipPass;
+	GLubyte* pixels = stbi_load_bottom_up(filename.c_str(), &width, &height, &components, 3, &flipPass);
+	if (pixels == NULL)
+	{
+		return NULL;
+	}
+	CompressedImage* image = BlockCompressor::CompressWithMipmaps(pixels, 3, width, height, format);
+	stbi_image_free(pixels);
+	image->SaveKTX(cacheName.c_str());
+	return image;
+}
+
+// Creates a texture from a BC1 copy of the image.  A lazy texture reads or
+// makes the copy in the background, so even the first run doesn't wait to
+// compress it
+Texture2D* createCompressedTexture(const char* filename)
+{
+	std::string path = filename;
+	if (lazyTextures)
+	{
+		return new Texture2D([path]()
+		{
+			CompressedImage* image = loadCompressedImage(path);
+			if (image == NULL)
+			{
+				std::cerr << "Unable to load image file " << path << std::endl;
+			}
+			return image;
+		});
+	}
+
+	// The texture reports the image that can't be decoded
+	CompressedImage* image = loadCompressedImage(path);
+	if (image == NULL)
+	{
+		return new Texture2D(filename);
+	}
+	Texture2D* texture = new Texture2D(*image);
+	delete image;
+	return texture;
+}
+
+// Gets a texture through the resource registry, compressed if enabled
+ResourceRegistry::Handle<Texture2D> loadTexture(const char* filename)
+{
+	if (!compressTextures || strrchr(filename, '.') == NULL ||
+		!CompressedImage::IsFormatSupported(GL_COMPRESSED_RGB_S3TC_DXT1_EXT))
+	{
+		if (lazyTextures)
+		{
+			std::string path = ResourceRegistry::GetCanonicalPath(filename);
+			std::string key = "Texture2D.lazy|" + (path.empty() ? std::string(filename) : path);
+			return ResourceRegistry::Load<Texture2D>(key, [filename]()
+			{
+				return new Texture2D(filename, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR,
+					GL_REPEAT, GL_REPEAT, 1.0f, true);
+			});
+		}
+		return ResourceRegistry::LoadTexture2D(filename, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR,
+			GL_REPEAT, GL_REPEAT, 1.0f, true);
+	}
+
+	std::string path = ResourceRegistry::GetCanonicalPath(filename);
+	std::string key = "Texture2D.bc1|" + (path.empty() ? std::string(filename) : path);
+	return ResourceRegistry::Load<Texture2D>(key, [filename]()
+	{
+		return createCompressedTexture(filename);
+	});
+}
+
+// Packs the planet and moon images into the layers of one texture array,
+// block-compressed if enabled.  Falls back to a texture each if neither
+// image could be added
+void loadSphereAtlas()
+{
+	sphereAtlas = new TextureAtlas(GL_RGB, 2048, 4);
+	planetImage = sphereAtlas->AddFile("images/planet.tga");
+	moonImage   = sphereAtlas->AddFile("images/moon.tga");
+	if (sphereAtlas->GetNumImages() == 0)
+	{
+		batchSpheres = false;
+		return;
+	}
+	sphereAtlas->Pack();
+
+	GLenum format = GL_NONE;
+	if (compressTextures && CompressedImage::IsFormatSupported(GL_COMPRESSED_RGB_S3TC_DXT1_EXT))
+	{
+		format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	}
+	sphereTexture = sphereAtlas->CreateTexture(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, 1.0f, format);
+
+	std::cout << "Sphere atlas: " << sphereAtlas->GetNumImages() << " images in "
+		<< sphereAtlas->GetNumPages() << " layer(s) of " << sphereAtlas->GetPageWidth()
+		<< "x" << sphereAtlas->GetPageHeight() << ", "
+		<< (int)(100.0f * sphereAtlas->GetEfficiency()) << "% covered by images" << std::endl;
+}
+
+// Hands a sphere's texture to the residency manager the first time it is
+// drawn, then reports how large the texture appears on screen.  The texture
+// wraps once around the sphere, so its width spans the circumference
+void requestResidency(Texture2D* texture, const char* filename, const mat4& model, float radius)
+{
+	// A lazy texture only has its levels once its image is swapped in
+	if (!texture->IsLoaded())
+	{
+		return;
+	}
+
+	// Compressed textures stream their levels back from the cached KTX file
+	std::string source = filename;
+	if (texture->IsCompressed())
+	{
+		source = std::string(filename, strrchr(filename, '.')) + ".ktx";
+	}
+	TextureResidency::Add(texture, source.c_str());
+
+	vec4 center = model * vec4(0.0, 0.0, 0.0, 1.0);
+	float distance = length(vec3(center.x, center.y, center.z) - camera->GetPosition());
+	float screenSize = TextureResidency::GetScreenSize(2.0f * M_PI * radius, distance,
+		camera->GetFieldOfView(), glutGet(GLUT_WINDOW_HEIGHT));
+	TextureResidency::Request(texture, screenSize);
+}
+
+// Prints how many resources the registry shared and the memory it saved
+void printResourceStats()
+{
+	// Textures still loading in the background have no size to report yet
+	bool spheresLoaded = batchSpheres ||
+		(planetTexture.IsReady() && moonTexture.IsReady() &&
+		 planetTexture->IsLoaded() && moonTexture->IsLoaded());
+	if (spheresLoaded)
+	{
+		// The textures are left uncompressed when compression is off or the
+		// driver can't decode S3TC, so the label comes from the textures
+		GLsizeiptr sphereMemory = batchSpheres ? sphereTexture->GetMemoryUsed() :
+			planetTexture->GetMemoryUsed() + moonTexture->GetMemoryUsed();
+		bool compressed = batchSpheres ? sphereTexture->IsCompressed() :
+			planetTexture->IsCompressed() && moonTexture->IsCompressed();
+		std::cout << "Planet and moon textures use " << sphereMemory / 1024
+			<< (compressed ? " KB (compressed)" : " KB (uncompressed)") << ", all textures "
+			<< Texture::GetTotalMemoryUsed() / 1024 << " KB" << std::endl;
+	}
+	else
+	{
+		std::cout << "Planet and moon textures are still loading" << std::endl;
+	}
+
+	std::cout << "Resources: " << ResourceRegistry::GetNumResources() << " loaded, "
+		<< ResourceRegistry::GetHits() << " requests shared, "
+		<< ResourceRegistry::GetMemorySaved() / 1024 << " KB of duplicates avoided" << std::endl;
+
+	const MipmapBuilder::Stats& mipStats = MipmapBuilder::GetStats();
+	std::cout << "Mip chains: " << mipStats.built << " built in " << mipStats.buildMilliseconds
+		<< " ms, " << mipStats.cacheHits << " loaded from cache in "
+		<< mipStats.loadMilliseconds << " ms" << std::endl;
+
+	const TextureUploader::Stats& uploadStats = TextureUploader::GetStats();
+	std::cout << "Texture uploads: " << uploadStats.uploaded << " streamed, "
+		<< uploadStats.bytesUploaded / 1024 << " KB, at most "
+		<< uploadStats.peakFrameBytes / 1024 << " KB started in a frame, "
+		<< uploadStats.deferred << " deferred by the budget" << std::endl;
+
+	const TextureResidency::Stats& residencyStats = TextureResidency::GetStats();
+	std::cout << "Texture residency: " << TextureResidency::GetNumTextures() << " textures, "
+		<< residencyStats.residentBytes / 1024 << " KB resident of a "
+		<< TextureResidency::GetBudget() / 1024 << " KB budget, "
+		<< residencyStats.levelsLoaded << " levels streamed in, "
+		<< residencyStats.levelsReleased << " released" << std::endl;
+}
+
 void initTextures()
 {
-	// Constructor sets up cube map with default sampling paramaters
-	skyboxTexture = new TextureCube(
+	// Constructor sets up cube map with default sampling paramaters.
+	// The six faces are decoded in parallel
+	// Mip levels are built on the CPU the first time and read back after
+	MipmapBuilder::SetCacheDirectory("mip_cache");
+
+	// Tight enough that the planet and moon only keep their finest levels
+	// while the camera is close to them, when they aren't batched
+	TextureResidency::SetBudget(1024 * 1024);
+
+	int start = glutGet(GLUT_ELAPSED_TIME);
+	skyboxTexture = ResourceRegistry::LoadTextureCube(
 		"images/pos_x.tga",
         "images/neg_x.tga",
         "images/pos_y.tga",
         "images/neg_y.tga",
         "images/pos_z.tga",
         "images/neg_z.tga");
+	std::cout << "Skybox loaded in " << glutGet(GLUT_ELAPSED_TIME) - start
+		<< " ms" << std::endl;
+
+	if (batchSpheres)
+	{
+		loadSphereAtlas();
+	}
+	if (!batchSpheres)
+	{
+		planetTexture = loadTexture("images/planet.tga");
+		moonTexture   = loadTexture("images/moon.tga");
+
+		// Both are in view from the start, so lazy textures start decoding
+		// now, alongside the shader builds, instead of at their first bind.
+		// Textures still loading through the registry aren't created yet
+		if (planetTexture.IsReady())
+		{
+			planetTexture->Prefetch();
+		}
+		if (moonTexture.IsReady())
+		{
+			moonTexture->Prefetch();
+		}
+	}
 
-	planetTexture = new Texture2D("images/planet.tga");
-	moonTexture   = new Texture2D("images/moon.tga");
+	// Images are decoded bottom-up instead of being flipped afterwards
+	std::cout << "Decoded " << Texture::GetBytesLoaded() / 1024 << " KB of images, "
+		<< Texture::GetFlipBytesSaved() / 1024 << " KB of flip copies avoided" << std::endl;
 }
 
 void initCamera()
@@ -101,42 +499,161 @@ void initCamera()
 
 void initShaders()
 {
-	skyboxShader = new Shader("vshader_cube_tex.glsl", "fshader_cube_tex.glsl");
-	lightShader  = new Shader("vshader_phong.glsl", "fshader_phong.glsl");
-	texShader    = new Shader("vshader_phong.glsl", "fshader_phong_tex.glsl");
+	// Every program reads its FrameData block from the same buffer
+	Shader::SetUniformBlockBinding("FrameData", frameDataBinding);
+	Shader::SetUniformBlockBinding("DrawData", drawDataBinding);
+	Shader::SetUniformBlockBinding("InstanceData", instanceDataBinding);
+
+	// Reuse the program binaries from the last run when nothing changed
+	Shader::SetProgramCacheDirectory("shader_cache");
+	Shader::ResetProgramCacheStats();
+
+	// Submit every program before checking any of them, so the driver can
+	// build them side by side instead of one after another
+	int start = glutGet(GLUT_ELAPSED_TIME);
+	Shader::SetAsyncCompile(asyncShaderBuild);
+
+	skyboxShader = ResourceRegistry::LoadShader("vshader_cube_tex.glsl", "fshader_cube_tex.glsl");
+	phongVertexShader = ResourceRegistry::LoadShader(GL_VERTEX_SHADER, "vshader_phong.glsl");
+	lightPermutations = new ShaderPermutations(GL_FRAGMENT_SHADER, "fshader_phong.glsl");
+	lightShader  = lightPermutations->Get(getLightDefines(useHalfVector));
+	texShader    = ResourceRegistry::LoadShader(GL_FRAGMENT_SHADER, "fshader_phong_tex.glsl");
+	instancedVertexShader = ResourceRegistry::LoadShader(GL_VERTEX_SHADER, "vshader_phong_instanced.glsl");
+	texArrayShader = ResourceRegistry::LoadShader(GL_FRAGMENT_SHADER, "fshader_phong_tex_array.glsl");
+
+	// The other lighting variant is only needed once toggled, so it is
+	// submitted now but left to finish in idle time
+	lightPermutations->Prefetch(getLightDefines(!useHalfVector));
+	if (asyncShaderBuild)
+	{
+		lightPermutations->CompilePending(1);
+	}
+	int submitted = glutGet(GLUT_ELAPSED_TIME) - start;
+
+	// Only the shaders drawn in the first frame are waited for
+	skyboxShader->WaitUntilBuilt();
+	phongVertexShader->WaitUntilBuilt();
+	lightShader->WaitUntilBuilt();
+	texShader->WaitUntilBuilt();
+	instancedVertexShader->WaitUntilBuilt();
+	texArrayShader->WaitUntilBuilt();
+	int built = glutGet(GLUT_ELAPSED_TIME) - start;
+
+	std::cout << "Shaders submitted in " << submitted << " ms, ready in "
+		<< built << " ms (" << (asyncShaderBuild ? "async" : "sync") << " build, "
+		<< (Shader::IsParallelCompileSupported() ? "parallel" : "serial")
+		<< " driver compile)" << std::endl;
+
+	phongPipeline = new ProgramPipeline();
+	phongPipeline->SetStage(phongVertexShader.Get());
+
+	const Shader::ProgramCacheStats& cacheStats = Shader::GetProgramCacheStats();
+	std::cout << "Shader programs: " << cacheStats.hits << " loaded from cache in "
+		<< cacheStats.loadMilliseconds << " ms, " << cacheStats.misses
+		<< " compiled in " << cacheStats.compileMilliseconds << " ms ("
+		<< cacheStats.stagesCompiled << " stages compiled, "
+		<< cacheStats.stagesShared << " shared)" << std::endl;
+
+	skyboxUniforms.textureCube = skyboxShader->GetUniformHandle("textureCube");
+	skyboxUniforms.model       = skyboxShader->GetUniformHandle("model");
+
+	texUniforms.texture         = texShader->GetUniformHandle("texture");
+	texArrayUniforms.texture    = texArrayShader->GetUniformHandle("textureArray");
+
+	// Lay out the FrameData block in the order it is declared in the shaders
+	frameDataOffsets.view            = frameDataLayout.Add(camera->GetView());
+	frameDataOffsets.projection      = frameDataLayout.Add(camera->GetProjection());
+	frameDataOffsets.lightPosition   = frameDataLayout.Add(lightPosition);
+	frameDataOffsets.lightProperties = frameDataLayout.Add(light);
+	assert(frameDataLayout.GetSize() == phongVertexShader->GetUniformBlockSize("FrameData"));
+
+	frameData = new UniformBuffer(frameDataLayout.GetSize());
+	frameData->Bind(frameDataBinding);
+
+	// Lay out the DrawData block, and check it against what the compiler
+	// chose for all of the phong stages
+	drawDataOffsets.model              = drawDataLayout.Add(mat4());
+	drawDataOffsets.normalMatrix       = drawDataLayout.Add(mat3());
+	drawDataOffsets.materialProperties = drawDataLayout.Add(mat3());
+	drawDataOffsets.shininess          = drawDataLayout.Add(0.0f);
+	drawDataSize = phongVertexShader->GetUniformBlockSize("DrawData");
+	assert(drawDataLayout.GetSize() == drawDataSize);
+	assert(lightShader->GetUniformBlockSize("DrawData") == drawDataSize);
+	assert(texShader->GetUniformBlockSize("DrawData") == drawDataSize);
+	assert(lightShader->GetUniformBlockOffset("shininess") == drawDataOffsets.shininess);
+	assert(texArrayShader->GetUniformBlockSize("DrawData") == drawDataSize);
+
+	// Lay out the InstanceData block, an array of Instance structs.  Each
+	// struct is padded to a multiple of 16 bytes, which the sequential
+	// adds reproduce
+	for (int i = 0; i < maxInstances; i++)
+	{
+		GLintptr model = instanceDataLayout.Add(mat4());
+		GLintptr normalMatrix = instanceDataLayout.Add(mat3());
+		GLintptr texCoordTransform = instanceDataLayout.Add(vec4());
+		GLintptr layer = instanceDataLayout.Add(0.0f);
+		if (i == 0)
+		{
+			instanceDataOffsets.model             = model;
+			instanceDataOffsets.normalMatrix      = normalMatrix;
+			instanceDataOffsets.texCoordTransform = texCoordTransform;
+			instanceDataOffsets.layer             = layer;
+		}
+		else if (i == 1)
+		{
+			instanceDataOffsets.stride = model - instanceDataOffsets.model;
+		}
+	}
+	instanceDataSize = instancedVertexShader->GetUniformBlockSize("InstanceData");
+	assert(instanceDataLayout.GetSize() == instanceDataSize);
+
+	// Room for a few frames of draws before the ring wraps
+	drawData = new UniformRingBuffer(64 * 1024);
+}
+
+// Writes this frame's camera and lighting data to the shared uniform buffer
+void updateFrameData()
+{
+	frameDataLayout.Set(frameDataOffsets.view, camera->GetView());
+	frameDataLayout.Set(frameDataOffsets.projection, camera->GetProjection());
+	frameDataLayout.Set(frameDataOffsets.lightPosition, lightPosition);
+	frameDataLayout.Set(frameDataOffsets.lightProperties, light);
+	frameData->SetData(frameDataLayout.GetData(), frameDataLayout.GetSize());
 }
 
 void initSkybox()
 {
 	// VAO for skybox
+	// The model is only needed until its vertices are uploaded, so the
+	// handle is dropped at the end of the function
 	skyboxVao = new VertexArray();
-	ObjFile m("models/cube_tex.obj");   
-    skyboxVao->AddAttribute("vPosition", m.GetVertices(), m.GetNumVertices());
-    skyboxVao->AddIndices(m.GetIndices(), m.GetNumIndices());
+	ResourceRegistry::Handle<ObjFile> m = ResourceRegistry::LoadObjFile("models/cube_tex.obj");
+    skyboxVao->AddAttribute("vPosition", m->GetVertices(), m->GetNumVertices());
+    skyboxVao->AddIndices(m->GetIndices(), m->GetNumIndices());
 }
 
 void initModels()
 {
 	// VAO for asteroid
 	asteroidVao = new VertexArray();
-	ObjFile m("models/asteroid.obj");
-	asteroidVao->AddAttribute("vPosition", m.GetVertices(), m.GetNumVertices());
-	asteroidVao->AddAttribute("vNormal", m.GetNormals(), m.GetNumVertices());
-	asteroidVao->AddIndices(m.GetIndices(), m.GetNumIndices());
+	ResourceRegistry::Handle<ObjFile> m = ResourceRegistry::LoadObjFile("models/asteroid.obj");
+	asteroidVao->AddAttribute("vPosition", m->GetVertices(), m->GetNumVertices());
+	asteroidVao->AddAttribute("vNormal", m->GetNormals(), m->GetNumVertices(), VertexArray::PACK_INT_2_10_10_10);
+	asteroidVao->AddIndices(m->GetIndices(), m->GetNumIndices());
 
 	// Vao for planet
 	planetVao = new VertexArray();
 	Sphere s(16, true);
 	planetVao->AddAttribute("vPosition", s.GetVertices(), s.GetNumVertices());
-	planetVao->AddAttribute("vTexCoord", s.GetTexCoords(), s.GetNumVertices());
-	planetVao->AddAttribute("vNormal", s.GetNormals(), s.GetNumVertices());
+	planetVao->AddAttribute("vTexCoord", s.GetTexCoords(), s.GetNumVertices(), VertexArray::PACK_HALF_FLOAT);
+	planetVao->AddAttribute("vNormal", s.GetNormals(), s.GetNumVertices(), VertexArray::PACK_INT_2_10_10_10);
 
 	// Vao for starcruiser
 	starcruiserVao = new VertexArray();
-	ObjFile starcruiser("models/starcruiser.obj");
-	starcruiserVao->AddAttribute("vPosition", starcruiser.GetVertices(), starcruiser.GetNumVertices());
-	starcruiserVao->AddAttribute("vNormal", starcruiser.GetNormals(), starcruiser.GetNumVertices());
-	starcruiserVao->AddIndices(starcruiser.GetIndices(), starcruiser.GetNumIndices());
+	ResourceRegistry::Handle<ObjFile> starcruiser = ResourceRegistry::LoadObjFile("models/starcruiser.obj");
+	starcruiserVao->AddAttribute("vPosition", starcruiser->GetVertices(), starcruiser->GetNumVertices());
+	starcruiserVao->AddAttribute("vNormal", starcruiser->GetNormals(), starcruiser->GetNumVertices(), VertexArray::PACK_INT_2_10_10_10);
+	starcruiserVao->AddIndices(starcruiser->GetIndices(), starcruiser->GetNumIndices());
 }
 
 void init()
@@ -146,6 +663,7 @@ void init()
 	initShaders();
 	initSkybox();
 	initModels();
+	printResourceStats();
 
 	glEnable( GL_DEPTH_TEST );
     glClearColor( 1.0, 1.0, 1.0, 1.0 ); 
@@ -161,11 +679,8 @@ void drawSkybox()
 	skyboxTexture->Bind(1);
 
 	skyboxShader->Bind();
-    skyboxShader->SetUniform("textureCube", 0);
-    skyboxShader->SetUniform("model",  Scale(20.0, 20.0, 20.0));
-    skyboxShader->SetUniform("view",  camera->GetView());
-    skyboxShader->SetUniform("projection", camera->GetProjection());
-    skyboxShader->SetUniform("textureCube", skyboxTexture->GetTextureUnit());
+    skyboxShader->SetUniform(skyboxUniforms.model,  Scale(20.0, 20.0, 20.0));
+    skyboxShader->SetUniform(skyboxUniforms.textureCube, skyboxTexture->GetTextureUnit());
     skyboxVao->Bind(*skyboxShader);
     skyboxVao->Draw(GL_TRIANGLES);
 
@@ -173,129 +688,141 @@ void drawSkybox()
     skyboxShader->Unbind();
 }
 
-void drawAsteroid(vec3 position, vec3 scale, Axis axis, float rotScale)
+// Computes the normal matrix of an object, the upper-left 3x3 of the
+// model-view matrix
+mat3 getNormalMatrix(const mat4& model)
 {
-	mat4 view = camera->GetView();
-	mat4 rotation;
-	if (axis == XAxis) rotation = RotateX(alphaAsteroid + rotScale);
-	else if (axis == YAxis) rotation = RotateY(alphaAsteroid + rotScale);
-	else rotation = RotateZ(alphaAsteroid + rotScale);
-
-	mat4 model = Scale(scale) * Translate(position) * rotation;
+	mat4 mv = camera->GetView() * model;
+	return mat3(vec3(mv[0][0], mv[0][1], mv[0][2]),
+	            vec3(mv[1][0], mv[1][1], mv[1][2]),
+	            vec3(mv[2][0], mv[2][1], mv[2][2]));
+}
 
-    mat4 mv = view * model;
-    mat3 normalMatrix = mat3(vec3(mv[0][0], mv[0][1], mv[0][2]),
-		                     vec3(mv[1][0], mv[1][1], mv[1][2]),
-                             vec3(mv[2][0], mv[2][1], mv[2][2]));
+// Pushes the per-object data of a draw to the ring buffer and records the
+// draw, which is issued later by drawModels
+void queueDraw(Shader* shader, VertexArray* vao, Texture* texture, const mat4& model,
+			   const mat3& materialProperties, GLfloat materialShininess)
+{
+	drawDataLayout.Set(drawDataOffsets.model, model);
+	drawDataLayout.Set(drawDataOffsets.normalMatrix, getNormalMatrix(model));
+	drawDataLayout.Set(drawDataOffsets.materialProperties, materialProperties);
+	drawDataLayout.Set(drawDataOffsets.shininess, materialShininess);
+
+	DrawCall draw = { phongVertexShader.Get(), shader, vao, texture, texUniforms.texture,
+		drawData->Push(drawDataLayout), 0, 0 };
+	drawCalls.push_back(draw);
+	numObjectsDrawn++;
+}
 
-	lightShader->Bind();
-    lightShader->SetUniform("model",  model);
-    lightShader->SetUniform("view",  view);
-    lightShader->SetUniform("projection", camera->GetProjection());
-	lightShader->SetUniform("normalMatrix", normalMatrix);
-	lightShader->SetUniform("lightPosition", lightPosition);
-	lightShader->SetUniform("materialProperties", material);
-	lightShader->SetUniform("lightProperties", light);
-	lightShader->SetUniform("shininess", shininess);
-	lightShader->SetUniform("useHalfVector", false);
+// Records a textured sphere to draw along with the others in queueSpheres
+void queueSphere(const mat4& model, int image)
+{
+	if (image < 0)
+	{
+		return;
+	}
 
-    asteroidVao->Bind(*lightShader);
-    asteroidVao->Draw(GL_TRIANGLES);
-    asteroidVao->Unbind();
-    lightShader->Unbind();
+	SphereInstance instance = { model, image };
+	sphereInstances.push_back(instance);
 }
 
-void drawPlanet()
+// Draws the recorded spheres with one instanced draw for every
+// maxInstances of them.  They share the mesh, the material and the texture
+// array, so only the per-instance block differs from one to the next
+void queueSpheres()
 {
-	mat4 view = camera->GetView();
-	mat4 rotation = Scale(1.0, 1.1, 1.0) * RotateY(alphaPlanet) * RotateX(90);
+	if (sphereInstances.empty())
+	{
+		return;
+	}
 
-	mat4 model = rotation;
+	drawDataLayout.Set(drawDataOffsets.model, mat4());
+	drawDataLayout.Set(drawDataOffsets.normalMatrix, mat3());
+	drawDataLayout.Set(drawDataOffsets.materialProperties, material);
+	drawDataLayout.Set(drawDataOffsets.shininess, shininess);
+	GLintptr materialData = drawData->Push(drawDataLayout);
 
-    mat4 mv = view * model;
-    mat3 normalMatrix = mat3(vec3(mv[0][0], mv[0][1], mv[0][2]),
-		                     vec3(mv[1][0], mv[1][1], mv[1][2]),
-                             vec3(mv[2][0], mv[2][1], mv[2][2]));
+	for (size_t first = 0; first < sphereInstances.size(); first += maxInstances)
+	{
+		int count = (int)std::min(sphereInstances.size() - first, (size_t)maxInstances);
+		for (int i = 0; i < count; i++)
+		{
+			const SphereInstance& instance = sphereInstances[first + i];
+			GLintptr offset = i * instanceDataOffsets.stride;
+			instanceDataLayout.Set(instanceDataOffsets.model + offset, instance.model);
+			instanceDataLayout.Set(instanceDataOffsets.normalMatrix + offset,
+				getNormalMatrix(instance.model));
+			instanceDataLayout.Set(instanceDataOffsets.texCoordTransform + offset,
+				sphereAtlas->GetTexCoordTransform(instance.image));
+			instanceDataLayout.Set(instanceDataOffsets.layer + offset,
+				(float)sphereAtlas->GetLayer(instance.image));
+		}
 
-	// Bind texture to a texture unit
-    planetTexture->Bind(1);
+		DrawCall draw = { instancedVertexShader.Get(), texArrayShader.Get(), planetVao,
+			sphereTexture, texArrayUniforms.texture, materialData, count,
+			drawData->Push(instanceDataLayout) };
+		drawCalls.push_back(draw);
+		numObjectsDrawn += count;
+	}
+	sphereInstances.clear();
+}
 
-	texShader->Bind();
-	texShader->SetUniform("texture", planetTexture->GetTextureUnit());
-    texShader->SetUniform("model",  model);
-    texShader->SetUniform("view",  view);
-    texShader->SetUniform("projection", camera->GetProjection());
-	texShader->SetUniform("normalMatrix", normalMatrix);
-	texShader->SetUniform("lightPosition", lightPosition);
-	texShader->SetUniform("materialProperties", material);
-	texShader->SetUniform("lightProperties", light);
-	texShader->SetUniform("shininess", shininess);
+void queueAsteroid(vec3 position, vec3 scale, Axis axis, float rotScale)
+{
+	mat4 rotation;
+	if (axis == XAxis) rotation = RotateX(alphaAsteroid + rotScale);
+	else if (axis == YAxis) rotation = RotateY(alphaAsteroid + rotScale);
+	else rotation = RotateZ(alphaAsteroid + rotScale);
 
-    planetVao->Bind(*texShader);
-    planetVao->Draw(GL_TRIANGLES);
-    planetVao->Unbind();
-    texShader->Unbind();
+	mat4 model = Scale(scale) * Translate(position) * rotation;
+	queueDraw(lightShader, asteroidVao, NULL, model, material, shininess);
 }
 
-void drawMoon()
+void queuePlanet()
 {
-	mat4 view = camera->GetView();
-	mat4 rotation = RotateY(alphaMoon) * RotateX(90);
+	// Skipped until the texture has finished loading in the background
+	if (!batchSpheres && !planetTexture.IsReady())
+	{
+		return;
+	}
 
-	mat4 model = rotation * Translate(2.0, -2.0, -1.0) * Scale(0.3, 0.3, 0.3);
+	mat4 rotation = Scale(1.0, 1.1, 1.0) * RotateY(alphaPlanet) * RotateX(90);
 
-    mat4 mv = view * model;
-    mat3 normalMatrix = mat3(vec3(mv[0][0], mv[0][1], mv[0][2]),
-		                     vec3(mv[1][0], mv[1][1], mv[1][2]),
-                             vec3(mv[2][0], mv[2][1], mv[2][2]));
+	mat4 model = rotation;
+	if (batchSpheres)
+	{
+		queueSphere(model, planetImage);
+		return;
+	}
+	requestResidency(planetTexture.Get(), "images/planet.tga", model, 1.0f);
+	queueDraw(texShader.Get(), planetVao, planetTexture.Get(), model, material, shininess);
+}
 
-	// Bind texture to a texture unit
-    moonTexture->Bind(1);
+void queueMoon()
+{
+	if (!batchSpheres && !moonTexture.IsReady())
+	{
+		return;
+	}
 
-	texShader->Bind();
-	texShader->SetUniform("texture", moonTexture->GetTextureUnit());
-    texShader->SetUniform("model",  model);
-    texShader->SetUniform("view",  view);
-    texShader->SetUniform("projection", camera->GetProjection());
-	texShader->SetUniform("normalMatrix", normalMatrix);
-	texShader->SetUniform("lightPosition", lightPosition);
-	texShader->SetUniform("materialProperties", material);
-	texShader->SetUniform("lightProperties", light);
-	texShader->SetUniform("shininess", shininess);
+	mat4 rotation = RotateY(alphaMoon) * RotateX(90);
 
-    planetVao->Bind(*texShader);
-    planetVao->Draw(GL_TRIANGLES);
-    planetVao->Unbind();
-    texShader->Unbind();
+	mat4 model = rotation * Translate(2.0, -2.0, -1.0) * Scale(0.3, 0.3, 0.3);
+	if (batchSpheres)
+	{
+		queueSphere(model, moonImage);
+		return;
+	}
+	requestResidency(moonTexture.Get(), "images/moon.tga", model, 0.3f);
+	queueDraw(texShader.Get(), planetVao, moonTexture.Get(), model, material, shininess);
 }
 
-void drawStarcruiser(vec3 position, vec3 scale)
+void queueStarcruiser(vec3 position, vec3 scale)
 {
-	mat4 view = camera->GetView();
 	mat4 rotation = RotateX(alphaMoon) * RotateZ(15.0);
 
 	mat4 model = Scale(scale) * Translate(position) * rotation;
-
-    mat4 mv = view * model;
-    mat3 normalMatrix = mat3(vec3(mv[0][0], mv[0][1], mv[0][2]),
-		                     vec3(mv[1][0], mv[1][1], mv[1][2]),
-                             vec3(mv[2][0], mv[2][1], mv[2][2]));
-
-	lightShader->Bind();
-    lightShader->SetUniform("model",  model);
-    lightShader->SetUniform("view",  view);
-    lightShader->SetUniform("projection", camera->GetProjection());
-	lightShader->SetUniform("normalMatrix", normalMatrix);
-	lightShader->SetUniform("lightPosition", lightPosition);
-	lightShader->SetUniform("materialProperties", cruiserMaterial);
-	lightShader->SetUniform("lightProperties", light);
-	lightShader->SetUniform("shininess", cruiserShininess);
-	lightShader->SetUniform("useHalfVector", false);
-
-    starcruiserVao->Bind(*lightShader);
-	starcruiserVao->Draw(GL_TRIANGLES);
-	starcruiserVao->Unbind();
-    lightShader->Unbind();
+	queueDraw(lightShader, starcruiserVao, NULL, model, cruiserMaterial, cruiserShininess);
 }
 
 void drawModels()
@@ -312,17 +839,56 @@ void drawModels()
     while (alphaMoon >= 360.0) alphaMoon -= 360.0;
     while (alphaMoon <= -360.0) alphaMoon += 360.0;
 
-	drawPlanet();
-	drawMoon();
-	drawStarcruiser(vec3(-5.0, 0.0, 50.0), vec3(0.03, 0.03, 0.03));
-	drawAsteroid(vec3(4.5, -7.0, 15.0), vec3(0.1, 0.1, 0.1), XAxis, 0.0);
-	drawAsteroid(vec3(-15.5, 10.0, -40.0), vec3(0.05, 0.05, 0.05), ZAxis, 0.2);
-	drawAsteroid(vec3(50.0, -12.5, 11.0), vec3(0.03, 0.05, 0.03), YAxis, 0.1);
-	drawAsteroid(vec3(-5.5, 9.0, 7.5), vec3(0.15, 0.15, 0.15), ZAxis, 0.4);
+	// Record every draw first, so all of the per-object data reaches the
+	// GPU in one write
+	drawCalls.clear();
+	numObjectsDrawn = 0;
+	drawData->Begin();
+	queuePlanet();
+	queueMoon();
+	queueSpheres();
+	queueStarcruiser(vec3(-5.0, 0.0, 50.0), vec3(0.03, 0.03, 0.03));
+	queueAsteroid(vec3(4.5, -7.0, 15.0), vec3(0.1, 0.1, 0.1), XAxis, 0.0);
+	queueAsteroid(vec3(-15.5, 10.0, -40.0), vec3(0.05, 0.05, 0.05), ZAxis, 0.2);
+	queueAsteroid(vec3(50.0, -12.5, 11.0), vec3(0.03, 0.05, 0.03), YAxis, 0.1);
+	queueAsteroid(vec3(-5.5, 9.0, 7.5), vec3(0.15, 0.15, 0.15), ZAxis, 0.4);
+	drawData->Upload();
+
+	// Only the stages change between draws, which doesn't relink anything,
+	// and each vertex stage keeps its own VAOs
+	phongPipeline->Bind();
+	for (size_t i = 0; i < drawCalls.size(); i++)
+	{
+		const DrawCall& draw = drawCalls[i];
+
+		phongPipeline->SetStage(draw.vertexShader);
+		phongPipeline->SetStage(draw.shader);
+		if (draw.texture != NULL)
+		{
+			// Bind texture to a texture unit
+			draw.texture->Bind(1);
+			draw.shader->SetUniform(draw.textureUniform, draw.texture->GetTextureUnit());
+		}
+
+		drawData->BindRange(drawDataBinding, draw.drawData, drawDataSize);
+		draw.vao->Bind(*phongPipeline);
+		if (draw.instanceCount > 0)
+		{
+			drawData->BindRange(instanceDataBinding, draw.instanceData, instanceDataSize);
+			draw.vao->DrawInstanced(GL_TRIANGLES, draw.instanceCount);
+		}
+		else
+		{
+			draw.vao->Draw(GL_TRIANGLES);
+		}
+		draw.vao->Unbind();
+	}
+	ProgramPipeline::Unbind();
 }
 
 void drawScene()
 {
+	updateFrameData();
 	drawSkybox();
 	drawModels();
 }
@@ -351,8 +917,116 @@ void postProcessBlur()
 	}
 }
 
+// Times SetUniform by name against SetUniform by handle and prints the
+// average cost of a call for each.  The values change every iteration so
+// that the shader's redundant upload check doesn't skip the calls
+void benchmarkUniforms()
+{
+	const int iterations = 200000;
+	mat4 model = Scale(1.0, 2.0, 3.0);
+
+	skyboxShader->Bind();
+
+	int start = glutGet(GLUT_ELAPSED_TIME);
+	for (int n = 0; n < iterations; n++)
+	{
+		model[0][0] = (GLfloat)n;
+		skyboxShader->SetUniform("model", model);
+		skyboxShader->SetUniform("textureCube", n & 1);
+	}
+	glFinish();
+	int byName = glutGet(GLUT_ELAPSED_TIME) - start;
+
+	start = glutGet(GLUT_ELAPSED_TIME);
+	for (int n = 0; n < iterations; n++)
+	{
+		model[0][0] = (GLfloat)n;
+		skyboxShader->SetUniform(skyboxUniforms.model, model);
+		skyboxShader->SetUniform(skyboxUniforms.textureCube, n & 1);
+	}
+	glFinish();
+	int byHandle = glutGet(GLUT_ELAPSED_TIME) - start;
+
+	skyboxShader->Unbind();
+
+	std::cout << "SetUniform by name:   " << 1.0e6 * byName / (2 * iterations)
+		<< " ns/call" << std::endl;
+	std::cout << "SetUniform by handle: " << 1.0e6 * byHandle / (2 * iterations)
+		<< " ns/call" << std::endl;
+}
+
+// Times decoding the scene's TGA files with TgaDecoder against stb_image,
+// and against only copying the decoded pixels as a bound on what any
+// decoder could reach.  Prints the average time and throughput of each
+void benchmarkImageDecoding()
+{
+	const int iterations = 20;
+	const char* files[] = { "images/planet.tga", "images/moon.tga", "images/pos_x.tga" };
+	const int numFiles = sizeof(files) / sizeof(files[0]);
+
+	std::cout << "Decoding with SSSE3 " << (TgaDecoder::IsSimdEnabled() ? "on" : "off") << std::endl;
+	for (int f = 0; f < numFiles; f++)
+	{
+		int width, height, components, flipPass;
+		GLubyte* decoded = TgaDecoder::Load(files[f], &width, &height, &components);
+		if (decoded == NULL)
+		{
+			std::cerr << "Unable to decode " << files[f] << std::endl;
+			continue;
+		}
+		size_t size = (size_t)width * height * components;
+
+		int start = glutGet(GLUT_ELAPSED_TIME);
+		for (int n = 0; n < iterations; n++)
+		{
+			free(TgaDecoder::Load(files[f], &width, &height, &components));
+		}
+		int native = glutGet(GLUT_ELAPSED_TIME) - start;
+
+		start = glutGet(GLUT_ELAPSED_TIME);
+		for (int n = 0; n < iterations; n++)
+		{
+			stbi_image_free(stbi_load_bottom_up(files[f], &width, &height, &components, 0, &flipPass));
+		}
+		int stb = glutGet(GLUT_ELAPSED_TIME) - start;
+
+		start = glutGet(GLUT_ELAPSED_TIME);
+		for (int n = 0; n < iterations; n++)
+		{
+			GLubyte* copy = (GLubyte*)malloc(size);
+			memcpy(copy, decoded, size);
+			free(copy);
+		}
+		int copy = glutGet(GLUT_ELAPSED_TIME) - start;
+		free(decoded);
+
+		// Milliseconds per decode, and megabytes of pixels per second
+		float megabytes = iterations * size / (1024.0f * 1024.0f);
+		std::cout << files[f] << " (" << width << "x" << height << "x" << components << "):" << std::endl;
+		std::cout << "  TgaDecoder: " << (float)native / iterations << " ms, "
+			<< megabytes * 1000.0f / std::max(native, 1) << " MB/s" << std::endl;
+		std::cout << "  stb_image:  " << (float)stb / iterations << " ms, "
+			<< megabytes * 1000.0f / std::max(stb, 1) << " MB/s" << std::endl;
+		std::cout << "  memcpy:     " << (float)copy / iterations << " ms, "
+			<< megabytes * 1000.0f / std::max(copy, 1) << " MB/s" << std::endl;
+	}
+}
+
+// Uniform uploads issued and skipped while drawing the previous frame
+unsigned int lastUploadsIssued;
+unsigned int lastUploadsSkipped;
+unsigned int lastBindsIssued;
+unsigned int lastBindsElided;
+
 void display( void )
 {
+	lastUploadsIssued  = Shader::GetUniformUploadsIssued();
+	lastUploadsSkipped = Shader::GetUniformUploadsSkipped();
+	Shader::ResetUniformCounters();
+	lastBindsIssued = Texture::GetBindsIssued();
+	lastBindsElided = Texture::GetBindsElided();
+	Texture::ResetBindCounters();
+
 	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
     drawScene();
 
@@ -364,6 +1038,13 @@ void display( void )
 	{
         glFlush();
 	}
+
+	if (!firstFrameDrawn)
+	{
+		firstFrameDrawn = true;
+		std::cout << "First frame drawn " << glutGet(GLUT_ELAPSED_TIME)
+			<< " ms after startup" << std::endl;
+	}
 }
 
 void keyboard( unsigned char key, int x, int y )
@@ -377,6 +1058,29 @@ void keyboard( unsigned char key, int x, int y )
 			break; 
 		case 'b':
 			blur = !blur;
+			break;
+		case 'u':
+			benchmarkUniforms();
+			break;
+		case 't':
+			benchmarkImageDecoding();
+			break;
+		case 'h':
+			useHalfVector = !useHalfVector;
+			lightShader = lightPermutations->Get(getLightDefines(useHalfVector));
+			break;
+		case 'c':
+			std::cout << "Uniform uploads last frame: " << lastUploadsIssued
+				<< " issued, " << lastUploadsSkipped << " skipped" << std::endl;
+			std::cout << "Texture binds last frame: " << lastBindsIssued
+				<< " issued, " << lastBindsElided << " elided, "
+				<< Texture::GetNumSamplers() << " samplers, "
+				<< Texture::GetTotalMemoryUsed() / 1024 << " KB of texture memory" << std::endl;
+			printResourceStats();
+			std::cout << "Draw data last frame: " << drawCalls.size() << " draws for "
+				<< numObjectsDrawn << " objects, "
+				<< drawData->GetFrameSize() << " bytes in one upload" << std::endl;
+			break;
 		}
 	}
 	glutPostRedisplay();
@@ -392,6 +1096,15 @@ void keyboardSpecial(int key, int x, int y)
 
 void idle( void )
 {
+	// Compile at most one prefetched shader variant between frames, and
+	// finish any variants the driver has built in the background
+	lightPermutations->CompilePending(1);
+
+	// Create any textures that have finished decoding in the background
+	ResourceRegistry::Update();
+
+	// Stream mip levels in and out for the textures drawn last frame
+	TextureResidency::Update();
 	glutPostRedisplay();
 }
 
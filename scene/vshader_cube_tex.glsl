@@ -2,8 +2,9 @@
 
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+#include "frame_data.glsl"
+
 in  vec4 vPosition;
 out vec3 fTexCoord;
 
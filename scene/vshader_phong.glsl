@@ -4,12 +4,8 @@
 // Shader for per-fragment lighting calculation with texture coordinate
 //
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-uniform mat3 normalMatrix;
-uniform vec4 lightPosition;
+#include "draw_data.glsl"
+#include "frame_data.glsl"
 
 in  vec4 vPosition;
 in vec3 vNormal;
@@ -0,0 +1,34 @@
+#version 150
+
+//
+// Shader for per-fragment lighting of several objects in one draw, each
+// with its own transform and texture array layer
+//
+
+#include "instance_data.glsl"
+#include "frame_data.glsl"
+
+in  vec4 vPosition;
+in vec3 vNormal;
+in vec2 vTexCoord;
+
+out vec3 fN;
+out vec3 fL;
+out vec3 fV;
+out vec2 fTexCoord;
+flat out float fLayer;
+
+void main() 
+{
+  Instance instance = instances[gl_InstanceID];
+  mat4 model = instance.model;
+
+  fN = instance.normalMatrix * vNormal;
+  fL = (view * lightPosition - view * model * vPosition).xyz;
+  fV = -(view * model * vPosition).xyz;
+  
+  // Move the coordinates into the object's rectangle of the atlas
+  fTexCoord = instance.texCoordTransform.xy + vTexCoord * instance.texCoordTransform.zw;
+  fLayer = instance.layer;
+  gl_Position = projection * view * model * vPosition;
+}
@@ -7,6 +7,10 @@
 //
 // Camera controls are standard.
 //
+// An equirectangular panorama given on the command line, such as a
+// Radiance .hdr file, is resampled into the cube map instead of the six
+// face images.
+//
 
 #include <Angel.h>
 #include <sphere.h>
@@ -24,6 +28,7 @@ Shader * cubeShader;
 Camera * camera;
 CameraControl * cameraControl;
 TextureCube * cubeTexture;
+const char * panoramaFilename = NULL;
 mat4 model;
 
 int numVertices;
@@ -31,13 +36,20 @@ int numVertices;
 void init()
 {
   // Constructor sets up cube map with default sampling paramaters
-  cubeTexture = new TextureCube(
-	"../images/pos_x.tga",
-    "../images/neg_x.tga",
-    "../images/pos_y.tga",
-    "../images/neg_y.tga",
-    "../images/pos_z.tga",
-    "../images/neg_z.tga");
+  if (panoramaFilename)
+  {
+    cubeTexture = new TextureCube(panoramaFilename);
+  }
+  else
+  {
+    cubeTexture = new TextureCube(
+      "../images/pos_x.tga",
+      "../images/neg_x.tga",
+      "../images/pos_y.tga",
+      "../images/neg_y.tga",
+      "../images/pos_z.tga",
+      "../images/neg_z.tga");
+  }
 
   camera = new Camera(vec3(0.0, 0.0, 0.0),   // position
               vec3(0.0, 0.0, -1.0),  // forward
@@ -110,6 +122,10 @@ void keyboardSpecial(int key, int x, int y)
 int main( int argc, char **argv )
 {
   glutInit( &argc, argv );
+  if (argc > 1)
+  {
+    panoramaFilename = argv[1];
+  }
   glutInitDisplayMode( GLUT_RGBA | GLUT_DEPTH );
   glutInitWindowSize( 512, 512 );
   glutCreateWindow( " " );
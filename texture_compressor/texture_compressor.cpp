@@ -0,0 +1,227 @@
+// Converts images to block-compressed KTX files, so textures can be loaded
+// with CompressedImage instead of being decoded and uploaded uncompressed.
+//
+// Usage:
+//   texture_compressor [-f bc1|bc3|bc4|bc5] [-nomips] image...
+//   texture_compressor [-f bc1|bc3] [-nomips] -cube +x -x +y -y +z -z output.ktx
+//
+// Each image is written next to itself with a .ktx extension.  Without -f,
+// images with alpha use BC3 and the rest BC1.  Rows are stored bottom-up,
+// the way OpenGL expects them.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <GL/glew.h>
+#include <stb_image.h>
+#include <BlockCompressor.h>
+#include <CompressedImage.h>
+#include <ThreadPool.h>
+
+// Uncompressed and compressed bytes of everything converted, for the summary
+size_t totalRawBytes = 0;
+size_t totalCompressedBytes = 0;
+
+void usage()
+{
+	std::cerr << "Usage: texture_compressor [-f bc1|bc3|bc4|bc5] [-nomips] image..." << std::endl
+		<< "       texture_compressor [-f bc1|bc3] [-nomips] -cube +x -x +y -y +z -z output.ktx" << std::endl;
+}
+
+// Gets the format named on the command line, or GL_NONE
+GLenum parseFormat(const char* name)
+{
+	if (strcmp(name, "bc1") == 0) return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	if (strcmp(name, "bc3") == 0) return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	if (strcmp(name, "bc4") == 0) return GL_COMPRESSED_RED_RGTC1;
+	if (strcmp(name, "bc5") == 0) return GL_COMPRESSED_RG_RGTC2;
+	return GL_NONE;
+}
+
+// Gets the size of an uncompressed image with its mip levels
+size_t rawSize(const CompressedImage& image, int components)
+{
+	size_t size = 0;
+	for (int level = 0; level < image.GetNumLevels(); level++)
+	{
+		const CompressedImage::Level& info = image.GetLevel(level);
+		size += (size_t)info.width * info.height * components;
+	}
+	return size * image.GetNumFaces();
+}
+
+// Loads an image, picking the format from its components when none was given
+GLubyte* loadImage(const char* filename, GLenum* format, int* width, int* height, int* components)
+{
+	int flipPass;
+	GLubyte* pixels = stbi_load_bottom_up(filename, width, height, components, 4, &flipPass);
+	if (pixels == NULL)
+	{
+		std::cerr << "Unable to load " << filename << ": " << stbi_failure_reason() << std::endl;
+		return NULL;
+	}
+	if (*format == GL_NONE)
+	{
+		*format = *components == 2 || *components == 4 ?
+			GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	}
+	return pixels;
+}
+
+// Prints the sizes of a converted image and adds them to the totals
+void report(const std::string& filename, const CompressedImage& image, int components, double ms)
+{
+	size_t raw = rawSize(image, components);
+	totalRawBytes += raw;
+	totalCompressedBytes += image.GetDataSize();
+
+	std::cout << filename << ": " << image.GetWidth() << "x" << image.GetHeight() << ", "
+		<< image.GetNumLevels() << " levels, " << raw / 1024 << " KB -> "
+		<< image.GetDataSize() / 1024 << " KB in " << (int)ms << " ms" << std::endl;
+}
+
+// Compresses one image to a .ktx file next to it
+bool compressImage(const char* filename, GLenum format, bool mipmaps)
+{
+	int width, height, components;
+	GLubyte* pixels = loadImage(filename, &format, &width, &height, &components);
+	if (pixels == NULL)
+	{
+		return false;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CompressedImage* image;
+	if (mipmaps)
+	{
+		image = BlockCompressor::CompressWithMipmaps(pixels, 4, width, height, format);
+	}
+	else
+	{
+		image = new CompressedImage(format, width, height, 1);
+		BlockCompressor::Compress(pixels, 4, width, height, format, image->GetLevelData(0));
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	stbi_image_free(pixels);
+
+	std::string output = filename;
+	size_t extension = output.rfind('.');
+	output = output.substr(0, extension == std::string::npos ? output.size() : extension) + ".ktx";
+
+	bool saved = image->SaveKTX(output.c_str());
+	if (saved)
+	{
+		report(output, *image, components, ms);
+	}
+	delete image;
+	return saved;
+}
+
+// Compresses 6 images into the faces of one cube map
+bool compressCube(char** filenames, const char* output, GLenum format, bool mipmaps)
+{
+	CompressedImage* cube = NULL;
+	int components = 0;
+	double ms = 0.0;
+	for (int face = 0; face < 6; face++)
+	{
+		int width, height;
+		GLubyte* pixels = loadImage(filenames[face], &format, &width, &height, &components);
+		if (pixels == NULL)
+		{
+			delete cube;
+			return false;
+		}
+		if (cube == NULL)
+		{
+			cube = new CompressedImage(format, width, height, mipmaps ? 0 : 1, 6);
+		}
+		else if (width != cube->GetWidth() || height != cube->GetHeight())
+		{
+			std::cerr << filenames[face] << " does not match the size of the other faces" << std::endl;
+			stbi_image_free(pixels);
+			delete cube;
+			return false;
+		}
+
+		// Compress the face on its own, then copy its levels into the cube
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		CompressedImage* image = mipmaps ?
+			BlockCompressor::CompressWithMipmaps(pixels, 4, width, height, format) :
+			new CompressedImage(format, width, height, 1);
+		if (!mipmaps)
+		{
+			BlockCompressor::Compress(pixels, 4, width, height, format, image->GetLevelData(0));
+		}
+		ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		stbi_image_free(pixels);
+
+		for (int level = 0; level < cube->GetNumLevels(); level++)
+		{
+			memcpy(cube->GetLevelData(level, face), image->GetLevelData(level), image->GetLevel(level).size);
+		}
+		delete image;
+	}
+
+	bool saved = cube->SaveKTX(output);
+	if (saved)
+	{
+		report(output, *cube, components, ms);
+	}
+	delete cube;
+	return saved;
+}
+
+int main(int argc, char** argv)
+{
+	GLenum format = GL_NONE;
+	bool mipmaps = true;
+	bool ok = true;
+	int converted = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+		{
+			format = parseFormat(argv[++i]);
+			if (format == GL_NONE)
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+		}
+		else if (strcmp(argv[i], "-nomips") == 0)
+		{
+			mipmaps = false;
+		}
+		else if (strcmp(argv[i], "-cube") == 0)
+		{
+			if (i + 7 >= argc)
+			{
+				usage();
+				return EXIT_FAILURE;
+			}
+			ok = compressCube(&argv[i + 1], argv[i + 7], format, mipmaps) && ok;
+			converted++;
+			i += 7;
+		}
+		else
+		{
+			ok = compressImage(argv[i], format, mipmaps) && ok;
+			converted++;
+		}
+	}
+
+	if (converted == 0)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "Total " << totalRawBytes / 1024 << " KB -> " << totalCompressedBytes / 1024
+		<< " KB of texture memory, using " << ThreadPool::GetShared().GetNumThreads()
+		<< " threads" << std::endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,33 @@
+#version 150
+
+uniform sampler2D cache;         // pages of resident tiles
+uniform sampler2D indirection;   // page and level of the tile to sample
+uniform vec4      params;        // grid pixels, tile pixels, border pixels, cache pixels
+uniform vec2      texCoordScale; // from image coordinates to grid coordinates
+
+in  vec2 fTexCoord;
+out vec4 color;
+
+// Looks up the finest resident tile for this pixel's level of detail, then
+// samples it from its page of the cache
+vec4 sampleVirtual(vec2 uv)
+{
+    vec2 texel = uv * params.x;
+    float lod = max(log2(max(length(dFdx(texel)), length(dFdy(texel)))), 0.0);
+    vec3 entry = floor(textureLod(indirection, uv, floor(lod)).rgb * 255.0 + 0.5);
+
+    float tilesAcross = params.x / params.y / exp2(entry.b);
+    vec2 inTile = fract(uv * tilesAcross) * params.y;
+    vec2 page = entry.rg * (params.y + 2.0 * params.z) + params.z;
+    return textureLod(cache, (page + inTile) / params.w, 0.0);
+}
+
+void main() 
+{ 
+    if (any(lessThan(fTexCoord, vec2(0.0))) || any(greaterThan(fTexCoord, vec2(1.0))))
+    {
+        color = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+    color = sampleVirtual(fTexCoord * texCoordScale);
+}
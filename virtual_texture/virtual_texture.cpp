@@ -0,0 +1,205 @@
+// Pans and zooms around an image far larger than video memory, paging in
+// only the tiles in view through a VirtualTexture.
+//
+// Usage:
+//   virtual_texture [image | file.vtex]
+//
+// An image is first cut into a tile pyramid saved next to it with a .vtex
+// extension, which later runs open directly.  Arrow keys pan, + and - zoom,
+// s prints the paging statistics.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <Angel.h>
+#include <stb_image.h>
+#include <Shader.h>
+#include <TilePyramid.h>
+#include <VertexArray.h>
+#include <VirtualTexture.h>
+
+// Tiles of 128 pixels fit 16x16 in a 2176 pixel cache, 18 MB as RGBA
+const int tileSize    = 128;
+const int tileBorder  = 4;
+const int pagesAcross = 16;
+
+VertexArray * quad;
+Shader * shader;
+VirtualTexture * image;
+
+// Image coordinates at the center of the window, and screen pixels per
+// image pixel
+vec2 center(0.5f, 0.5f);
+float zoom = 1.0f;
+
+// Gets the tile pyramid for a file, building it first from an image
+std::string preparePyramid(const std::string& filename)
+{
+	size_t extension = filename.rfind('.');
+	if (extension != std::string::npos && filename.substr(extension) == ".vtex")
+	{
+		return filename;
+	}
+
+	std::string output = filename.substr(0, extension == std::string::npos ? filename.size() : extension) + ".vtex";
+	FILE* existing = fopen(output.c_str(), "rb");
+	if (existing != NULL)
+	{
+		fclose(existing);
+		return output;
+	}
+
+	// Grey images are expanded so the cache can be sampled as color
+	int width, height, components, flipPass;
+	if (stbi_info(filename.c_str(), &width, &height, &components) == 0)
+	{
+		std::cerr << "Unable to load " << filename << ": " << stbi_failure_reason() << std::endl;
+		return output;
+	}
+	int wanted = components == 2 || components == 4 ? 4 : 3;
+	GLubyte* pixels = stbi_load_bottom_up(filename.c_str(), &width, &height, &components, wanted, &flipPass);
+	if (pixels == NULL)
+	{
+		std::cerr << "Unable to load " << filename << ": " << stbi_failure_reason() << std::endl;
+		return output;
+	}
+
+	std::cout << "Building " << output << " from " << width << "x" << height << " image" << std::endl;
+	TilePyramid::Build(pixels, wanted, width, height, tileSize, tileBorder, output.c_str());
+	stbi_image_free(pixels);
+	return output;
+}
+
+void init(const char* filename)
+{
+	image = new VirtualTexture(preparePyramid(filename).c_str(), pagesAcross);
+	if (!image->IsValid())
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	// Start with the whole image in view
+	zoom = std::min(512.0f / image->GetWidth(), 512.0f / image->GetHeight());
+
+	shader = new Shader("vshader_virtual.glsl", "fshader_virtual.glsl");
+
+	vec4 corners[4] = {
+		vec4(-1.0, -1.0, 0.0, 1.0),
+		vec4( 1.0, -1.0, 0.0, 1.0),
+		vec4(-1.0,  1.0, 0.0, 1.0),
+		vec4( 1.0,  1.0, 0.0, 1.0)
+	};
+	quad = new VertexArray();
+	quad->AddAttribute("vPosition", corners, 4);
+
+	glClearColor( 0.0, 0.0, 0.0, 1.0 );
+}
+
+//----------------------------------------------------------------------------
+
+void display( void )
+{
+	glClear( GL_COLOR_BUFFER_BIT );
+
+	// Request the part of the image in view at the level drawn, then let
+	// the tiles that arrived since the last frame into the cache
+	int windowWidth  = glutGet(GLUT_WINDOW_WIDTH);
+	int windowHeight = glutGet(GLUT_WINDOW_HEIGHT);
+	vec2 size(windowWidth / (zoom * image->GetWidth()), windowHeight / (zoom * image->GetHeight()));
+	vec2 corner = center - size * 0.5f;
+	image->RequestRegion(corner.x, corner.y, corner.x + size.x, corner.y + size.y, image->GetLevel(1.0f / zoom));
+	image->Update();
+
+	vec2 scale  = image->GetTexCoordScale();
+	vec4 params = image->GetShaderParams();
+	image->Bind(0, 1);
+	shader->Bind();
+	shader->SetUniform("cache", 0);
+	shader->SetUniform("indirection", 1);
+	shader->SetUniform("params", params.x, params.y, params.z, params.w);
+	shader->SetUniform("texCoordScale", scale.x, scale.y);
+	shader->SetUniform("view", corner.x, corner.y, size.x, size.y);
+	quad->Bind(*shader);
+	quad->Draw(GL_TRIANGLE_STRIP);
+
+	quad->Unbind();
+	shader->Unbind();
+	glutSwapBuffers();
+}
+
+// Keeps drawing while tiles are still being read
+void idle( void )
+{
+	if (image->GetNumPendingLoads() > 0)
+	{
+		glutPostRedisplay();
+	}
+}
+
+void printStats()
+{
+	const VirtualTexture::Stats& stats = image->GetStats();
+	std::cout << image->GetNumResidentTiles() << " tiles resident, "
+		<< image->GetNumPendingLoads() << " loading, "
+		<< stats.tilesLoaded << " loaded, "
+		<< stats.tilesEvicted << " evicted, "
+		<< stats.tilesDropped << " dropped, "
+		<< stats.bytesRead / 1024 << " KB read, "
+		<< image->GetMemoryUsed() / 1024 << " KB used" << std::endl;
+}
+
+void keyboard( unsigned char key, int x, int y )
+{
+	switch( key ) {
+	case 033: // Escape Key
+	case 'q': case 'Q':
+		exit( EXIT_SUCCESS );
+		break;
+	case '+': case '=':
+		zoom *= 1.25f;
+		break;
+	case '-':
+		zoom /= 1.25f;
+		break;
+	case 's': case 'S':
+		printStats();
+		break;
+	}
+	glutPostRedisplay();
+}
+
+// Arrow keys pan by a tenth of the window
+void keyboardSpecial(int key, int x, int y)
+{
+	vec2 step(glutGet(GLUT_WINDOW_WIDTH)  * 0.1f / (zoom * image->GetWidth()),
+	          glutGet(GLUT_WINDOW_HEIGHT) * 0.1f / (zoom * image->GetHeight()));
+	switch( key ) {
+	case GLUT_KEY_LEFT:  center.x -= step.x; break;
+	case GLUT_KEY_RIGHT: center.x += step.x; break;
+	case GLUT_KEY_DOWN:  center.y -= step.y; break;
+	case GLUT_KEY_UP:    center.y += step.y; break;
+	}
+	glutPostRedisplay();
+}
+
+int main( int argc, char **argv )
+{
+	glutInit( &argc, argv );
+	glutInitDisplayMode( GLUT_RGBA | GLUT_DOUBLE );
+	glutInitWindowSize( 512, 512 );
+	glutCreateWindow( "Virtual texture" );
+
+	glewInit();
+
+	init(argc > 1 ? argv[1] : "../images/house.jpg");
+
+	glutDisplayFunc(display);
+	glutIdleFunc(idle);
+	glutKeyboardFunc(keyboard);
+	glutSpecialFunc(keyboardSpecial);
+
+	glutMainLoop();
+	return 0;
+}
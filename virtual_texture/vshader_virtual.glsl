@@ -0,0 +1,13 @@
+#version 150
+
+// Image coordinates at the bottom left of the window, then across it
+uniform vec4 view;
+
+in  vec4 vPosition;
+out vec2 fTexCoord;
+
+void main() 
+{
+  fTexCoord = view.xy + (vPosition.xy * 0.5 + 0.5) * view.zw;
+  gl_Position = vPosition;
+} 